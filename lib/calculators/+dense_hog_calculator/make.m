@@ -0,0 +1,15 @@
+function make(varargin)
+%MAKE Build necessary binary files.
+
+  % dense HOG in one call, shadows private/dense_hog.m
+  cwd = fileparts(mfilename('fullpath'));
+  cmd = sprintf('mex -O %s %s -outdir %s -output %s', ...
+                'CXXFLAGS="\$CXXFLAGS -march=native"',...
+                fullfile(cwd, 'private', 'dense_hog_mex.cpp'),...
+                fullfile(cwd, 'private'),...
+                'dense_hog'...
+               );
+  disp(cmd);
+  eval(cmd);
+
+end
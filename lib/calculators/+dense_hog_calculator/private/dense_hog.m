@@ -18,6 +18,10 @@ function features = dense_hog(input_image, window)
 % values at the 32nd dimension to be used as a boundary indicator. This
 % implementation does not append the boundary indicator.
 %
+% dense_hog_calculator.make builds dense_hog_mex.cpp as a mex of the same
+% name, which computes these features in bands on all cores and is used in
+% place of this file when present.
+%
 % To emulate the original HOG implementation, subsample the features at
 % grid points, and append zeros at the end.
 %
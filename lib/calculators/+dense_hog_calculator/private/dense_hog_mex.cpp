@@ -0,0 +1,395 @@
+/*
+   The dense HOG of dense_hog.m in one mex call.
+   If necessary to recompile, run dense_hog_calculator.make, which builds
+   this file as private/dense_hog and so shadows dense_hog.m.
+
+   features = dense_hog(input_image);
+   features = dense_hog(input_image, window);
+
+   input_image: M-by-N-by-d image, uint8, single or double.
+   window: block size in pixels, a scalar or [rows, cols]; 4 by default.
+   features: M-by-N-by-31 double array, the features of dense_hog.m.
+
+   dense_hog.m keeps a dozen M-by-N-by-18 double arrays alive.  Here the
+   image is cut into full height bands of columns, each padded by the
+   support of the voting and block filters, and a band only needs float32
+   buffers of its own width, so the memory beyond the output grows with
+   the height of the image times the number of threads but not with its
+   width.  The bands run on all cores (HOG_NUM_THREADS overrides the
+   number of threads).  The voting kernel is linear on each side of its peak, so it
+   is applied with integral images of the responses and of their first
+   moment, in constant time per pixel whatever the window.  Features match
+   dense_hog.m up to the float32 rounding of the votes, about 1e-7.
+*/
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include "mex.h"
+
+using namespace std;
+
+namespace {
+
+const int kOrientations = 18;        /* must be even */
+const int kFeatures = kOrientations + kOrientations/2 + 4;
+const int kBandWidth = 64;           /* columns of features per band */
+
+/* The voting_kernel of dense_hog.m along one axis, placed as imfilter
+   does: tap o in [lo, hi] weighs a[0] + b[0]*o before split and
+   a[1] + b[1]*o from split on. */
+struct vote_kernel {
+  int lo, hi, split;
+  double a[2], b[2];
+};
+
+vote_kernel make_vote_kernel(int window) {
+  int y_first = (int)ceil(-window * 0.5 - 0.5);
+  int y_last = (int)floor(window * 1.5 - 0.5);
+  int size = y_last - y_first + 1;
+  int center = (size + 1) / 2;         /* 1-based origin of imfilter */
+  int shift = y_first - 1 + center;    /* kernel position y = o + shift */
+  double c = (shift + 0.5) / window - 0.5;
+  vote_kernel k;
+  k.lo = 1 - center;
+  k.hi = size - center;
+  k.split = min(max((window - 1) / 2 - shift + 1, k.lo), k.hi + 1);
+  k.a[0] = 1 + c;
+  k.b[0] = 1.0 / window;
+  k.a[1] = 1 - c;
+  k.b[1] = -1.0 / window;
+  return k;
+}
+
+/* out[q*ostride + l] = sum over taps o of weight(o) * x(q + first + o)[l]
+   for q in [0, count) and l in [0, len), where x(t) is the vector at
+   in + (clamp(t) - in_first)*istride and clamp replicates the borders of
+   [0, n).  p0 and p1 hold (count + hi - lo + 1)*len running sums. */
+void vote(const vote_kernel &k, const float *in, int in_first, int istride,
+          int n, int first, int count, float *out, int ostride, int len,
+          double *p0, double *p1) {
+  int base = first + k.lo;
+  int span = count + k.hi - k.lo;
+
+  memset(p0, 0, len*sizeof(*p0));
+  memset(p1, 0, len*sizeof(*p1));
+  for (int r = 0; r < span; r++) {
+    int t = min(max(base + r, 0), n - 1);
+    const float *x = in + (ptrdiff_t)(t - in_first)*istride;
+    const double *s0 = p0 + (ptrdiff_t)r*len, *s1 = p1 + (ptrdiff_t)r*len;
+    double *d0 = p0 + (ptrdiff_t)(r + 1)*len, *d1 = p1 + (ptrdiff_t)(r + 1)*len;
+    for (int l = 0; l < len; l++) {
+      d0[l] = s0[l] + x[l];
+      d1[l] = s1[l] + (double)r*x[l];
+    }
+  }
+  for (int q = 0; q < count; q++) {
+    float *y = out + (ptrdiff_t)q*ostride;
+    /* taps [lo, split) and [split, hi] cover sums [q, q + split - lo) and
+       [q + split - lo, q + hi - lo + 1); tap o is at r = q + o - lo */
+    int r0 = q, r1 = q + k.split - k.lo, r2 = q + k.hi - k.lo + 1;
+    double alpha0 = k.a[0] + k.b[0]*(k.lo - q);
+    double alpha1 = k.a[1] + k.b[1]*(k.lo - q);
+    const double *a0 = p0 + (ptrdiff_t)r0*len, *a1 = p1 + (ptrdiff_t)r0*len;
+    const double *b0 = p0 + (ptrdiff_t)r1*len, *b1 = p1 + (ptrdiff_t)r1*len;
+    const double *c0 = p0 + (ptrdiff_t)r2*len, *c1 = p1 + (ptrdiff_t)r2*len;
+    /* weights and responses are not negative, but differences of the
+       sums may round below zero */
+    for (int l = 0; l < len; l++) {
+      double v = alpha0*(b0[l] - a0[l]) + k.b[0]*(b1[l] - a1[l]) +
+                 alpha1*(c0[l] - b0[l]) + k.b[1]*(c1[l] - b1[l]);
+      y[l] = (float)max(v, 0.0);
+    }
+  }
+}
+
+struct hog_args {
+  const void *image;
+  mxClassID class_id;
+  int rows, cols, channels;
+  int window[2];                       /* rows, cols */
+  vote_kernel kernel[2];
+  double cos_theta[kOrientations];
+  double sin_theta[kOrientations];
+  int band_width;
+  int num_bands;
+  int num_threads;
+  double *features;
+};
+
+struct hog_worker {
+  const hog_args *args;
+  int thread;
+};
+
+/* the value of pixel (i, j) of channel c, as im2double would give it */
+inline double pixel(const hog_args &a, int i, int j, int c) {
+  ptrdiff_t index = ((ptrdiff_t)c*a.cols + j)*a.rows + i;
+  switch (a.class_id) {
+    case mxUINT8_CLASS: return ((const unsigned char *)a.image)[index] / 255.0;
+    case mxSINGLE_CLASS: return ((const float *)a.image)[index];
+    default: return ((const double *)a.image)[index];
+  }
+}
+
+/* responses of column j: the strongest channel gradient, snapped to the
+   orientation of largest inner product, as in dense_hog.m */
+void oriented_gradient(const hog_args &a, int j, int *bin, float *magnitude) {
+  int jl = max(j - 1, 0), jr = min(j + 1, a.cols - 1);
+  for (int i = 0; i < a.rows; i++) {
+    int il = max(i - 1, 0), ir = min(i + 1, a.rows - 1);
+    double dx = 0, dy = 0, max_magnitude = -1;
+    for (int c = 0; c < a.channels; c++) {
+      double gx = pixel(a, i, jr, c) - pixel(a, i, jl, c);
+      double gy = pixel(a, ir, j, c) - pixel(a, il, j, c);
+      double m = gx*gx + gy*gy;
+      if (m > max_magnitude) {
+        max_magnitude = m;
+        dx = gx;
+        dy = gy;
+      }
+    }
+    int best = 0;
+    double best_product = dx*a.cos_theta[0] + dy*a.sin_theta[0];
+    for (int k = 1; k < kOrientations; k++) {
+      double product = dx*a.cos_theta[k] + dy*a.sin_theta[k];
+      if (product > best_product) {
+        best_product = product;
+        best = k;
+      }
+    }
+    bin[i] = best;
+    magnitude[i] = (float)sqrt(max_magnitude);
+  }
+}
+
+/* per thread buffers, sized for the widest band */
+struct hog_buffers {
+  vector<int> bin;
+  vector<float> magnitude;
+  vector<float> responses;             /* kOrientations columns of one image column */
+  vector<float> column_votes;          /* voted along columns, per column and orientation */
+  vector<float> votes;                 /* voted along both axes */
+  vector<float> norms;                 /* votes_norm of dense_hog.m */
+  vector<double> p0, p1;
+  vector<double> coeffs[4];
+  vector<double> texture[4];
+};
+
+/* features of columns [j0, j1) */
+void compute_band(const hog_args &a, int j0, int j1, hog_buffers &b) {
+  const int m = a.rows, n = a.cols;
+  const int wy = a.window[0], wx = a.window[1];
+  const vote_kernel &ky = a.kernel[0], &kx = a.kernel[1];
+  const ptrdiff_t plane = (ptrdiff_t)m*n;
+  const int stride = kOrientations*m;
+
+  /* block normalization reads votes wx columns away, which are voted from
+     the responses of the columns under the kernel */
+  int c0 = max(j0 - wx, 0), c1 = min(j1 + wx, n);
+  int r0 = max(c0 + kx.lo, 0), r1 = min(c1 - 1 + kx.hi, n - 1) + 1;
+
+  /* vote along the columns of the image */
+  for (int j = r0; j < r1; j++) {
+    oriented_gradient(a, j, &b.bin[0], &b.magnitude[0]);
+    fill(b.responses.begin(), b.responses.end(), 0.0f);
+    for (int i = 0; i < m; i++)
+      b.responses[b.bin[i]*m + i] = b.magnitude[i];
+    for (int k = 0; k < kOrientations; k++)
+      vote(ky, &b.responses[k*m], 0, 1, m, 0, m,
+           &b.column_votes[(ptrdiff_t)(j - r0)*stride + k*m], 1, 1,
+           &b.p0[0], &b.p1[0]);
+  }
+
+  /* and along the rows, all rows of an orientation at a time */
+  for (int k = 0; k < kOrientations; k++)
+    vote(kx, &b.column_votes[k*m], r0, stride, n, c0, c1 - c0,
+         &b.votes[k*m], stride, m, &b.p0[0], &b.p1[0]);
+
+  /* energy of the contrast insensitive votes */
+  for (int j = c0; j < c1; j++) {
+    const float *v = &b.votes[(ptrdiff_t)(j - c0)*stride];
+    float *norm = &b.norms[(ptrdiff_t)(j - c0)*m];
+    for (int i = 0; i < m; i++)
+      norm[i] = 0;
+    for (int k = 0; k < kOrientations/2; k++) {
+      for (int i = 0; i < m; i++) {
+        float s = v[k*m + i] + v[(k + kOrientations/2)*m + i];
+        norm[i] += s*s;
+      }
+    }
+  }
+
+  for (int j = j0; j < j1; j++) {
+    const float *v = &b.votes[(ptrdiff_t)(j - c0)*stride];
+    const float *left = &b.norms[(ptrdiff_t)(max(j - wx, 0) - c0)*m];
+    const float *center = &b.norms[(ptrdiff_t)(j - c0)*m];
+    const float *right = &b.norms[(ptrdiff_t)(min(j + wx, n - 1) - c0)*m];
+    double *out = a.features + (ptrdiff_t)j*m;
+
+    /* the four blocks around each pixel, coeff1..coeff4 of dense_hog.m */
+    for (int i = 0; i < m; i++) {
+      int up = max(i - wy, 0), down = min(i + wy, m - 1);
+      double e1 = (double)center[i] + center[down] + right[i] + right[down];
+      double e2 = (double)center[up] + center[i] + right[up] + right[i];
+      double e3 = (double)left[i] + left[down] + center[i] + center[down];
+      double e4 = (double)left[up] + left[i] + center[up] + center[i];
+      b.coeffs[0][i] = 1 / sqrt(e1 + DBL_EPSILON);
+      b.coeffs[1][i] = 1 / sqrt(e2 + DBL_EPSILON);
+      b.coeffs[2][i] = 1 / sqrt(e3 + DBL_EPSILON);
+      b.coeffs[3][i] = 1 / sqrt(e4 + DBL_EPSILON);
+    }
+    for (int t = 0; t < 4; t++)
+      fill(b.texture[t].begin(), b.texture[t].end(), 0.0);
+
+    /* contrast sensitive features and their sums for the texture */
+    for (int k = 0; k < kOrientations; k++) {
+      double *f = out + k*plane;
+      for (int i = 0; i < m; i++) {
+        double x = v[k*m + i], sum = 0;
+        for (int t = 0; t < 4; t++) {
+          double h = min(x*b.coeffs[t][i], 0.2);
+          sum += h;
+          b.texture[t][i] += h;
+        }
+        f[i] = 0.5*sum;
+      }
+    }
+    /* contrast insensitive features */
+    for (int k = 0; k < kOrientations/2; k++) {
+      double *f = out + (kOrientations + k)*plane;
+      for (int i = 0; i < m; i++) {
+        double x = (double)v[k*m + i] + v[(k + kOrientations/2)*m + i];
+        double sum = 0;
+        for (int t = 0; t < 4; t++)
+          sum += min(x*b.coeffs[t][i], 0.2);
+        f[i] = 0.5*sum;
+      }
+    }
+    /* texture features */
+    for (int t = 0; t < 4; t++) {
+      double *f = out + (kOrientations + kOrientations/2 + t)*plane;
+      for (int i = 0; i < m; i++)
+        f[i] = 0.2357*b.texture[t][i];
+    }
+  }
+}
+
+/* thread t runs bands t, t+num_threads, ... */
+void *run_bands(void *p) {
+  hog_worker *w = (hog_worker *)p;
+  const hog_args &a = *w->args;
+  const int m = a.rows;
+  const vote_kernel &kx = a.kernel[1];
+  /* widest band: its columns, the normalization and the voting support */
+  int cols = a.band_width + 2*a.window[1] + kx.hi - kx.lo;
+  /* running sums of one column along its rows, or of the band along its
+     columns with all rows at a time */
+  size_t sums = max((size_t)(m + a.kernel[0].hi - a.kernel[0].lo + 1),
+                    (size_t)(cols + 1)*m);
+  hog_buffers b;
+
+  b.bin.resize(m);
+  b.magnitude.resize(m);
+  b.responses.resize((size_t)kOrientations*m);
+  b.column_votes.resize((size_t)cols*kOrientations*m);
+  b.votes.resize((size_t)(a.band_width + 2*a.window[1])*kOrientations*m);
+  b.norms.resize((size_t)(a.band_width + 2*a.window[1])*m);
+  b.p0.resize(sums);
+  b.p1.resize(sums);
+  for (int t = 0; t < 4; t++) {
+    b.coeffs[t].resize(m);
+    b.texture[t].resize(m);
+  }
+  for (int band = w->thread; band < a.num_bands; band += a.num_threads) {
+    int j0 = band*a.band_width;
+    compute_band(a, j0, min(j0 + a.band_width, a.cols), b);
+  }
+  return NULL;
+}
+
+/* number of threads, the number of online cores unless HOG_NUM_THREADS
+   is set */
+int num_threads() {
+  const char *env = getenv("HOG_NUM_THREADS");
+  int n = env ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? n : 1;
+}
+
+} // namespace
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  if (nrhs < 1 || nrhs > 2 || nlhs > 1)
+    mexErrMsgTxt("use: features = dense_hog(input_image, window);");
+  if (!mxIsDouble(prhs[0]) && !mxIsSingle(prhs[0]) && !mxIsUint8(prhs[0]))
+    mexErrMsgTxt("dense_hog: input_image should be uint8, single or double");
+  if (mxIsComplex(prhs[0]) || mxGetNumberOfDimensions(prhs[0]) > 3)
+    mexErrMsgTxt("dense_hog: input_image should be a real M-by-N-by-d array");
+
+  hog_args args;
+  args.window[0] = args.window[1] = 4;
+  if (nrhs > 1) {
+    int count = (int)mxGetNumberOfElements(prhs[1]);
+    if (!mxIsDouble(prhs[1]) || (count != 1 && count != 2))
+      mexErrMsgTxt("dense_hog: window should be a scalar or a 2-element vector");
+    for (int i = 0; i < 2; i++) {
+      double w = mxGetPr(prhs[1])[count == 2 ? i : 0];
+      if (w < 1 || w != floor(w))
+        mexErrMsgTxt("dense_hog: window should be positive integers");
+      args.window[i] = (int)w;
+    }
+  }
+
+  const mwSize *d = mxGetDimensions(prhs[0]);
+  args.image = mxGetData(prhs[0]);
+  args.class_id = mxGetClassID(prhs[0]);
+  args.rows = (int)d[0];
+  args.cols = (int)d[1];
+  args.channels = mxGetNumberOfDimensions(prhs[0]) > 2 ? (int)d[2] : 1;
+  mwSize dims[3] = {d[0], d[1], (mwSize)kFeatures};
+  plhs[0] = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
+  args.features = mxGetPr(plhs[0]);
+  if (args.rows == 0 || args.cols == 0 || args.channels == 0)
+    return;
+
+  for (int i = 0; i < 2; i++)
+    args.kernel[i] = make_vote_kernel(args.window[i]);
+  for (int k = 0; k < kOrientations; k++) {
+    double theta = 2.0*k/kOrientations*M_PI;
+    args.cos_theta[k] = cos(theta);
+    args.sin_theta[k] = sin(theta);
+  }
+
+  /* narrow bands on narrow images, so that all threads get one */
+  args.num_threads = num_threads();
+  args.band_width = min(kBandWidth,
+                        (args.cols + args.num_threads - 1)/args.num_threads);
+  args.num_bands = (args.cols + args.band_width - 1)/args.band_width;
+  args.num_threads = min(args.num_threads, args.num_bands);
+
+  /* thread 0 runs on the calling thread, the others fall back to it when
+     they cannot be created */
+  vector<hog_worker> workers(args.num_threads);
+  vector<pthread_t> threads(args.num_threads);
+  vector<bool> started(args.num_threads, false);
+  for (int t = 0; t < args.num_threads; t++) {
+    workers[t].args = &args;
+    workers[t].thread = t;
+    started[t] = t > 0 &&
+                 pthread_create(&threads[t], NULL, run_bands, &workers[t]) == 0;
+  }
+  for (int t = 0; t < args.num_threads; t++) {
+    if (!started[t])
+      run_bands(&workers[t]);
+  }
+  for (int t = 1; t < args.num_threads; t++) {
+    if (started[t])
+      pthread_join(threads[t], NULL);
+  }
+}
@@ -5,9 +5,29 @@ function config = create( varargin )
 % data. This must be saved in a matfile which can be spacified by
 % 'StyleDescriptor2sFile'. This file should contain 'sample_ids', 'descriptors',
 % 'tags', and 'taggings'.
+%
+% With 'IndexFile', the KD-tree and the descriptors are saved to that file by
+% vl_kdtreesave, and config.kdtree holds its name in place of the tree. Queries
+% then map the file, shared by all workers, instead of carrying the tree and
+% the descriptors in the config. The index is built again when it is older than
+% the descriptor file.
+%
+% With 'IndexType' 'pq', the descriptors are product-quantized instead: config.pq
+% holds one byte per 'PQSubspaces' block of dimensions, by default 16 times less
+% memory than the descriptors, and queries scan these codes and re-rank the
+% 'PQCandidates' closest ones by their exact distance. The recall against the
+% kd-forest is logged and kept in config.pq.recall. The descriptors used by the
+% re-rank are written to 'RerankFile' and mapped by the queries, so that the
+% config does not keep config.descriptors. By default, the file is named after
+% 'IndexFile', or after the descriptor file when no index file is given.
 %
 
   DESCRIPTOR_FILE = 'data/paperdoll_descriptors.mat';
+  INDEX_FILE = [];
+  INDEX_TYPE = 'kdtree';
+  PQ_SUBSPACES = [];
+  PQ_CANDIDATES = 250;
+  RERANK_FILE = [];
 
   config = struct(...
     'name',          'knn_retriever', ...
@@ -20,6 +40,7 @@ function config = create( varargin )
     'sample_ids',    [], ...
     'descriptors',   [], ...
     'kdtree',        [], ...
+    'pq',            [], ...
     'num_neighbors', 25, ...
     'target_recall', 0.5, ...
     'threshold',     0.157035 ... % Recall = 0.5 in training data.
@@ -33,21 +54,127 @@ function config = create( varargin )
       case 'OutputLabels', config.output_labels = varargin{i+1};
       case 'NumNeighbors', config.num_neighbors = varargin{i+1};
       case 'DescriptorFile', DESCRIPTOR_FILE = varargin{i+1};
+      case 'IndexFile',    INDEX_FILE = varargin{i+1};
+      case 'IndexType',    INDEX_TYPE = varargin{i+1};
+      case 'PQSubspaces',  PQ_SUBSPACES = varargin{i+1};
+      case 'PQCandidates', PQ_CANDIDATES = varargin{i+1};
+      case 'RerankFile',   RERANK_FILE = varargin{i+1};
     end
   end
 
   assert(exist(DESCRIPTOR_FILE, 'file') > 0, ...
          'Descriptor file not found: %s', DESCRIPTOR_FILE);
+  if isempty(RERANK_FILE)
+    RERANK_FILE = default_rerank_file(INDEX_FILE, DESCRIPTOR_FILE);
+  end
+  assert(any(strcmp(INDEX_TYPE, {'kdtree', 'pq'})), ...
+         'Unknown index type: %s', INDEX_TYPE);
+  if strcmp(INDEX_TYPE, 'kdtree') && ~isempty(INDEX_FILE) && ...
+     is_up_to_date(INDEX_FILE, DESCRIPTOR_FILE)
+    DESCRIPTOR_FILE = load(DESCRIPTOR_FILE, 'taggings', 'tags', 'sample_ids');
+    config.taggings = DESCRIPTOR_FILE.taggings;
+    config.tags = DESCRIPTOR_FILE.tags;
+    config.sample_ids = DESCRIPTOR_FILE.sample_ids;
+    config.kdtree = INDEX_FILE;
+    return;
+  end
   DESCRIPTOR_FILE = load(DESCRIPTOR_FILE);
   config.taggings = DESCRIPTOR_FILE.taggings;
   config.tags = DESCRIPTOR_FILE.tags;
   config.sample_ids = DESCRIPTOR_FILE.sample_ids;
   config.descriptors = single(DESCRIPTOR_FILE.descriptors');
 
+  if strcmp(INDEX_TYPE, 'pq')
+    if isempty(PQ_SUBSPACES)
+      PQ_SUBSPACES = ceil(size(config.descriptors, 1) / 4);
+    end
+    config.pq = create_pq_index(config, PQ_SUBSPACES, PQ_CANDIDATES);
+    logger('Saving descriptors for re-ranking to %s.', RERANK_FILE);
+    write_descriptors(config.descriptors, RERANK_FILE);
+    config.pq.rerank_file = RERANK_FILE;
+    full_bytes = struct_bytes(config);
+    config.descriptors = [];
+    logger('PQ index: the config takes %g times less memory.', ...
+           full_bytes / struct_bytes(config));
+    return;
+  end
+
   logger('Building KD-tree for %d of %d-d vectors.', ...
          size(config.descriptors, 2), ...
          size(config.descriptors, 1));
   config.kdtree = vl_kdtreebuild(config.descriptors);
+  if ~isempty(INDEX_FILE)
+    logger('Saving KD-tree to %s.', INDEX_FILE);
+    vl_kdtreesave(config.kdtree, config.descriptors, INDEX_FILE);
+    config.kdtree = INDEX_FILE;
+    config.descriptors = [];
+  end
+
+end
+
+function flag = is_up_to_date(index_file, descriptor_file)
+%IS_UP_TO_DATE Check if the index file is newer than the descriptors.
+  index_info = dir(index_file);
+  descriptor_info = dir(descriptor_file);
+  flag = numel(index_info) == 1 && ...
+         index_info.datenum >= descriptor_info.datenum;
+end
+
+function pq = create_pq_index(config, num_subspaces, num_candidates)
+%CREATE_PQ_INDEX Quantize the descriptors and measure the recall of queries.
+  NUM_TRAINING = 100000;
+  NUM_QUERIES = 1000;
+  [dimension, num_data] = size(config.descriptors);
+  logger('Training product quantizer for %d of %d-d vectors, %d subspaces.', ...
+         num_data, dimension, num_subspaces);
+  pq = train_pq(config.descriptors, num_subspaces, NUM_TRAINING);
+  pq.num_candidates = num_candidates;
+  pq.rerank_file = [];
+
+  % Recall of the neighbors of the kd-forest on descriptors of the corpus.
+  queries = config.descriptors(:, randperm(num_data, min(num_data, NUM_QUERIES)));
+  num_neighbors = min(config.num_neighbors, num_data);
+  expected = vl_kdtreequery(vl_kdtreebuild(config.descriptors), ...
+                            config.descriptors, ...
+                            queries, ...
+                            'NUMNEIGHBORS', num_neighbors);
+  index = pq_search(pq.codebooks, pq.subspaces, pq.codes, queries, ...
+                    num_neighbors, num_candidates, config.descriptors);
+  hits = 0;
+  for i = 1:size(queries, 2)
+    hits = hits + numel(intersect(index(:, i), expected(:, i)));
+  end
+  pq.recall = hits / numel(expected);
+  logger('PQ index: recall@%d %g against the kd-forest.', ...
+         num_neighbors, pq.recall);
+end
 
+function filename = default_rerank_file(index_file, descriptor_file)
+%DEFAULT_RERANK_FILE Name the re-rank file after the index or descriptor file.
+  if ~isempty(index_file)
+    [directory, name] = fileparts(index_file);
+  else
+    [directory, name] = fileparts(descriptor_file);
+  end
+  filename = fullfile(directory, [name, '_rerank.bin']);
 end
 
+function bytes = struct_bytes(value)
+%STRUCT_BYTES Memory of a value and everything it holds.
+  info = whos('value');
+  bytes = info.bytes;
+end
+
+function write_descriptors(descriptors, filename)
+%WRITE_DESCRIPTORS Write single descriptors as raw data for pq_search.
+  try
+    fid = fopen(filename, 'w');
+    fwrite(fid, descriptors, 'single');
+    fclose(fid);
+  catch exception
+    if exist(filename, 'file')
+        delete(filename);
+    end
+    rethrow(exception);
+  end
+end
@@ -0,0 +1,14 @@
+function make(varargin)
+%MAKE Build necessary binary files.
+
+  % product-quantized search of the 'pq' index
+  cwd = fileparts(mfilename('fullpath'));
+  cmd = sprintf('mex -O %s %s -outdir %s', ...
+                'CFLAGS="\$CFLAGS -march=native"',...
+                fullfile(cwd, 'private', 'pq_search.c'),...
+                fullfile(cwd, 'private')...
+               );
+  disp(cmd);
+  eval(cmd);
+
+end
@@ -0,0 +1,398 @@
+/*
+   Nearest neighbors from product-quantized codes, with an exact re-rank.
+   If necessary to recompile, type:
+       mex -O CFLAGS="\$CFLAGS -march=native" pq_search.c
+   from within matlab, or run knn_retriever.make.
+
+   [index, distances] = pq_search(codebooks, subspaces, codes, queries, ...
+                                  num_neighbors, num_candidates, descriptors);
+
+   codebooks: D-by-K single, row block s of column k the k-th centroid of
+       subspace s, K <= 256.
+   subspaces: 1-by-(M+1) double, subspace s is rows subspaces(s)+1 to
+       subspaces(s+1).
+   codes: N-by-M uint8, codes(n,s)+1 the centroid of subspace s of point n.
+   queries: D-by-Q single.
+   num_neighbors: number of neighbors to return per query.
+   num_candidates: number of neighbors by code distance to re-rank.
+   descriptors: the D-by-N single descriptors the codes were computed from,
+       or the name of a file holding them as raw single, used for the exact
+       re-rank.  [] returns the code distances instead.
+   index: num_neighbors-by-Q uint32, 1-based like vl_kdtreequery.
+   distances: num_neighbors-by-Q single squared L2 distances.
+
+   Each query builds an M-by-K table of the distances of its subvectors to
+   the centroids, then scans the codes column by column, 8 points at a time
+   (AVX2 gathers from the table when available), keeping the closest
+   num_candidates in a heap.  Only those are compared with the descriptors,
+   so a descriptor file is mapped and only the pages of candidates are read;
+   the mapping is kept across calls.  Queries run on all cores
+   (PQ_NUM_THREADS overrides the number of threads).
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mex.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define MAX_CENTROIDS 256
+#define BLOCK 8
+
+typedef struct {
+    const float *codebooks;
+    const int *subspaces;
+    int dimension, num_centroids, num_subspaces;
+    const uint8_t *codes;
+    size_t num_data;
+    const float *queries;
+    size_t num_queries;
+    int num_neighbors, num_candidates;
+    const float *descriptors;   /* NULL for no re-rank */
+    uint32_t *index;
+    float *distances;
+    int num_threads;
+} pq_args;
+
+/* candidate of the scan */
+typedef struct {
+    float distance;
+    uint32_t index;
+} pq_candidate;
+
+/* number of threads, the number of online cores unless PQ_NUM_THREADS
+   is set */
+static int num_threads(void)
+{
+    const char *env = getenv("PQ_NUM_THREADS");
+    int n = env ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+/* max-heap of candidates by distance */
+static void heap_sift_down(pq_candidate *heap, int size, int i)
+{
+    for (;;) {
+        int largest = i, l = 2*i+1, r = 2*i+2;
+        pq_candidate t;
+        if (l < size && heap[l].distance > heap[largest].distance)
+            largest = l;
+        if (r < size && heap[r].distance > heap[largest].distance)
+            largest = r;
+        if (largest == i)
+            return;
+        t = heap[i]; heap[i] = heap[largest]; heap[largest] = t;
+        i = largest;
+    }
+}
+
+static void heap_push(pq_candidate *heap, int *size, int capacity,
+    float distance, uint32_t index)
+{
+    int i;
+
+    if (*size == capacity) {
+        if (distance >= heap[0].distance)
+            return;
+        heap[0].distance = distance;
+        heap[0].index = index;
+        heap_sift_down(heap, *size, 0);
+        return;
+    }
+    i = (*size)++;
+    while (i > 0 && heap[(i-1)/2].distance < distance) {
+        heap[i] = heap[(i-1)/2];
+        i = (i-1)/2;
+    }
+    heap[i].distance = distance;
+    heap[i].index = index;
+}
+
+static int compare_candidates(const void *a, const void *b)
+{
+    const pq_candidate *x = a, *y = b;
+    if (x->distance != y->distance)
+        return x->distance < y->distance ? -1 : 1;
+    return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+/* distance table of a query, table[s*MAX_CENTROIDS + k] the squared
+   distance of subvector s to centroid k */
+static void build_table(const pq_args *a, const float *query, float *table)
+{
+    int s, k, d;
+
+    for (s = 0; s < a->num_subspaces; s++) {
+        for (k = 0; k < a->num_centroids; k++) {
+            const float *c = a->codebooks + (size_t)k*a->dimension;
+            float sum = 0.0f;
+            for (d = a->subspaces[s]; d < a->subspaces[s+1]; d++) {
+                float diff = query[d] - c[d];
+                sum += diff*diff;
+            }
+            table[s*MAX_CENTROIDS + k] = sum;
+        }
+    }
+}
+
+/* code distances of points n to n+BLOCK-1, summed over subspaces in order */
+static void scan_block(const pq_args *a, const float *table, size_t n,
+    float *out)
+{
+    const uint8_t *codes = a->codes + n;
+    int s;
+#if defined(__AVX2__)
+    __m256 sum = _mm256_setzero_ps();
+    for (s = 0; s < a->num_subspaces; s++) {
+        __m128i c = _mm_loadl_epi64((const __m128i *)(codes + s*a->num_data));
+        sum = _mm256_add_ps(sum, _mm256_i32gather_ps(table + s*MAX_CENTROIDS,
+            _mm256_cvtepu8_epi32(c), 4));
+    }
+    _mm256_storeu_ps(out, sum);
+#else
+    int j;
+    for (j = 0; j < BLOCK; j++)
+        out[j] = 0.0f;
+    for (s = 0; s < a->num_subspaces; s++) {
+        const float *t = table + s*MAX_CENTROIDS;
+        const uint8_t *c = codes + s*a->num_data;
+        for (j = 0; j < BLOCK; j++)
+            out[j] += t[c[j]];
+    }
+#endif
+}
+
+static float exact_distance(const pq_args *a, const float *query, uint32_t n)
+{
+    const float *x = a->descriptors + (size_t)n*a->dimension;
+    float sum = 0.0f;
+    int d;
+
+    for (d = 0; d < a->dimension; d++) {
+        float diff = query[d] - x[d];
+        sum += diff*diff;
+    }
+    return sum;
+}
+
+/* queries q = thread, thread+num_threads, ... */
+typedef struct {
+    const pq_args *args;
+    int thread;
+    int out_of_memory;          /* read by the caller after the join only */
+} pq_worker;
+
+static void *run_queries(void *p)
+{
+    pq_worker *w = p;
+    const pq_args *a = w->args;
+    float *table = malloc(sizeof(float)*a->num_subspaces*MAX_CENTROIDS);
+    pq_candidate *heap = malloc(sizeof(pq_candidate)*a->num_candidates);
+    size_t q, n;
+
+    if (table == NULL || heap == NULL) {
+        free(table);
+        free(heap);
+        w->out_of_memory = 1;
+        return NULL;
+    }
+    for (q = w->thread; q < a->num_queries; q += a->num_threads) {
+        const float *query = a->queries + q*a->dimension;
+        size_t full = a->num_data - a->num_data%BLOCK;
+        float block[BLOCK];
+        int size = 0, i;
+
+        build_table(a, query, table);
+        for (n = 0; n < full; n += BLOCK) {
+            scan_block(a, table, n, block);
+            for (i = 0; i < BLOCK; i++) {
+                if (size < a->num_candidates || block[i] < heap[0].distance)
+                    heap_push(heap, &size, a->num_candidates, block[i],
+                        (uint32_t)(n+i));
+            }
+        }
+        for (n = full; n < a->num_data; n++) {
+            float sum = 0.0f;
+            int s;
+            for (s = 0; s < a->num_subspaces; s++)
+                sum += table[s*MAX_CENTROIDS + a->codes[n + s*a->num_data]];
+            heap_push(heap, &size, a->num_candidates, sum, (uint32_t)n);
+        }
+
+        /* re-rank the candidates by their exact distance */
+        if (a->descriptors) {
+            for (i = 0; i < size; i++)
+                heap[i].distance = exact_distance(a, query, heap[i].index);
+        }
+        qsort(heap, size, sizeof(*heap), compare_candidates);
+        for (i = 0; i < a->num_neighbors; i++) {
+            a->index[q*a->num_neighbors + i] = heap[i].index + 1;
+            a->distances[q*a->num_neighbors + i] = heap[i].distance;
+        }
+    }
+    free(heap);
+    free(table);
+    return NULL;
+}
+
+/* descriptor file mapped by a previous call */
+static struct {
+    char *path;
+    time_t modification_time;
+    void *data;
+    size_t size;
+} mapped;
+
+static void unmap_descriptors(void)
+{
+    if (mapped.data)
+        munmap(mapped.data, mapped.size);
+    free(mapped.path);
+    memset(&mapped, 0, sizeof(mapped));
+}
+
+static const float *map_descriptors(const mxArray *path_array, size_t size)
+{
+    char *path = mxArrayToString(path_array);
+    struct stat info;
+    int fd;
+
+    if (path == NULL || stat(path, &info) != 0)
+        mexErrMsgTxt("pq_search: cannot read the descriptor file");
+    if ((size_t)info.st_size != size)
+        mexErrMsgTxt("pq_search: descriptor file does not match the codes");
+    if (mapped.path && strcmp(mapped.path, path) == 0 &&
+        mapped.modification_time == info.st_mtime && mapped.size == size) {
+        mxFree(path);
+        return mapped.data;
+    }
+    unmap_descriptors();
+    fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        mapped.data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (fd < 0 || mapped.data == MAP_FAILED) {
+        mapped.data = NULL;
+        mexErrMsgTxt("pq_search: cannot map the descriptor file");
+    }
+    mapped.path = strdup(path);
+    mapped.modification_time = info.st_mtime;
+    mapped.size = size;
+    mexAtExit(unmap_descriptors);
+    mxFree(path);
+    return mapped.data;
+}
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs, const mxArray *prhs[])
+{
+    pq_args args;
+    pq_worker *workers;
+    pthread_t *threads;
+    int *started;
+    int *subspaces;
+    const double *bounds;
+    int s, t;
+
+    if (nrhs != 7 || nlhs > 2)
+        mexErrMsgTxt("use: [index, distances] = pq_search(codebooks, "
+            "subspaces, codes, queries, num_neighbors, num_candidates, "
+            "descriptors);");
+    if (!mxIsSingle(prhs[0]) || !mxIsDouble(prhs[1]) ||
+        !mxIsUint8(prhs[2]) || !mxIsSingle(prhs[3]))
+        mexErrMsgTxt("pq_search: codebooks and queries should be single, "
+            "subspaces double and codes uint8");
+
+    args.dimension = (int)mxGetM(prhs[0]);
+    args.num_centroids = (int)mxGetN(prhs[0]);
+    args.num_subspaces = (int)mxGetNumberOfElements(prhs[1]) - 1;
+    args.num_data = mxGetM(prhs[2]);
+    args.num_queries = mxGetN(prhs[3]);
+    args.num_neighbors = (int)mxGetScalar(prhs[4]);
+    args.num_candidates = (int)mxGetScalar(prhs[5]);
+    if (args.num_centroids > MAX_CENTROIDS || args.num_subspaces < 1 ||
+        (int)mxGetN(prhs[2]) != args.num_subspaces)
+        mexErrMsgTxt("pq_search: codes do not match the codebooks");
+    if ((int)mxGetM(prhs[3]) != args.dimension && args.num_queries > 0)
+        mexErrMsgTxt("pq_search: queries do not match the codebooks");
+    if (args.num_neighbors < 1 || (size_t)args.num_neighbors > args.num_data)
+        mexErrMsgTxt("pq_search: num_neighbors out of range");
+    if (args.num_candidates < args.num_neighbors)
+        args.num_candidates = args.num_neighbors;
+    if ((size_t)args.num_candidates > args.num_data)
+        args.num_candidates = (int)args.num_data;
+
+    bounds = mxGetPr(prhs[1]);
+    subspaces = mxMalloc(sizeof(int)*(args.num_subspaces+1));
+    for (s = 0; s <= args.num_subspaces; s++) {
+        subspaces[s] = (int)bounds[s];
+        if (subspaces[s] < 0 || subspaces[s] > args.dimension ||
+            (s > 0 && subspaces[s] < subspaces[s-1]))
+            mexErrMsgTxt("pq_search: invalid subspaces");
+    }
+    args.subspaces = subspaces;
+    args.codebooks = mxGetData(prhs[0]);
+    args.codes = mxGetData(prhs[2]);
+    args.queries = mxGetData(prhs[3]);
+
+    if (mxIsEmpty(prhs[6]))
+        args.descriptors = NULL;
+    else if (mxIsChar(prhs[6]))
+        args.descriptors = map_descriptors(prhs[6],
+            sizeof(float)*args.dimension*args.num_data);
+    else if (mxIsSingle(prhs[6]) &&
+             mxGetM(prhs[6]) == (size_t)args.dimension &&
+             mxGetN(prhs[6]) == args.num_data)
+        args.descriptors = mxGetData(prhs[6]);
+    else
+        mexErrMsgTxt("pq_search: descriptors should be D-by-N single");
+
+    plhs[0] = mxCreateNumericMatrix(args.num_neighbors, args.num_queries,
+        mxUINT32_CLASS, mxREAL);
+    plhs[1] = mxCreateNumericMatrix(args.num_neighbors, args.num_queries,
+        mxSINGLE_CLASS, mxREAL);
+    args.index = mxGetData(plhs[0]);
+    args.distances = mxGetData(plhs[1]);
+    if (args.num_queries == 0)
+        return;
+
+    args.num_threads = num_threads();
+    if ((size_t)args.num_threads > args.num_queries)
+        args.num_threads = (int)args.num_queries;
+    workers = mxCalloc(args.num_threads, sizeof(*workers));
+    threads = mxCalloc(args.num_threads, sizeof(*threads));
+    started = mxCalloc(args.num_threads, sizeof(*started));
+    /* thread 0 runs on the calling thread, the others fall back to it when
+       they cannot be created */
+    for (t = 0; t < args.num_threads; t++) {
+        workers[t].args = &args;
+        workers[t].thread = t;
+        started[t] = t > 0 &&
+            pthread_create(&threads[t], NULL, run_queries, &workers[t]) == 0;
+    }
+    for (t = 0; t < args.num_threads; t++) {
+        if (!started[t])
+            run_queries(&workers[t]);
+    }
+    for (t = 1; t < args.num_threads; t++) {
+        if (started[t])
+            pthread_join(threads[t], NULL);
+    }
+    for (t = 0; t < args.num_threads; t++) {
+        if (workers[t].out_of_memory)
+            mexErrMsgTxt("pq_search: out of memory");
+    }
+    mxFree(started);
+    mxFree(threads);
+    mxFree(workers);
+    mxFree(subspaces);
+}
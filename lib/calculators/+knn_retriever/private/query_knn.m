@@ -1,10 +1,24 @@
 function [retrieved_ids, tag_scores] = query_knn(config, samples)
 %QUERY_KNN Retrieve nearest neighbors.
   queries = cat(1, samples.(config.input));
-  [index, distances] = vl_kdtreequery(config.kdtree, ...
-                                      config.descriptors, ...
-                                      single(queries'), ...
-                                      'NUMNEIGHBORS', config.num_neighbors);
+  if isfield(config, 'pq') && ~isempty(config.pq)
+    descriptors = config.descriptors;
+    if ~isempty(config.pq.rerank_file)
+      descriptors = config.pq.rerank_file;
+    end
+    [index, distances] = pq_search(config.pq.codebooks, ...
+                                   config.pq.subspaces, ...
+                                   config.pq.codes, ...
+                                   single(queries'), ...
+                                   config.num_neighbors, ...
+                                   config.pq.num_candidates, ...
+                                   descriptors);
+  else
+    [index, distances] = vl_kdtreequery(config.kdtree, ...
+                                        config.descriptors, ...
+                                        single(queries'), ...
+                                        'NUMNEIGHBORS', config.num_neighbors);
+  end
   weights = 1 ./ (1 + distances);
   weights = bsxfun(@rdivide, weights, sum(weights, 1))';
   retrieved_ids = config.sample_ids(index)';
@@ -0,0 +1,34 @@
+function pq = train_pq(descriptors, num_subspaces, training_size)
+%TRAIN_PQ Train a product quantizer and encode descriptors.
+%
+%    pq = train_pq(descriptors, num_subspaces, training_size)
+%
+% The D-by-N descriptors are split into num_subspaces blocks of rows, and
+% each block is quantized to at most 256 centroids learned by k-means on
+% training_size random descriptors. The result has the fields
+%
+%    codebooks  D-by-K single, rows of subspace s hold its K centroids.
+%    subspaces  1-by-(M+1), subspace s is rows subspaces(s)+1:subspaces(s+1).
+%    codes      N-by-M uint8, 0-based centroid of each subspace.
+%
+% See also pq_search
+
+  [dimension, num_data] = size(descriptors);
+  num_subspaces = min(num_subspaces, dimension);
+  num_centroids = min(256, num_data);
+  sample = descriptors(:, randperm(num_data, min(num_data, training_size)));
+
+  pq.subspaces = round(linspace(0, dimension, num_subspaces + 1));
+  pq.codebooks = zeros(dimension, num_centroids, 'single');
+  pq.codes = zeros(num_data, num_subspaces, 'uint8');
+  for s = 1:num_subspaces
+    rows = pq.subspaces(s)+1:pq.subspaces(s+1);
+    centroids = vl_kmeans(sample(rows, :), num_centroids);
+    pq.codebooks(rows, :) = centroids;
+    index = vl_kdtreequery(vl_kdtreebuild(centroids), ...
+                           centroids, ...
+                           descriptors(rows, :));
+    pq.codes(:, s) = uint8(index' - 1);
+  end
+
+end
@@ -5,10 +5,10 @@ function [segmentation, segment_geometry, segment_bows] = ...
   if size(input_image, 3) == 1
     input_image = repmat(input_image, [1,1,3]);
   end
-  segmentation = pf.segment(input_image, ...
-                            config.pf_sigma_smooth, ...
-                            config.pf_k_threshold, ...
-                            config.pf_min_size);
+  segmentation = double(pf.segment(input_image, ...
+                                   config.pf_sigma_smooth, ...
+                                   config.pf_k_threshold, ...
+                                   config.pf_min_size));
   % Compute geometry feature for each segment.
   pose_map = sample.(config.input_pose_map);
   image_size = size(pose_map);
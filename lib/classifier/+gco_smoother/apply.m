@@ -4,11 +4,17 @@ function [labeling, negative_log_likelihood] = apply( unary_probabilities, input
   BETA = [];
   GAMMA = 10;
   V_smooth = [];
+  METHOD = 'swap';
+  TILE_SIZE = [256, 256];
+  HANDLE = [];
   for i = 1:2:numel(varargin)
     switch varargin{i}
       case 'Beta', BETA = varargin{i+1};
       case 'Gamma', GAMMA = varargin{i+1};
       case 'SmoothCost', V_smooth = varargin{i+1};
+      case 'Method', METHOD = varargin{i+1};
+      case 'TileSize', TILE_SIZE = varargin{i+1};
+      case 'Handle', HANDLE = varargin{i+1};
     end
   end
 
@@ -18,7 +24,11 @@ function [labeling, negative_log_likelihood] = apply( unary_probabilities, input
   % Prepare costs.
   unary_probabilities = reshape(unary_probabilities, ...
                                 [num_sites, size(unary_probabilities, 3)]);
-  valid_labels = find(max(unary_probabilities, [], 1) ~= 0);
+  if isempty(HANDLE)
+    valid_labels = find(max(unary_probabilities, [], 1) ~= 0);
+  else
+    valid_labels = 1:size(unary_probabilities, 2); % fixed by the handle
+  end
   num_labels = numel(valid_labels);
   U = -log(unary_probabilities(:, valid_labels));
   U = min(U, 10000000 - 1); % Limit to prevent integer overflow.
@@ -28,37 +38,42 @@ function [labeling, negative_log_likelihood] = apply( unary_probabilities, input
     V_smooth = min(V_smooth(valid_labels, valid_labels), 10000000 - 1);
   end
   
-  features = reshape(im2double(input_image), [num_sites, image_size(3)]);
-  [J, I] = ndgrid(1:image_size(1), 1:image_size(2));
-  Y1 = sub2ind(image_size(1:2), J(1:end-1,:), I(1:end-1,:));
-  Y2 = sub2ind(image_size(1:2), J(2:end  ,:), I(2:end,  :));
-  X1 = sub2ind(image_size(1:2), J(:,1:end-1), I(:,1:end-1));
-  X2 = sub2ind(image_size(1:2), J(:,2:end  ), I(:,2:end  ));
-  square_feature_diff = sum([features(X1(:), :) - features(X2(:), :);...
-                             features(Y1(:), :) - features(Y2(:), :)].^2, 2);
-  if isempty(BETA)
-    BETA = 1 ./ (2 * mean(square_feature_diff));
+  % A handle from GCO_CreateGrid of the same size and labels is reused, and
+  % kept for the next image.
+  if isempty(HANDLE)
+    gco_object = GCO_CreateGrid(image_size(1), image_size(2), num_labels);
+  else
+    gco_object = HANDLE;
+    GCO_Reset(gco_object);
   end
-  W = GAMMA * exp(-BETA * square_feature_diff);
-  V_neigh = sparse([X1(:);Y1(:)], [X2(:);Y2(:)], W(:), num_sites, num_sites);
-  
-  gco_object = GCO_Create(num_sites, num_labels);
   try
     GCO_SetDataCost(gco_object, int32(U'));
     GCO_SetSmoothCost(gco_object, int32(V_smooth));
-    GCO_SetNeighbors(gco_object, round(V_neigh));
-    %GCO_Expansion(gco_object);
-    GCO_Swap(gco_object);
+    % Contrast weights of the 4-connected grid, computed in the mex.
+    GCO_SetContrastNeighbors(gco_object, input_image, BETA, GAMMA);
+    if strcmp(METHOD, 'expansion')
+      GCO_Expansion(gco_object);
+    elseif strcmp(METHOD, 'tiled')
+      GCO_ExpansionTiled(gco_object, TILE_SIZE);
+    elseif strcmp(METHOD, 'warm')
+      GCO_ExpansionWarm(gco_object);
+    else
+      GCO_Swap(gco_object);
+    end
     labeling = GCO_GetLabeling(gco_object);
     labeling = reshape(double(valid_labels(labeling)), image_size(1:2));
     if nargout > 1
       negative_log_likelihood = GCO_ComputeEnergy(gco_object);
     end
   catch e
-    GCO_Delete(gco_object);
+    if isempty(HANDLE)
+      GCO_Delete(gco_object);
+    end
     rethrow(e);
   end
-  GCO_Delete(gco_object);
+  if isempty(HANDLE)
+    GCO_Delete(gco_object);
+  end
 
 end
 
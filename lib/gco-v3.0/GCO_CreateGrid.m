@@ -0,0 +1,14 @@
+function Handle = GCO_CreateGrid(Rows,Cols,NumLabels)
+% GCO_CreateGrid    Create a GCoptimization object on a 4-connected grid.
+%    Handle = GCO_CreateGrid(Rows,Cols,NumLabels) creates a new
+%    GCoptimization object with Rows*Cols sites, one per pixel of a
+%    Rows-by-Cols image in column-major order, each connected to its 4
+%    neighbors. Neighbor weights are set by GCO_SetContrastNeighbors
+%    instead of GCO_SetNeighbors, and are stored per pixel rather than
+%    in a NumSites-by-NumSites sparse matrix.
+%    Call GCO_Delete(Handle) to delete the object and free its memory.
+
+GCO_LoadLib();
+if (nargin < 3), error('Expected 3 arguments'); end
+Handle = gco_matlab('gco_create_grid',int32(Rows),int32(Cols),int32(NumLabels));
+end
@@ -0,0 +1,31 @@
+function [Energy,Gap] = GCO_ExpansionTiled(Handle,TileSize,NumThreads,NumSweeps)
+% GCO_ExpansionTiled   Run alpha-expansion on tiles of a grid in parallel.
+%    GCO_ExpansionTiled(Handle,TileSize) splits a grid created by
+%    GCO_CreateGrid into tiles of TileSize = [Rows Cols] sites or more,
+%    coloured as a checkerboard. The tiles of one colour are optimized
+%    concurrently with alpha-expansion, the other colour held fixed, and
+%    then those of the other colour. A final cycle of expansion over the
+%    whole grid reconciles the tile boundaries.
+%    GCO_ExpansionTiled(Handle,TileSize,NumThreads) uses NumThreads
+%    threads; by default the number of cores, or GCO_NUM_THREADS if set.
+%    GCO_ExpansionTiled(Handle,TileSize,NumThreads,NumSweeps) runs at most
+%    NumSweeps final cycles instead of 1.
+%    Returns the energy of the computed labeling.
+%
+%    [Energy,Gap] = GCO_ExpansionTiled(...) also runs GCO_Expansion from
+%    the same initial labeling and returns Energy minus its energy; the
+%    labeling is still that of the tiled expansion.
+%
+%    Falls back to GCO_Expansion when label costs or sparse data costs
+%    are set.
+
+GCO_LoadLib();
+if (nargin < 2), error('ExpansionTiled requires handle and tile size'); end
+if (nargin < 3), NumThreads = 0; end
+if (nargin < 4), NumSweeps = 1; end
+if (nargout > 1)
+    [Energy,Gap] = gco_matlab('gco_expansion_tiled',Handle,int32(TileSize),int32(NumThreads),int32(NumSweeps));
+else
+    Energy = gco_matlab('gco_expansion_tiled',Handle,int32(TileSize),int32(NumThreads),int32(NumSweeps));
+end
+end
@@ -0,0 +1,29 @@
+function [Energy,Stats] = GCO_ExpansionWarm(Handle,MaxIter)
+% GCO_ExpansionWarm   Run alpha-expansion, reusing graphs across cycles.
+%    GCO_ExpansionWarm(Handle) minimizes the current energy via 
+%    alpha-expansion with "standard cycles" until convergence, like
+%    GCO_Expansion(Handle,MaxIter). The graph of each label is kept from
+%    one cycle to the next: only the sites whose label changed since the
+%    previous move on that label are updated, and maxflow continues from
+%    the previous flow and search trees. Late cycles, which change few
+%    sites, then cost a fraction of a full rebuild. Holds one graph per
+%    label in memory.
+%    GCO_ExpansionWarm(Handle,MaxIter) runs at most MaxIter cycles.
+%    Returns the energy of the computed labeling.
+%
+%    [Energy,Stats] = GCO_ExpansionWarm(...) also returns a 3-by-cycles
+%    matrix: the energy after each cycle, its time in seconds, and the
+%    number of sites updated over its moves.
+%
+%    Falls back to GCO_Expansion when label costs or sparse data costs
+%    are set; Stats is then empty.
+
+GCO_LoadLib();
+if (nargin < 1), error('ExpansionWarm requires handle to GCO instance'); end
+if (nargin < 2), MaxIter = -1; end
+if (nargout > 1)
+    [Energy,Stats] = gco_matlab('gco_expansion_warm',Handle,int32(MaxIter));
+else
+    Energy = gco_matlab('gco_expansion_warm',Handle,int32(MaxIter));
+end
+end
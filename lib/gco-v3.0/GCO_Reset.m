@@ -0,0 +1,13 @@
+function GCO_Reset(Handle)
+% GCO_Reset    Prepare a GCoptimization object for another problem.
+%    GCO_Reset(Handle) sets the labeling back to all 1s and keeps the
+%    memory of the object: its graph, neighbours and the buffers of the
+%    moves. A server labeling a stream of images of the same size can then
+%    create one object and, per image, call GCO_Reset, GCO_SetDataCost
+%    and GCO_SetContrastNeighbors or GCO_SetSmoothCost, instead of
+%    GCO_Create and GCO_Delete. Smooth costs, label costs and data costs
+%    stay in effect until they are set again.
+
+GCO_LoadLib();
+gco_matlab('gco_reset',int32(Handle));
+end
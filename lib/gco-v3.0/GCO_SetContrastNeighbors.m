@@ -0,0 +1,18 @@
+function GCO_SetContrastNeighbors(Handle,Image,Beta,Gamma)
+% GCO_SetContrastNeighbors   Set contrast-sensitive weights of a grid.
+%     GCO_SetContrastNeighbors(Handle,Image,Beta,Gamma) weighs the smooth
+%     cost of neighboring pixels p and q of a grid created by
+%     GCO_CreateGrid by
+%        round(Gamma * exp(-Beta * sum((Image(p,:) - Image(q,:)).^2)))
+%     where Image is Rows-by-Cols-by-NumChannels, scaled as by im2double.
+%     If Beta is empty, it is 1/(2*mean(squared difference)) over all
+%     neighboring pairs. Gamma defaults to 1.
+%
+%     Uses the Potts model unless GCO_SetSmoothCost has been called.
+
+GCO_LoadLib();
+if (nargin < 2), error('Expected at least 2 arguments'); end
+if (nargin < 3), Beta = []; end
+if (nargin < 4), Gamma = 1; end
+gco_matlab('gco_setcontrastneighbors',Handle,Image,double(Beta),double(Gamma));
+end
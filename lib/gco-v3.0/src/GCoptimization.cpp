@@ -5,8 +5,10 @@
 #include "LinkedBlockList.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <vector>
 #include <algorithm>
+#include <new>
 
 // will leave this one just for the laughs :)
 //#define olga_assert(expr) assert(!(expr))
@@ -104,12 +106,18 @@ GCoptimization::GCoptimization(SiteID nSites, LabelID nLabels)
 , m_solveSpecialCases(&GCoptimization::solveSpecialCases<DataCostFnFromArray>)
 , m_datacostFnDelete(0)
 , m_smoothcostFnDelete(0)
+, m_giveDataCost(0)
+, m_giveSmoothCost(0)
+, m_interruptible(true)
+, m_activeSites(new SiteID[nSites])
+, m_moveEnergy(0)
 , m_random_label_order(false)
 , m_verbosity(0)
 , m_labelingInfoDirty(true)
 , m_lookupSiteVar(new SiteID[nSites])
 , m_labeling(new LabelID[nSites])
 , m_labelTable(new LabelID[nLabels])
+, m_labelOrder(new LabelID[nLabels])
 , m_labelingDataCosts(new EnergyTermType[nSites])
 , m_labelCounts(new SiteID[nLabels])
 , m_activeLabelCounts(new SiteID[m_num_labels])
@@ -119,9 +127,11 @@ GCoptimization::GCoptimization(SiteID nSites, LabelID nLabels)
 	if ( nLabels <= 1 ) handleError("Number of labels must be >= 2");
 	if ( nSites <= 0 )  handleError("Number of sites must be >= 1");
 	
-	if ( !m_lookupSiteVar || !m_labelTable || !m_labeling ){
+	if ( !m_lookupSiteVar || !m_labelTable || !m_labelOrder || !m_labeling || !m_activeSites ){
 		if (m_lookupSiteVar) delete [] m_lookupSiteVar;
+		if (m_activeSites) delete [] m_activeSites;
 		if (m_labelTable) delete [] m_labelTable;
+		if (m_labelOrder) delete [] m_labelOrder;
 		if (m_labeling) delete [] m_labeling;
 		if (m_labelingDataCosts) delete [] m_labelingDataCosts;
 		if (m_labelCounts) delete [] m_labelCounts;
@@ -139,11 +149,14 @@ GCoptimization::GCoptimization(SiteID nSites, LabelID nLabels)
 GCoptimization::~GCoptimization()
 {
 	delete [] m_labelTable;
+	delete [] m_labelOrder;
 	delete [] m_lookupSiteVar;
 	delete [] m_labeling;
 	delete [] m_labelingDataCosts;
 	delete [] m_labelCounts;
 	delete [] m_activeLabelCounts;
+	delete [] m_activeSites;
+	delete m_moveEnergy;
 
 	if (m_datacostFnDelete) m_datacostFnDelete(m_datacostFn);
 	if (m_smoothcostFnDelete) m_smoothcostFnDelete(m_smoothcostFn);
@@ -214,14 +227,23 @@ void GCoptimization::applyNewLabeling<GCoptimization::DataCostFnSparse>(EnergyT
 
 template <typename UserFunctor>
 void GCoptimization::specializeDataCostFunctor(const UserFunctor f) {
-	if ( m_datacostFnDelete )
-		m_datacostFnDelete(m_datacostFn);
 	if ( m_datacostIndividual )
 	{
 		delete [] m_datacostIndividual;
 		m_datacostIndividual = 0;
 	}
-	m_datacostFn = new UserFunctor(f);
+	if ( m_datacostFnDelete == &GCoptimization::deleteFunctor<UserFunctor> )
+	{
+		// Same kind of data cost as before, so reuse its storage
+		reinterpret_cast<UserFunctor*>(m_datacostFn)->~UserFunctor();
+		new (m_datacostFn) UserFunctor(f);
+	}
+	else
+	{
+		if ( m_datacostFnDelete )
+			m_datacostFnDelete(m_datacostFn);
+		m_datacostFn = new UserFunctor(f);
+	}
 	m_datacostFnDelete          = &GCoptimization::deleteFunctor<UserFunctor>;
 	m_queryActiveSitesExpansion = &GCoptimization::queryActiveSitesExpansion<UserFunctor>;
 	m_setupDataCostsExpansion   = &GCoptimization::setupDataCostsExpansion<UserFunctor>;
@@ -229,22 +251,33 @@ void GCoptimization::specializeDataCostFunctor(const UserFunctor f) {
 	m_applyNewLabeling          = &GCoptimization::applyNewLabeling<UserFunctor>;
 	m_updateLabelingDataCosts   = &GCoptimization::updateLabelingDataCosts<UserFunctor>;
 	m_solveSpecialCases         = &GCoptimization::solveSpecialCases<UserFunctor>;
+	m_giveDataCost              = &GCoptimization::giveDataCostInternal<UserFunctor>;
 }
 
 template <typename UserFunctor>
 void GCoptimization::specializeSmoothCostFunctor(const UserFunctor f) {
-	if ( m_smoothcostFnDelete )
-		m_smoothcostFnDelete(m_smoothcostFn);
 	if ( m_smoothcostIndividual )
 	{
 		delete [] m_smoothcostIndividual;
 		m_smoothcostIndividual = 0;
 	}
-	m_smoothcostFn = new UserFunctor(f);
+	if ( m_smoothcostFnDelete == &GCoptimization::deleteFunctor<UserFunctor> )
+	{
+		// Same kind of smooth cost as before, so reuse its storage
+		reinterpret_cast<UserFunctor*>(m_smoothcostFn)->~UserFunctor();
+		new (m_smoothcostFn) UserFunctor(f);
+	}
+	else
+	{
+		if ( m_smoothcostFnDelete )
+			m_smoothcostFnDelete(m_smoothcostFn);
+		m_smoothcostFn = new UserFunctor(f);
+	}
 	m_smoothcostFnDelete        = &GCoptimization::deleteFunctor<UserFunctor>;
 	m_giveSmoothEnergyInternal  = &GCoptimization::giveSmoothEnergyInternal<UserFunctor>;
 	m_setupSmoothCostsExpansion = &GCoptimization::setupSmoothCostsExpansion<UserFunctor>;
 	m_setupSmoothCostsSwap      = &GCoptimization::setupSmoothCostsSwap<UserFunctor>;
+	m_giveSmoothCost            = &GCoptimization::giveSmoothCostInternal<UserFunctor>;
 }
 
 //-------------------------------------------------------------------
@@ -272,6 +305,20 @@ GCoptimization::EnergyType GCoptimization::giveSmoothEnergyInternal()
 
 //-------------------------------------------------------------------
 
+template <typename DataCostT>
+GCoptimization::EnergyTermType GCoptimization::giveDataCostInternal(SiteID s, LabelID l)
+{
+	return ((DataCostT*)m_datacostFn)->compute(s,l);
+}
+
+template <typename SmoothCostT>
+GCoptimization::EnergyTermType GCoptimization::giveSmoothCostInternal(SiteID s1, SiteID s2, LabelID l1, LabelID l2)
+{
+	return ((SmoothCostT*)m_smoothcostFn)->compute(s1,s2,l1,l2);
+}
+
+//-------------------------------------------------------------------
+
 OLGA_INLINE void GCoptimization::addterm1_checked(EnergyT* e, VarID i, EnergyTermType e0, EnergyTermType e1)
 {
 	if ( e0 > GCO_MAX_ENERGYTERM || e1 > GCO_MAX_ENERGYTERM )
@@ -763,6 +810,7 @@ void GCoptimization::setDataCostFunctor(DataCostFunctor* f) {
 	m_applyNewLabeling          = &GCoptimization::applyNewLabeling<DataCostFunctor>;
 	m_updateLabelingDataCosts   = &GCoptimization::updateLabelingDataCosts<DataCostFunctor>;
 	m_solveSpecialCases         = &GCoptimization::solveSpecialCases<DataCostFunctor>;
+	m_giveDataCost              = &GCoptimization::giveDataCostInternal<DataCostFunctor>;
 	m_labelingInfoDirty = true;
 }
 
@@ -825,6 +873,7 @@ void GCoptimization::setSmoothCostFunctor(SmoothCostFunctor* f) {
 	m_giveSmoothEnergyInternal  = &GCoptimization::giveSmoothEnergyInternal<SmoothCostFunctor>;
 	m_setupSmoothCostsExpansion = &GCoptimization::setupSmoothCostsExpansion<SmoothCostFunctor>;
 	m_setupSmoothCostsSwap      = &GCoptimization::setupSmoothCostsSwap<SmoothCostFunctor>;
+	m_giveSmoothCost            = &GCoptimization::giveSmoothCostInternal<SmoothCostFunctor>;
 }
 
 //-------------------------------------------------------------------
@@ -942,6 +991,18 @@ GCoptimization::EnergyType GCoptimization::compute_energy()
 
 //-------------------------------------------------------------------
 
+void GCoptimization::reset()
+{
+	if ( m_datacostIndividual )
+		memset(m_datacostIndividual, 0, m_num_sites*m_num_labels*sizeof(EnergyTermType));
+	memset(m_labeling, 0, m_num_sites*sizeof(LabelID));
+	memset(m_lookupSiteVar,-1,m_num_sites*sizeof(SiteID));
+	memcpy(m_labelTable,m_labelOrder,m_num_labels*sizeof(LabelID));
+	m_labelingInfoDirty = true;
+}
+
+//-------------------------------------------------------------------
+
 void GCoptimization::permuteLabelTable()
 {
 	if ( !m_random_label_order )
@@ -1046,6 +1107,7 @@ void GCoptimization::setLabelOrder(bool isRandom)
 	m_random_label_order = isRandom;
 	for ( LabelID i = 0; i < m_num_labels; i++ )
 		m_labelTable[i] = i;
+	memcpy(m_labelOrder,m_labelTable,m_num_labels*sizeof(LabelID));
 }
 
 //-------------------------------------------------------------------
@@ -1060,6 +1122,7 @@ void GCoptimization::setLabelOrder(const LabelID* order, LabelID size)
 	m_random_label_order = false;
 	memcpy(m_labelTable,order,size*sizeof(LabelID));
 	memset(m_labelTable+size,-1,(m_num_labels-size)*sizeof(LabelID));
+	memcpy(m_labelOrder,m_labelTable,m_num_labels*sizeof(LabelID));
 }
 
 //------------------------------------------------------------------
@@ -1073,7 +1136,7 @@ void GCoptimization::handleError(const char *message)
 
 void GCoptimization::checkInterrupt()
 {
-	if ( utIsInterruptPending() )
+	if ( m_interruptible && utIsInterruptPending() )
 		throw GCException("Interrupted.");
 }
 
@@ -1187,6 +1250,21 @@ void GCoptimization::updateLabelingInfo(bool updateCounts, bool updateActive, bo
 	}
 }
 
+//-------------------------------------------------------------------
+// Empties the energy of the previous move, or creates it on the first move
+// with room for the largest move, so that building a move does not allocate.
+
+GCoptimization::EnergyT& GCoptimization::resetMoveEnergy()
+{
+	if ( m_moveEnergy )
+		m_moveEnergy->reset();
+	else
+		m_moveEnergy = new EnergyT(m_num_sites+m_labelcostCount,
+		                           m_numNeighborsTotal+(m_labelcostCount?m_num_sites+m_labelcostCount : 0),
+		                           (void(*)(char*))handleError);
+	return *m_moveEnergy;
+}
+
 //-------------------------------------------------------------------
 // Sets up the binary expansion energy, optimizes it, and updates the current labeling.
 //
@@ -1204,7 +1282,7 @@ bool GCoptimization::alpha_expansion(LabelID alpha_label)
 
 	// Determine list of active sites for this expansion move
 	SiteID size = 0;
-	SiteID *activeSites = new SiteID[m_num_sites];
+	SiteID *activeSites = m_activeSites;
 	EnergyType afterExpansionEnergy = 0;
 	try 
 	{
@@ -1213,7 +1291,6 @@ bool GCoptimization::alpha_expansion(LabelID alpha_label)
 			size = (this->*m_queryActiveSitesExpansion)(alpha_label,activeSites);
 		if ( size == 0 )  // Nothing to do
 		{
-			delete [] activeSites;
 			printStatus2(alpha_label,-1,size,ticks0);
 			return false;
 		}
@@ -1225,9 +1302,7 @@ bool GCoptimization::alpha_expansion(LabelID alpha_label)
 
 		// Create binary variables for each remaining site, add the data costs,
 		// and compute the smooth costs between variables.
-		EnergyT e(size+m_labelcostCount, // poor guess at number of pairwise terms needed :(
-				 m_numNeighborsTotal+(m_labelcostCount?size+m_labelcostCount : 0),
-				 (void(*)(char*))handleError);
+		EnergyT& e = resetMoveEnergy();
 		e.add_variable(size);
 		m_beforeExpansionEnergy = 0;
 		if ( m_setupDataCostsExpansion   ) (this->*m_setupDataCostsExpansion  )(size,alpha_label,&e,activeSites);
@@ -1247,10 +1322,10 @@ bool GCoptimization::alpha_expansion(LabelID alpha_label)
 	} 
 	catch (...)
 	{
-		delete [] activeSites;
+		for ( SiteID i = 0; i < size; i++ )
+			m_lookupSiteVar[activeSites[i]] = -1;
 		throw;
 	}
-	delete [] activeSites;
 	return afterExpansionEnergy < m_beforeExpansionEnergy;
 }
 
@@ -1269,6 +1344,310 @@ GCoptimization::EnergyType GCoptimization::oneExpansionIteration()
 	return compute_energy();
 }
 
+//-------------------------------------------------------------------//
+//                  METHODS for WARM-STARTED EXPANSION               //  
+//-------------------------------------------------------------------//
+
+// The binary energy of a move on alpha_label, over all sites. Sites already
+// labeled alpha_label get equal costs for both values, and so no terms.
+struct GCoptimization::WarmGraph {
+	WarmGraph(): graph(0), solved(false) { }
+	~WarmGraph() { delete graph; }
+	GraphT* graph;
+	bool    solved;             // maxflow has run, so its trees can be reused
+	std::vector<LabelID> built; // labeling the capacities are for
+};
+
+// Edge k of every graph joins site s to a neighbour n < s, in the order of
+// giveNeighborInfo; edge[offset[i]+n] is the edge to the n-th neighbour of i.
+struct GCoptimization::WarmEdges {
+	std::vector<SiteID> offset;
+	std::vector<SiteID> edge;
+};
+
+//-------------------------------------------------------------------
+// Terms t = {tx,ty,cxy,cyx} that Energy::add_term2 would give the smooth cost
+// of sites s and n, with labels ls and ln, in a move on alpha_label:
+// t-link capacities (source minus sink) of s and n, and the capacities
+// of the arcs s->n and n->s.
+
+void GCoptimization::warmTerm2(SiteID s, SiteID n, EnergyTermType w, LabelID alpha, LabelID ls, LabelID ln, EnergyTermType* t)
+{
+	EnergyTermType e00 = (this->*m_giveSmoothCost)(s,n,alpha,alpha);
+	EnergyTermType e01 = (this->*m_giveSmoothCost)(s,n,alpha,ln);
+	EnergyTermType e10 = (this->*m_giveSmoothCost)(s,n,ls,alpha);
+	EnergyTermType e11 = (this->*m_giveSmoothCost)(s,n,ls,ln);
+	if ( e00 > GCO_MAX_ENERGYTERM || e11 > GCO_MAX_ENERGYTERM || e01 > GCO_MAX_ENERGYTERM || e10 > GCO_MAX_ENERGYTERM )
+		handleError("Smooth cost term was larger than GCO_MAX_ENERGYTERM; danger of integer overflow.");
+	if ( w > GCO_MAX_ENERGYTERM )
+		handleError("Smoothness weight was larger than GCO_MAX_ENERGYTERM; danger of integer overflow.");
+	if ( e00+e11 > e01+e10 )
+		handleError("Non-submodular expansion term detected; smooth costs must be a metric for expansion");
+	EnergyTermType A = e00*w, B = e01*w, C = e10*w, D = e11*w;
+	t[0] = D-A; t[1] = 0;
+	B -= A; C -= D;
+	if ( B < 0 )
+	{
+		t[0] -= B; t[1] += B;
+		t[2] = 0; t[3] = B+C;
+	}
+	else if ( C < 0 )
+	{
+		t[0] += C; t[1] -= C;
+		t[2] = B+C; t[3] = 0;
+	}
+	else
+	{
+		t[2] = B; t[3] = C;
+	}
+}
+
+//-------------------------------------------------------------------
+
+void GCoptimization::buildWarmGraph(WarmGraph& g, LabelID alpha_label)
+{
+	SiteID i,n,numN,nSite,*nPointer;
+	EnergyTermType *weights, t[4];
+
+	g.graph = new GraphT(m_num_sites,m_numNeighborsTotal/2,(void(*)(char*))handleError);
+	g.graph->add_node(m_num_sites);
+	g.built.assign(m_labeling,m_labeling+m_num_sites);
+	for ( i = 0; i < m_num_sites; i++ )
+	{
+		if ( m_giveDataCost )
+		{
+			EnergyTermType e0 = (this->*m_giveDataCost)(i,alpha_label);
+			EnergyTermType e1 = (this->*m_giveDataCost)(i,m_labeling[i]);
+			if ( e0 > GCO_MAX_ENERGYTERM || e1 > GCO_MAX_ENERGYTERM )
+				handleError("Data cost term was larger than GCO_MAX_ENERGYTERM; danger of integer overflow.");
+			g.graph->add_tweights(i,e1,e0);
+		}
+		giveNeighborInfo(i,&numN,&nPointer,&weights);
+		for ( n = 0; n < numN; n++ )
+		{
+			nSite = nPointer[n];
+			if ( nSite < i )
+			{
+				warmTerm2(i,nSite,weights[n],alpha_label,m_labeling[i],m_labeling[nSite],t);
+				g.graph->add_tweights(i,t[0],0);
+				g.graph->add_tweights(nSite,t[1],0);
+				g.graph->add_edge(i,nSite,t[2],t[3]);
+			}
+		}
+	}
+	g.solved = false;
+}
+
+//-------------------------------------------------------------------
+// Brings the capacities of graph g from g.built to the current labeling.
+// The flow is kept: where a capacity drops below the flow through the arc,
+// the excess is sent back through the terminals, which changes the cut
+// costs by a constant only. Returns the number of sites updated.
+
+GCoptimization::SiteID GCoptimization::updateWarmGraph(WarmGraph& g, const WarmEdges& edges, LabelID alpha_label)
+{
+	SiteID i,n,numN,nSite,*nPointer,updated = 0;
+	EnergyTermType *weights, told[4], tnew[4];
+	GraphT* graph = g.graph;
+	GraphT::arc_id arcs = graph->get_first_arc();
+
+	for ( i = 0; i < m_num_sites; i++ )
+	{
+		if ( g.built[i] == m_labeling[i] )
+			continue;
+		updated++;
+		if ( m_giveDataCost )
+		{
+			EnergyTermType e1 = (this->*m_giveDataCost)(i,m_labeling[i]);
+			if ( e1 > GCO_MAX_ENERGYTERM )
+				handleError("Data cost term was larger than GCO_MAX_ENERGYTERM; danger of integer overflow.");
+			graph->set_trcap(i,graph->get_trcap(i) + e1 - (this->*m_giveDataCost)(i,g.built[i]));
+			graph->mark_node(i);
+		}
+		giveNeighborInfo(i,&numN,&nPointer,&weights);
+		for ( n = 0; n < numN; n++ )
+		{
+			nSite = nPointer[n];
+			if ( nSite > i && g.built[nSite] != m_labeling[nSite] )
+				continue; // updated with nSite
+			SiteID s = i > nSite ? i : nSite, m = i > nSite ? nSite : i;
+			warmTerm2(s,m,weights[n],alpha_label,g.built[s],g.built[m],told);
+			warmTerm2(s,m,weights[n],alpha_label,m_labeling[s],m_labeling[m],tnew);
+
+			GraphT::arc_id a = arcs + 2*(size_t)edges.edge[edges.offset[i]+n];
+			EnergyTermType tx = graph->get_trcap(s) + tnew[0]-told[0];
+			EnergyTermType ty = graph->get_trcap(m) + tnew[1]-told[1];
+			EnergyTermType rxy = graph->get_rcap(a)   + tnew[2]-told[2];
+			EnergyTermType ryx = graph->get_rcap(a+1) + tnew[3]-told[3];
+			if ( rxy < 0 )
+			{
+				tx -= rxy; ty += rxy;
+				ryx += rxy; rxy = 0;
+			}
+			else if ( ryx < 0 )
+			{
+				ty -= ryx; tx += ryx;
+				rxy += ryx; ryx = 0;
+			}
+			graph->set_trcap(s,tx);
+			graph->set_trcap(m,ty);
+			graph->set_rcap(a,rxy);
+			graph->set_rcap(a+1,ryx);
+			graph->mark_node(s);
+			graph->mark_node(m);
+		}
+	}
+	for ( i = 0; i < m_num_sites; i++ )
+		g.built[i] = m_labeling[i];
+	return updated;
+}
+
+//-------------------------------------------------------------------
+// alpha_expansion() on the kept graph of alpha_label.
+
+bool GCoptimization::warm_alpha_expansion(WarmGraph& g, const WarmEdges& edges, LabelID alpha_label, SiteID* updatedSites)
+{
+	gcoclock_t ticks0 = gcoclock();
+	SiteID i,n,numN,nSite,*nPointer;
+	EnergyTermType *weights;
+
+	if ( !g.graph )
+	{
+		buildWarmGraph(g,alpha_label);
+		*updatedSites = m_num_sites;
+	}
+	else
+		*updatedSites = updateWarmGraph(g,edges,alpha_label);
+	checkInterrupt();
+	g.graph->maxflow(g.solved);
+	g.solved = true;
+	checkInterrupt();
+
+	// Energy change of the move, summed over the sites that take alpha_label
+	// and the smooth costs around them
+	EnergyType delta = 0;
+	SiteID size = 0;
+	for ( i = 0; i < m_num_sites; i++ )
+	{
+		if ( m_labeling[i] == alpha_label || g.graph->what_segment(i) != GraphT::SOURCE )
+			continue;
+		size++;
+		if ( m_giveDataCost )
+			delta += (this->*m_giveDataCost)(i,alpha_label) - (this->*m_giveDataCost)(i,m_labeling[i]);
+		giveNeighborInfo(i,&numN,&nPointer,&weights);
+		for ( n = 0; n < numN; n++ )
+		{
+			nSite = nPointer[n];
+			bool nMoves = m_labeling[nSite] != alpha_label && g.graph->what_segment(nSite) == GraphT::SOURCE;
+			if ( nMoves && nSite > i )
+				continue; // counted with nSite
+			LabelID ln = nMoves ? alpha_label : m_labeling[nSite];
+			delta += (EnergyType)weights[n]*((this->*m_giveSmoothCost)(i,nSite,alpha_label,ln)
+			                               - (this->*m_giveSmoothCost)(i,nSite,m_labeling[i],m_labeling[nSite]));
+		}
+	}
+	if ( delta < 0 )
+	{
+		for ( i = 0; i < m_num_sites; i++ )
+			if ( g.graph->what_segment(i) == GraphT::SOURCE )
+				m_labeling[i] = alpha_label;
+		m_labelingInfoDirty = true;
+	}
+	printStatus2(alpha_label,-1,size,ticks0);
+	return delta < 0;
+}
+
+//-------------------------------------------------------------------
+
+GCoptimization::EnergyType GCoptimization::expansionWarm(int max_num_iterations)
+{
+	EnergyType new_energy, old_energy;
+	m_cycleStats.clear();
+	if ( (this->*m_solveSpecialCases)(new_energy) )
+		return new_energy;
+
+	// Label costs are not terms of the graph, and sparse data costs would have
+	// to be expanded to every site of every graph.
+	if ( m_labelcostsAll || !m_giveSmoothCost || m_queryActiveSitesExpansion == (SiteID (GCoptimization::*)(LabelID,SiteID*))&GCoptimization::queryActiveSitesExpansion<DataCostFnSparse> )
+		return expansion(max_num_iterations);
+	if ( max_num_iterations == -1 )
+		max_num_iterations = 10000000;
+	finalizeNeighbors();
+
+	// Number the edges as the graphs will add them
+	WarmEdges edges;
+	SiteID i,n,m,numN,nNumN,nSite,*nPointer,*nnPointer,k = 0;
+	EnergyTermType *weights, *nWeights;
+	edges.offset.resize(m_num_sites+1);
+	edges.offset[0] = 0;
+	for ( i = 0; i < m_num_sites; i++ )
+	{
+		giveNeighborInfo(i,&numN,&nPointer,&weights);
+		edges.offset[i+1] = edges.offset[i] + numN;
+	}
+	edges.edge.resize(edges.offset[m_num_sites]);
+	for ( i = 0; i < m_num_sites; i++ )
+	{
+		giveNeighborInfo(i,&numN,&nPointer,&weights);
+		for ( n = 0; n < numN; n++ )
+		{
+			nSite = nPointer[n];
+			if ( nSite < i )
+			{
+				edges.edge[edges.offset[i]+n] = k;
+				giveNeighborInfo(nSite,&nNumN,&nnPointer,&nWeights);
+				for ( m = 0; m < nNumN; m++ )
+					if ( nnPointer[m] == i )
+						edges.edge[edges.offset[nSite]+m] = k;
+				k++;
+			}
+		}
+	}
+
+	permuteLabelTable();
+	updateLabelingInfo();
+	printStatus1("starting alpha-expansion w/ standard cycles, warm-started");
+	WarmGraph* graphs = new WarmGraph[m_num_labels];
+	try
+	{
+		new_energy = compute_energy();
+		m_stepsThisCycleTotal = m_num_labels;
+		for ( int cycle = 1; cycle <= max_num_iterations; cycle++ )
+		{
+			gcoclock_t ticks0 = gcoclock();
+			CycleStats stats;
+			stats.updatedSites = 0;
+			for ( m_stepsThisCycle = 0; m_stepsThisCycle < m_num_labels; m_stepsThisCycle++ )
+			{
+				LabelID alpha = m_labelTable[m_stepsThisCycle];
+				if ( alpha < 0 )
+					continue; // label was disabled due to setLabelOrder on subset of labels
+				SiteID updated;
+				warm_alpha_expansion(graphs[alpha],edges,alpha,&updated);
+				stats.updatedSites += updated;
+			}
+			old_energy = new_energy;
+			new_energy = compute_energy();
+			stats.energy = new_energy;
+			stats.seconds = (double)(gcoclock() - ticks0)/GCO_CLOCKS_PER_SEC;
+			m_cycleStats.push_back(stats);
+			printStatus1(cycle,false,ticks0);
+			if ( new_energy == old_energy )
+				break;
+			permuteLabelTable();
+		}
+	}
+	catch (...)
+	{
+		delete [] graphs;
+		m_stepsThisCycle = m_stepsThisCycleTotal = 0;
+		throw;
+	}
+	delete [] graphs;
+	m_stepsThisCycle = m_stepsThisCycleTotal = 0;
+	return new_energy;
+}
+
 //-------------------------------------------------------------------//
 //                  METHODS for SWAP MOVES                           //  
 //-------------------------------------------------------------------//
@@ -1340,7 +1719,7 @@ void GCoptimization::alpha_beta_swap(LabelID alpha_label, LabelID beta_label)
 
 	// Determine the list of active sites for this swap move
 	SiteID size = 0;
-	SiteID *activeSites = new SiteID[m_num_sites];
+	SiteID *activeSites = m_activeSites;
 	try
 	{
 		for ( SiteID i = 0; i < m_num_sites; i++ )
@@ -1354,14 +1733,13 @@ void GCoptimization::alpha_beta_swap(LabelID alpha_label, LabelID beta_label)
 		}
 		if ( size == 0 )
 		{
-			delete [] activeSites;
 			printStatus2(alpha_label,beta_label,size,ticks0);
 			return;
 		}
 
 		// Create binary variables for each remaining site, add the data costs,
 		// and compute the smooth costs between variables.
-		EnergyT e(size,m_numNeighborsTotal,(void(*)(char*))handleError);
+		EnergyT& e = resetMoveEnergy();
 		e.add_variable(size);
 		if ( m_setupDataCostsSwap   ) (this->*m_setupDataCostsSwap  )(size,alpha_label,beta_label,&e,activeSites);
 		if ( m_setupSmoothCostsSwap ) (this->*m_setupSmoothCostsSwap)(size,alpha_label,beta_label,&e,activeSites);
@@ -1379,10 +1757,10 @@ void GCoptimization::alpha_beta_swap(LabelID alpha_label, LabelID beta_label)
 	} 
 	catch (...)
 	{
-		delete [] activeSites;
+		for ( SiteID i = 0; i < size; i++ )
+			m_lookupSiteVar[activeSites[i]] = -1;
 		throw;
 	}
-	delete [] activeSites;
 
 	printStatus2(alpha_label,beta_label,size,ticks0);
 }
@@ -1398,6 +1776,7 @@ GCoptimizationGridGraph::GCoptimizationGridGraph(SiteID width, SiteID height,Lab
 	assert( (width > 1) && (height > 1) && (num_labels > 1 ));
 
 	m_weightedGraph = 0;
+	m_neighborsWeights = 0;
 	for (int  i = 0; i < 4; i ++ )	m_unityWeights[i] = 1;
 
 	m_width  = width;
@@ -1495,7 +1874,8 @@ void GCoptimizationGridGraph::computeNeighborWeights(EnergyTermType *vCosts,Ener
 	SiteID i,n,nSite;
 	GCoptimization::EnergyTermType weight;
 	
-	m_neighborsWeights = new EnergyTermType[m_num_sites*4];
+	if (!m_neighborsWeights) // kept when the weights are set again
+		m_neighborsWeights = new EnergyTermType[m_num_sites*4];
 
 	for ( i = 0; i < m_num_sites; i++ )
 	{
@@ -1512,6 +1892,214 @@ void GCoptimizationGridGraph::computeNeighborWeights(EnergyTermType *vCosts,Ener
 	}
 
 }
+//-------------------------------------------------------------------
+// Tiled expansion
+
+struct GCoptimizationGridGraph::Tile {
+	SiteID x0, y0, width, height;
+};
+
+// Tiles of one colour, handed out to the threads in turn
+struct GCoptimizationGridGraph::TileQueue {
+	GCoptimizationGridGraph* grid;
+	const std::vector<Tile>* tiles;
+	size_t next;
+	pthread_mutex_t lock;
+	const char* error;
+};
+
+// Smooth cost of a tile, in the sites of the whole grid, for smooth costs
+// that may depend on the sites
+struct GCoptimizationGridGraph::TileSmoothCost: public SmoothCostFunctor {
+	TileSmoothCost(GCoptimizationGridGraph* grid, const Tile& tile): m_grid(grid), m_tile(tile) { }
+	EnergyTermType compute(SiteID s1, SiteID s2, LabelID l1, LabelID l2)
+	{
+		return (m_grid->*m_grid->m_giveSmoothCost)(gridSite(s1),gridSite(s2),l1,l2);
+	}
+private:
+	SiteID gridSite(SiteID s) const 
+	{
+		return m_tile.x0 + s%m_tile.width + (m_tile.y0 + s/m_tile.width)*m_grid->m_width;
+	}
+	GCoptimizationGridGraph* m_grid;
+	const Tile& m_tile;
+};
+
+//-------------------------------------------------------------------
+
+GCoptimization::EnergyTermType GCoptimizationGridGraph::giveNeighborWeight(SiteID site, SiteID nSite)
+{
+	if ( !m_weightedGraph )
+		return 1;
+	for ( SiteID n = 0; n < m_numNeighbors[site]; n++ )
+		if ( m_neighbors[4*site+n] == nSite )
+			return m_neighborsWeights[4*site+n];
+	return 0;
+}
+
+//-------------------------------------------------------------------
+// Runs expansion to convergence on the sites of tile t, with the sites
+// around it fixed. Only reads the labels outside the tile and only
+// writes those inside it, so tiles that do not touch can run concurrently.
+
+void GCoptimizationGridGraph::solveTile(const Tile& t)
+{
+	GCoptimizationGridGraph tile(t.width,t.height,m_num_labels);
+	tile.m_interruptible = false;
+
+	// Data costs, plus the smooth costs to the fixed sites around the tile
+	std::vector<EnergyTermType> data((size_t)t.width*t.height*m_num_labels);
+	SiteID i,x,y,n,numN,nSite,*nPointer;
+	EnergyTermType *weights;
+	for ( y = 0; y < t.height; y++ )
+		for ( x = 0; x < t.width; x++ )
+		{
+			SiteID site = t.x0+x + (t.y0+y)*m_width;
+			EnergyTermType *dc = &data[(size_t)(x+y*t.width)*m_num_labels];
+			for ( LabelID l = 0; l < m_num_labels; l++ )
+				dc[l] = m_giveDataCost ? (this->*m_giveDataCost)(site,l) : 0;
+			giveNeighborInfo(site,&numN,&nPointer,&weights);
+			for ( n = 0; n < numN; n++ )
+			{
+				nSite = nPointer[n];
+				SiteID nx = nSite%m_width, ny = nSite/m_width;
+				if ( nx >= t.x0 && nx < t.x0+t.width && ny >= t.y0 && ny < t.y0+t.height )
+					continue;
+				for ( LabelID l = 0; l < m_num_labels; l++ )
+					dc[l] += weights[n]*(this->*m_giveSmoothCost)(site,nSite,l,m_labeling[nSite]);
+			}
+			tile.m_labeling[x+y*t.width] = m_labeling[site];
+		}
+	tile.setDataCost(&data[0]);
+
+	if ( m_weightedGraph )
+	{
+		std::vector<EnergyTermType> vCosts((size_t)t.width*t.height,0), hCosts((size_t)t.width*t.height,0);
+		for ( y = 0; y < t.height; y++ )
+			for ( x = 0; x < t.width; x++ )
+			{
+				SiteID site = t.x0+x + (t.y0+y)*m_width;
+				i = x+y*t.width;
+				if ( x < t.width-1 )  hCosts[i] = giveNeighborWeight(site,site+1);
+				if ( y < t.height-1 ) vCosts[i] = giveNeighborWeight(site,site+m_width);
+			}
+		tile.m_weightedGraph = 1;
+		tile.computeNeighborWeights(&vCosts[0],&hCosts[0]);
+	}
+
+	// Smooth costs that do not depend on the sites are shared as they are
+	TileSmoothCost tileSmoothCost(this,t);
+	if ( m_giveSmoothCost == &GCoptimization::giveSmoothCostInternal<SmoothCostFnFromArray> )
+		tile.specializeSmoothCostFunctor(*(SmoothCostFnFromArray*)m_smoothcostFn);
+	else if ( m_giveSmoothCost != &GCoptimization::giveSmoothCostInternal<SmoothCostFnPotts> )
+		tile.setSmoothCostFunctor(&tileSmoothCost);
+
+	tile.expansion();
+
+	for ( y = 0; y < t.height; y++ )
+		for ( x = 0; x < t.width; x++ )
+			m_labeling[t.x0+x + (t.y0+y)*m_width] = tile.m_labeling[x+y*t.width];
+}
+
+//-------------------------------------------------------------------
+
+void* GCoptimizationGridGraph::solveTiles(void* p)
+{
+	TileQueue* queue = (TileQueue*)p;
+	for (;;)
+	{
+		pthread_mutex_lock(&queue->lock);
+		size_t next = queue->error ? queue->tiles->size() : queue->next++;
+		pthread_mutex_unlock(&queue->lock);
+		if ( next >= queue->tiles->size() )
+			return 0;
+		try 
+		{
+			queue->grid->solveTile((*queue->tiles)[next]);
+		}
+		catch (GCException e)
+		{
+			pthread_mutex_lock(&queue->lock);
+			queue->error = e.message;
+			pthread_mutex_unlock(&queue->lock);
+		}
+		catch (...)
+		{
+			pthread_mutex_lock(&queue->lock);
+			queue->error = "Not enough memory.";
+			pthread_mutex_unlock(&queue->lock);
+		}
+	}
+}
+
+//-------------------------------------------------------------------
+
+GCoptimization::EnergyType GCoptimizationGridGraph::expansionTiled(SiteID tileWidth, SiteID tileHeight, int numThreads, int numSweeps)
+{
+	EnergyType energy;
+	if ( (this->*m_solveSpecialCases)(energy) )
+		return energy;
+
+	// Label costs couple all the sites, and sparse data costs cache their
+	// lookups, so neither can be split over threads.
+	if ( m_labelcostsAll || m_queryActiveSitesExpansion == (SiteID (GCoptimization::*)(LabelID,SiteID*))&GCoptimization::queryActiveSitesExpansion<DataCostFnSparse> )
+		return expansion();
+	if ( tileWidth < 2 || tileHeight < 2 )
+		handleError("Tiles must be at least 2x2 sites");
+	if ( numThreads < 1 )
+		numThreads = 1;
+
+	updateLabelingInfo();
+
+	// Split the grid into tiles of at least tileWidth x tileHeight sites; tiles
+	// of the same colour share no edges.
+	SiteID numX = std::max(m_width/tileWidth,1), numY = std::max(m_height/tileHeight,1);
+	std::vector<Tile> tiles[2];
+	for ( SiteID ty = 0; ty < numY; ty++ )
+		for ( SiteID tx = 0; tx < numX; tx++ )
+		{
+			Tile t;
+			t.x0 = (SiteID)((long long)tx*m_width/numX);
+			t.y0 = (SiteID)((long long)ty*m_height/numY);
+			t.width  = (SiteID)((long long)(tx+1)*m_width/numX) - t.x0;
+			t.height = (SiteID)((long long)(ty+1)*m_height/numY) - t.y0;
+			tiles[(tx+ty)%2].push_back(t);
+		}
+
+	for ( int colour = 0; colour < 2; colour++ )
+	{
+		TileQueue queue;
+		queue.grid = this;
+		queue.tiles = &tiles[colour];
+		queue.next = 0;
+		queue.error = 0;
+		pthread_mutex_init(&queue.lock,0);
+
+		// The calling thread solves tiles too, and on its own when threads
+		// cannot be created.
+		int count = std::min(numThreads,(int)tiles[colour].size());
+		std::vector<pthread_t> threads(count);
+		std::vector<bool> started(count,false);
+		for ( int t = 1; t < count; t++ )
+			started[t] = pthread_create(&threads[t],0,solveTiles,&queue) == 0;
+		solveTiles(&queue);
+		for ( int t = 1; t < count; t++ )
+			if ( started[t] )
+				pthread_join(threads[t],0);
+		pthread_mutex_destroy(&queue.lock);
+
+		m_labelingInfoDirty = true;
+		if ( queue.error )
+			handleError(queue.error);
+		checkInterrupt();
+	}
+
+	updateLabelingInfo();
+	if ( numSweeps > 0 )
+		return expansion(numSweeps);
+	return compute_energy();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // Functions for the GCoptimizationGeneralGraph, derived from GCoptimization
 ////////////////////////////////////////////////////////////////////////////////////////////////////
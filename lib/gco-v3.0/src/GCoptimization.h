@@ -106,6 +106,7 @@
 #endif
 
 #include <cstddef>
+#include <vector>
 #include "energy.h"
 #include "graph.cpp"
 #include "maxflow.cpp"
@@ -158,6 +159,7 @@ public:
 #endif
 	typedef int EnergyTermType;    // 32-bit energy terms
 	typedef Energy<EnergyTermType,EnergyTermType,EnergyType> EnergyT;
+	typedef Graph<EnergyTermType,EnergyTermType,EnergyType> GraphT;
 	typedef EnergyT::Var VarID;
 	typedef int LabelID;                     // Type for labels
 	typedef VarID SiteID;                    // Type for sites
@@ -173,6 +175,22 @@ public:
 	// If no input specified,runs until convergence. Returns total energy of labeling. 
 	EnergyType expansion(int max_num_iterations=-1);
 
+	// Peforms expansion like expansion(max_num_iterations) with standard cycles, but keeps
+	// the graph of every label and its search trees alive from one cycle to the next.
+	// A move then only updates the capacities around sites whose label changed since
+	// the previous move on that label, and reuses the trees in maxflow, so late cycles
+	// that change few sites are cheap. Holds num_labels graphs of all sites in memory.
+	// Falls back to expansion() when there are label costs or sparse data costs.
+	EnergyType expansionWarm(int max_num_iterations=-1);
+
+	// Counters of each cycle of the last expansionWarm()
+	struct CycleStats {
+		EnergyType energy;       // energy after the cycle
+		double     seconds;      // time taken by the cycle
+		SiteID     updatedSites; // sites whose capacities were updated, summed over the moves
+	};
+	const std::vector<CycleStats>& cycleStats() const { return m_cycleStats; }
+
 	// Peforms  expansion on one label, specified by the input parameter alpha_label 
 	bool alpha_expansion(LabelID alpha_label);
 
@@ -244,6 +262,14 @@ public:
 	// Returns total energy for the current labeling
 	EnergyType compute_energy();
 
+	// Prepares the object for another problem with the same sites, labels and
+	// neighbours, without freeing memory: data costs set with setDataCost(s,l,e)
+	// are zeroed, the labeling goes back to all 0s and the label order to the
+	// one last set, so results match those of a new object. Smooth costs, label
+	// costs and caller-owned data costs stay until they are set again; setting
+	// them with the same kind of cost reuses the storage of the old ones.
+	void reset();
+
 	// Returns separate Data, Smooth, and Label energy of current labeling 
 	EnergyType giveDataEnergy();
 	EnergyType giveSmoothEnergy();
@@ -281,6 +307,7 @@ protected:
 	SiteID  *m_lookupSiteVar; // holds index of variable corresponding to site participating in a move,
 	                          // -1 for nonparticipating site
 	LabelID *m_labelTable;    // to figure out label order in which to do expansion/swaps
+	LabelID *m_labelOrder;    // order as last set, since expansion() reorders m_labelTable
 	int      m_stepsThisCycle;
 	int      m_stepsThisCycleTotal;
 	int      m_random_label_order;
@@ -314,6 +341,14 @@ protected:
 	void (*m_datacostFnDelete)(void* f);
 	void (*m_smoothcostFnDelete)(void* f);
 	bool (GCoptimization::*m_solveSpecialCases)(EnergyType&);
+	EnergyTermType (GCoptimization::*m_giveDataCost)(SiteID,LabelID);
+	EnergyTermType (GCoptimization::*m_giveSmoothCost)(SiteID,SiteID,LabelID,LabelID);
+	bool m_interruptible;  // false for objects solved off the main thread
+
+	// Storage reused by every expansion/swap move, so that moves do not allocate
+	SiteID  *m_activeSites;  // sites taking part in the current move
+	EnergyT *m_moveEnergy;   // binary energy of the current move, sized for all sites
+	EnergyT& resetMoveEnergy();
 
 	// returns a pointer to the neighbors of a site and the weights
 	virtual void giveNeighborInfo(SiteID site, SiteID *numSites, SiteID **neighbors, EnergyTermType **weights)=0;
@@ -437,6 +472,8 @@ protected:
 	template <typename SmoothCostT> void setupSmoothCostsSwap(SiteID size,LabelID alpha_label,LabelID beta_label,EnergyT *e,SiteID *activeSites);
 	template <typename DataCostT>   void applyNewLabeling(EnergyT *e,SiteID *activeSites,SiteID size,LabelID alpha_label);
 	template <typename DataCostT>   void updateLabelingDataCosts();
+	template <typename DataCostT>   EnergyTermType giveDataCostInternal(SiteID s, LabelID l);
+	template <typename SmoothCostT> EnergyTermType giveSmoothCostInternal(SiteID s1, SiteID s2, LabelID l1, LabelID l2);
 	template <typename UserFunctor> void specializeDataCostFunctor(const UserFunctor f);
 	template <typename UserFunctor> void specializeSmoothCostFunctor(const UserFunctor f);
 
@@ -453,12 +490,21 @@ protected:
 	template <typename Functor> static void deleteFunctor(void* f) { delete reinterpret_cast<Functor*>(f); }
 
 	static void handleError(const char *message);
-	static void checkInterrupt();
+	void checkInterrupt();
 
 private:
 	// Peforms one iteration (one pass over all pairs of labels) of expansion/swap algorithm
 	EnergyType oneExpansionIteration();
 	EnergyType oneSwapIteration();
+
+	// Graphs kept by expansionWarm()
+	struct WarmGraph;
+	struct WarmEdges;
+	std::vector<CycleStats> m_cycleStats;
+	void   warmTerm2(SiteID s, SiteID n, EnergyTermType w, LabelID alpha, LabelID ls, LabelID ln, EnergyTermType* t);
+	void   buildWarmGraph(WarmGraph& g, LabelID alpha_label);
+	SiteID updateWarmGraph(WarmGraph& g, const WarmEdges& edges, LabelID alpha_label);
+	bool   warm_alpha_expansion(WarmGraph& g, const WarmEdges& edges, LabelID alpha_label, SiteID* updatedSites);
 	void printStatus1(const char* extraMsg=0);
 	void printStatus1(int cycle, bool isSwap, gcoclock_t ticks0);
 	void printStatus2(int alpha, int beta, int numVars, gcoclock_t ticks0);
@@ -526,6 +572,13 @@ public:
 
 	void setSmoothCostVH(EnergyTermType *smoothArray, EnergyTermType *vCosts, EnergyTermType *hCosts);
 
+	// Peforms expansion on tiles of tileWidth x tileHeight sites, numThreads tiles at a time.
+	// The tiles are coloured as a checkerboard and each colour is solved in turn to convergence,
+	// the other colour held fixed. Then numSweeps standard cycles of expansion over the whole
+	// grid reconcile the tile boundaries. Returns total energy of labeling. Falls back to
+	// expansion() when there are label costs or sparse data costs.
+	EnergyType expansionTiled(SiteID tileWidth, SiteID tileHeight, int numThreads, int numSweeps=1);
+
 protected:
 	virtual void giveNeighborInfo(SiteID site, SiteID *numSites, SiteID **neighbors, EnergyTermType **weights);
 	virtual void finalizeNeighbors();
@@ -540,6 +593,13 @@ private:
 	
 	void setupNeighbData(SiteID startY,SiteID endY,SiteID startX,SiteID endX,SiteID maxInd,SiteID *indexes);
 	void computeNeighborWeights(EnergyTermType *vCosts,EnergyTermType *hCosts);
+
+	struct Tile;
+	struct TileQueue;
+	struct TileSmoothCost;
+	EnergyTermType giveNeighborWeight(SiteID site, SiteID nSite);
+	void solveTile(const Tile& t);
+	static void* solveTiles(void* queue);
 };
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
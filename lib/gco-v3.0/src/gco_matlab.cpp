@@ -1,5 +1,9 @@
 #include <mex.h>
 #include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
 #include <map>
 #include <string>
 #include "GCoptimization.h"
@@ -48,7 +52,7 @@ FuncRegistry::LookupTable FuncRegistry::sLookup;
 
 
 struct GCInstanceInfo {
-	GCInstanceInfo(): gco(0), grid(false), dc(0), sc(0) { }
+	GCInstanceInfo(): gco(0), grid(false), rows(0), cols(0), dc(0), sc(0) { }
 	~GCInstanceInfo() {
 		if (sc) mxDestroyArray(sc);
 		if (dc) mxDestroyArray(dc);
@@ -56,8 +60,10 @@ struct GCInstanceInfo {
 	}
 	GCoptimization* gco;
 	bool grid;
+	GCoptimization::SiteID rows, cols; // grid size, site = row + col*rows
 	mxArray* dc;
 	mxArray* sc;
+	std::vector<GCoptimization::EnergyTermType> hCosts, vCosts; // contrast weights, kept for reuse
 private:
 };
 
@@ -160,6 +166,35 @@ GCO_EXPORT(gco_create_general)
 	}
 }
 
+GCO_EXPORT(gco_create_grid)
+{
+	int instanceID = 0;
+	try {
+		MATLAB_ASSERT_ARGCOUNT(1,3);
+		MATLAB_ASSERT_INTYPE(0,cSiteClassID);
+		MATLAB_ASSERT_INTYPE(1,cSiteClassID);
+		MATLAB_ASSERT_INTYPE(2,cLabelClassID);
+		SiteID  rows      = *(SiteID* )mxGetData(prhs[0]); MATLAB_ASSERT(rows >= 2, "Grid must have at least 2 rows");
+		SiteID  cols      = *(SiteID* )mxGetData(prhs[1]); MATLAB_ASSERT(cols >= 2, "Grid must have at least 2 columns");
+		LabelID numLabels = *(LabelID*)mxGetData(prhs[2]); MATLAB_ASSERT(numLabels >= 2, "Number of labels must be positive");
+		instanceID = gNextInstanceID++;
+		GCInstanceInfo& gcinstance = gInstanceMap[instanceID];
+		// The grid graph numbers sites x+y*width, so MATLAB rows run along
+		// its width and site indices match column-major order.
+		gcinstance.gco = new GCoptimizationGridGraph(rows, cols, numLabels);
+		gcinstance.grid = true;
+		gcinstance.rows = rows;
+		gcinstance.cols = cols;
+		mwSize outSize = 1;
+		plhs[0] = mxCreateNumericArray(1, &outSize, mxINT32_CLASS, mxREAL);
+		*(int*)mxGetData(plhs[0]) = instanceID;
+	} catch (MatlabError) {
+		if (instanceID) 
+			gInstanceMap.erase(instanceID);
+		throw;
+	}
+}
+
 GCO_EXPORT(gco_delete)
 {
 	MATLAB_ASSERT_HANDLE(0);
@@ -172,6 +207,15 @@ GCO_EXPORT(gco_delete)
 	}
 }
 
+GCO_EXPORT(gco_reset)
+{
+	MATLAB_ASSERT_ARGCOUNT(0,1);
+	MATLAB_ASSERT_HANDLE(0);
+	GCInstanceInfo& gcinstance = sGetGCInstance(*(int*)mxGetData(prhs[0]));
+	// The data cost array stays referenced until SetDataCost replaces it
+	gcinstance.gco->reset();
+}
+
 GCO_EXPORT(gco_listhandles)
 {
 	MATLAB_ASSERT_ARGCOUNT(1,0);
@@ -329,6 +373,96 @@ GCO_EXPORT(gco_setneighbors)
 	}
 }
 
+// Squared distance between the features of sites a and b; features are
+// stored one channel after another, as in an image of numSites pixels.
+template <typename T>
+static double sFeatureDist(const T* data, mwSize numSites, mwSize numChannels, double scale, SiteID a, SiteID b)
+{
+	double dist = 0;
+	for (mwSize c = 0; c < numChannels; ++c) {
+		double d = scale*((double)data[c*numSites+a] - (double)data[c*numSites+b]);
+		dist += d*d;
+	}
+	return dist;
+}
+
+// Contrast sensitive weights of the 4-connected grid, Gamma*exp(-Beta*dist)
+// rounded to integers; hCosts[i] weighs sites i and i+1 (along a column),
+// vCosts[i] sites i and i+rows (along a row). A negative Beta is replaced by
+// 1/(2*mean(dist)) over all neighbouring pairs.
+template <typename T>
+static void sContrastWeights(const T* data, SiteID rows, SiteID cols, mwSize numChannels, double scale,
+                             double beta, double gamma, EnergyTermType* hCosts, EnergyTermType* vCosts)
+{
+	mwSize numSites = (mwSize)rows*cols;
+	if (beta < 0) {
+		double sum = 0;
+		for (SiteID x = 0; x < cols-1; ++x)
+			for (SiteID y = 0; y < rows; ++y)
+				sum += sFeatureDist(data, numSites, numChannels, scale, y+x*rows, y+(x+1)*rows);
+		for (SiteID x = 0; x < cols; ++x)
+			for (SiteID y = 0; y < rows-1; ++y)
+				sum += sFeatureDist(data, numSites, numChannels, scale, y+x*rows, y+1+x*rows);
+		double count = (double)rows*(cols-1) + (double)(rows-1)*cols;
+		beta = sum > 0 ? count/(2*sum) : 0;
+	}
+	for (SiteID x = 0; x < cols; ++x) {
+		for (SiteID y = 0; y < rows; ++y) {
+			SiteID i = y+x*rows;
+			hCosts[i] = y < rows-1 ? (EnergyTermType)floor(gamma*exp(-beta*sFeatureDist(data, numSites, numChannels, scale, i, i+1)) + 0.5) : 0;
+			vCosts[i] = x < cols-1 ? (EnergyTermType)floor(gamma*exp(-beta*sFeatureDist(data, numSites, numChannels, scale, i, i+rows)) + 0.5) : 0;
+		}
+	}
+}
+
+GCO_EXPORT(gco_setcontrastneighbors)
+{
+	MATLAB_ASSERT_ARGCOUNT(0,4);
+	MATLAB_ASSERT_HANDLE(0);
+	MATLAB_ASSERT_INTYPE(2,mxDOUBLE_CLASS);
+	MATLAB_ASSERT_INTYPE(3,mxDOUBLE_CLASS);
+	GCInstanceInfo& gcinstance = sGetGCInstance(*(int*)mxGetData(prhs[0]));
+	MATLAB_ASSERT(gcinstance.grid == true, "SetContrastNeighbors can only be called on grid graphs");
+	GCoptimizationGridGraph* gco = static_cast<GCoptimizationGridGraph*>(gcinstance.gco);
+	const mxArray* im = prhs[1];
+	mwSize numSites = (mwSize)gcinstance.rows*gcinstance.cols;
+	MATLAB_ASSERT(mxGetNumberOfDimensions(im) <= 3 && mxGetDimensions(im)[0] == (mwSize)gcinstance.rows &&
+	              mxGetDimensions(im)[1] == (mwSize)gcinstance.cols && mxGetNumberOfElements(im) > 0,
+	              "Image must be Rows x Cols x NumChannels in size");
+	mwSize numChannels = mxGetNumberOfElements(im) / numSites;
+	double beta  = mxGetNumberOfElements(prhs[2]) ? *mxGetPr(prhs[2]) : -1; // empty for automatic
+	MATLAB_ASSERT(beta >= 0 || !mxGetNumberOfElements(prhs[2]), "Beta must be non-negative");
+	double gamma = *mxGetPr(prhs[3]);
+	MATLAB_ASSERT(gamma >= 0 && gamma < GCO_MAX_ENERGYTERM, "Gamma must be in range 0..GCO_MAX_ENERGYTERM");
+
+	gcinstance.hCosts.resize(numSites);
+	gcinstance.vCosts.resize(numSites);
+	EnergyTermType* hCosts = &gcinstance.hCosts[0];
+	EnergyTermType* vCosts = &gcinstance.vCosts[0];
+	// Same scaling as im2double.
+	switch (mxGetClassID(im)) {
+	case mxDOUBLE_CLASS: sContrastWeights((double*)mxGetData(im), gcinstance.rows, gcinstance.cols, numChannels, 1.0, beta, gamma, hCosts, vCosts); break;
+	case mxSINGLE_CLASS: sContrastWeights((float*)mxGetData(im), gcinstance.rows, gcinstance.cols, numChannels, 1.0, beta, gamma, hCosts, vCosts); break;
+	case mxUINT8_CLASS:  sContrastWeights((unsigned char*)mxGetData(im), gcinstance.rows, gcinstance.cols, numChannels, 1.0/255, beta, gamma, hCosts, vCosts); break;
+	case mxUINT16_CLASS: sContrastWeights((unsigned short*)mxGetData(im), gcinstance.rows, gcinstance.cols, numChannels, 1.0/65535, beta, gamma, hCosts, vCosts); break;
+	default:
+		throw MatlabError("Image must be double, single, uint8 or uint16");
+	}
+
+	// Potts model unless SetSmoothCost has already been called, as for
+	// general graphs.
+	if (!gcinstance.sc) {
+		LabelID numLabels = gco->numLabels();
+		mxArray* sc = mxCreateNumericMatrix(numLabels, numLabels, cEnergyTermClassID, mxREAL);
+		EnergyTermType* potts = (EnergyTermType*)mxGetData(sc);
+		for (LabelID i = 0; i < numLabels*numLabels; ++i)
+			potts[i] = i % (numLabels+1) ? 1 : 0;
+		mexMakeArrayPersistent(sc);
+		gcinstance.sc = sc;
+	}
+	gco->setSmoothCostVH((EnergyTermType*)mxGetData(gcinstance.sc), vCosts, hCosts);
+}
+
 GCO_EXPORT(gco_setlabelorder)
 {
 	MATLAB_ASSERT_ARGCOUNT(0,2);
@@ -374,6 +508,78 @@ GCO_EXPORT(gco_expansion)
 	*(EnergyType*)mxGetData(plhs[0]) = energy;
 }
 
+GCO_EXPORT(gco_expansion_warm)
+{
+	MATLAB_ASSERT(nlhs <= 2, "Too many output arguments, expected at most 2");
+	MATLAB_ASSERT(nrhs >= 2, "Not enough input arguments, expected 2");
+	MATLAB_ASSERT(nrhs <= 2, "Too many input arguments, expected 2");
+	MATLAB_ASSERT_HANDLE(0);
+	MATLAB_ASSERT_INTYPE(1,mxINT32_CLASS);
+	GCInstanceInfo& gcinstance = sGetGCInstance(*(int*)mxGetData(prhs[0]));
+	int maxIter = *(int*)mxGetData(prhs[1]);
+	EnergyType energy = gcinstance.gco->expansionWarm(maxIter);
+	mwSize outdim = 1;
+	plhs[0] = mxCreateNumericArray(1, &outdim, cEnergyClassID, mxREAL);
+	*(EnergyType*)mxGetData(plhs[0]) = energy;
+	if (nlhs > 1) {
+		// One column per cycle: energy, seconds, updated sites
+		const std::vector<GCoptimization::CycleStats>& cycles = gcinstance.gco->cycleStats();
+		plhs[1] = mxCreateDoubleMatrix(3, cycles.size(), mxREAL);
+		double* stats = mxGetPr(plhs[1]);
+		for (size_t c = 0; c < cycles.size(); ++c) {
+			stats[3*c+0] = (double)cycles[c].energy;
+			stats[3*c+1] = cycles[c].seconds;
+			stats[3*c+2] = (double)cycles[c].updatedSites;
+		}
+	}
+}
+
+GCO_EXPORT(gco_expansion_tiled)
+{
+	MATLAB_ASSERT(nlhs <= 2, "Too many output arguments, expected at most 2");
+	MATLAB_ASSERT(nrhs >= 4, "Not enough input arguments, expected 4");
+	MATLAB_ASSERT(nrhs <= 4, "Too many input arguments, expected 4");
+	MATLAB_ASSERT_HANDLE(0);
+	MATLAB_ASSERT_INTYPE(1,cSiteClassID);
+	MATLAB_ASSERT_INTYPE(2,mxINT32_CLASS);
+	MATLAB_ASSERT_INTYPE(3,mxINT32_CLASS);
+	GCInstanceInfo& gcinstance = sGetGCInstance(*(int*)mxGetData(prhs[0]));
+	MATLAB_ASSERT(gcinstance.grid == true, "ExpansionTiled can only be called on grid graphs");
+	MATLAB_ASSERT(mxGetNumberOfElements(prhs[1]) == 2, "Tile size must be [Rows Cols]");
+	GCoptimizationGridGraph* gco = static_cast<GCoptimizationGridGraph*>(gcinstance.gco);
+	const SiteID* tileSize = (SiteID*)mxGetData(prhs[1]);
+	int numThreads = *(int*)mxGetData(prhs[2]);
+	int numSweeps  = *(int*)mxGetData(prhs[3]);
+	if (numThreads <= 0) {
+		// number of online cores unless GCO_NUM_THREADS is set
+		const char* env = getenv("GCO_NUM_THREADS");
+		numThreads = env ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	// MATLAB rows run along the width of the grid
+	SiteID numSites = gco->numSites();
+	std::vector<LabelID> initial(nlhs > 1 ? numSites : 0);
+	if (nlhs > 1)
+		gco->whatLabel(0, numSites, &initial[0]);
+	EnergyType energy = gco->expansionTiled(tileSize[0], tileSize[1], numThreads, numSweeps);
+	mwSize outdim = 1;
+	plhs[0] = mxCreateNumericArray(1, &outdim, cEnergyClassID, mxREAL);
+	*(EnergyType*)mxGetData(plhs[0]) = energy;
+	if (nlhs > 1) {
+		// Gap to plain expansion from the same initial labeling, which is
+		// then thrown away
+		std::vector<LabelID> tiled(numSites);
+		gco->whatLabel(0, numSites, &tiled[0]);
+		for (SiteID i = 0; i < numSites; ++i)
+			gco->setLabel(i, initial[i]);
+		EnergyType sequential = gco->expansion();
+		for (SiteID i = 0; i < numSites; ++i)
+			gco->setLabel(i, tiled[i]);
+		plhs[1] = mxCreateNumericArray(1, &outdim, cEnergyClassID, mxREAL);
+		*(EnergyType*)mxGetData(plhs[1]) = energy - sequential;
+	}
+}
+
 GCO_EXPORT(gco_swap)
 {
 	MATLAB_ASSERT_ARGCOUNT(1,2);
@@ -48,11 +48,8 @@ template <typename captype, typename tcaptype, typename flowtype>
 	arc_last = arcs;
 	node_num = 0;
 
-	if (nodeptr_block) 
-	{ 
-		delete nodeptr_block; 
-		nodeptr_block = NULL; 
-	}
+	// nodes, arcs and nodeptr_block keep their memory for the next graph;
+	// every nodeptr has been returned to nodeptr_block by maxflow()
 
 	maxflow_iteration = 0;
 	flow = 0;
@@ -593,7 +593,9 @@ template <typename captype, typename tcaptype, typename flowtype>
 	}
 	// test_consistency();
 
-	if (!reuse_trees || (maxflow_iteration % 64) == 0)
+	// without reuse_trees the block is kept for the next maxflow() or a graph
+	// built after reset()
+	if (reuse_trees && (maxflow_iteration % 64) == 0)
 	{
 		delete nodeptr_block; 
 		nodeptr_block = NULL; 
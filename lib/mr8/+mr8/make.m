@@ -10,5 +10,15 @@ function make(varargin)
                );
   disp(cmd);
   eval(cmd);
+
+  % whole filter bank in one call, used in apply, with the float32 SIMD
+  % line filters of anigauss.c
+  cmd = sprintf('mex -O %s %s -outdir %s', ...
+                'CFLAGS="\$CFLAGS -march=native"',...
+                fullfile(cwd, 'private', 'MR8fused.c'),...
+                fullfile(cwd, 'private')...
+               );
+  disp(cmd);
+  eval(cmd);
  
 end
@@ -81,15 +81,33 @@ including any modified or derived versions.
 
 
 /* define the input buffer type, e.g. "float" */
+#ifndef SRCTYPE
 #define SRCTYPE double
+#endif
 
 /* define the output buffer type, should be at least "float" */
+#ifndef DSTTYPE
 #define DSTTYPE double
+#endif
+
+/* define ANIGAUSS_SIMD, with float input and output buffers, to run the
+   recursions in float32 over SIMD lanes: the x-line filter over groups of
+   adjacent lines, the y- and t-line filters over adjacent columns */
+#ifdef ANIGAUSS_SIMD
+#include "simd.h"
+#define SIMD_SPAN(n) ((n)/SIMD_WIDTH*SIMD_WIDTH)
+#else
+#define SIMD_SPAN(n) 0
+#endif
 
 
 /* the function prototypes */
 void anigauss(SRCTYPE *input, DSTTYPE *output, int sizex, int sizey,
 	double sigmav, double sigmau, double phi, int orderv, int orderu);
+void anigauss_smooth(SRCTYPE *input, DSTTYPE *output, int sizex, int sizey,
+	double sigmav, double sigmau, double phi);
+void anigauss_derivative(DSTTYPE *buf, int sizex, int sizey, double phi,
+	int orderv, int orderu);
 void YvVfilterCoef(double sigma, double *filter);
 void TriggsM(double *filter, double *M);
 
@@ -101,6 +119,19 @@ static void f_iir_tline_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy,
     double *filter, double tanp);
 static void f_iir_derivative_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy,
     double phi, int order);
+#ifdef ANIGAUSS_SIMD
+static int f_simd_xline_filter(float *src, float *dest, int sx, int sy,
+    double *filter);
+static void simd_recurse_line(const float *src, float *dest, float *p0,
+    double scale, const float *p1, const float *p2, const float *p3,
+    double b1, double b2, double b3, int n);
+static void simd_tline_causal(const float *src, float *dest, float *p0,
+    const float *p1, const float *p2, const float *p3, double b1, double b2,
+    double b3, double c, double d, double e, double f, double prevres, int n);
+static void simd_tline_anticausal(float *line, float *q0, const float *q1,
+    const float *q2, const float *q3, double b1, double b2, double b3,
+    double c, double d, double e, double f, double prevres, int n);
+#endif
 
 
 
@@ -130,13 +161,32 @@ static void f_iir_derivative_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy,
 
 void anigauss(SRCTYPE *input, DSTTYPE *output, int sizex, int sizey,
 	double sigmav, double sigmau, double phi, int orderv, int orderu)
+{
+    anigauss_smooth(input, output, sizex, sizey, sigmav, sigmau, phi);
+    anigauss_derivative(output, sizex, sizey, phi, orderv, orderu);
+}
+
+
+/*
+ *  the two steps of anigauss, so that several derivatives of the same
+ *  smoothed buffer can be taken without filtering it again:
+ *    anigauss_smooth(inbuf, outbuf, bufwidth, bufheight, sigma_v, sigma_u,
+ *       phi);
+ *    anigauss_derivative(outbuf, bufwidth, bufheight, phi,
+ *       derivative_order_v, derivative_order_u);
+ *
+ *  the derivative is taken in-place, and applying orders (0,1) twice gives
+ *  the same result as orders (0,2) once.
+ */
+
+void anigauss_smooth(SRCTYPE *input, DSTTYPE *output, int sizex, int sizey,
+	double sigmav, double sigmau, double phi)
 {
     double	filter[7];
     double sigmax, sigmay, tanp;
     double su2, sv2;
     double phirad;
     double a11, a21, a22;
-    int    i;
 
     su2 = sigmau*sigmau;
     sv2 = sigmav*sigmav;
@@ -167,12 +217,22 @@ void anigauss(SRCTYPE *input, DSTTYPE *output, int sizex, int sizey,
         /* isotropic filter or anisotropic filter aligned with grid */
          f_iir_yline_filter(output,output,sizex,sizey,filter);
     }
+}
+
+
+void anigauss_derivative(DSTTYPE *buf, int sizex, int sizey, double phi,
+	int orderv, int orderu)
+{
+    double phirad;
+    int    i;
+
+    phirad = phi*PI/180.;
 
     /* do the derivative filter: [-1,0,1] rotated over phi */
     for(i=0; i<orderv; i++)
-        f_iir_derivative_filter(output, output, sizex, sizey, phirad-PI/2., 1);
+        f_iir_derivative_filter(buf, buf, sizex, sizey, phirad-PI/2., 1);
     for(i=0; i<orderu; i++)
-        f_iir_derivative_filter(output, output, sizex, sizey, phirad, 1);
+        f_iir_derivative_filter(buf, buf, sizex, sizey, phirad, 1);
 }
 
 
@@ -267,7 +327,15 @@ f_iir_xline_filter(SRCTYPE *src, DSTTYPE *dest, int sx, int sy, double *filter)
     sumsq = filter[3];
     sum = sumsq*sumsq;
 
-    for (i = 0; i < sy; i++) {
+#ifdef ANIGAUSS_SIMD
+    /* whole groups of SIMD_WIDTH lines at once, the remaining ones below */
+    i = f_simd_xline_filter(src, dest, sx, sy, filter);
+    src += i*sx;
+    dest += i*sx;
+#else
+    i = 0;
+#endif
+    for (; i < sy; i++) {
 		/* causal filter */
         b1 = filter[2]; b2 = filter[1]; b3 = filter[0];
 		p1 = *src/sumsq; p2 = p1; p3 = p1;
@@ -312,9 +380,9 @@ f_iir_xline_filter(SRCTYPE *src, DSTTYPE *dest, int sx, int sy, double *filter)
 static void
 f_iir_yline_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy, double *filter)
 {
-    double   *p0, *p1, *p2, *p3, *pswap;
-    double   *buf0, *buf1, *buf2, *buf3;
-    double   *uplusbuf;
+    DSTTYPE  *p0, *p1, *p2, *p3, *pswap;
+    DSTTYPE  *buf0, *buf1, *buf2, *buf3;
+    DSTTYPE  *uplusbuf;
     int      i, j;
     double   b1, b2, b3;
     double   pix;
@@ -350,7 +418,13 @@ f_iir_yline_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy, double *filter)
     src -= sy*sx;
 
     for (i = 0; i < sy; i++) {
-        for (j = 0; j < sx; j++) {
+#ifdef ANIGAUSS_SIMD
+        simd_recurse_line(src, dest, p0, 1.0, p1, p2, p3, b1, b2, b3,
+            SIMD_SPAN(sx));
+        src += SIMD_SPAN(sx);
+        dest += SIMD_SPAN(sx);
+#endif
+        for (j = SIMD_SPAN(sx); j < sx; j++) {
             pix = *src++ + b1*p1[j] + b2*p2[j] + b3*p3[j];
             *dest++ = pix;
             p0[j] = pix;
@@ -387,11 +461,16 @@ f_iir_yline_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy, double *filter)
     }
 
     for (i = sy-2; i >= 0; i--) {
-        for (j = sx-1; j >= 0; j--) {
+        for (j = sx-1; j >= SIMD_SPAN(sx); j--) {
             pix = sum * *(--dest) + b1*p1[j] + b2*p2[j] + b3*p3[j];
             *dest = pix;
             p0[j] = pix;
         }
+#ifdef ANIGAUSS_SIMD
+        dest -= SIMD_SPAN(sx);
+        simd_recurse_line(dest, dest, p0, sum, p1, p2, p3, b1, b2, b3,
+            SIMD_SPAN(sx));
+#endif
 
         /* shift history */
 		pswap = p3; p3 = p2; p2 = p1; p1 = p0; p0 = pswap;
@@ -409,16 +488,19 @@ static void
 f_iir_tline_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy,
     double *filter, double tanp)
 {
-    double   *p0, *p1, *p2, *p3;
-    double   *buf0, *buf1, *buf2, *buf3;
-    double   *uplusbuf;
+    DSTTYPE  *p0, *p1, *p2, *p3;
+    DSTTYPE  *buf0, *buf1, *buf2, *buf3;
+    DSTTYPE  *uplusbuf;
     int      i, j;
     double   b1, b2, b3;
-    double   sum, sumsq;
+    double   sumsq;
     double   uplus, vplus;
     double   unp, unp1, unp2;
     double   M[9];
-    double   pix, prev, val;
+    double   pix, prev;
+#ifndef ANIGAUSS_SIMD
+    double   val;
+#endif
     double   res, prevres;
     double   xf;
     int      x;
@@ -449,7 +531,6 @@ f_iir_tline_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy,
     }
 
     sumsq = filter[3];
-    sum = sumsq*sumsq;
 
     /* causal filter */
     b1 = filter[2]; b2 = filter[1]; b3 = filter[0];
@@ -513,6 +594,12 @@ f_iir_tline_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy,
         prevres = sumsq*prev + b1 * *p1 + b2 * *p2 + b3 * *p3;
 
         /* run the filter */
+#ifdef ANIGAUSS_SIMD
+        simd_tline_causal(src, dest, p0, p1, p2, p3, b1, b2, b3,
+            c, d, e, f, prevres, sx);
+        src += sx;
+        dest += sx;
+#else
         for (j = 0; j < sx; j++) {
             pix = *src++;
             val = c*pix+d*prev;
@@ -523,6 +610,7 @@ f_iir_tline_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy,
             *dest++ = f*res+e*prevres;
             prevres = res;
         }
+#endif
 
         /* shift history */
         p0 = buf3; buf3 = buf2; buf2 = buf1; buf1 = buf0; buf0 = p0;
@@ -604,6 +692,11 @@ f_iir_tline_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy,
         prevres = sumsq*prev + b1 * *(p1-1) + b2 * *(p2-1) + b3 * *(p3-1);
 
         /* run the filter */
+#ifdef ANIGAUSS_SIMD
+        dest -= sx;
+        simd_tline_anticausal(dest, p0-sx, p1-sx, p2-sx, p3-sx, b1, b2, b3,
+            c, d, e, f, prevres, sx);
+#else
         for (j = 0; j < sx; j++) {
             pix = *(--dest);
             val = d*pix+c*prev;
@@ -614,6 +707,7 @@ f_iir_tline_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy,
             *dest = e*res+f*prevres;
             prevres = res;
         }
+#endif
 
         /* shift history */
         p0 = buf3; buf3 = buf2; buf2 = buf1; buf1 = buf0; buf0 = p0;
@@ -675,3 +769,182 @@ f_iir_derivative_filter(DSTTYPE *src, DSTTYPE *dest, int sx, int sy,
 
    free(buf);
 }
+
+
+#ifdef ANIGAUSS_SIMD
+
+/**********************************************
+ * the float32 SIMD parts of the line filters *
+ **********************************************/
+
+/*
+   the x-line filter of whole groups of SIMD_WIDTH lines, returns the number
+   of lines done; each group is transposed into a buffer so that the lanes
+   of a vector are the same position on adjacent lines
+*/
+static int
+f_simd_xline_filter(float *src, float *dest, int sx, int sy, double *filter)
+{
+    int      i, j, k;
+    float    *buf;
+    vfloat   b1, b2, b3;
+    vfloat   pix, p1, p2, p3;
+    vfloat   sum, sumsq;
+    vfloat   iplus, uplus, vplus;
+    vfloat   unp, unp1, unp2;
+    double   M[9];
+    vfloat   m[9];
+
+    if (SIMD_WIDTH == 1 || sy < SIMD_WIDTH)
+        return 0;
+    buf = malloc(sx*SIMD_WIDTH*sizeof(*buf));
+
+    TriggsM(filter, M);
+    for (k = 0; k < 9; k++)
+        m[k] = vset1((float)M[k]);
+    sumsq = vset1((float)filter[3]);
+    sum = vset1((float)(filter[3]*filter[3]));
+
+    for (i = 0; i + SIMD_WIDTH <= sy; i += SIMD_WIDTH) {
+        for (k = 0; k < SIMD_WIDTH; k++) {
+            const float *s = src + (i+k)*sx;
+            for (j = 0; j < sx; j++)
+                buf[j*SIMD_WIDTH+k] = s[j];
+        }
+
+		/* causal filter */
+        b1 = vset1((float)filter[2]);
+        b2 = vset1((float)filter[1]);
+        b3 = vset1((float)filter[0]);
+        p1 = vdiv(vload(buf), sumsq); p2 = p1; p3 = p1;
+
+        iplus = vload(buf + (sx-1)*SIMD_WIDTH);
+        for (j = 0; j < sx; j++) {
+            pix = vrecurse(vload(buf + j*SIMD_WIDTH), b1, p1, b2, p2, b3, p3);
+            vstore(buf + j*SIMD_WIDTH, pix);
+            p3 = p2; p2 = p1; p1 = pix;
+        }
+
+		/* anti-causal filter */
+
+        /* apply Triggs border condition */
+        uplus = vmul(iplus, vset1((float)(1.0/(1.0-filter[2]-filter[1]-filter[0]))));
+        b1 = vset1((float)filter[4]);
+        b2 = vset1((float)filter[5]);
+        b3 = vset1((float)filter[6]);
+        vplus = vmul(uplus, vset1((float)(1.0/(1.0-filter[4]-filter[5]-filter[6]))));
+
+        unp = vsub(p1, uplus);
+        unp1 = vsub(p2, uplus);
+        unp2 = vsub(p3, uplus);
+
+        pix = vadd(vadd(vmul(m[0], unp), vmul(m[1], unp1)), vadd(vmul(m[2], unp2), vplus));
+        p1  = vadd(vadd(vmul(m[3], unp), vmul(m[4], unp1)), vadd(vmul(m[5], unp2), vplus));
+        p2  = vadd(vadd(vmul(m[6], unp), vmul(m[7], unp1)), vadd(vmul(m[8], unp2), vplus));
+        pix = vmul(pix, sum); p1 = vmul(p1, sum); p2 = vmul(p2, sum);
+
+        vstore(buf + (sx-1)*SIMD_WIDTH, pix);
+        p3 = p2; p2 = p1; p1 = pix;
+
+        for (j = sx-2; j >= 0; j--) {
+            pix = vrecurse(vmul(sum, vload(buf + j*SIMD_WIDTH)),
+                b1, p1, b2, p2, b3, p3);
+            vstore(buf + j*SIMD_WIDTH, pix);
+            p3 = p2; p2 = p1; p1 = pix;
+        }
+
+        for (k = 0; k < SIMD_WIDTH; k++) {
+            float *d = dest + (i+k)*sx;
+            for (j = 0; j < sx; j++)
+                d[j] = buf[j*SIMD_WIDTH+k];
+        }
+    }
+
+    free(buf);
+    return i;
+}
+
+/*
+   dest[j] = p0[j] = scale*src[j] + b1*p1[j] + b2*p2[j] + b3*p3[j] for
+   j < n, n a multiple of SIMD_WIDTH; src may be dest
+*/
+static void
+simd_recurse_line(const float *src, float *dest, float *p0, double scale,
+    const float *p1, const float *p2, const float *p3,
+    double b1, double b2, double b3, int n)
+{
+    vfloat   vs = vset1((float)scale);
+    vfloat   v1 = vset1((float)b1), v2 = vset1((float)b2), v3 = vset1((float)b3);
+    vfloat   pix;
+    int      j;
+
+    for (j = 0; j < n; j += SIMD_WIDTH) {
+        pix = vrecurse(vmul(vs, vload(src+j)), v1, vload(p1+j), v2,
+            vload(p2+j), v3, vload(p3+j));
+        vstore(dest+j, pix);
+        vstore(p0+j, pix);
+    }
+}
+
+/*
+   a line of the causal t-line filter, whose recursion runs along the
+   columns: p0[j] = c*src[j] + d*src[j-1] + b1*p1[j] + b2*p2[j] + b3*p3[j],
+   then dest[j] = f*p0[j] + e*p0[j-1], with src[-1] = src[0] and
+   p0[-1] = prevres; src may be dest
+*/
+static void
+simd_tline_causal(const float *src, float *dest, float *p0,
+    const float *p1, const float *p2, const float *p3, double b1, double b2,
+    double b3, double c, double d, double e, double f, double prevres, int n)
+{
+    vfloat   v1 = vset1((float)b1), v2 = vset1((float)b2), v3 = vset1((float)b3);
+    vfloat   vc = vset1((float)c), vd = vset1((float)d);
+    vfloat   ve = vset1((float)e), vf = vset1((float)f);
+    int      j;
+
+    p0[0] = (float)(c*src[0] + d*src[0] + b1*p1[0] + b2*p2[0] + b3*p3[0]);
+    for (j = 1; j + SIMD_WIDTH <= n; j += SIMD_WIDTH)
+        vstore(p0+j, vrecurse(vadd(vmul(vc, vload(src+j)), vmul(vd, vload(src+j-1))),
+            v1, vload(p1+j), v2, vload(p2+j), v3, vload(p3+j)));
+    for (; j < n; j++)
+        p0[j] = (float)(c*src[j] + d*src[j-1] + b1*p1[j] + b2*p2[j] + b3*p3[j]);
+
+    dest[0] = (float)(f*p0[0] + e*prevres);
+    for (j = 1; j + SIMD_WIDTH <= n; j += SIMD_WIDTH)
+        vstore(dest+j, vadd(vmul(vf, vload(p0+j)), vmul(ve, vload(p0+j-1))));
+    for (; j < n; j++)
+        dest[j] = (float)(f*p0[j] + e*p0[j-1]);
+}
+
+/*
+   a line of the anti-causal t-line filter, in place:
+   q0[j] = d*line[j] + c*line[j+1] + b1*q1[j] + b2*q2[j] + b3*q3[j], then
+   line[j] = e*q0[j] + f*q0[j+1], with line[n] = line[n-1] and
+   q0[n] = prevres
+*/
+static void
+simd_tline_anticausal(float *line, float *q0, const float *q1,
+    const float *q2, const float *q3, double b1, double b2, double b3,
+    double c, double d, double e, double f, double prevres, int n)
+{
+    vfloat   v1 = vset1((float)b1), v2 = vset1((float)b2), v3 = vset1((float)b3);
+    vfloat   vc = vset1((float)c), vd = vset1((float)d);
+    vfloat   ve = vset1((float)e), vf = vset1((float)f);
+    int      j;
+
+    for (j = 0; j + SIMD_WIDTH < n; j += SIMD_WIDTH)
+        vstore(q0+j, vrecurse(vadd(vmul(vd, vload(line+j)), vmul(vc, vload(line+j+1))),
+            v1, vload(q1+j), v2, vload(q2+j), v3, vload(q3+j)));
+    for (; j < n-1; j++)
+        q0[j] = (float)(d*line[j] + c*line[j+1] + b1*q1[j] + b2*q2[j] + b3*q3[j]);
+    q0[n-1] = (float)(d*line[n-1] + c*line[n-1] + b1*q1[n-1] + b2*q2[n-1] +
+        b3*q3[n-1]);
+
+    for (j = 0; j + SIMD_WIDTH < n; j += SIMD_WIDTH)
+        vstore(line+j, vadd(vmul(ve, vload(q0+j)), vmul(vf, vload(q0+j+1))));
+    for (; j < n-1; j++)
+        line[j] = (float)(e*q0[j] + f*q0[j+1]);
+    line[n-1] = (float)(e*q0[n-1] + f*prevres);
+}
+
+#endif
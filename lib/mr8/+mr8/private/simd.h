@@ -0,0 +1,54 @@
+#ifndef MR8_SIMD_H
+#define MR8_SIMD_H
+
+/*
+ * Thin wrapper over the float32 vector instructions available at compile
+ * time, for the line filters of anigauss.c.  The same source builds for
+ * AVX (8 lanes), SSE (4 lanes) or plain scalar code, so compile with
+ * -march=native to get the widest path the machine supports.
+ */
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+typedef __m256 vfloat;
+static inline vfloat vset1(float x) { return _mm256_set1_ps(x); }
+static inline vfloat vload(const float *p) { return _mm256_loadu_ps(p); }
+static inline void vstore(float *p, vfloat v) { _mm256_storeu_ps(p, v); }
+static inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+typedef __m128 vfloat;
+static inline vfloat vset1(float x) { return _mm_set1_ps(x); }
+static inline vfloat vload(const float *p) { return _mm_loadu_ps(p); }
+static inline void vstore(float *p, vfloat v) { _mm_storeu_ps(p, v); }
+static inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+
+#else
+#define SIMD_WIDTH 1
+typedef float vfloat;
+static inline vfloat vset1(float x) { return x; }
+static inline vfloat vload(const float *p) { return *p; }
+static inline void vstore(float *p, vfloat v) { *p = v; }
+static inline vfloat vadd(vfloat a, vfloat b) { return a + b; }
+static inline vfloat vsub(vfloat a, vfloat b) { return a - b; }
+static inline vfloat vmul(vfloat a, vfloat b) { return a * b; }
+static inline vfloat vdiv(vfloat a, vfloat b) { return a / b; }
+#endif
+
+/* x + b1*p1 + b2*p2 + b3*p3, the step of a third order recursion */
+static inline vfloat vrecurse(vfloat x, vfloat b1, vfloat p1, vfloat b2,
+    vfloat p2, vfloat b3, vfloat p3)
+{
+    return vadd(vadd(x, vmul(b1, p1)), vadd(vmul(b2, p2), vmul(b3, p3)));
+}
+
+#endif
@@ -2,12 +2,28 @@ function [segmentation, num_segments] = segment(input_image, sigma, k, min_size)
 %SEGMENT Image segmentation based on Pedro Felzenszwalb 2004
 % 
 %    [segmentation, num_segments] = pf.segment(input_image, sigma, k, min_size);
+%    [segmentation, num_segments] = pf.segment(..., mode);
+%    [segmentations, num_segments] = pf.segment(input_image, sigma, ks, min_sizes, ...);
 %
 % Input:
 %   input_image: uint8 type H-by-W-by-3 RGB array
 %         sigma: scalar param used to smooth the input image before segmenting it
 %             k: scalar param for the threshold function
 %      min_size: param for minimum component size enforced by post-processing
+%            ks: vector of k, one per level of a hierarchy from fine to coarse
+%     min_sizes: scalar or vector of min_size, one per level
+%          mode: 'sort' (default) uses the original comparison sort, 'fast'
+%                builds the graph on all cores and sorts it in linear time.
+%                The fast mode visits edges of equal weight in another
+%                order than std::sort, so a few segments may differ.
 % Output:
-%  segmentation: double H-by-W-by-3 index array
+%  segmentation: int32 H-by-W index array
 %  num_segments: number of segments in double scalar
+% segmentations: int32 H-by-W-by-L index array of L nested segmentations,
+%                each segment of a level lies in one segment of the next.
+%                The first level equals pf.segment with ks(1), min_sizes(1),
+%                the next ones merge the segments of the previous level, so
+%                multi-scale superpixels cost about as much as one call.
+%                A coarser level has fewer segments than pf.segment with the
+%                same k, as it starts from the segments of the finer one.
+%  num_segments: 1-by-L double array of the number of segments of each level
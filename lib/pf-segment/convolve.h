@@ -26,24 +26,109 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
 #include <cmath>
 #include "image.h"
 
-/* convolve src with mask.  dst is flipped! */
-static void convolve_even(image<float> *src, image<float> *dst, 
-			  std::vector<float> &mask) {
-  int width = src->width();
-  int height = src->height();
-  int len = mask.size();
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#endif
 
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      float sum = mask[0] * imRef(src, x, y);
-      for (int i = 1; i < len; i++) {
-	sum += mask[i] * 
-	  (imRef(src, std::max(x-i,0), y) + 
-	   imRef(src, std::min(x+i, width-1), y));
+/* copy row y of a strided plane to buf[pad, pad+width), repeating the
+   border pixels over pad entries on both sides */
+template <class T>
+static inline void pad_row(const T *src, int width, int xstride, int ystride,
+			   int y, int pad, float *buf) {
+  const T *row = src + y*ystride;
+  for (int x = 0; x < width; x++)
+    buf[pad+x] = row[x*xstride];
+  for (int i = 0; i < pad; i++) {
+    buf[i] = buf[pad];
+    buf[pad+width+i] = buf[pad+width-1];
+  }
+}
+
+/* convolve the four padded rows in buf with mask and store the first
+   rows of them as columns y, y+1, ... of dst.  Four outputs of each row
+   are computed in one vector and a 4x4 transpose turns them into four
+   rows of dst.  Every output is summed in the same order as the scalar
+   loop, so the result does not depend on the vector path. */
+static void convolve_block(const float *buf, int stride, int width, int pad,
+			   int y, int rows, image<float> *dst,
+			   std::vector<float> &mask) {
+  int len = mask.size();
+  int x = 0;
+#ifdef __SSE2__
+  for (; x + 4 <= width; x += 4) {
+    __m128 sum[4];
+    for (int r = 0; r < 4; r++) {
+      const float *p = buf + r*stride + pad + x;
+      __m128 s = _mm_mul_ps(_mm_set1_ps(mask[0]), _mm_loadu_ps(p));
+      for (int i = 1; i < len; i++)
+	s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(mask[i]),
+				     _mm_add_ps(_mm_loadu_ps(p-i),
+						_mm_loadu_ps(p+i))));
+      sum[r] = s;
+    }
+    _MM_TRANSPOSE4_PS(sum[0], sum[1], sum[2], sum[3]);
+    for (int j = 0; j < 4; j++) {
+      if (rows == 4) {
+	_mm_storeu_ps(imPtr(dst, y, x+j), sum[j]);
+      } else {
+	float col[4];
+	_mm_storeu_ps(col, sum[j]);
+	for (int r = 0; r < rows; r++)
+	  imRef(dst, y+r, x+j) = col[r];
       }
-      imRef(dst, y, x) = sum;
     }
   }
+#endif
+  for (; x < width; x++) {
+    for (int r = 0; r < rows; r++) {
+      const float *p = buf + r*stride + pad + x;
+      float sum = mask[0] * p[0];
+      for (int i = 1; i < len; i++)
+	sum += mask[i] * (p[-i] + p[i]);
+      imRef(dst, y+r, x) = sum;
+    }
+  }
+}
+
+/* convolve num_planes width x height planes with mask, pixel (x, y) of
+   plane k is src[k][x*xstride + y*ystride].  dst is flipped!  Rows are
+   padded at the borders and taken four at a time, for all planes in the
+   same pass. */
+template <class T>
+static void convolve_even(const T *const *src, int num_planes,
+			  int width, int height, int xstride, int ystride,
+			  image<float> **dst, std::vector<float> &mask) {
+  int pad = mask.size()-1;
+  int stride = width + 2*pad;
+  float *buf = new float[4*stride];
+
+  for (int y = 0; y < height; y += 4) {
+    int rows = std::min(4, height-y);
+    for (int k = 0; k < num_planes; k++) {
+      for (int r = 0; r < 4; r++)
+	pad_row(src[k], width, xstride, ystride, y + std::min(r, rows-1),
+		pad, buf + r*stride);
+      convolve_block(buf, stride, width, pad, y, rows, dst[k], mask);
+    }
+  }
+  delete [] buf;
+}
+
+/* convolve a width x height plane with mask, pixel (x, y) of the plane is
+   src[x*xstride + y*ystride].  dst is flipped! */
+template <class T>
+static void convolve_even(const T *src, int width, int height,
+			  int xstride, int ystride, image<float> *dst,
+			  std::vector<float> &mask) {
+  convolve_even(&src, 1, width, height, xstride, ystride, &dst, mask);
+}
+
+/* convolve src with mask.  dst is flipped! */
+static void convolve_even(image<float> *src, image<float> *dst, 
+			  std::vector<float> &mask) {
+  convolve_even(src->data, src->width(), src->height(), 1, src->width(),
+		dst, mask);
 }
 
 /* convolve src with mask.  dst is flipped! */
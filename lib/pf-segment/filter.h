@@ -71,6 +71,29 @@ static image<float> *smooth(image<float> *src, float sigma) {
   return dst;
 }
 
+/* convolve num_planes strided planes with gaussian filter in one pass,
+   pixel (x, y) of plane k is src[k][x*xstride + y*ystride] */
+template <class T>
+static void smooth(const T *const *src, int num_planes, int width, int height,
+		   int xstride, int ystride, float sigma, image<float> **dst) {
+  std::vector<float> mask = make_fgauss(sigma);
+  normalize(mask);
+
+  image<float> **tmp = new image<float> *[num_planes];
+  const float **tmp_data = new const float *[num_planes];
+  for (int k = 0; k < num_planes; k++) {
+    tmp[k] = new image<float>(height, width, false);
+    tmp_data[k] = tmp[k]->data;
+    dst[k] = new image<float>(width, height, false);
+  }
+  convolve_even(src, num_planes, width, height, xstride, ystride, tmp, mask);
+  convolve_even(tmp_data, num_planes, height, width, 1, height, dst, mask);
+  for (int k = 0; k < num_planes; k++)
+    delete tmp[k];
+  delete [] tmp_data;
+  delete [] tmp;
+}
+
 /* convolve image with gaussian filter */
 image<float> *smooth(image<uchar> *src, float sigma) {
   image<float> *tmp = imageUCHARtoFLOAT(src);
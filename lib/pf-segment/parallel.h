@@ -0,0 +1,60 @@
+/* parallel loops over row bands */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <pthread.h>
+#include <cstdlib>
+#include <unistd.h>
+
+typedef void (*band_fun)(void *arg, int band, int num_bands);
+
+struct band_job {
+  band_fun fun;
+  void *arg;
+  int band;
+  int num_bands;
+};
+
+static void *run_band(void *p) {
+  band_job *job = (band_job *)p;
+  job->fun(job->arg, job->band, job->num_bands);
+  return NULL;
+}
+
+/* number of threads, the number of online cores unless PF_NUM_THREADS
+   is set */
+static int num_threads() {
+  const char *env = getenv("PF_NUM_THREADS");
+  int n = env ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? n : 1;
+}
+
+/* run fun(arg, band, num_bands) for every band, one thread per band; the
+   calling thread runs band 0 and bands fall back to it when a thread
+   cannot be created */
+static void parallel_bands(int num_bands, band_fun fun, void *arg) {
+  band_job *jobs = new band_job[num_bands];
+  pthread_t *threads = new pthread_t[num_bands];
+  bool *started = new bool[num_bands];
+  for (int i = 0; i < num_bands; i++) {
+    jobs[i].fun = fun;
+    jobs[i].arg = arg;
+    jobs[i].band = i;
+    jobs[i].num_bands = num_bands;
+    started[i] = i > 0 && pthread_create(&threads[i], NULL, run_band, &jobs[i]) == 0;
+  }
+  for (int i = 0; i < num_bands; i++) {
+    if (!started[i])
+      run_band(&jobs[i]);
+  }
+  for (int i = 1; i < num_bands; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+  }
+  delete [] started;
+  delete [] threads;
+  delete [] jobs;
+}
+
+#endif
@@ -21,6 +21,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <stdint.h>
 #include "disjoint-set.h"
 
 // threshold function
@@ -35,21 +37,83 @@ bool operator<(const edge &a, const edge &b) {
   return a.w < b.w;
 }
 
+// edge of a pixel grid in 8 bytes, ab holds a*4 + k and the other end is
+// b = a + offsets[k] for a table of neighbor offsets given with the edges
+typedef struct {
+  float w;
+  unsigned int ab;
+} grid_edge;
+
+bool operator<(const grid_edge &a, const grid_edge &b) {
+  return a.w < b.w;
+}
+
+// endpoints of an edge
+static inline int edge_a(const edge &e, const int *offsets) { return e.a; }
+static inline int edge_b(const edge &e, const int *offsets) { return e.b; }
+static inline int edge_a(const grid_edge &e, const int *offsets) {
+  return e.ab >> 2;
+}
+static inline int edge_b(const grid_edge &e, const int *offsets) {
+  return (e.ab >> 2) + offsets[e.ab & 3];
+}
+
 /*
- * Segment a graph
+ * Sort edges by weight in linear time
+ *
+ * Weights are non-negative floats, whose bit patterns sort like unsigned
+ * integers, so three stable counting passes over 11 bits each sort them
+ * exactly.  Equal weights keep their input order, which std::sort does
+ * not promise, so ties may be visited in another order than there.
+ *
+ * num_edges: number of edges.
+ * edges: array of edges, sorted in place.
+ */
+template <class E>
+void radix_sort_edges(int num_edges, E *edges) {
+  E *tmp = new E[num_edges];
+  int *count = new int[1 << 11];
+  E *src = edges, *dst = tmp;
+  for (int shift = 0; shift < 32; shift += 11) {
+    memset(count, 0, (1 << 11) * sizeof(int));
+    for (int i = 0; i < num_edges; i++) {
+      uint32_t key;
+      memcpy(&key, &src[i].w, sizeof(key));
+      count[(key >> shift) & 0x7FF]++;
+    }
+    int sum = 0;
+    for (int k = 0; k < (1 << 11); k++) {
+      int n = count[k];
+      count[k] = sum;
+      sum += n;
+    }
+    for (int i = 0; i < num_edges; i++) {
+      uint32_t key;
+      memcpy(&key, &src[i].w, sizeof(key));
+      dst[count[(key >> shift) & 0x7FF]++] = src[i];
+    }
+    std::swap(src, dst);
+  }
+  // three passes leave the result in tmp
+  memcpy(edges, src, num_edges * sizeof(E));
+  delete [] count;
+  delete [] tmp;
+}
+
+/*
+ * Segment a graph whose edges are sorted by weight
  *
  * Returns a disjoint-set forest representing the segmentation.
  *
  * num_vertices: number of vertices in graph.
  * num_edges: number of edges in graph
- * edges: array of edges.
+ * edges: array of edges, in non-decreasing weight order.
  * c: constant for treshold function.
+ * offsets: neighbor offsets of grid edges.
  */
-universe *segment_graph(int num_vertices, int num_edges, edge *edges, 
-			float c) { 
-  // sort edges by weight
-  std::sort(edges, edges + num_edges);
-
+template <class E>
+universe *segment_sorted_graph(int num_vertices, int num_edges, E *edges,
+                               float c, const int *offsets = NULL) {
   // make a disjoint-set forest
   universe *u = new universe(num_vertices);
 
@@ -60,11 +124,11 @@ universe *segment_graph(int num_vertices, int num_edges, edge *edges,
 
   // for each edge, in non-decreasing weight order...
   for (int i = 0; i < num_edges; i++) {
-    edge *pedge = &edges[i];
+    E *pedge = &edges[i];
     
     // components conected by this edge
-    int a = u->find(pedge->a);
-    int b = u->find(pedge->b);
+    int a = u->find(edge_a(*pedge, offsets));
+    int b = u->find(edge_b(*pedge, offsets));
     if (a != b) {
       if ((pedge->w <= threshold[a]) &&
 	  (pedge->w <= threshold[b])) {
@@ -76,8 +140,79 @@ universe *segment_graph(int num_vertices, int num_edges, edge *edges,
   }
 
   // free up
-  delete threshold;
+  delete [] threshold;
   return u;
 }
 
+/*
+ * Coarsen a segmentation of a graph whose edges are sorted by weight
+ *
+ * Runs the pass of segment_sorted_graph again with another constant,
+ * starting from the components of u instead of single vertices, so the
+ * new segmentation is nested in the one of u.  The internal difference of
+ * a component is the largest edge weight merged into it, the weight of the
+ * last merge in segment_sorted_graph, so a fresh forest with zero internal
+ * differences gives the segmentation of segment_sorted_graph.
+ *
+ * u: disjoint-set forest of the segmentation, updated in place.
+ * internal: internal difference of each component, indexed by its
+ *   representative in u, updated in place.
+ * num_vertices: number of vertices in graph.
+ * num_edges: number of edges in graph
+ * edges: array of edges, in non-decreasing weight order.
+ * c: constant for treshold function.
+ * offsets: neighbor offsets of grid edges.
+ */
+template <class E>
+void coarsen_sorted_graph(universe *u, float *internal, int num_vertices,
+                          int num_edges, const E *edges, float c,
+                          const int *offsets = NULL) {
+  // init thresholds of the components
+  float *threshold = new float[num_vertices];
+  for (int i = 0; i < num_vertices; i++) {
+    if (u->find(i) == i)
+      threshold[i] = internal[i] + THRESHOLD(u->size(i), c);
+  }
+
+  // for each edge, in non-decreasing weight order...
+  for (int i = 0; i < num_edges; i++) {
+    const E *pedge = &edges[i];
+
+    // components conected by this edge
+    int a = u->find(edge_a(*pedge, offsets));
+    int b = u->find(edge_b(*pedge, offsets));
+    if (a != b) {
+      if ((pedge->w <= threshold[a]) &&
+	  (pedge->w <= threshold[b])) {
+	float w = std::max(pedge->w, std::max(internal[a], internal[b]));
+	u->join(a, b);
+	a = u->find(a);
+	internal[a] = w;
+	threshold[a] = w + THRESHOLD(u->size(a), c);
+      }
+    }
+  }
+
+  // free up
+  delete [] threshold;
+}
+
+/*
+ * Segment a graph
+ *
+ * Returns a disjoint-set forest representing the segmentation.
+ *
+ * num_vertices: number of vertices in graph.
+ * num_edges: number of edges in graph
+ * edges: array of edges.
+ * c: constant for treshold function.
+ */
+universe *segment_graph(int num_vertices, int num_edges, edge *edges, 
+			float c) { 
+  // sort edges by weight
+  std::sort(edges, edges + num_edges);
+
+  return segment_sorted_graph(num_vertices, num_edges, edges, c);
+}
+
 #endif
@@ -20,11 +20,13 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
 #define SEGMENT_IMAGE
 
 #include <cstdlib>
-#include <map>
+#include <algorithm>
+#include <cstring>
 #include "image.h"
 #include "misc.h"
 #include "filter.h"
 #include "segment-graph.h"
+#include "parallel.h"
 
 // random color
 rgb random_rgb(){ 
@@ -46,113 +48,270 @@ static inline float diff(image<float> *r, image<float> *g, image<float> *b,
 	      square(imRef(b, x1, y1)-imRef(b, x2, y2)));
 }
 
-/*
- * Segment an image
- *
- * Returns an index image representing the segmentation.
- *
- * im: image to segment.
- * sigma: to smooth the image.
- * c: constant for treshold function.
- * min_size: minimum component size (enforced by post-processing stage).
- * num_ccs: number of connected components in the segmentation.
- */
-image<int> *segment_image_int(image<rgb> *im, float sigma, float c,
-                                   int min_size, int *num_ccs) {
-  int width = im->width();
-  int height = im->height();
+// number of edges of the pixels in rows above y
+static inline int edges_before_row(int y, int width, int height) {
+  return y * (width-1) + std::min(y, height-1) * (2*width-1) +
+    std::max(y-1, 0) * (width-1);
+}
 
-  image<float> *r = new image<float>(width, height);
-  image<float> *g = new image<float>(width, height);
-  image<float> *b = new image<float>(width, height);
+struct edge_band_args {
+  image<float> *r, *g, *b;
+  grid_edge *edges;
+};
 
-  // smooth each color channel  
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      imRef(r, x, y) = imRef(im, x, y).r;
-      imRef(g, x, y) = imRef(im, x, y).g;
-      imRef(b, x, y) = imRef(im, x, y).b;
-    }
-  }
-  image<float> *smooth_r = smooth(r, sigma);
-  image<float> *smooth_g = smooth(g, sigma);
-  image<float> *smooth_b = smooth(b, sigma);
-  delete r;
-  delete g;
-  delete b;
- 
-  // build graph
-  edge *edges = new edge[width*height*4];
-  int num = 0;
-  for (int y = 0; y < height; y++) {
+// edges of the pixels in one band of rows, in the same order as a single
+// pass over the whole image; the neighbor k of the edges is right, down,
+// down-right and up-right
+static void build_edge_band(void *arg, int band, int num_bands) {
+  edge_band_args *args = (edge_band_args *)arg;
+  image<float> *smooth_r = args->r;
+  image<float> *smooth_g = args->g;
+  image<float> *smooth_b = args->b;
+  grid_edge *edges = args->edges;
+  int width = smooth_r->width();
+  int height = smooth_r->height();
+  int y0 = (int)((long)height * band / num_bands);
+  int y1 = (int)((long)height * (band+1) / num_bands);
+  int num = edges_before_row(y0, width, height);
+  for (int y = y0; y < y1; y++) {
     for (int x = 0; x < width; x++) {
+      unsigned int a = (unsigned int)(y * width + x) << 2;
       if (x < width-1) {
-	edges[num].a = y * width + x;
-	edges[num].b = y * width + (x+1);
+	edges[num].ab = a;
 	edges[num].w = diff(smooth_r, smooth_g, smooth_b, x, y, x+1, y);
 	num++;
       }
 
       if (y < height-1) {
-	edges[num].a = y * width + x;
-	edges[num].b = (y+1) * width + x;
+	edges[num].ab = a | 1;
 	edges[num].w = diff(smooth_r, smooth_g, smooth_b, x, y, x, y+1);
 	num++;
       }
 
       if ((x < width-1) && (y < height-1)) {
-	edges[num].a = y * width + x;
-	edges[num].b = (y+1) * width + (x+1);
+	edges[num].ab = a | 2;
 	edges[num].w = diff(smooth_r, smooth_g, smooth_b, x, y, x+1, y+1);
 	num++;
       }
 
       if ((x < width-1) && (y > 0)) {
-	edges[num].a = y * width + x;
-	edges[num].b = (y-1) * width + (x+1);
+	edges[num].ab = a | 3;
 	edges[num].w = diff(smooth_r, smooth_g, smooth_b, x, y, x+1, y-1);
 	num++;
       }
     }
   }
+}
+
+/*
+ * Build the graph of the planes of an image
+ *
+ * Returns the edges of the pixel grid sorted by weight, see segment_planes
+ * for the arguments.
+ *
+ * num_edges: output, number of edges.
+ * offsets: output, the 4 neighbor offsets of the edges.
+ */
+template <class T>
+grid_edge *build_sorted_graph(const T *r, const T *g, const T *b,
+                              int width, int height, int xstride, int ystride,
+                              float sigma, bool fast,
+                              int *num_edges, int *offsets) {
+  // smooth each color channel  
+  const T *planes[3] = {r, g, b};
+  image<float> *smoothed[3];
+  smooth(planes, 3, width, height, xstride, ystride, sigma, smoothed);
+  image<float> *smooth_r = smoothed[0];
+  image<float> *smooth_g = smoothed[1];
+  image<float> *smooth_b = smoothed[2];
+ 
+  // build graph
+  int num = edges_before_row(height, width, height);
+  offsets[0] = 1;
+  offsets[1] = width;
+  offsets[2] = width+1;
+  offsets[3] = 1-width;
+  grid_edge *edges = new grid_edge[num];
+  edge_band_args args = {smooth_r, smooth_g, smooth_b, edges};
+  int num_bands = fast ? std::min(num_threads(), height) : 1;
+  parallel_bands(num_bands, build_edge_band, &args);
   delete smooth_r;
   delete smooth_g;
   delete smooth_b;
 
+  // sort
+  if (fast)
+    radix_sort_edges(num, edges);
+  else
+    std::sort(edges, edges + num);
+  *num_edges = num;
+  return edges;
+}
+
+// write the index of the component of each pixel to labels, numbering
+// components from 1 in raster order
+static void label_components(universe *u, int width, int height,
+                             int *labels, int lxstride, int lystride) {
+  int *segment_ids = new int[width*height];
+  memset(segment_ids, 0, width*height*sizeof(int));
+  int num_ids = 0;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int comp = u->find(y * width + x);
+      if (segment_ids[comp] == 0)
+        segment_ids[comp] = ++num_ids;
+      labels[x*lxstride + y*lystride] = segment_ids[comp];
+    }
+  }
+  delete [] segment_ids;
+}
+
+/*
+ * Segment the planes of an image
+ *
+ * Returns the number of connected components in the segmentation and
+ * writes the index of the segment of each pixel to labels, segments are
+ * numbered from 1 in raster order.
+ *
+ * r, g, b: color planes of a width x height image, pixel (x, y) of a plane
+ *   is r[x*xstride + y*ystride], so that interleaved or column-major
+ *   buffers are read in place.
+ * sigma: to smooth the image.
+ * c: constant for treshold function.
+ * min_size: minimum component size (enforced by post-processing stage).
+ * fast: build the graph on several threads and sort its edges in linear
+ *   time; only edges of equal weight may be visited in another order.
+ * labels: output, pixel (x, y) is labels[x*lxstride + y*lystride].
+ */
+template <class T>
+int segment_planes(const T *r, const T *g, const T *b, int width, int height,
+                   int xstride, int ystride, float sigma, float c,
+                   int min_size, bool fast,
+                   int *labels, int lxstride, int lystride) {
+  // build graph
+  int num;
+  int offsets[4];
+  grid_edge *edges = build_sorted_graph(r, g, b, width, height,
+                                        xstride, ystride, sigma, fast,
+                                        &num, offsets);
+
   // segment
-  universe *u = segment_graph(width*height, num, edges, c);
+  universe *u = segment_sorted_graph(width*height, num, edges, c, offsets);
   
   // post process small components
   for (int i = 0; i < num; i++) {
-    int a = u->find(edges[i].a);
-    int b = u->find(edges[i].b);
+    int a = u->find(edge_a(edges[i], offsets));
+    int b = u->find(edge_b(edges[i], offsets));
     if ((a != b) && ((u->size(a) < min_size) || (u->size(b) < min_size)))
       u->join(a, b);
   }
   delete [] edges;
-  *num_ccs = u->num_sets();
+  int num_ccs = u->num_sets();
 
-  // make an pixel index map.
-  std::map<int, int> segment_ids;
-  image<int> *output = new image<int>(width, height);
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      int comp = u->find(y * width + x);
-      std::map<int, int>::iterator entry = segment_ids.find(comp);
-      int segment_id;
-      if (entry != segment_ids.end()) {
-        segment_id = entry->second;
-      }
-      else {
-        segment_id = segment_ids.size()+1;
-        segment_ids[comp] = segment_id;
+  // make an pixel index map
+  label_components(u, width, height, labels, lxstride, lystride);
+  delete u;
+
+  return num_ccs;
+}
+
+/*
+ * Segment the planes of an image at several scales
+ *
+ * Computes a hierarchy of segmentations from one smoothed image and one
+ * sorted graph.  The first level is the segmentation of segment_planes
+ * with c[0] and min_size[0], and every next level merges the segments of
+ * the previous one with c[l] and min_size[l], see coarsen_sorted_graph, so
+ * each segment of a level lies in one segment of the next.  Levels are
+ * meant to go from fine to coarse, with non-decreasing c and min_size; a
+ * level merges more than segment_planes with the same c would, as its
+ * pass starts from the segments of the previous level.  Edges inside
+ * segments are dropped after each level, so the next ones only visit the
+ * boundaries.
+ *
+ * r, g, b, width, height, xstride, ystride, sigma, fast: see
+ *   segment_planes.
+ * c: constant for treshold function of each level.
+ * min_size: minimum component size of each level.
+ * num_levels: number of levels.
+ * labels: output, pixel (x, y) of level l is
+ *   labels[x*lxstride + y*lystride + l*lzstride].
+ * num_ccs: output, number of connected components of each level.
+ */
+template <class T>
+void segment_planes_levels(const T *r, const T *g, const T *b,
+                           int width, int height, int xstride, int ystride,
+                           float sigma, const float *c, const int *min_size,
+                           int num_levels, bool fast, int *labels,
+                           int lxstride, int lystride, int lzstride,
+                           int *num_ccs) {
+  // build graph
+  int num;
+  int offsets[4];
+  grid_edge *edges = build_sorted_graph(r, g, b, width, height,
+                                        xstride, ystride, sigma, fast,
+                                        &num, offsets);
+
+  universe *u = new universe(width*height);
+  float *internal = new float[width*height];
+  memset(internal, 0, width*height*sizeof(float));
+  for (int l = 0; l < num_levels; l++) {
+    // segment
+    coarsen_sorted_graph(u, internal, width*height, num, edges, c[l],
+                         offsets);
+
+    // post process small components, keeping only the edges between
+    // components for the next levels
+    int kept = 0;
+    for (int i = 0; i < num; i++) {
+      int a = u->find(edge_a(edges[i], offsets));
+      int b = u->find(edge_b(edges[i], offsets));
+      if (a == b)
+        continue;
+      if ((u->size(a) < min_size[l]) || (u->size(b) < min_size[l])) {
+        float w = std::max(internal[a], internal[b]);
+        u->join(a, b);
+        internal[u->find(a)] = w;
+      } else {
+        edges[kept++] = edges[i];
       }
-      imRef(output, x, y) = segment_id;
     }
+    num = kept;
+    num_ccs[l] = u->num_sets();
+
+    // make an pixel index map
+    label_components(u, width, height, labels + (long)l*lzstride,
+                     lxstride, lystride);
   }
 
+  delete [] internal;
+  delete [] edges;
   delete u;
+}
 
+/*
+ * Segment an image
+ *
+ * Returns an index image representing the segmentation, segments are
+ * numbered from 1 in raster order.
+ *
+ * im: image to segment.
+ * sigma: to smooth the image.
+ * c: constant for treshold function.
+ * min_size: minimum component size (enforced by post-processing stage).
+ * num_ccs: number of connected components in the segmentation.
+ * fast: see segment_planes.
+ */
+image<int> *segment_image_int(image<rgb> *im, float sigma, float c,
+                                   int min_size, int *num_ccs,
+                                   bool fast = false) {
+  int width = im->width();
+  int height = im->height();
+  const uchar *data = (const uchar *)im->data;
+  image<int> *output = new image<int>(width, height, false);
+  *num_ccs = segment_planes(data, data+1, data+2, width, height,
+                            3, 3*width, sigma, c, min_size, fast,
+                            output->data, 1, width);
   return output;
 }
 
@@ -4,20 +4,32 @@
  *
  * Usage:
  *   [segmentation, num_segments] = pfsegment(img, sigma, k, min_size);
+ *   [segmentation, num_segments] = pfsegment(img, sigma, k, min_size, mode);
+ *   [segmentations, num_segments] = pfsegment(img, sigma, ks, min_sizes, ...);
  * Input:
  *           img: uint8 type H-by-W-by-3 RGB array
  *         sigma: scalar param used to smooth the input image before segmenting it
  *             k: scalar param for the threshold function
  *      min_size: param for minimum component size enforced by post-processing
+ *            ks: vector of k, one per level of a hierarchy from fine to coarse
+ *     min_sizes: scalar or vector of min_size, one per level
+ *          mode: 'sort' (default) uses the original comparison sort, 'fast'
+ *                builds the graph on all cores and sorts it in linear time,
+ *                which may visit edges of equal weight in another order
  * Output:
- *  segmentation: double H-by-W-by-3 index array
+ *  segmentation: int32 H-by-W index array
  *  num_segments: number of segments in double scalar
+ * segmentations: int32 H-by-W-by-L index array of L nested segmentations,
+ *                the image is smoothed and its graph sorted only once
+ *  num_segments: 1-by-L double array of the number of segments of each level
  *
  * Kota Yamaguchi 2011
  */
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <vector>
 #include "image.h"
 #include "misc.h"
 #include "pnmfile.h"
@@ -28,31 +40,6 @@ using namespace std;
 
 namespace {
 
-/**
- * Converts mxArray to image<rgb>
- * @param arr mxArray object
- * @return image<rgb> pointer
- */
-image<rgb> *mxArrayToRGB(const mxArray *arr) {
-	/* Be careful that image is transposed in mxArray */
-	const mwSize *d = mxGetDimensions(arr);
-	int width  = d[1];
-	int height = d[0];
-	int stride = width * height;
-	image<rgb> *im = new image<rgb>(width, height);
-	uchar *ptr = (uchar*)mxGetData(arr);
-	for (int i = 0; i < width; i++)
-		for (int j = 0; j < height; j++) {
-			rgb pix;
-			int loc = j + i*height;
-			pix.r = ptr[loc           ];
-			pix.g = ptr[loc +   stride];
-			pix.b = ptr[loc + 2*stride];
-			imRef(im,i,j) = pix;
-		}
-	return im;
-}
-
 /**
  * Converts image<rgb> to mxArray
  * @param arr mxArray object
@@ -79,26 +66,6 @@ mxArray *RGBToMxArray(const image<rgb> *im) {
 	return arr;
 }
 
-/**
- * Converts image<int> to mxArray
- * @param arr mxArray object
- * @return mxArray pointer
- */
-mxArray *ImageToMxArray(const image<int> *im) {
-	/* Be careful that image is transposed in mxArray */
-	int width = im->width();
-	int height = im->height();
-	mxArray* arr = mxCreateDoubleMatrix(height, width, mxREAL);
-	double *ptr = (double*)mxGetPr(arr);
-	for (int i = 0; i < width; i++)
-		for (int j = 0; j < height; j++) {
-			int pix = imRef(im,i,j);
-			int loc = j + i*height;
-			ptr[loc] = pix;
-		}
-	return arr;
-}
-
 } // namespace
 
 /**
@@ -114,7 +81,7 @@ void mexFunction( int nlhs, mxArray *plhs[],
                   int nrhs, const mxArray *prhs[] )
 {
 	/* Check the input format */
-	if(nrhs!=4 || nlhs!=1)
+	if(nrhs<4 || nrhs>5 || nlhs>2)
         	mexErrMsgIdAndTxt("mexsegment:invalidArgs","Wrong number of arguments");
 	if (mxGetClassID(prhs[0])!=mxUINT8_CLASS)
         	mexErrMsgIdAndTxt("mexsegment:invalidArgs","Only UINT8 type is supported");
@@ -123,19 +90,56 @@ void mexFunction( int nlhs, mxArray *plhs[],
 	
 	/* Get options */
 	float sigma = (float)mxGetScalar(prhs[1]);
-	float k = (float)mxGetScalar(prhs[2]);
-	int min_size = (int)mxGetScalar(prhs[3]);
+	int num_levels = mxGetNumberOfElements(prhs[2]);
+	int num_sizes = mxGetNumberOfElements(prhs[3]);
+	if (num_levels < 1 || (num_sizes != 1 && num_sizes != num_levels) ||
+	    (num_levels > 1 && !mxIsDouble(prhs[2])) ||
+	    (num_sizes > 1 && !mxIsDouble(prhs[3])))
+		mexErrMsgIdAndTxt("mexsegment:invalidArgs","k and min_size should be scalars or double vectors of the same length");
+	vector<float> k(num_levels);
+	vector<int> min_size(num_levels);
+	for (int i = 0; i < num_levels; i++) {
+		k[i] = (float)(num_levels > 1 ? mxGetPr(prhs[2])[i] : mxGetScalar(prhs[2]));
+		min_size[i] = (int)(num_sizes > 1 ? mxGetPr(prhs[3])[i] : mxGetScalar(prhs[3]));
+	}
+	bool fast = false;
+	if (nrhs > 4) {
+		char mode[8];
+		if (!mxIsChar(prhs[4]) || mxGetString(prhs[4], mode, sizeof(mode)) ||
+		    (strcmp(mode, "fast") && strcmp(mode, "sort")))
+			mexErrMsgIdAndTxt("mexsegment:invalidArgs","Mode should be 'fast' or 'sort'");
+		fast = strcmp(mode, "fast") == 0;
+	}
     
-	/* Convert mxArray to image */
-	auto_ptr<image<rgb> > im = auto_ptr<image<rgb> >(mxArrayToRGB(prhs[0]));
-	
-	/* Compute segmentation */
-	int num_ccs;
-	auto_ptr<image<int> > seg = auto_ptr<image<int> >(
-            segment_image_int(im.get(), sigma, k, min_size, &num_ccs));
-	
-	/* Convert image to mxArray */
-	plhs[0] = ImageToMxArray(seg.get());
-  if (nlhs > 1)
-    plhs[1] = mxCreateDoubleScalar(num_ccs);
+	/* Compute segmentation on the mxArray buffer, transposed as in Matlab */
+	const mwSize *d = mxGetDimensions(prhs[0]);
+	int width  = d[1];
+	int height = d[0];
+	int stride = width * height;
+	const uchar *ptr = (const uchar*)mxGetData(prhs[0]);
+	if (num_levels == 1) {
+		plhs[0] = mxCreateNumericMatrix(height, width, mxINT32_CLASS, mxREAL);
+		int num_ccs = segment_planes(ptr, ptr + stride, ptr + 2*stride,
+		                             width, height, height, 1, sigma, k[0],
+		                             min_size[0], fast,
+		                             (int*)mxGetData(plhs[0]), height, 1);
+		if (nlhs > 1)
+			plhs[1] = mxCreateDoubleScalar(num_ccs);
+		return;
+	}
+
+	/* Compute the hierarchy, one H-by-W plane per level */
+	mwSize dims[3] = {d[0], d[1], (mwSize)num_levels};
+	plhs[0] = mxCreateNumericArray(3, dims, mxINT32_CLASS, mxREAL);
+	vector<int> num_ccs(num_levels);
+	segment_planes_levels(ptr, ptr + stride, ptr + 2*stride,
+	                      width, height, height, 1, sigma, &k[0],
+	                      &min_size[0], num_levels, fast,
+	                      (int*)mxGetData(plhs[0]), height, 1, stride,
+	                      &num_ccs[0]);
+	if (nlhs > 1) {
+		plhs[1] = mxCreateDoubleMatrix(1, num_levels, mxREAL);
+		for (int i = 0; i < num_levels; i++)
+			mxGetPr(plhs[1])[i] = num_ccs[i];
+	}
 }
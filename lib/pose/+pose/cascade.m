@@ -0,0 +1,105 @@
+function model = cascade(model, samples, varargin)
+%CASCADE Learn the early-reject thresholds of the cascade detection mode.
+%
+% ## Input
+%  * __model__ Trained pose estimator, a scalar struct.
+%  * __samples__ Struct array of positive samples.
+%    * __im__ Image or file path to an image.
+%    * __point__ 14-by-2 row vectors (x,y) of pose keypoints in the order of
+%                pose.train.
+%
+% ## Output
+%  * __model__ The model with a 'cascade' field. Use the 'Recall' option of
+%              pose.estimate to detect with it.
+%
+% ## Options
+%  * __'Scale'__ Image scale, the same as in pose.estimate. Default 0.5.
+%  * __'Radius'__ How far, in HOG cells, a part is searched around its anchor
+%                 during the early-reject stages. Default 3.
+%
+% Every root location of the feature pyramid is a hypothesis, and the parts
+% are added to it one at a time, each at its best place near its parent.
+% For every sample, the hypothesis that best matches the annotation keeps
+% the partial score it had after each part. pose.estimate turns these into
+% per-part thresholds that keep a given fraction of them, see the README.
+%
+
+  scale = 0.5;
+  radius = 3;
+  for i = 1:2:numel(varargin)
+    switch varargin{i}
+      case 'Scale', scale = varargin{i+1};
+      case 'Radius', radius = varargin{i+1};
+    end
+  end
+
+  scores = cell(1, numel(model.components));
+  for i = 1:numel(samples)
+    fprintf('cascade: scoring positives: %d/%d\n', i, numel(samples));
+    [S, c] = score_positive(model, samples(i), scale, radius);
+    if ~isempty(S)
+      scores{c}(end+1, :) = S;
+    end
+  end
+  model.cascade = struct('radius', radius, 'scores', {scores});
+
+end
+
+function [score, component] = score_positive(model, sample, scale, radius)
+%SCORE_POSITIVE Partial scores of the hypothesis that matches the annotation.
+
+  % keypoints closer than this fraction of the body size are correct, and
+  % a hypothesis needs half of them correct, as in eval_pck
+  pck_thresh = 0.1;
+  min_pck = 0.5;
+
+  im = sample.im;
+  if ischar(im)
+    im = imread(im);
+  end
+  if scale > 1.0
+    scale = min(1.0, scale / max(size(im, 1), size(im, 2)));
+  end
+  im = imresize(im, scale);
+  gt = sample.point;
+  gt_scale = max(max(gt, [], 1) - min(gt, [], 1) + 1);
+
+  pyra = featpyramid_fast(im, model);
+  [components, filters] = modelcomponents_fast(model, pyra);
+  best = [min_pck -inf];
+  score = [];
+  component = 0;
+  for rlevel = 1:numel(pyra.feat)
+    for c = 1:numel(components)
+      parts = components{c};
+      t = -inf(1, numel(parts));
+      [X, Y, M, S] = cascade_component(parts, pyra, filters, rlevel, t, radius);
+
+      % part centers of every hypothesis in the original image, as in
+      % backtrack and box2point
+      for k = 1:numel(parts)
+        s = pyra.scale(rlevel - parts(k).scale * model.interval);
+        x1 = (X(:, k) - 1 - pyra.padx) * s + 1;
+        y1 = (Y(:, k) - 1 - pyra.pady) * s + 1;
+        bx(:, k) = x1 + (parts(k).sizx(M(:, k)) * s - 1) / 2;
+        by(:, k) = y1 + (parts(k).sizy(M(:, k)) * s - 1) / 2;
+      end
+      det.point = permute(cat(3, bx, by), [2 3 1]) / scale;
+      det = pose.PARSE_from_UCI(det);
+      dist = sqrt(sum(bsxfun(@minus, det.point, gt).^2, 2));
+      pck = squeeze(mean(dist <= pck_thresh * gt_scale, 1));
+
+      % most correct keypoints, then highest score
+      top = find(pck == max(pck));
+      [foo, j] = max(S(top, end));
+      j = top(j);
+      if pck(j) > best(1) || (pck(j) == best(1) && S(j, end) > best(2))
+        best = [pck(j) S(j, end)];
+        score = S(j, :);
+        component = c;
+      end
+      clear bx by det;
+    end
+  end
+
+end
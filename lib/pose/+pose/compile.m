@@ -12,17 +12,30 @@ function compile
   % mex -O fconvMT.cc -o fconv 
   % 3) basic convolution, very compatible
   mex -O fconv.cc -output fconv
+  % float32 SIMD convolution of all filters at once, used in detect_fast
+  mex -O -largeArrayDims CXXFLAGS="\$CXXFLAGS -march=native" fconvSIMD.cc
+  % tiled FFT convolution for large levels, used in detect_fast
+  mex -O -largeArrayDims CXXFLAGS="\$CXXFLAGS -march=native" fconvFFT.cc
 
   mex -O resize.cc
   mex -O reduce.cc
   mex -O dt.cc
   mex -O shiftdt.cc
-  mex -O features.cc
+  % message passing and backtracking of one component, used in detect_fast
+  mex -O -largeArrayDims detect_component.cc
+  % early-reject stages of the cascade detection mode
+  mex -O -largeArrayDims CXXFLAGS="\$CXXFLAGS -march=native" cascade_component.cc
+  mex -O CXXFLAGS="\$CXXFLAGS -march=native" features.cc
+  % whole feature pyramid in one call, used in detect_fast
+  mex -O -largeArrayDims CXXFLAGS="\$CXXFLAGS -march=native" featpyramid_fast.cc
+  % whole detections of a batch of images, used in estimate
+  mex -O -largeArrayDims CXXFLAGS="\$CXXFLAGS -march=native" detect_batch.cc
 
   % =============
   % Learning code
-  mex -O -largeArrayDims qp_one_sparse.cc
-  mex -O -largeArrayDims score.cc
-  mex -O -largeArrayDims lincomb.cc
+  % block-sparse QP kernels, score and lincomb run on the thread pool
+  mex -O -largeArrayDims CXXFLAGS="\$CXXFLAGS -march=native" qp_one_sparse.cc
+  mex -O -largeArrayDims CXXFLAGS="\$CXXFLAGS -march=native" score.cc
+  mex -O -largeArrayDims CXXFLAGS="\$CXXFLAGS -march=native" lincomb.cc
   cd(cwd);
 end
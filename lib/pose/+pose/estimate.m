@@ -3,29 +3,65 @@ function [boxes] = estimate(model, samples, varargin)
 %
 %    model: trained pose estimator, a scalar struct.
 %    samples: image, struct array with 'im' field, or cell string of image paths.
+%
+%    Options:
+%    'Scale': image scale, or maximum image width/height if above 1.
+%    'NMSThreshold': overlap threshold of the non-maximum suppression.
+%    'Recall': use the cascade detection mode learned by pose.cascade,
+%              keeping about this fraction of its training positives.
+%              Lower values are faster and lose more detections.
+%    'BatchSize': number of images detected concurrently, one per core.
+%                 Without 'Recall', the model is compiled once and images
+%                 are processed in batches of this size. Default 16.
 %
 
   scale = 0.5;
   nms_threshold = 0.3;
+  recall = [];
+  batch_size = 16;
   for i = 1:2:numel(varargin)
     switch varargin{i}
       case 'Scale', scale = varargin{i+1};
       case 'NMSThreshold', nms_threshold = varargin{i+1};
+      case 'Recall', recall = varargin{i+1};
+      case 'BatchSize', batch_size = varargin{i+1};
     end
   end
+  cascade = {};
+  if ~isempty(recall)
+    cascade = {cascade_thresholds(model, recall)};
+  end
   
   if isnumeric(samples), samples = {samples}; end
   if isstruct(samples), samples = {samples.im}; end
   boxes = cell(size(samples));
-  for i = 1:numel(samples)
-    boxes{i} = process(model, samples{i}, scale, nms_threshold);
+  if isempty(cascade)
+    % Compile the model once and detect a batch of images in parallel.
+    cmodel = compile_model(model);
+    for i = 1:batch_size:numel(samples)
+      j = i:min(i + batch_size - 1, numel(samples));
+      ims = cell(size(j));
+      scales = zeros(size(j));
+      for k = 1:numel(j)
+        [ims{k}, scales(k)] = load_image(samples{j(k)}, scale);
+      end
+      box = detect_batch(ims, cmodel, model.thresh);
+      for k = 1:numel(j)
+        boxes{j(k)} = postprocess(box{k}, scales(k), nms_threshold);
+      end
+    end
+  else
+    for i = 1:numel(samples)
+      [im, s] = load_image(samples{i}, scale);
+      box = detect_fast(im, model, model.thresh, cascade{:});
+      boxes{i} = postprocess(box, s, nms_threshold);
+    end
   end
   if isscalar(boxes), boxes = boxes{1}; end
 
 end
 
-function boxes = process(model, sample, scale, nms_threshold)
-  detector_threshold = model.thresh;
+function [im, scale] = load_image(sample, scale)
   im = sample;
   if ischar(im)
       im = imread(im);
@@ -35,7 +71,9 @@ function boxes = process(model, sample, scale, nms_threshold)
     scale = min(1.0, scale / max(size(im, 1), size(im, 2)));
   end
   im = imresize(im, scale);
-  box = detect_fast(im, model, detector_threshold);
+end
+
+function boxes = postprocess(box, scale, nms_threshold)
   box(:, 1:end-2) = box(:, 1:end-2) / scale;
   boxes = nms(box, nms_threshold);
 end
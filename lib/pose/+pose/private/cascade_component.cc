@@ -0,0 +1,323 @@
+#include <math.h>
+#include <string.h>
+#include "mex.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+/*
+ * Early-reject stage of the cascade detection mode, in the spirit of the
+ * star-cascade DPM of Felzenszwalb, Girshick and McAllester.
+ *
+ * Every root location of one component at one root level is a
+ * hypothesis.  Parts are added in model order, which is top-down since a
+ * parent always comes before its children: each part is placed at its
+ * best location and mixture within radius cells of the anchor given the
+ * placement of its parent, and its score is added to the partial score
+ * of the hypothesis.  A hypothesis is dropped as soon as its partial
+ * score after part k falls below t(k).  The greedy placement is a
+ * feasible configuration, so its total never exceeds the exact score of
+ * the tree.
+ *
+ * Filter responses are only computed at the cells that are looked at,
+ * and cached so that overlapping windows share them.  Hypotheses run in
+ * parallel on the thread pool, one root column per task.
+ */
+
+struct cascade_part {
+  int parent;              // -1 for the root
+  int level;               // pyramid level, from 0
+  int K;                   // number of mixtures
+  int height, width;       // response map size
+  float **B;               // packed filter per mixture
+  int *fh, *fw;            // filter size per mixture
+  double *resp;            // height x width x K, NaN until computed
+  const double *b;         // bias, L x K, or K for the root
+  const double *w;         // deformation, 4 x K
+  const double *startx, *starty;
+  int step;
+};
+
+struct cascade_level {
+  float *feat;             // packed features, NULL if unused
+  int height, width;
+};
+
+struct cascade_data {
+  cascade_part *parts;
+  int num_parts;
+  cascade_level *levels;
+  int num_features;
+  const double *t;         // stage thresholds
+  int radius;
+  // per root location, num_parts values each
+  int *X, *Y, *M;
+  double *S;
+  bool *alive;
+};
+
+// response of mixture m of part p at cell (x,y); concurrent tasks may
+// compute the same cell, they store the same value
+static double response(const cascade_data *d, cascade_part *p, int m, int x, int y) {
+  double *r = p->resp + ((size_t)m*p->width + x)*p->height + y;
+  double v;
+  __atomic_load(r, &v, __ATOMIC_RELAXED);
+  if (!isnan(v))
+    return v;
+  const cascade_level *level = &d->levels[p->level];
+  const int nf = d->num_features;
+  const int len = p->fh[m]*nf;
+  vfloat s = vzero();
+  for (int xp = 0; xp < p->fw[m]; xp++) {
+    const float *a = level->feat + ((size_t)(x+xp)*level->height + y)*nf;
+    const float *b = p->B[m] + xp*len;
+    for (int i = 0; i < len; i += SIMD_WIDTH)
+      s = vmadd(vload(a+i), vload(b+i), s);
+  }
+  v = vsum(s);
+  __atomic_store(r, &v, __ATOMIC_RELAXED);
+  return v;
+}
+
+static inline int clamp(int x, int lo, int hi) {
+  return x < lo ? lo : (x > hi ? hi : x);
+}
+
+// run every hypothesis of one root column through the stages
+void evaluate_column(void *arg, int x0) {
+  cascade_data *d = (cascade_data *)arg;
+  cascade_part *root = &d->parts[0];
+  const int np = d->num_parts;
+  const int r = d->radius;
+  for (int y0 = 0; y0 < root->height; y0++) {
+    size_t h = ((size_t)x0*root->height + y0)*np;
+    int *X = d->X + h;
+    int *Y = d->Y + h;
+    int *M = d->M + h;
+    double *S = d->S + h;
+
+    // root filter and bias
+    double best = -INFINITY;
+    for (int m = 0; m < root->K; m++) {
+      double s = response(d, root, m, x0, y0) + root->b[m];
+      if (s > best) {
+        best = s;
+        M[0] = m;
+      }
+    }
+    X[0] = x0;
+    Y[0] = y0;
+    S[0] = best;
+    bool alive = !(S[0] < d->t[0]);
+
+    // place parts top-down given their parents
+    for (int k = 1; k < np && alive; k++) {
+      cascade_part *p = &d->parts[k];
+      int par = p->parent;
+      int L = d->parts[par].K;
+      best = -INFINITY;
+      for (int m = 0; m < p->K; m++) {
+        // anchor of the child on its own grid, as in shiftdt
+        int ax = (int)p->startx[m]-1 + X[par]*p->step;
+        int ay = (int)p->starty[m]-1 + Y[par]*p->step;
+        int cx = clamp(ax, 0, p->width-1);
+        int cy = clamp(ay, 0, p->height-1);
+        const double *w = p->w + 4*m;
+        double bias = p->b[M[par]+L*m];
+        for (int x = clamp(cx-r, 0, p->width-1); x <= clamp(cx+r, 0, p->width-1); x++) {
+          int dx = ax-x;
+          double defx = bias - w[0]*dx*dx - w[1]*dx;
+          for (int y = clamp(cy-r, 0, p->height-1); y <= clamp(cy+r, 0, p->height-1); y++) {
+            int dy = ay-y;
+            double s = response(d, p, m, x, y) + defx - w[2]*dy*dy - w[3]*dy;
+            if (s > best) {
+              best = s;
+              X[k] = x;
+              Y[k] = y;
+              M[k] = m;
+            }
+          }
+        }
+      }
+      S[k] = S[k-1] + best;
+      alive = !(S[k] < d->t[k]);
+    }
+    d->alive[(size_t)x0*root->height + y0] = alive;
+  }
+}
+
+static const mxArray *get_field(const mxArray *s, int k, const char *name) {
+  const mxArray *field = mxGetField(s, k, name);
+  if (field == NULL || !mxIsDouble(field))
+    mexErrMsgTxt("Invalid input: parts");
+  return field;
+}
+
+static int numel(const mxArray *s, int k, const char *name) {
+  return mxGetNumberOfElements(get_field(s, k, name));
+}
+
+// matlab entry point
+// [X, Y, M, S] = cascade_component(parts, pyra, filters, rlevel, t, radius)
+// parts is the part struct array of a component built by detect_fast,
+// filters the cell of filter weights and t one threshold per part.
+// Returns one row per root location at rlevel that passes every stage,
+// in the order of find(): the cell (X,Y) and mixture M of every part,
+// from 1, and the partial scores S after each part.
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+  if (nrhs != 6)
+    mexErrMsgTxt("Wrong number of inputs");
+  if (nlhs > 4)
+    mexErrMsgTxt("Wrong number of outputs");
+  const mxArray *mxparts = prhs[0];
+  const mxArray *filters = prhs[2];
+  if (!mxIsStruct(mxparts) || !mxIsStruct(prhs[1]) || !mxIsCell(filters) ||
+      !mxIsDouble(prhs[4]))
+    mexErrMsgTxt("Invalid input");
+  const mxArray *feat = mxGetField(prhs[1], 0, "feat");
+  const mxArray *mxinterval = mxGetField(prhs[1], 0, "interval");
+  if (!feat || !mxIsCell(feat) || !mxinterval)
+    mexErrMsgTxt("Invalid input: pyra");
+  int num_levels = mxGetNumberOfElements(feat);
+  int interval = (int)mxGetScalar(mxinterval);
+  int rlevel = (int)mxGetScalar(prhs[3])-1;
+
+  cascade_data d;
+  d.num_parts = mxGetNumberOfElements(mxparts);
+  if (d.num_parts < 1 || (int)mxGetNumberOfElements(prhs[4]) != d.num_parts)
+    mexErrMsgTxt("Invalid input: t should have one threshold per part");
+  d.t = mxGetPr(prhs[4]);
+  d.radius = (int)mxGetScalar(prhs[5]);
+  d.parts = (cascade_part *)mxCalloc(d.num_parts, sizeof(cascade_part));
+  d.levels = (cascade_level *)mxCalloc(num_levels, sizeof(cascade_level));
+  d.num_features = 0;
+
+  for (int k = 0; k < d.num_parts; k++) {
+    cascade_part *p = &d.parts[k];
+    p->parent = (int)mxGetScalar(get_field(mxparts, k, "parent"))-1;
+    if (p->parent >= k || (k > 0 && p->parent < 0) || (k == 0 && p->parent >= 0))
+      mexErrMsgTxt("Invalid input: parts should be in topological order");
+    p->level = rlevel - (int)mxGetScalar(get_field(mxparts, k, "scale"))*interval;
+    if (p->level < 0 || p->level >= num_levels)
+      mexErrMsgTxt("Invalid input: level out of range");
+
+    // pack the feature level the first time a part needs it
+    cascade_level *level = &d.levels[p->level];
+    const mxArray *mxfeat = mxGetCell(feat, p->level);
+    if (!mxfeat || mxGetNumberOfDimensions(mxfeat) != 3 ||
+        !(mxIsSingle(mxfeat) || mxIsDouble(mxfeat)))
+      mexErrMsgTxt("Invalid input: pyra.feat");
+    const mwSize *dims = mxGetDimensions(mxfeat);
+    if (d.num_features == 0)
+      d.num_features = simd_padded(dims[2]);
+    if (!level->feat) {
+      level->height = dims[0];
+      level->width = dims[1];
+      level->feat = (float *)mxMalloc(dims[0]*dims[1]*d.num_features*sizeof(float));
+      if (mxIsSingle(mxfeat))
+        pack((float *)mxGetData(mxfeat), level->feat, dims[0], dims[1], dims[2], d.num_features);
+      else
+        pack(mxGetPr(mxfeat), level->feat, dims[0], dims[1], dims[2], d.num_features);
+    }
+
+    const mxArray *filterid = get_field(mxparts, k, "filterid");
+    p->K = mxGetNumberOfElements(filterid);
+    int L = k > 0 ? d.parts[p->parent].K : 1;
+    if (p->K < 1 || numel(mxparts, k, "b") != L*p->K)
+      mexErrMsgTxt("Invalid input: parts");
+    p->b = mxGetPr(get_field(mxparts, k, "b"));
+    if (k > 0) {
+      if (numel(mxparts, k, "w") < 4*p->K || numel(mxparts, k, "startx") < p->K ||
+          numel(mxparts, k, "starty") < p->K || numel(mxparts, k, "step") < 1)
+        mexErrMsgTxt("Invalid input: parts");
+      p->w = mxGetPr(get_field(mxparts, k, "w"));
+      p->startx = mxGetPr(get_field(mxparts, k, "startx"));
+      p->starty = mxGetPr(get_field(mxparts, k, "starty"));
+      p->step = (int)mxGetScalar(get_field(mxparts, k, "step"));
+    }
+
+    // pack the filters; mixtures of a part have the same size
+    p->B = (float **)mxCalloc(p->K, sizeof(float *));
+    p->fh = (int *)mxCalloc(p->K, sizeof(int));
+    p->fw = (int *)mxCalloc(p->K, sizeof(int));
+    for (int m = 0; m < p->K; m++) {
+      int f = (int)mxGetPr(filterid)[m]-1;
+      const mxArray *mxB = (f >= 0 && f < (int)mxGetNumberOfElements(filters)) ?
+                           mxGetCell(filters, f) : NULL;
+      if (!mxB || !mxIsDouble(mxB) || mxGetNumberOfDimensions(mxB) != 3 ||
+          mxGetDimensions(mxB)[2] != dims[2])
+        mexErrMsgTxt("Invalid input: filters");
+      const mwSize *B_dims = mxGetDimensions(mxB);
+      p->fh[m] = B_dims[0];
+      p->fw[m] = B_dims[1];
+      p->B[m] = (float *)mxMalloc(B_dims[0]*B_dims[1]*d.num_features*sizeof(float));
+      pack(mxGetPr(mxB), p->B[m], B_dims[0], B_dims[1], B_dims[2], d.num_features);
+      if (p->fh[m] != p->fh[0] || p->fw[m] != p->fw[0])
+        mexErrMsgTxt("Invalid input: mixtures of a part differ in size");
+    }
+    p->height = level->height - p->fh[0] + 1;
+    p->width = level->width - p->fw[0] + 1;
+    if (p->height < 1 || p->width < 1)
+      mexErrMsgTxt("Invalid input: filters should be smaller than pyra.feat");
+    size_t n = (size_t)p->height*p->width*p->K;
+    p->resp = (double *)mxMalloc(n*sizeof(double));
+    for (size_t i = 0; i < n; i++)
+      p->resp[i] = NAN;
+  }
+
+  // run the stages
+  cascade_part *root = &d.parts[0];
+  size_t num_hyps = (size_t)root->height*root->width;
+  d.X = (int *)mxMalloc(num_hyps*d.num_parts*sizeof(int));
+  d.Y = (int *)mxMalloc(num_hyps*d.num_parts*sizeof(int));
+  d.M = (int *)mxMalloc(num_hyps*d.num_parts*sizeof(int));
+  d.S = (double *)mxMalloc(num_hyps*d.num_parts*sizeof(double));
+  d.alive = (bool *)mxMalloc(num_hyps*sizeof(bool));
+  ThreadPool::instance().parallel_for(root->width, evaluate_column, &d);
+
+  // collect the survivors
+  int n = 0;
+  for (size_t h = 0; h < num_hyps; h++)
+    n += d.alive[h];
+  mxArray *mxX = mxCreateDoubleMatrix(n, d.num_parts, mxREAL);
+  mxArray *mxY = mxCreateDoubleMatrix(n, d.num_parts, mxREAL);
+  mxArray *mxM = mxCreateDoubleMatrix(n, d.num_parts, mxREAL);
+  mxArray *mxS = mxCreateDoubleMatrix(n, d.num_parts, mxREAL);
+  double *X = mxGetPr(mxX), *Y = mxGetPr(mxY), *M = mxGetPr(mxM), *S = mxGetPr(mxS);
+  int i = 0;
+  for (size_t h = 0; h < num_hyps; h++) {
+    if (!d.alive[h])
+      continue;
+    for (int k = 0; k < d.num_parts; k++) {
+      size_t j = h*d.num_parts + k;
+      X[i+(size_t)n*k] = d.X[j]+1;
+      Y[i+(size_t)n*k] = d.Y[j]+1;
+      M[i+(size_t)n*k] = d.M[j]+1;
+      S[i+(size_t)n*k] = d.S[j];
+    }
+    i++;
+  }
+  plhs[0] = mxX;
+  if (nlhs > 1) plhs[1] = mxY; else mxDestroyArray(mxY);
+  if (nlhs > 2) plhs[2] = mxM; else mxDestroyArray(mxM);
+  if (nlhs > 3) plhs[3] = mxS; else mxDestroyArray(mxS);
+
+  for (int k = 0; k < d.num_parts; k++) {
+    cascade_part *p = &d.parts[k];
+    for (int m = 0; m < p->K; m++)
+      mxFree(p->B[m]);
+    mxFree(p->B);
+    mxFree(p->fh);
+    mxFree(p->fw);
+    mxFree(p->resp);
+  }
+  for (int l = 0; l < num_levels; l++)
+    if (d.levels[l].feat)
+      mxFree(d.levels[l].feat);
+  mxFree(d.X);
+  mxFree(d.Y);
+  mxFree(d.M);
+  mxFree(d.S);
+  mxFree(d.alive);
+  mxFree(d.levels);
+  mxFree(d.parts);
+}
@@ -0,0 +1,30 @@
+function cascade = cascade_thresholds(model, recall)
+% cascade = cascade_thresholds(model, recall)
+% Stage thresholds of the cascade detection mode that keep about a recall
+% fraction of the training positives scored by pose.cascade.  Every part
+% drops an equal share of the positives, the lowest partial scores first,
+% so recall = 1 thresholds each stage at the lowest positive.
+%
+% The result is the last argument of detect_fast.
+
+assert(isfield(model, 'cascade'), 'Run pose.cascade on the model first');
+assert(recall > 0 && recall <= 1, 'Recall should be in (0,1]');
+
+cascade.radius = model.cascade.radius;
+cascade.thresh = cell(1, length(model.components));
+for c = 1:length(model.components)
+  numparts = length(model.components{c});
+  t = -inf(1, numparts);
+  S = model.cascade.scores{c};
+  if ~isempty(S)
+    num = size(S, 1);
+    alive = true(num, 1);
+    for k = 1:numparts
+      s = sort(S(alive, k));
+      drop = max(floor((1-recall)*num*k/numparts) - (num-numel(s)), 0);
+      t(k) = s(min(drop+1, numel(s)));
+      alive = alive & S(:, k) >= t(k);
+    end
+  end
+  cascade.thresh{c} = t;
+end
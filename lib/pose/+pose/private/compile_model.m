@@ -0,0 +1,55 @@
+function cmodel = compile_model(model)
+% cmodel = compile_model(model)
+% Gather the part topology, anchors, biases and filters of the model once
+% into the flat arrays read by detect_batch, instead of once per image as
+% in detect_fast.
+%
+% Every component holds per-part rows (parent, scale, step) and
+% per-mixture rows (filterid, sizx, sizy, startx, starty, w); mix(k)+1 is
+% the first mixture of part k and bias(k)+1 its first entry in b.
+
+% the padding featpyramid uses, which the anchors depend on
+pyra.pady = max(model.maxsize(1)-1-1,0);
+pyra.padx = max(model.maxsize(2)-1-1,0);
+components = modelcomponents_fast(model,pyra);
+
+cmodel.sbin     = model.sbin;
+cmodel.interval = model.interval;
+cmodel.padx     = pyra.padx;
+cmodel.pady     = pyra.pady;
+cmodel.filters  = cellfun(@single,{model.filters.w},'UniformOutput',false);
+cmodel.components = struct('parent',{},'scale',{},'step',{},'mix',{}, ...
+  'bias',{},'filterid',{},'sizx',{},'sizy',{},'startx',{},'starty',{}, ...
+  'w',{},'b',{});
+for c = 1:length(components),
+  parts = components{c};
+  numparts = length(parts);
+  K = arrayfun(@(p) numel(p.filterid),parts);
+  comp.parent   = [parts.parent];
+  comp.scale    = [parts.scale];
+  comp.step     = ones(1,numparts);
+  comp.mix      = [0 cumsum(K)];
+  comp.bias     = [0 cumsum(arrayfun(@(p) numel(p.b),parts))];
+  comp.filterid = zeros(1,sum(K));
+  comp.sizx     = zeros(1,sum(K));
+  comp.sizy     = zeros(1,sum(K));
+  comp.startx   = zeros(1,sum(K));
+  comp.starty   = zeros(1,sum(K));
+  comp.w        = zeros(4,sum(K));
+  comp.b        = zeros(1,comp.bias(end));
+  for k = 1:numparts,
+    p = parts(k);
+    i = comp.mix(k)+1:comp.mix(k+1);
+    comp.filterid(i) = p.filterid;
+    comp.sizx(i)     = p.sizx;
+    comp.sizy(i)     = p.sizy;
+    comp.b(comp.bias(k)+1:comp.bias(k+1)) = p.b(:);
+    if k > 1,
+      comp.step(k)   = p.step;
+      comp.startx(i) = p.startx;
+      comp.starty(i) = p.starty;
+      comp.w(:,i)    = p.w;
+    end
+  end
+  cmodel.components(c) = comp;
+end
@@ -0,0 +1,94 @@
+#ifndef POSE_CONV_H
+#define POSE_CONV_H
+
+#include "simd.h"
+
+/*
+ * Filter responses of a packed feature map, shared by fconvSIMD and the
+ * batch detector.
+ *
+ * The feature map and the filters are packed so that the feature
+ * dimension is innermost, see pack() in simd.h, which turns every filter
+ * column into one contiguous dot product of length height*features.  The
+ * output is split into tiles of map columns, and each conv_tile task
+ * convolves one tile with all the filters while its columns are still in
+ * cache.
+ */
+
+// number of output columns per tile
+#define TILE_COLS 8
+
+struct packed_filter {
+  float *B;
+  int height;
+  int width;
+  double *C;               // C_dims[0] x C_dims[1] responses
+  int C_dims[2];
+};
+
+struct conv_data {
+  float *A;
+  int A_height;
+  int A_width;
+  int num_features;
+  packed_filter *filters;
+  int num_filters;
+  int num_tiles;
+};
+
+// convolve output columns [x0,x1) of one filter
+static void convolve_tile(const conv_data *args, const packed_filter *p,
+                   int x0, int x1) {
+  const int nf = args->num_features;
+  const int len = p->height*nf;
+  const int stride = args->A_height*nf;
+  const int height = p->C_dims[0];
+
+  for (int x = x0; x < x1; x++) {
+    double *dst = p->C + x*height;
+    int y = 0;
+    // four output rows at a time share every filter load
+    for (; y+4 <= height; y += 4) {
+      vfloat s0 = vzero(), s1 = vzero(), s2 = vzero(), s3 = vzero();
+      for (int xp = 0; xp < p->width; xp++) {
+        const float *a = args->A + (x+xp)*stride + y*nf;
+        const float *b = p->B + xp*len;
+        for (int i = 0; i < len; i += SIMD_WIDTH) {
+          vfloat bv = vload(b+i);
+          s0 = vmadd(vload(a+i), bv, s0);
+          s1 = vmadd(vload(a+i+nf), bv, s1);
+          s2 = vmadd(vload(a+i+2*nf), bv, s2);
+          s3 = vmadd(vload(a+i+3*nf), bv, s3);
+        }
+      }
+      dst[y] = vsum(s0);
+      dst[y+1] = vsum(s1);
+      dst[y+2] = vsum(s2);
+      dst[y+3] = vsum(s3);
+    }
+    for (; y < height; y++) {
+      vfloat s = vzero();
+      for (int xp = 0; xp < p->width; xp++) {
+        const float *a = args->A + (x+xp)*stride + y*nf;
+        const float *b = p->B + xp*len;
+        for (int i = 0; i < len; i += SIMD_WIDTH)
+          s = vmadd(vload(a+i), vload(b+i), s);
+      }
+      dst[y] = vsum(s);
+    }
+  }
+}
+
+// convolve one tile of columns with all filters
+static void conv_tile(void *thread_arg, int t) {
+  conv_data *args = (conv_data *)thread_arg;
+  for (int i = 0; i < args->num_filters; i++) {
+    const packed_filter *p = &args->filters[i];
+    int x0 = t*TILE_COLS;
+    int x1 = x0+TILE_COLS < (int)p->C_dims[1] ? x0+TILE_COLS : p->C_dims[1];
+    if (x0 < x1)
+      convolve_tile(args, p, x0, x1);
+  }
+}
+
+#endif
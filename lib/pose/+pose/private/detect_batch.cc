@@ -0,0 +1,472 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mex.h"
+#include "pyramid.h"
+#include "conv.h"
+#include "tree.h"
+
+/*
+ * Detection on a whole batch of images with a model compiled once by
+ * compile_model, the equivalent of calling detect_fast on every image.
+ * Filter responses always use the direct convolution of conv.h, so the
+ * scores match detect_fast exactly where fconvFFT picks the direct method
+ * and up to the float32 rounding of the FFT, about 1e-6, elsewhere.
+ *
+ * Every image is one pool task that builds its pyramid, filter responses
+ * and tree inference on its own, with the nested loops running serially
+ * in the task; responses of a level are released as soon as no root
+ * level needs them anymore.  Only malloc is used in the tasks, and the
+ * boxes are copied to MATLAB arrays once all images are done.
+ */
+
+struct batch_component {
+  int num_parts;
+  const double *parent;    // per part, from 1, 0 for the root
+  const double *scale;     // per part, in octaves below the root
+  const double *step;
+  const double *mix;       // first mixture of every part, num_parts+1
+  const double *bias;      // first bias of every part, num_parts+1
+  const double *filterid;  // per mixture, from 1
+  const double *sizx;
+  const double *sizy;
+  const double *startx;
+  const double *starty;
+  const double *w;         // 4 per mixture
+  const double *b;
+};
+
+struct batch_image {
+  const void *data;
+  mxClassID type;
+  int height;
+  int width;
+  int chan;
+  double *rows;            // num_rows x (4*num_parts+2), row-major
+  int num_rows;
+  int capacity;
+  bool failed;             // out of memory
+};
+
+struct batch_data {
+  int sbin;
+  int interval;
+  int padx;
+  int pady;
+  double thresh;
+  packed_filter *filters;
+  int num_filters;
+  int num_features;        // padded, see simd_padded()
+  batch_component *components;
+  int num_components;
+  int num_cols;            // columns of a box
+  int max_scale;           // largest part scale of all components
+  batch_image *images;
+};
+
+// append the boxes of one tree inference as rows of the image's output
+static bool append_boxes(batch_image *im, const tree_data *t, int n, int cols) {
+  if (im->num_rows + n > im->capacity) {
+    int capacity = im->capacity > 0 ? 2*im->capacity : 64;
+    while (capacity < im->num_rows + n)
+      capacity *= 2;
+    double *rows = (double *)realloc(im->rows, (size_t)capacity*cols*sizeof(double));
+    if (rows == NULL)
+      return false;
+    im->rows = rows;
+    im->capacity = capacity;
+  }
+  for (int i = 0; i < n; i++) {
+    double *dst = im->rows + (size_t)(im->num_rows+i)*cols;
+    for (int j = 0; j < cols; j++)
+      dst[j] = t->boxes[i+(size_t)n*j];
+  }
+  im->num_rows += n;
+  return true;
+}
+
+// responses of every filter at one level, NULL when out of memory
+static double **level_responses(const batch_data *d, const pyramid_level *level) {
+  double **resp = (double **)calloc(d->num_filters, sizeof(double *));
+  conv_data conv;
+  conv.num_features = d->num_features;
+  conv.A_height = level->dims[0];
+  conv.A_width = level->dims[1];
+  conv.num_filters = d->num_filters;
+  conv.filters = (packed_filter *)malloc(d->num_filters*sizeof(packed_filter));
+  conv.A = (float *)malloc((size_t)level->dims[0]*level->dims[1]*d->num_features*sizeof(float));
+  bool ok = resp && conv.filters && conv.A;
+  int max_width = 0;
+  for (int i = 0; i < d->num_filters && ok; i++) {
+    packed_filter *p = &conv.filters[i];
+    *p = d->filters[i];
+    p->C_dims[0] = level->dims[0] - p->height + 1;
+    p->C_dims[1] = level->dims[1] - p->width + 1;
+    if (p->C_dims[0] < 1 || p->C_dims[1] < 1) {
+      p->C_dims[0] = p->C_dims[1] = 0;
+      continue;
+    }
+    resp[i] = p->C = (double *)malloc((size_t)p->C_dims[0]*p->C_dims[1]*sizeof(double));
+    ok = p->C != NULL;
+    if (p->C_dims[1] > max_width)
+      max_width = p->C_dims[1];
+  }
+  if (ok) {
+    pack(level->feat, conv.A, level->dims[0], level->dims[1], level->dims[2],
+         d->num_features);
+    conv.num_tiles = (max_width + TILE_COLS - 1) / TILE_COLS;
+    ThreadPool::instance().parallel_for(conv.num_tiles, conv_tile, &conv);
+  }
+  free(conv.filters);
+  free(conv.A);
+  if (!ok && resp) {
+    for (int i = 0; i < d->num_filters; i++)
+      free(resp[i]);
+    free(resp);
+    resp = NULL;
+  }
+  return resp;
+}
+
+static void free_responses(double **resp, int num_filters) {
+  if (resp == NULL)
+    return;
+  for (int i = 0; i < num_filters; i++)
+    free(resp[i]);
+  free(resp);
+}
+
+// tree inference of component c at root level rlevel, as in detect_fast
+static bool detect_level(const batch_data *d, batch_image *im, pyramid_data *pyra,
+                         double ***resp, int rlevel, int c) {
+  const batch_component *comp = &d->components[c];
+  tree_data t;
+  memset(&t, 0, sizeof(t));
+  t.num_parts = comp->num_parts;
+  t.scale = pyra->scale;
+  t.padx = d->padx;
+  t.pady = d->pady;
+  t.component = c+1;
+  t.parts = (tree_part *)calloc(t.num_parts, sizeof(tree_part));
+  if (t.parts == NULL)
+    return false;
+
+  bool ok = true;
+  bool empty = false;
+  for (int k = 0; k < t.num_parts && ok && !empty; k++) {
+    tree_part *p = &t.parts[k];
+    int m0 = (int)comp->mix[k];
+    p->parent = (int)comp->parent[k]-1;
+    p->level = rlevel - (int)comp->scale[k]*d->interval;
+    p->K = (int)comp->mix[k+1] - m0;
+    p->b = comp->b + (int)comp->bias[k];
+    p->w = comp->w + 4*m0;
+    p->startx = comp->startx + m0;
+    p->starty = comp->starty + m0;
+    p->step = (int)comp->step[k];
+    p->sizx = comp->sizx + m0;
+    p->sizy = comp->sizy + m0;
+    if (p->level < 0) {
+      empty = true;
+      break;
+    }
+    if (resp[p->level] == NULL) {
+      resp[p->level] = level_responses(d, &pyra->levels[p->level]);
+      ok = resp[p->level] != NULL;
+      if (!ok)
+        break;
+    }
+
+    // local scores, one plane per mixture
+    const packed_filter *f = &d->filters[(int)comp->filterid[m0]-1];
+    p->height = pyra->levels[p->level].dims[0] - f->height + 1;
+    p->width = pyra->levels[p->level].dims[1] - f->width + 1;
+    size_t N = (size_t)p->height*p->width;
+    for (int m = 0; m < p->K; m++) {
+      f = &d->filters[(int)comp->filterid[m0+m]-1];
+      int height = pyra->levels[p->level].dims[0] - f->height + 1;
+      int width = pyra->levels[p->level].dims[1] - f->width + 1;
+      if (height != p->height || width != p->width || height < 1 || width < 1)
+        empty = true;
+    }
+    if (empty)
+      break;
+    p->score = (double *)malloc(N*p->K*sizeof(double));
+    ok = p->score != NULL;
+    for (int m = 0; m < p->K && ok; m++)
+      memcpy(p->score + m*N, resp[p->level][(int)comp->filterid[m0+m]-1],
+             N*sizeof(double));
+  }
+
+  if (ok && !empty) {
+    int n = tree_detect(&t, d->thresh);
+    ok = n >= 0;
+    if (n > 1)
+      ok = append_boxes(im, &t, n, d->num_cols);
+  }
+  tree_free(&t);
+  free(t.parts);
+  return ok;
+}
+
+// all detections of image i
+static void detect_image(void *arg, int i) {
+  batch_data *d = (batch_data *)arg;
+  batch_image *im = &d->images[i];
+
+  // input image as float planes
+  pyramid_data pyra;
+  memset(&pyra, 0, sizeof(pyra));
+  pyra.height = im->height;
+  pyra.width = im->width;
+  pyra.sbin = d->sbin;
+  pyra.interval = d->interval;
+  pyra.padx = d->padx;
+  pyra.pady = d->pady;
+  int pixels = im->height*im->width;
+  pyra.im = (float *)malloc((size_t)pixels*3*sizeof(float));
+  if (pyra.im == NULL) {
+    im->failed = true;
+    return;
+  }
+  bool integral;
+  if (im->type == mxUINT8_CLASS)
+    integral = convert_image((const unsigned char *)im->data, pyra.im, pixels, im->chan);
+  else if (im->type == mxSINGLE_CLASS)
+    integral = convert_image((const float *)im->data, pyra.im, pixels, im->chan);
+  else
+    integral = convert_image((const double *)im->data, pyra.im, pixels, im->chan);
+
+  // an image too small for the model has no detections; pyramid_init
+  // only fails with its buffers allocated when a level is too small
+  const char *err = pyramid_init(&pyra, integral);
+  if (err && pyra.levels && pyra.scale) {
+    pyramid_free(&pyra);
+    free(pyra.im);
+    return;
+  }
+  int num_levels = pyra.num_levels;
+  double ***resp = NULL;
+  bool ok = err == NULL;
+  if (ok) {
+    for (int l = 0; l < num_levels && ok; l++) {
+      const int *dims = pyra.levels[l].dims;
+      pyra.levels[l].feat = (float *)calloc((size_t)dims[0]*dims[1]*dims[2], sizeof(float));
+      ok = pyra.levels[l].feat != NULL;
+    }
+    ok = ok && pyramid_build(&pyra);
+    resp = (double ***)calloc(num_levels, sizeof(double **));
+    ok = ok && resp != NULL;
+  }
+  // keep the features and scales, release the scaled images
+  for (int l = 1; ok && l < num_levels; l++) {
+    if (pyra.levels[l].owner) {
+      free(pyra.levels[l].im);
+      pyra.levels[l].owner = false;
+    }
+  }
+  free(pyra.im);
+  pyra.im = NULL;
+
+  // Iterate over scales and components
+  for (int rlevel = 0; rlevel < num_levels && ok; rlevel++) {
+    for (int c = 0; c < d->num_components && ok; c++)
+      ok = detect_level(d, im, &pyra, resp, rlevel, c);
+    // no later root level uses the responses of this one
+    int done = rlevel - d->max_scale*d->interval;
+    if (done >= 0) {
+      free_responses(resp[done], d->num_filters);
+      resp[done] = NULL;
+    }
+  }
+
+  if (resp) {
+    for (int l = 0; l < num_levels; l++)
+      free_responses(resp[l], d->num_filters);
+    free(resp);
+  }
+  if (pyra.levels) {
+    for (int l = 0; l < num_levels; l++)
+      free(pyra.levels[l].feat);
+  }
+  pyramid_free(&pyra);
+  im->failed = !ok;
+}
+
+static const mxArray *get_field(const mxArray *s, int i, const char *name) {
+  const mxArray *field = mxGetField(s, i, name);
+  if (field == NULL || !mxIsDouble(field) || mxGetNumberOfElements(field) < 1)
+    mexErrMsgTxt("Invalid input: cmodel");
+  return field;
+}
+
+static void free_batch(batch_data *d, int num_images) {
+  for (int i = 0; i < d->num_filters; i++)
+    mxFree(d->filters[i].B);
+  mxFree(d->filters);
+  mxFree(d->components);
+  for (int i = 0; i < num_images; i++)
+    free(d->images[i].rows);
+  mxFree(d->images);
+}
+
+// matlab entry point
+// boxes = detect_batch(ims, cmodel, thresh)
+// ims is a cell array of uint8, single or double images, gray or color,
+// and cmodel the output of compile_model.  Returns a cell array of the
+// same size with the boxes of every image, as detect_fast would.
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+  if (nrhs != 3)
+    mexErrMsgTxt("Wrong number of inputs");
+  if (nlhs > 1)
+    mexErrMsgTxt("Wrong number of outputs");
+  const mxArray *ims = prhs[0];
+  const mxArray *cmodel = prhs[1];
+  if (!mxIsCell(ims))
+    mexErrMsgTxt("Invalid input: ims");
+  if (!mxIsStruct(cmodel))
+    mexErrMsgTxt("Invalid input: cmodel");
+
+  batch_data d;
+  d.sbin = (int)mxGetScalar(get_field(cmodel, 0, "sbin"));
+  d.interval = (int)mxGetScalar(get_field(cmodel, 0, "interval"));
+  d.padx = (int)mxGetScalar(get_field(cmodel, 0, "padx"));
+  d.pady = (int)mxGetScalar(get_field(cmodel, 0, "pady"));
+  d.thresh = mxGetScalar(prhs[2]);
+  if (d.sbin < 1 || d.interval < 1)
+    mexErrMsgTxt("Invalid input: cmodel");
+
+  // validate everything before allocating
+  const mxArray *mxfilters = mxGetField(cmodel, 0, "filters");
+  const mxArray *mxcomponents = mxGetField(cmodel, 0, "components");
+  if (mxfilters == NULL || !mxIsCell(mxfilters) ||
+      mxcomponents == NULL || !mxIsStruct(mxcomponents))
+    mexErrMsgTxt("Invalid input: cmodel");
+  d.num_filters = mxGetNumberOfElements(mxfilters);
+  d.num_components = mxGetNumberOfElements(mxcomponents);
+  if (d.num_filters < 1 || d.num_components < 1)
+    mexErrMsgTxt("Invalid input: cmodel");
+  for (int i = 0; i < d.num_filters; i++) {
+    const mxArray *mxB = mxGetCell(mxfilters, i);
+    if (mxB == NULL || !mxIsSingle(mxB) || mxGetNumberOfDimensions(mxB) != 3 ||
+        mxGetDimensions(mxB)[2] != HOG_FEATURES)
+      mexErrMsgTxt("Invalid input: cmodel.filters");
+  }
+  d.num_cols = 0;
+  d.max_scale = 0;
+  for (int c = 0; c < d.num_components; c++) {
+    int num_parts = mxGetNumberOfElements(get_field(mxcomponents, c, "parent"));
+    const double *parent = mxGetPr(get_field(mxcomponents, c, "parent"));
+    const double *scale = mxGetPr(get_field(mxcomponents, c, "scale"));
+    const double *mix = mxGetPr(get_field(mxcomponents, c, "mix"));
+    const double *bias = mxGetPr(get_field(mxcomponents, c, "bias"));
+    const double *filterid = mxGetPr(get_field(mxcomponents, c, "filterid"));
+    int num_mix = (int)mix[num_parts];
+    if (c == 0)
+      d.num_cols = 4*num_parts+2;
+    if (4*num_parts+2 != d.num_cols ||
+        (int)mxGetNumberOfElements(get_field(mxcomponents, c, "mix")) != num_parts+1 ||
+        (int)mxGetNumberOfElements(get_field(mxcomponents, c, "bias")) != num_parts+1 ||
+        (int)mxGetNumberOfElements(get_field(mxcomponents, c, "scale")) != num_parts ||
+        (int)mxGetNumberOfElements(get_field(mxcomponents, c, "step")) != num_parts ||
+        (int)mxGetNumberOfElements(get_field(mxcomponents, c, "filterid")) != num_mix ||
+        (int)mxGetNumberOfElements(get_field(mxcomponents, c, "sizx")) != num_mix ||
+        (int)mxGetNumberOfElements(get_field(mxcomponents, c, "sizy")) != num_mix ||
+        (int)mxGetNumberOfElements(get_field(mxcomponents, c, "startx")) != num_mix ||
+        (int)mxGetNumberOfElements(get_field(mxcomponents, c, "starty")) != num_mix ||
+        (int)mxGetNumberOfElements(get_field(mxcomponents, c, "w")) != 4*num_mix ||
+        (int)mxGetNumberOfElements(get_field(mxcomponents, c, "b")) != (int)bias[num_parts])
+      mexErrMsgTxt("Invalid input: cmodel.components");
+    for (int k = 0; k < num_parts; k++) {
+      int p = (int)parent[k]-1;
+      int K = (int)(mix[k+1]-mix[k]);
+      int L = k > 0 ? (int)(mix[p+1]-mix[p]) : 1;
+      if (p >= k || (k > 0 && p < 0) || (k == 0 && p >= 0))
+        mexErrMsgTxt("Invalid input: parts should be in topological order");
+      if (K < 1 || (int)(bias[k+1]-bias[k]) != L*K || scale[k] < 0)
+        mexErrMsgTxt("Invalid input: cmodel.components");
+      if ((int)scale[k] > d.max_scale)
+        d.max_scale = (int)scale[k];
+    }
+    for (int m = 0; m < num_mix; m++)
+      if ((int)filterid[m] < 1 || (int)filterid[m] > d.num_filters)
+        mexErrMsgTxt("Invalid input: cmodel.components");
+  }
+  int num_images = mxGetNumberOfElements(ims);
+  for (int i = 0; i < num_images; i++) {
+    const mxArray *mximage = mxGetCell(ims, i);
+    if (mximage == NULL)
+      mexErrMsgTxt("Invalid input: ims");
+    const mwSize *im_dims = mxGetDimensions(mximage);
+    int chan = mxGetNumberOfDimensions(mximage) == 3 ? im_dims[2] : 1;
+    if (mxGetNumberOfDimensions(mximage) > 3 || (chan != 1 && chan != 3) ||
+        !(mxIsUint8(mximage) || mxIsSingle(mximage) || mxIsDouble(mximage)))
+      mexErrMsgTxt("Invalid input: image");
+  }
+
+  // pack the filters once for all images
+  d.num_features = simd_padded(HOG_FEATURES);
+  d.filters = (packed_filter *)mxCalloc(d.num_filters, sizeof(packed_filter));
+  for (int i = 0; i < d.num_filters; i++) {
+    const mxArray *mxB = mxGetCell(mxfilters, i);
+    const mwSize *B_dims = mxGetDimensions(mxB);
+    packed_filter *p = &d.filters[i];
+    p->height = B_dims[0];
+    p->width = B_dims[1];
+    p->B = (float *)mxMalloc(p->height*p->width*d.num_features*sizeof(float));
+    pack((const float *)mxGetData(mxB), p->B, p->height, p->width, HOG_FEATURES,
+         d.num_features);
+  }
+  d.components = (batch_component *)mxCalloc(d.num_components, sizeof(batch_component));
+  for (int c = 0; c < d.num_components; c++) {
+    batch_component *comp = &d.components[c];
+    comp->num_parts = mxGetNumberOfElements(get_field(mxcomponents, c, "parent"));
+    comp->parent = mxGetPr(get_field(mxcomponents, c, "parent"));
+    comp->scale = mxGetPr(get_field(mxcomponents, c, "scale"));
+    comp->step = mxGetPr(get_field(mxcomponents, c, "step"));
+    comp->mix = mxGetPr(get_field(mxcomponents, c, "mix"));
+    comp->bias = mxGetPr(get_field(mxcomponents, c, "bias"));
+    comp->filterid = mxGetPr(get_field(mxcomponents, c, "filterid"));
+    comp->sizx = mxGetPr(get_field(mxcomponents, c, "sizx"));
+    comp->sizy = mxGetPr(get_field(mxcomponents, c, "sizy"));
+    comp->startx = mxGetPr(get_field(mxcomponents, c, "startx"));
+    comp->starty = mxGetPr(get_field(mxcomponents, c, "starty"));
+    comp->w = mxGetPr(get_field(mxcomponents, c, "w"));
+    comp->b = mxGetPr(get_field(mxcomponents, c, "b"));
+  }
+  d.images = (batch_image *)mxCalloc(num_images > 0 ? num_images : 1, sizeof(batch_image));
+  for (int i = 0; i < num_images; i++) {
+    const mxArray *mximage = mxGetCell(ims, i);
+    const mwSize *im_dims = mxGetDimensions(mximage);
+    batch_image *im = &d.images[i];
+    im->data = mxGetData(mximage);
+    im->type = mxGetClassID(mximage);
+    im->height = im_dims[0];
+    im->width = im_dims[1];
+    im->chan = mxGetNumberOfDimensions(mximage) == 3 ? im_dims[2] : 1;
+  }
+
+  // the pool, the arena and the tables are created from this thread
+  hog_init_lut();
+  ThreadPool &pool = ThreadPool::instance();
+  DtArena::instance();
+  pool.parallel_for(num_images, detect_image, &d);
+
+  for (int i = 0; i < num_images; i++) {
+    if (d.images[i].failed) {
+      free_batch(&d, num_images);
+      mexErrMsgTxt("Out of memory");
+    }
+  }
+  plhs[0] = mxCreateCellArray(mxGetNumberOfDimensions(ims), mxGetDimensions(ims));
+  for (int i = 0; i < num_images; i++) {
+    const batch_image *im = &d.images[i];
+    mxArray *boxes = mxCreateDoubleMatrix(im->num_rows, d.num_cols, mxREAL);
+    double *dst = mxGetPr(boxes);
+    for (int r = 0; r < im->num_rows; r++)
+      for (int j = 0; j < d.num_cols; j++)
+        dst[r+(size_t)im->num_rows*j] = im->rows[(size_t)r*d.num_cols+j];
+    mxSetCell(plhs[0], i, boxes);
+  }
+  free_batch(&d, num_images);
+}
@@ -0,0 +1,127 @@
+#include <math.h>
+#include <string.h>
+#include "mex.h"
+#include "tree.h"
+
+/*
+ * Tree inference of one component of the pose model at one root level,
+ * the inner loop of detect_fast.  The local scores of every part are read
+ * from the response cache, the inference itself is in tree.h.
+ */
+
+// the score and message buffers are malloc'ed, release them before raising
+static void fail(tree_data *d, const char *msg) {
+  tree_free(d);
+  mexErrMsgTxt(msg);
+}
+
+static const mxArray *get_field(tree_data *d, const mxArray *s, int k, const char *name) {
+  const mxArray *field = mxGetField(s, k, name);
+  if (field == NULL || !mxIsDouble(field))
+    fail(d, "Invalid input: parts");
+  return field;
+}
+
+static int numel(tree_data *d, const mxArray *s, int k, const char *name) {
+  return mxGetNumberOfElements(get_field(d, s, k, name));
+}
+
+// matlab entry point
+// boxes = detect_component(parts, resp, rlevel, pyra, c, thresh)
+// parts is the part struct array of component c built by detect_fast,
+// resp the response cache with every level used by the parts filled in.
+// Returns one row [x1 y1 x2 y2 (per part) c score] per root location at
+// rlevel scoring at least thresh, in the order of find().
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+  if (nrhs != 6)
+    mexErrMsgTxt("Wrong number of inputs");
+  if (nlhs != 1)
+    mexErrMsgTxt("Wrong number of outputs");
+  const mxArray *mxparts = prhs[0];
+  const mxArray *resp = prhs[1];
+  if (!mxIsStruct(mxparts) || !mxIsCell(resp) || !mxIsStruct(prhs[3]))
+    mexErrMsgTxt("Invalid input");
+  int rlevel = (int)mxGetScalar(prhs[2])-1;
+  const mxArray *mxscale = mxGetField(prhs[3], 0, "scale");
+  const mxArray *mxinterval = mxGetField(prhs[3], 0, "interval");
+  const mxArray *mxpadx = mxGetField(prhs[3], 0, "padx");
+  const mxArray *mxpady = mxGetField(prhs[3], 0, "pady");
+  if (!mxscale || !mxIsDouble(mxscale) || !mxinterval || !mxpadx || !mxpady)
+    mexErrMsgTxt("Invalid input: pyra");
+  int interval = (int)mxGetScalar(mxinterval);
+  int num_levels = mxGetNumberOfElements(mxscale);
+  double thresh = mxGetScalar(prhs[5]);
+
+  tree_data d;
+  memset(&d, 0, sizeof(d));
+  d.num_parts = mxGetNumberOfElements(mxparts);
+  if (d.num_parts < 1)
+    mexErrMsgTxt("Invalid input: parts");
+  d.parts = (tree_part *)mxCalloc(d.num_parts, sizeof(tree_part));
+  d.scale = mxGetPr(mxscale);
+  d.padx = mxGetScalar(mxpadx);
+  d.pady = mxGetScalar(mxpady);
+  d.component = (int)mxGetScalar(prhs[4]);
+
+  // model and local scores
+  for (int k = 0; k < d.num_parts; k++) {
+    tree_part *p = &d.parts[k];
+    const mxArray *filterid = get_field(&d, mxparts, k, "filterid");
+    p->parent = (int)mxGetScalar(get_field(&d, mxparts, k, "parent"))-1;
+    if (p->parent >= k || (k > 0 && p->parent < 0) || (k == 0 && p->parent >= 0))
+      fail(&d, "Invalid input: parts should be in topological order");
+    p->level = rlevel - (int)mxGetScalar(get_field(&d, mxparts, k, "scale"))*interval;
+    if (p->level < 0 || p->level >= num_levels ||
+        p->level >= (int)mxGetNumberOfElements(resp))
+      fail(&d, "Invalid input: level out of range");
+    const mxArray *cache = mxGetCell(resp, p->level);
+    if (cache == NULL || !mxIsCell(cache))
+      fail(&d, "Invalid input: resp is not filled in");
+    p->K = mxGetNumberOfElements(filterid);
+    p->b = mxGetPr(get_field(&d, mxparts, k, "b"));
+    p->sizx = mxGetPr(get_field(&d, mxparts, k, "sizx"));
+    p->sizy = mxGetPr(get_field(&d, mxparts, k, "sizy"));
+    if (p->K < 1 || numel(&d, mxparts, k, "sizx") < p->K ||
+        numel(&d, mxparts, k, "sizy") < p->K)
+      fail(&d, "Invalid input: parts");
+    int L = k > 0 ? d.parts[p->parent].K : 1;
+    if (numel(&d, mxparts, k, "b") != L*p->K)
+      fail(&d, "Invalid input: parts.b");
+    if (k > 0) {
+      if (numel(&d, mxparts, k, "w") < 4*p->K || numel(&d, mxparts, k, "startx") < p->K ||
+          numel(&d, mxparts, k, "starty") < p->K || numel(&d, mxparts, k, "step") < 1)
+        fail(&d, "Invalid input: parts");
+      p->w = mxGetPr(get_field(&d, mxparts, k, "w"));
+      p->startx = mxGetPr(get_field(&d, mxparts, k, "startx"));
+      p->starty = mxGetPr(get_field(&d, mxparts, k, "starty"));
+      p->step = (int)mxGetScalar(get_field(&d, mxparts, k, "step"));
+    }
+
+    for (int m = 0; m < p->K; m++) {
+      int f = (int)mxGetPr(filterid)[m]-1;
+      const mxArray *r = (f >= 0 && f < (int)mxGetNumberOfElements(cache)) ?
+                         mxGetCell(cache, f) : NULL;
+      if (r == NULL || !mxIsDouble(r))
+        fail(&d, "Invalid input: resp");
+      if (m == 0) {
+        p->height = mxGetM(r);
+        p->width = mxGetN(r);
+        p->score = (double *)malloc((size_t)p->height*p->width*p->K*sizeof(double));
+        if (p->score == NULL)
+          fail(&d, "Out of memory");
+      } else if ((int)mxGetM(r) != p->height || (int)mxGetN(r) != p->width) {
+        fail(&d, "Invalid input: mixtures of a part differ in size");
+      }
+      size_t N = (size_t)p->height*p->width;
+      memcpy(p->score + m*N, mxGetPr(r), N*sizeof(double));
+    }
+  }
+
+  int n = tree_detect(&d, thresh);
+  if (n < 0)
+    fail(&d, "Out of memory");
+  plhs[0] = mxCreateDoubleMatrix(n, 4*d.num_parts+2, mxREAL);
+  memcpy(mxGetPr(plhs[0]), d.boxes, (size_t)n*(4*d.num_parts+2)*sizeof(double));
+  tree_free(&d);
+  mxFree(d.parts);
+}
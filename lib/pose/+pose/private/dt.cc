@@ -1,53 +1,38 @@
-#define INF 1E20
 #include <math.h>
 #include <sys/types.h>
 #include "mex.h"
+#include "dt.h"
 
 /*
  * Generalized distance transforms based on Felzenswalb and Huttenlocher.
  * This computes output values on a shifted grid of length "end", 
  * shifted to start at index "start"
  * This is useful for computing shifted messages
+ * The line transform dt1d is in dt.h.
  */
 
-static inline int square(int x) { return x*x; }
-
-void dt1d(double *src, double *dst, int *ptr, int step, int n, double a, double b, int start, int end, int delta) {
-  int   *v = new int[n];
-  float *z = new float[n+1];
-  int k = 0;
-  int q = 0;
-  v[0] = 0;
-  z[0] = -INF;
-  z[1] = +INF;
-  for (q = 1; q <= n-1; q++) {
-    float s = ((src[q*step] - src[v[k]*step]) - b*(q - v[k]) + a*(square(q) - square(v[k]))) / (2*a*(q-v[k]));
-    while (s <= z[k]) {
-      // Update pointer
-      k--;
-      s  = ((src[q*step] - src[v[k]*step]) - b*(q - v[k]) + a*(square(q) - square(v[k]))) / (2*a*(q-v[k]));
-    }
-    k++;
-    v[k]   = q;
-    z[k]   = s;
-    z[k+1] = +INF;
-  }
-
-   k = 0;
-   q = start;
-   for (int i=0; i <= end-1; i++) {
-     while (z[k+1] < q)
-       k++;
-     dst[i*step] = a*square(q-v[k]) + b*(q-v[k]) + src[v[k]*step];
-     ptr[i*step] = v[k];
-     q+=delta;
-  }
-
-  delete [] v;
-  delete [] z;
+// arguments shared by the column and row passes
+struct dt_data {
+  double *vals, *tmpM, *M;
+  int32_t *tmpIx, *tmpIy;
+  const int *dims;
+  double ax, bx, ay, by;
+  int offx, offy, Nx, Ny, step;
+};
+
+void dt_column(void *arg, int x) {
+  dt_data *d = (dt_data *)arg;
+  const int *dims = d->dims;
+  dt_scratch &s = DtArena::instance().local();
+  dt1d(d->vals+x*dims[0], d->tmpM+x*dims[0], d->tmpIy+x*dims[0], 1, dims[0], d->ay, d->by, d->offy, d->Ny, d->step, s.v, s.z);
 }
 
-
+void dt_row(void *arg, int y) {
+  dt_data *d = (dt_data *)arg;
+  const int *dims = d->dims;
+  dt_scratch &s = DtArena::instance().local();
+  dt1d(d->tmpM+y, d->M+y, d->tmpIx+y, dims[0], dims[1], d->ax, d->bx, d->offx, d->Nx, d->step, s.v, s.z);
+}
 
 // matlab entry point
 // [M, Ix, Iy] = dt(vals, ax, bx, ay, by)
@@ -86,11 +71,12 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 
   // printf("(%g,%g),(%g,%g)(%d,%d)\n",offx,offy,Nx,Ny,dims[1],dims[0]);
 
-  for (int x = 0; x < dims[1]; x++)
-    dt1d(vals+x*dims[0], tmpM+x*dims[0], tmpIy+x*dims[0], 1, dims[0], ay, by, offy, Ny, step);
-  
-  for (int y = 0; y < dims[0]; y++)
-    dt1d(tmpM+y, M+y, tmpIx+y, dims[0], dims[1], ax, bx, offx, Nx, step);
+  // columns and rows are independent, run each pass on the thread pool
+  if (!DtArena::instance().reserve(dims[0] > dims[1] ? dims[0] : dims[1], 0))
+    mexErrMsgTxt("Out of memory");
+  dt_data d = {vals, tmpM, M, tmpIx, tmpIy, dims, ax, bx, ay, by, offx, offy, Nx, Ny, step};
+  ThreadPool::instance().parallel_for(dims[1], dt_column, &d);
+  ThreadPool::instance().parallel_for(dims[0], dt_row, &d);
 
   // get argmins and adjust for matlab indexing from 1
   for (int x = 0; x < Nx; x++) {
@@ -0,0 +1,194 @@
+#ifndef POSE_DT_H
+#define POSE_DT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "mex.h"
+#include "thread_pool.h"
+
+/*
+ * Generalized distance transforms based on Felzenszwalb and Huttenlocher,
+ * shared by the distance transform mex files.
+ *
+ * The lower envelope (v, z) of a line and the column pass results of a
+ * map are kept in per-thread scratch buffers instead of being allocated
+ * for every row and column.  The buffers only grow, are reserved from
+ * the calling thread before a parallel loop, and are released together
+ * with the thread pool when the mex file is cleared.
+ */
+
+#define DT_INF 1E20
+
+static inline int dt_square(int x) { return x*x; }
+
+// min convolution of the n samples src[0], src[step], ... with the
+// quadratic a*d^2 + b*d, evaluated on the shifted grid start,
+// start+delta, ... of length len; v holds n ints and z n+1 floats
+static inline void dt1d(const double *src, double *dst, int32_t *ptr, int step, int n,
+                        double a, double b, int start, int len, int delta,
+                        int *v, float *z) {
+  int k = 0;
+  int q = 0;
+  v[0] = 0;
+  z[0] = -DT_INF;
+  z[1] = +DT_INF;
+  for (q = 1; q <= n-1; q++) {
+    float s = ((src[q*step] - src[v[k]*step]) - b*(q - v[k]) + a*(dt_square(q) - dt_square(v[k]))) / (2*a*(q-v[k]));
+    while (s <= z[k]) {
+      // Update pointer
+      k--;
+      s  = ((src[q*step] - src[v[k]*step]) - b*(q - v[k]) + a*(dt_square(q) - dt_square(v[k]))) / (2*a*(q-v[k]));
+    }
+    k++;
+    v[k]   = q;
+    z[k]   = s;
+    z[k+1] = +DT_INF;
+  }
+
+  k = 0;
+  q = start;
+  for (int i = 0; i <= len-1; i++) {
+    while (z[k+1] < q)
+      k++;
+    dst[i*step] = a*dt_square(q-v[k]) + b*(q-v[k]) + src[v[k]*step];
+    ptr[i*step] = v[k];
+    q += delta;
+  }
+}
+
+// scratch memory of one pool thread
+struct dt_scratch {
+  int *v;        // lower envelope locations, line_size
+  float *z;      // lower envelope boundaries, line_size+1
+  double *M;     // column pass values, map_size
+  int32_t *I;    // column pass argmins, map_size
+  int line_size;
+  size_t map_size;
+};
+
+class DtArena {
+ public:
+  // process-wide instance, created on first use together with the pool
+  static DtArena &instance() {
+    if (!instance_) {
+      ThreadPool &pool = ThreadPool::instance();
+      instance_ = new DtArena(pool.size());
+      // replaces the pool's own exit handler, destroy() releases both
+      mexAtExit(destroy);
+    }
+    return *instance_;
+  }
+
+  static void destroy() {
+    delete instance_;
+    instance_ = NULL;
+    ThreadPool::destroy();
+  }
+
+  // make every thread hold lines of n and maps of m samples; must be
+  // called before the parallel loop that uses the scratch.  Inside a pool
+  // task only the scratch of the calling thread grows, as nested loops
+  // run on it, and no other thread can be using its own meanwhile.
+  // Returns false when out of memory.
+  bool reserve(int n, size_t m) {
+    if (ThreadPool::in_worker())
+      return grow(&local(), n, m);
+    for (int s = 0; s < num_slots_; s++)
+      if (!grow(&slots_[s], n, m))
+        return false;
+    return true;
+  }
+
+  // scratch of the calling thread
+  dt_scratch &local() { return slots_[ThreadPool::slot()]; }
+
+ private:
+  static bool grow(dt_scratch *d, int n, size_t m) {
+    if (d->line_size < n) {
+      free(d->v);
+      free(d->z);
+      d->v = (int *)malloc(n*sizeof(int));
+      d->z = (float *)malloc((n+1)*sizeof(float));
+      d->line_size = n;
+      if (!d->v || !d->z) {
+        d->line_size = 0;
+        return false;
+      }
+    }
+    if (d->map_size < m) {
+      free(d->M);
+      free(d->I);
+      d->M = (double *)malloc(m*sizeof(double));
+      d->I = (int32_t *)malloc(m*sizeof(int32_t));
+      d->map_size = m;
+      if (!d->M || !d->I) {
+        d->map_size = 0;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  explicit DtArena(int num_slots) : num_slots_(num_slots) {
+    slots_ = (dt_scratch *)calloc(num_slots_, sizeof(dt_scratch));
+  }
+
+  ~DtArena() {
+    for (int s = 0; s < num_slots_; s++) {
+      free(slots_[s].v);
+      free(slots_[s].z);
+      free(slots_[s].M);
+      free(slots_[s].I);
+    }
+    free(slots_);
+  }
+
+  static DtArena *instance_;
+
+  int num_slots_;
+  dt_scratch *slots_;
+};
+
+DtArena *DtArena::instance_ = NULL;
+
+// one shifted 2D transform of a sizy x sizx map onto a leny x lenx grid
+struct dt_job {
+  const double *vals;
+  int sizx, sizy;
+  double ax, bx, ay, by;
+  int offx, offy, lenx, leny, step;
+  double *M;
+  int32_t *Ix, *Iy;
+};
+
+// pool task arguments, one task per job
+struct dt_batch {
+  dt_job *jobs;
+  DtArena *arena;
+};
+
+// column pass into the scratch of the calling thread, then row pass into
+// M; the argmins are written straight into Ix and Iy, indexed from 1
+static void dt_map(void *arg, int j) {
+  dt_batch *d = (dt_batch *)arg;
+  const dt_job *job = &d->jobs[j];
+  dt_scratch &s = d->arena->local();
+  int leny = job->leny;
+
+  for (int x = 0; x < job->sizx; x++)
+    dt1d(job->vals+x*job->sizy, s.M+x*leny, s.I+x*leny, 1, job->sizy,
+         job->ay, job->by, job->offy, leny, job->step, s.v, s.z);
+
+  for (int y = 0; y < leny; y++) {
+    dt1d(s.M+y, job->M+y, job->Ix+y, leny, job->sizx,
+         job->ax, job->bx, job->offx, job->lenx, job->step, s.v, s.z);
+    // get argmins and adjust for matlab indexing from 1
+    for (int x = 0; x < job->lenx; x++) {
+      int p = x*leny+y;
+      job->Iy[p] = s.I[job->Ix[p]*leny+y]+1;
+      job->Ix[p] = job->Ix[p]+1;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,506 @@
+#include "mex.h"
+#include <math.h>
+#include <string.h>
+#include "conv.h"
+#include "fft.h"
+#include "thread_pool.h"
+
+/*
+ * This code is used for computing filter responses.  It computes the
+ * response of a set of filters with a feature map.
+ *
+ * Frequency-domain version.  The feature map is cut into FFT_TILE x
+ * FFT_TILE tiles overlapping by the size of the largest filter minus one
+ * (overlap-save), so that the spectra of the filters only depend on the
+ * tile size and are computed once per model.  They are kept between
+ * calls with a copy of the filters they come from, and recomputed when
+ * the size or any value of the filters differs.  All tiles are
+ * transformed first, then every pair of filters runs over the tiles with
+ * its spectra in cache, and the two filters share one inverse transform
+ * as the real and imaginary parts of the same output.  Both passes are
+ * scheduled on the shared thread pool.
+ *
+ * Small levels are faster with the direct convolution of conv.h, which is
+ * picked per call by comparing the flop counts of both methods.
+ */
+
+// tile size, a power of two larger than the filters
+#define FFT_TILE 32
+// frequencies of a tile with ky <= FFT_TILE/2, the first columns of the
+// transposed spectrum; the others follow by conjugate symmetry
+#define FFT_HALF (FFT_TILE*(FFT_TILE/2+1))
+// the direct convolution has about this many times the flop throughput
+#define FFT_DIRECT_SPEEDUP 3.0
+// flops worth of time to load one value of the filter spectra
+#define FFT_LOAD_COST 12.0
+
+// data of a single or double array, read from the pool threads
+struct array_ref {
+  const void *data;
+  bool single;
+};
+
+static inline array_ref get_ref(const mxArray *mx) {
+  array_ref r = {mxGetData(mx), mxGetClassID(mx) == mxSINGLE_CLASS};
+  return r;
+}
+
+static inline float get(const array_ref &a, size_t i) {
+  return a.single ? ((const float *)a.data)[i] : (float)((const double *)a.data)[i];
+}
+
+// spectra of a set of filters at the tile size
+struct filter_spectra {
+  int num_filters;
+  int num_features;
+  int *height;
+  int *width;
+  float *B;                // the filters, as read by get, one after another
+  float *S;                // num_filters x num_features x (re, im) x FFT_HALF
+  fft_plan plan;
+};
+
+struct fft_data {
+  array_ref A;
+  int A_height;
+  int A_width;
+  int num_features;
+  filter_spectra *spectra;
+  double **C;              // num_filters outputs
+  int *C_height;
+  int *C_width;
+  int step_y;              // valid outputs per tile
+  int step_x;
+  int tiles_y;
+  int num_tiles;
+  float *F;                // num_tiles x num_features x (re, im) x FFT_HALF
+  bool failed;
+};
+
+static filter_spectra *cached = NULL;
+
+static void free_spectra(filter_spectra *s) {
+  if (s == NULL)
+    return;
+  free(s->height);
+  free(s->width);
+  free(s->B);
+  free(s->S);
+  fft_plan_free(&s->plan);
+  free(s);
+}
+
+// the pool's own exit handler is replaced, this one releases both
+static void destroy() {
+  free_spectra(cached);
+  cached = NULL;
+  ThreadPool::destroy();
+}
+
+// whether s holds the spectra of filters start..start+len-1: same sizes
+// and same values as read by get, so that the spectra would not change
+static bool same_filters(const filter_spectra *s, const mxArray *cellB,
+                         int start, int len, int nf) {
+  if (s->num_filters != len || s->num_features != nf)
+    return false;
+  const float *b = s->B;
+  for (int i = 0; i < len; i++) {
+    const mxArray *mxB = mxGetCell(cellB, i+start);
+    const mwSize *dims = mxGetDimensions(mxB);
+    if ((int)dims[0] != s->height[i] || (int)dims[1] != s->width[i])
+      return false;
+    size_t n = dims[0]*dims[1]*dims[2];
+    array_ref B = get_ref(mxB);
+    for (size_t k = 0; k < n; k++) {
+      float v = get(B, k);
+      if (memcmp(&v, &b[k], sizeof(v)))
+        return false;
+    }
+    b += n;
+  }
+  return true;
+}
+
+// Transform features 2p and 2p+1 of a column-major height x width map,
+// read from (y0, x0) on and zero-padded, as the real and imaginary parts
+// of one tile, and split the result into the half spectra of both.
+// Xr and Xi hold FFT_TILE^2 values.
+static void transform_pair(const array_ref &a, int height, int width, int features,
+                           int y0, int x0, int p, const fft_plan *plan,
+                           float *Xr, float *Xi, float *dst0, float *dst1) {
+  const int T = FFT_TILE;
+  memset(Xr, 0, T*T*sizeof(float));
+  memset(Xi, 0, T*T*sizeof(float));
+  int rows = height-y0 < T ? height-y0 : T;
+  int cols = width-x0 < T ? width-x0 : T;
+  size_t plane = (size_t)height*width;
+  for (int x = 0; x < cols; x++) {
+    for (int y = 0; y < rows; y++) {
+      size_t i = (size_t)(x0+x)*height + y0+y;
+      Xr[x*T+y] = get(a, i + 2*p*plane);
+      if (2*p+1 < features)
+        Xi[x*T+y] = get(a, i + (2*p+1)*plane);
+    }
+  }
+  fft_2d(plan, Xr, Xi, rows);
+
+  // A[k] = (X[k] + conj(X[-k]))/2, B[k] = -i (X[k] - conj(X[-k]))/2
+  for (int c = 0; c <= T/2; c++) {
+    for (int r = 0; r < T; r++) {
+      int k = c*T+r;
+      int m = ((T-c)%T)*T + (T-r)%T;
+      float pr = Xr[k], pi = Xi[k];
+      float qr = Xr[m], qi = -Xi[m];
+      dst0[k] = 0.5f*(pr+qr);
+      dst0[FFT_HALF+k] = 0.5f*(pi+qi);
+      if (dst1) {
+        dst1[k] = 0.5f*(pi-qi);
+        dst1[FFT_HALF+k] = -0.5f*(pr-qr);
+      }
+    }
+  }
+}
+
+struct spectra_args {
+  array_ref *B;
+  filter_spectra *s;
+  bool failed;
+};
+
+// spectra of all features of filter i
+static void transform_filter(void *arg, int i) {
+  spectra_args *a = (spectra_args *)arg;
+  filter_spectra *s = a->s;
+  int nf = s->num_features;
+  float *X = (float *)malloc(2*FFT_TILE*FFT_TILE*sizeof(float));
+  if (!X) {
+    a->failed = true;
+    return;
+  }
+  for (int p = 0; 2*p < nf; p++) {
+    float *dst = s->S + ((size_t)i*nf + 2*p)*2*FFT_HALF;
+    transform_pair(a->B[i], s->height[i], s->width[i], nf, 0, 0, p, &s->plan,
+                   X, X+FFT_TILE*FFT_TILE, dst, 2*p+1 < nf ? dst+2*FFT_HALF : NULL);
+  }
+  free(X);
+}
+
+// spectra of filters start..start+len-1, from the cache if unchanged
+static filter_spectra *get_spectra(const mxArray *cellB, int start, int len, int nf) {
+  if (cached && same_filters(cached, cellB, start, len, nf))
+    return cached;
+  free_spectra(cached);
+  cached = NULL;
+
+  filter_spectra *s = (filter_spectra *)calloc(1, sizeof(filter_spectra));
+  if (s == NULL)
+    mexErrMsgTxt("Out of memory");
+  s->num_filters = len;
+  s->num_features = nf;
+  s->height = (int *)malloc(len*sizeof(int));
+  s->width = (int *)malloc(len*sizeof(int));
+  size_t size = 0;
+  for (int i = 0; i < len; i++)
+    size += mxGetNumberOfElements(mxGetCell(cellB, i+start));
+  s->B = (float *)malloc(size*sizeof(float));
+  s->S = (float *)malloc((size_t)len*nf*2*FFT_HALF*sizeof(float));
+  if (!s->height || !s->width || !s->B || !s->S ||
+      !fft_plan_init(&s->plan, FFT_TILE)) {
+    free_spectra(s);
+    mexErrMsgTxt("Out of memory");
+  }
+  array_ref *B = (array_ref *)mxCalloc(len, sizeof(array_ref));
+  float *b = s->B;
+  for (int i = 0; i < len; i++) {
+    B[i] = get_ref(mxGetCell(cellB, i+start));
+    const mwSize *dims = mxGetDimensions(mxGetCell(cellB, i+start));
+    s->height[i] = dims[0];
+    s->width[i] = dims[1];
+    size_t n = dims[0]*dims[1]*dims[2];
+    for (size_t k = 0; k < n; k++)
+      b[k] = get(B[i], k);
+    b += n;
+  }
+  spectra_args args = {B, s, false};
+  ThreadPool::instance().parallel_for(len, transform_filter, &args);
+  mxFree(B);
+  if (args.failed) {
+    free_spectra(s);
+    mexErrMsgTxt("Out of memory");
+  }
+  cached = s;
+  return s;
+}
+
+// Z = S0 + i S1 on the whole tile, from the half spectra of two real
+// outputs, using S[-k] = conj(S[k])
+static void combine_pair(const float *S0, const float *S1, float *Zr, float *Zi) {
+  const int T = FFT_TILE;
+  for (int c = 0; c < T; c++) {
+    for (int r = 0; r < T; r++) {
+      int k = c*T+r;
+      if (c <= T/2) {
+        Zr[k] = S0[k] - S1[FFT_HALF+k];
+        Zi[k] = S0[FFT_HALF+k] + S1[k];
+      } else {
+        int m = ((T-c)%T)*T + (T-r)%T;
+        Zr[k] = S0[m] + S1[FFT_HALF+m];
+        Zi[k] = -S0[FFT_HALF+m] + S1[m];
+      }
+    }
+  }
+}
+
+// spectra of all features of tile t
+static void transform_tile(void *arg, int t) {
+  fft_data *d = (fft_data *)arg;
+  const int nf = d->num_features;
+  int y0 = (t % d->tiles_y)*d->step_y;
+  int x0 = (t / d->tiles_y)*d->step_x;
+  float *X = (float *)malloc(2*FFT_TILE*FFT_TILE*sizeof(float));
+  if (!X) {
+    d->failed = true;
+    return;
+  }
+  float *F = d->F + (size_t)t*nf*2*FFT_HALF;
+  for (int p = 0; 2*p < nf; p++)
+    transform_pair(d->A, d->A_height, d->A_width, nf, y0, x0, p, &d->spectra->plan,
+                   X, X+FFT_TILE*FFT_TILE, F + 2*p*2*FFT_HALF,
+                   2*p+1 < nf ? F + (2*p+1)*2*FFT_HALF : NULL);
+  free(X);
+}
+
+// responses of filters 2q and 2q+1 on all tiles, the spectra of both
+// filters stay in cache while the tiles stream by
+static void process_pair(void *arg, int q) {
+  fft_data *d = (fft_data *)arg;
+  const filter_spectra *s = d->spectra;
+  const int T = FFT_TILE;
+  const int nf = d->num_features;
+  int i = 2*q;
+  int j = i+1 < s->num_filters ? i+1 : -1;
+  const float *B0 = s->S + (size_t)i*nf*2*FFT_HALF;
+  const float *B1 = j >= 0 ? B0 + (size_t)nf*2*FFT_HALF : NULL;
+  float *S = (float *)malloc((4*FFT_HALF + 2*T*T)*sizeof(float));
+  if (!S) {
+    d->failed = true;
+    return;
+  }
+  float *Zr = S + 4*FFT_HALF;
+  float *Zi = Zr + T*T;
+
+  for (int t = 0; t < d->num_tiles; t++) {
+    // correlation is A[k] conj(B[k]) summed over features
+    const float *F = d->F + (size_t)t*nf*2*FFT_HALF;
+    for (int k = 0; k < FFT_HALF; k += SIMD_WIDTH) {
+      vfloat s0r = vzero(), s0i = vzero(), s1r = vzero(), s1i = vzero();
+      for (int f = 0; f < nf; f++) {
+        const float *a = F + (size_t)f*2*FFT_HALF + k;
+        vfloat ar = vload(a), ai = vload(a+FFT_HALF);
+        const float *b = B0 + (size_t)f*2*FFT_HALF + k;
+        vfloat br = vload(b), bi = vload(b+FFT_HALF);
+        s0r = vmadd(ar, br, vmadd(ai, bi, s0r));
+        s0i = vsub(vmadd(ai, br, s0i), vmul(ar, bi));
+        if (B1) {
+          b = B1 + (size_t)f*2*FFT_HALF + k;
+          br = vload(b);
+          bi = vload(b+FFT_HALF);
+          s1r = vmadd(ar, br, vmadd(ai, bi, s1r));
+          s1i = vsub(vmadd(ai, br, s1i), vmul(ar, bi));
+        }
+      }
+      vstore(S+k, s0r);
+      vstore(S+FFT_HALF+k, s0i);
+      vstore(S+2*FFT_HALF+k, s1r);
+      vstore(S+3*FFT_HALF+k, s1i);
+    }
+    combine_pair(S, S+2*FFT_HALF, Zr, Zi);
+    ifft_2d(&s->plan, Zr, Zi, d->step_y);
+
+    // keep the valid outputs of the tile
+    int y0 = (t % d->tiles_y)*d->step_y;
+    int x0 = (t / d->tiles_y)*d->step_x;
+    const float scale = 1.0f/(T*T);
+    for (int c = 0; c < 2; c++) {
+      int f = c == 0 ? i : j;
+      if (f < 0)
+        break;
+      const float *Z = c == 0 ? Zr : Zi;
+      int rows = d->C_height[f]-y0 < d->step_y ? d->C_height[f]-y0 : d->step_y;
+      int cols = d->C_width[f]-x0 < d->step_x ? d->C_width[f]-x0 : d->step_x;
+      for (int x = 0; x < cols; x++)
+        for (int y = 0; y < rows; y++)
+          d->C[f][(size_t)(x0+x)*d->C_height[f] + y0+y] = scale*Z[x*T+y];
+    }
+  }
+  free(S);
+}
+
+float *pack_array(const mxArray *mx, int num_features) {
+  const mwSize *dims = mxGetDimensions(mx);
+  float *dst = (float *)mxMalloc(dims[0]*dims[1]*num_features*sizeof(float));
+  if (mxGetClassID(mx) == mxSINGLE_CLASS)
+    pack((float *)mxGetData(mx), dst, dims[0], dims[1], dims[2], num_features);
+  else
+    pack((double *)mxGetPr(mx), dst, dims[0], dims[1], dims[2], num_features);
+  return dst;
+}
+
+// direct convolution into the preallocated outputs, as in fconvSIMD
+static void convolve_direct(const mxArray *mxA, const mxArray *cellB, int start,
+                            int len, double **C, const int *C_height,
+                            const int *C_width) {
+  const mwSize *A_dims = mxGetDimensions(mxA);
+  conv_data args;
+  args.num_features = simd_padded(A_dims[2]);
+  args.A_height = A_dims[0];
+  args.A_width = A_dims[1];
+  args.num_filters = len;
+  args.filters = (packed_filter *)mxCalloc(len, sizeof(packed_filter));
+  int max_width = 0;
+  for (int i = 0; i < len; i++) {
+    const mxArray *mxB = mxGetCell(cellB, i+start);
+    packed_filter *p = &args.filters[i];
+    p->height = mxGetDimensions(mxB)[0];
+    p->width = mxGetDimensions(mxB)[1];
+    p->B = pack_array(mxB, args.num_features);
+    p->C = C[i];
+    p->C_dims[0] = C_height[i];
+    p->C_dims[1] = C_width[i];
+    if (C_width[i] > max_width)
+      max_width = C_width[i];
+  }
+  args.A = pack_array(mxA, args.num_features);
+  args.num_tiles = (max_width + TILE_COLS - 1) / TILE_COLS;
+  ThreadPool::instance().parallel_for(args.num_tiles, conv_tile, &args);
+  for (int i = 0; i < len; i++)
+    mxFree(args.filters[i].B);
+  mxFree(args.A);
+  mxFree(args.filters);
+}
+
+static inline bool valid_class(const mxArray *mx) {
+  return mxGetClassID(mx) == mxDOUBLE_CLASS ||
+         mxGetClassID(mx) == mxSINGLE_CLASS;
+}
+
+// matlab entry point
+// C = fconvFFT(A, cell of B, start, end, mode);
+// mode is 'auto' (default), 'fft' or 'direct'
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+  if (nrhs != 4 && nrhs != 5)
+    mexErrMsgTxt("Wrong number of inputs");
+  if (nlhs != 1)
+    mexErrMsgTxt("Wrong number of outputs");
+
+  // get A
+  const mxArray *mxA = prhs[0];
+  if (mxGetNumberOfDimensions(mxA) != 3 || !valid_class(mxA))
+    mexErrMsgTxt("Invalid input: A");
+  const mwSize *A_dims = mxGetDimensions(mxA);
+
+  // get B and start/end
+  const mxArray *cellB = prhs[1];
+  int num_bs = mxGetNumberOfElements(cellB);
+  int start = (int)mxGetScalar(prhs[2]) - 1;
+  int end = (int)mxGetScalar(prhs[3]) - 1;
+  if (start < 0 || end >= num_bs || start > end)
+    mexErrMsgTxt("Invalid input: start/end");
+  int len = end-start+1;
+
+  // get mode
+  char mode[8] = "auto";
+  if (nrhs == 5 && (!mxIsChar(prhs[4]) || mxGetString(prhs[4], mode, sizeof(mode)) ||
+                    (strcmp(mode, "auto") && strcmp(mode, "fft") && strcmp(mode, "direct"))))
+    mexErrMsgTxt("Invalid input: mode should be 'auto', 'fft' or 'direct'");
+
+  // allocate outputs and count the flops of both methods
+  plhs[0] = mxCreateCellMatrix(1, len);
+  double **C = (double **)mxCalloc(len, sizeof(double *));
+  int *C_height = (int *)mxCalloc(len, sizeof(int));
+  int *C_width = (int *)mxCalloc(len, sizeof(int));
+  int max_height = 0, max_width = 0;
+  int max_C_height = 0, max_C_width = 0;
+  double direct_flops = 0;
+  for (int i = 0; i < len; i++) {
+    const mxArray *mxB = mxGetCell(cellB, i+start);
+    const mwSize *B_dims = mxGetDimensions(mxB);
+    if (mxGetNumberOfDimensions(mxB) != 3 || !valid_class(mxB) ||
+        A_dims[2] != B_dims[2])
+      mexErrMsgTxt("Invalid input: B");
+    C_height[i] = A_dims[0] - B_dims[0] + 1;
+    C_width[i] = A_dims[1] - B_dims[1] + 1;
+    if (C_height[i] < 1 || C_width[i] < 1)
+      mexErrMsgTxt("Invalid input: B should be smaller than A");
+    mxArray *mxC = mxCreateDoubleMatrix(C_height[i], C_width[i], mxREAL);
+    C[i] = mxGetPr(mxC);
+    mxSetCell(plhs[0], i, mxC);
+    max_height = (int)B_dims[0] > max_height ? B_dims[0] : max_height;
+    max_width = (int)B_dims[1] > max_width ? B_dims[1] : max_width;
+    max_C_height = C_height[i] > max_C_height ? C_height[i] : max_C_height;
+    max_C_width = C_width[i] > max_C_width ? C_width[i] : max_C_width;
+    direct_flops += 2.0*B_dims[0]*B_dims[1]*A_dims[2]*C_height[i]*C_width[i];
+  }
+  int nf = A_dims[2];
+  int step_y = FFT_TILE - max_height + 1;
+  int step_x = FFT_TILE - max_width + 1;
+  int tiles_y = step_y > 0 ? (max_C_height + step_y - 1) / step_y : 0;
+  int tiles_x = step_x > 0 ? (max_C_width + step_x - 1) / step_x : 0;
+  double fft_flops = 5.0*FFT_TILE*FFT_TILE*log2((double)FFT_TILE*FFT_TILE);
+  fft_flops = (double)tiles_y*tiles_x*((nf+1)/2*fft_flops + 8.0*len*nf*FFT_HALF +
+                                       (len+1)/2*fft_flops);
+  // every call streams the whole filter spectra from memory once
+  fft_flops += FFT_LOAD_COST*len*nf*2*FFT_HALF;
+
+  bool use_fft = strcmp(mode, "fft") == 0 ||
+                 (strcmp(mode, "auto") == 0 &&
+                  fft_flops*FFT_DIRECT_SPEEDUP < direct_flops);
+  if (step_y < 1 || step_x < 1)
+    use_fft = false;
+
+  ThreadPool &pool = ThreadPool::instance();
+  if (use_fft) {
+    if (cached == NULL)
+      mexAtExit(destroy);
+    fft_data d;
+    d.A = get_ref(mxA);
+    d.A_height = A_dims[0];
+    d.A_width = A_dims[1];
+    d.num_features = nf;
+    d.spectra = get_spectra(cellB, start, len, nf);
+    d.C = C;
+    d.C_height = C_height;
+    d.C_width = C_width;
+    d.step_y = step_y;
+    d.step_x = step_x;
+    d.tiles_y = tiles_y;
+    d.num_tiles = tiles_y*tiles_x;
+    d.F = (float *)malloc((size_t)d.num_tiles*nf*2*FFT_HALF*sizeof(float));
+    d.failed = d.F == NULL;
+    if (!d.failed)
+      pool.parallel_for(d.num_tiles, transform_tile, &d);
+    if (!d.failed)
+      pool.parallel_for((len+1)/2, process_pair, &d);
+    free(d.F);
+    if (d.failed)
+      mexErrMsgTxt("Out of memory");
+  } else {
+    convolve_direct(mxA, cellB, start, len, C, C_height, C_width);
+  }
+  mxFree(C);
+  mxFree(C_height);
+  mxFree(C_width);
+}
+
+/*
+%%% DEBUGGING CODE %%%
+A = single(rand(120,90,32));
+B = arrayfun(@(i) single(rand(5+mod(i,2),5+mod(i,3),32)), 1:156, 'UniformOutput', false);
+
+tic; C = fconvSIMD(A,B,1,numel(B)); toc;
+tic; C2 = fconvFFT(A,B,1,numel(B),'fft'); toc;
+tic; C2 = fconvFFT(A,B,1,numel(B),'fft'); toc;
+
+max(cellfun(@(c,c2) max(abs(c(:)-c2(:)))/max(abs(c(:))), C, C2))
+
+*/
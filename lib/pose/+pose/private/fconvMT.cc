@@ -1,13 +1,14 @@
 #include "mex.h"
-#include <pthread.h>
 #include <math.h>
 #include <string.h>
+#include "thread_pool.h"
 
 /*
  * This code is used for computing filter responses.  It computes the
  * response of a set of filters with a feature map.  
  *
- * Multithreaded version.
+ * Multithreaded version.  Filters are distributed over the shared
+ * thread pool.
  */
 
 struct thread_data {
@@ -20,9 +21,9 @@ struct thread_data {
   mwSize C_dims[2];
 };
 
-// convolve A and B
-void *process(void *thread_arg) {
-  thread_data *args = (thread_data *)thread_arg;
+// convolve A and the i-th B
+void process(void *thread_arg, int i) {
+  thread_data *args = (thread_data *)thread_arg + i;
   double *A = args->A;
   double *B = args->B;
   double *C = args->C;
@@ -73,7 +74,6 @@ void *process(void *thread_arg) {
       }
     }
   }
-  pthread_exit(NULL);
 }
 
 // matlab entry point
@@ -99,9 +99,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     mexErrMsgTxt("Invalid input: start/end");
   int len = end-start+1;
 
-  // start threads
+  // prepare tasks
   thread_data *td = (thread_data *)mxCalloc(len, sizeof(thread_data));
-  pthread_t *ts = (pthread_t *)mxCalloc(len, sizeof(pthread_t));
   const mwSize *A_dims = mxGetDimensions(mxA);
   double *A = (double *)mxGetPr(mxA);
   for (int i = 0; i < len; i++) {
@@ -124,20 +123,14 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     td[i].C_dims[1] = width;
     td[i].mxC = mxCreateNumericArray(2, td[i].C_dims, mxDOUBLE_CLASS, mxREAL);
     td[i].C = (double *)mxGetPr(td[i].mxC);
-
-    if (pthread_create(&ts[i], NULL, process, (void *)&td[i]))
-      mexErrMsgTxt("Error creating thread");  
   }
 
-  // wait for the treads to finish and set return values
-  void *status;
+  // run the convolutions and set return values
+  ThreadPool::instance().parallel_for(len, process, (void *)td);
   plhs[0] = mxCreateCellMatrix(1, len);
-  for (int i = 0; i < len; i++) {
-    pthread_join(ts[i], &status);
+  for (int i = 0; i < len; i++)
     mxSetCell(plhs[0], i, td[i].mxC);
-  }
   mxFree(td);
-  mxFree(ts);
 }
 
 
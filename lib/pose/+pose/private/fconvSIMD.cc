@@ -0,0 +1,110 @@
+#include "mex.h"
+#include <math.h>
+#include <string.h>
+#include "conv.h"
+#include "thread_pool.h"
+
+/*
+ * This code is used for computing filter responses.  It computes the
+ * response of a set of filters with a feature map.
+ *
+ * Float32 SIMD version, see conv.h.  Tiles are scheduled on the shared
+ * thread pool.
+ */
+
+float *pack_array(const mxArray *mx, int num_features) {
+  const mwSize *dims = mxGetDimensions(mx);
+  float *dst = (float *)mxMalloc(dims[0]*dims[1]*num_features*sizeof(float));
+  if (mxGetClassID(mx) == mxSINGLE_CLASS)
+    pack((float *)mxGetData(mx), dst, dims[0], dims[1], dims[2], num_features);
+  else
+    pack((double *)mxGetPr(mx), dst, dims[0], dims[1], dims[2], num_features);
+  return dst;
+}
+
+static inline bool valid_class(const mxArray *mx) {
+  return mxGetClassID(mx) == mxDOUBLE_CLASS ||
+         mxGetClassID(mx) == mxSINGLE_CLASS;
+}
+
+// matlab entry point
+// C = fconvSIMD(A, cell of B, start, end);
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+  if (nrhs != 4)
+    mexErrMsgTxt("Wrong number of inputs");
+  if (nlhs != 1)
+    mexErrMsgTxt("Wrong number of outputs");
+
+  // get A
+  const mxArray *mxA = prhs[0];
+  if (mxGetNumberOfDimensions(mxA) != 3 || !valid_class(mxA))
+    mexErrMsgTxt("Invalid input: A");
+  const mwSize *A_dims = mxGetDimensions(mxA);
+
+  // get B and start/end
+  const mxArray *cellB = prhs[1];
+  int num_bs = mxGetNumberOfElements(cellB);
+  int start = (int)mxGetScalar(prhs[2]) - 1;
+  int end = (int)mxGetScalar(prhs[3]) - 1;
+  if (start < 0 || end >= num_bs || start > end)
+    mexErrMsgTxt("Invalid input: start/end");
+  int len = end-start+1;
+
+  // pack the filters and allocate outputs
+  conv_data args;
+  args.num_features = simd_padded(A_dims[2]);
+  args.A_height = A_dims[0];
+  args.A_width = A_dims[1];
+  args.num_filters = len;
+  args.filters = (packed_filter *)mxCalloc(len, sizeof(packed_filter));
+  mxArray **mxC = (mxArray **)mxCalloc(len, sizeof(mxArray *));
+  int max_width = 0;
+  for (int i = 0; i < len; i++) {
+    const mxArray *mxB = mxGetCell(cellB, i+start);
+    const mwSize *B_dims = mxGetDimensions(mxB);
+    if (mxGetNumberOfDimensions(mxB) != 3 || !valid_class(mxB) ||
+        A_dims[2] != B_dims[2])
+      mexErrMsgTxt("Invalid input: B");
+
+    // compute size of output
+    packed_filter *p = &args.filters[i];
+    int height = A_dims[0] - B_dims[0] + 1;
+    int width = A_dims[1] - B_dims[1] + 1;
+    if (height < 1 || width < 1)
+      mexErrMsgTxt("Invalid input: B should be smaller than A");
+    p->height = B_dims[0];
+    p->width = B_dims[1];
+    p->B = pack_array(mxB, args.num_features);
+    p->C_dims[0] = height;
+    p->C_dims[1] = width;
+    mxC[i] = mxCreateDoubleMatrix(height, width, mxREAL);
+    p->C = mxGetPr(mxC[i]);
+    if (width > max_width)
+      max_width = width;
+  }
+  args.A = pack_array(mxA, args.num_features);
+  args.num_tiles = (max_width + TILE_COLS - 1) / TILE_COLS;
+  ThreadPool::instance().parallel_for(args.num_tiles, conv_tile, &args);
+
+  // set return values
+  plhs[0] = mxCreateCellMatrix(1, len);
+  for (int i = 0; i < len; i++) {
+    mxSetCell(plhs[0], i, mxC[i]);
+    mxFree(args.filters[i].B);
+  }
+  mxFree(args.A);
+  mxFree(args.filters);
+  mxFree(mxC);
+}
+
+/*
+%%% DEBUGGING CODE %%%
+A = rand(60,40,32);
+B = arrayfun(@(i) rand(5+mod(i,2),5+mod(i,3),32), 1:26, 'UniformOutput', false);
+
+tic; C = fconv(A,B,1,numel(B)); toc;
+tic; C2 = fconvSIMD(A,B,1,numel(B)); toc;
+
+max(cellfun(@(c,c2) max(abs(c(:)-c2(:)))/max(abs(c(:))), C, C2))
+
+*/
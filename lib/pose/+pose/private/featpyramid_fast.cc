@@ -0,0 +1,109 @@
+#include <math.h>
+#include <string.h>
+#include "mex.h"
+#include "pyramid.h"
+
+/*
+ * Compute the whole feature pyramid in one call, see featpyramid.m and
+ * pyramid.h.
+ */
+
+static double get_field(const mxArray *model, const char *name, int i) {
+  const mxArray *field = mxGetField(model, 0, name);
+  if (field == NULL || !mxIsDouble(field) ||
+      (int)mxGetNumberOfElements(field) <= i)
+    mexErrMsgTxt("Invalid input: model");
+  return mxGetPr(field)[i];
+}
+
+// matlab entry point
+// pyra = featpyramid_fast(im, model)
+// image should be uint8, single or double, gray or color
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+  if (nrhs != 2)
+    mexErrMsgTxt("Wrong number of inputs");
+  if (nlhs > 1)
+    mexErrMsgTxt("Wrong number of outputs");
+
+  const mxArray *mximage = prhs[0];
+  const mwSize *im_dims = mxGetDimensions(mximage);
+  int chan = mxGetNumberOfDimensions(mximage) == 3 ? im_dims[2] : 1;
+  if (mxGetNumberOfDimensions(mximage) > 3 || (chan != 1 && chan != 3) ||
+      !(mxIsUint8(mximage) || mxIsSingle(mximage) || mxIsDouble(mximage)))
+    mexErrMsgTxt("Invalid input: image");
+  if (!mxIsStruct(prhs[1]))
+    mexErrMsgTxt("Invalid input: model");
+
+  pyramid_data d;
+  d.height = im_dims[0];
+  d.width = im_dims[1];
+  d.sbin = (int)get_field(prhs[1], "sbin", 0);
+  d.interval = (int)get_field(prhs[1], "interval", 0);
+  d.pady = pyramid_max((int)get_field(prhs[1], "maxsize", 0)-1-1, 0);
+  d.padx = pyramid_max((int)get_field(prhs[1], "maxsize", 1)-1-1, 0);
+  if (d.sbin < 1 || d.interval < 1)
+    mexErrMsgTxt("Invalid input: model");
+
+  // input image as float planes
+  int pixels = d.height*d.width;
+  d.im = (float *)mxMalloc(pixels*3*sizeof(float));
+  bool integral;
+  if (mxIsUint8(mximage))
+    integral = convert_image((unsigned char *)mxGetData(mximage), d.im, pixels, chan);
+  else if (mxIsSingle(mximage))
+    integral = convert_image((float *)mxGetData(mximage), d.im, pixels, chan);
+  else
+    integral = convert_image((double *)mxGetPr(mximage), d.im, pixels, chan);
+
+  const char *err = pyramid_init(&d, integral);
+  if (err) {
+    pyramid_free(&d);
+    mexErrMsgTxt(err);
+  }
+  int num_levels = d.num_levels;
+
+  // allocate padded feature maps
+  mxArray *mxfeat = mxCreateCellMatrix(num_levels, 1);
+  mxArray *mxscale = mxCreateDoubleMatrix(num_levels, 1, mxREAL);
+  memcpy(mxGetPr(mxscale), d.scale, num_levels*sizeof(double));
+  for (int l = 0; l < num_levels; l++) {
+    pyramid_level *level = &d.levels[l];
+    mwSize dims[3];
+    for (int k = 0; k < 3; k++)
+      dims[k] = level->dims[k];
+    mxArray *feat = mxCreateNumericArray(3, dims, mxSINGLE_CLASS, mxREAL);
+    level->feat = (float *)mxGetData(feat);
+    mxSetCell(mxfeat, l, feat);
+  }
+
+  hog_init_lut();
+  bool ok = pyramid_build(&d);
+  pyramid_free(&d);
+  mxFree(d.im);
+  if (!ok)
+    mexErrMsgTxt("Out of memory");
+
+  const char *fields[] = {"feat", "scale", "interval", "imy", "imx",
+                          "pady", "padx"};
+  plhs[0] = mxCreateStructMatrix(1, 1, 7, fields);
+  mxSetField(plhs[0], 0, "feat", mxfeat);
+  mxSetField(plhs[0], 0, "scale", mxscale);
+  mxSetField(plhs[0], 0, "interval", mxCreateDoubleScalar(d.interval));
+  mxSetField(plhs[0], 0, "imy", mxCreateDoubleScalar(d.height));
+  mxSetField(plhs[0], 0, "imx", mxCreateDoubleScalar(d.width));
+  mxSetField(plhs[0], 0, "pady", mxCreateDoubleScalar(d.pady));
+  mxSetField(plhs[0], 0, "padx", mxCreateDoubleScalar(d.padx));
+}
+
+/*
+%%% DEBUGGING CODE %%%
+im = imread('peppers.png');
+model = struct('sbin', 4, 'interval', 10, 'maxsize', [5 5]);
+
+tic; pyra = featpyramid(im, model); toc;
+tic; pyra2 = featpyramid_fast(im, model); toc;
+
+max(cellfun(@(a,b) max(abs(a(:)-double(b(:)))), pyra.feat, pyra2.feat))
+max(abs(pyra.scale - pyra2.scale))
+
+*/
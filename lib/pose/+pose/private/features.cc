@@ -1,5 +1,7 @@
 #include <math.h>
 #include "mex.h"
+#include "hog.h"
+#include "thread_pool.h"
 
 // small value, used to avoid division by zero
 #define eps 0.0001
@@ -30,40 +32,29 @@ static inline double max(double x, double y) { return (x <= y ? y : x); }
 static inline int min(int x, int y) { return (x <= y ? x : y); }
 static inline int max(int x, int y) { return (x <= y ? y : x); }
 
-// main function:
-// takes a double color image and a bin size 
-// returns HOG features
-mxArray *process(const mxArray *mximage, const mxArray *mxsbin) {
-  double *im = (double *)mxGetPr(mximage);
-  const int *dims = mxGetDimensions(mximage);
-  if (mxGetNumberOfDimensions(mximage) != 3 ||
-      dims[2] != 3 ||
-      mxGetClassID(mximage) != mxDOUBLE_CLASS)
-    mexErrMsgTxt("Invalid input");
-
-  int sbin = (int)mxGetScalar(mxsbin);
-
-  // memory for caching orientation histograms & their norms
+// state shared by the histogram and feature tasks
+struct hog_data {
+  double *im;
+  const int *dims;
+  int sbin;
   int blocks[2];
-  blocks[0] = (int)round((double)dims[0]/(double)sbin);
-  blocks[1] = (int)round((double)dims[1]/(double)sbin);
-  double *hist = (double *)mxCalloc(blocks[0]*blocks[1]*18, sizeof(double));
-  double *norm = (double *)mxCalloc(blocks[0]*blocks[1], sizeof(double));
-
-  // memory for HOG features
-  int out[3];
-  out[0] = max(blocks[0]-2, 0);
-  out[1] = max(blocks[1]-2, 0);
-  out[2] = 27+4+1;
-  mxArray *mxfeat = mxCreateNumericArray(3, out, mxDOUBLE_CLASS, mxREAL);
-  double *feat = (double *)mxGetPr(mxfeat);
-  
   int visible[2];
-  visible[0] = blocks[0]*sbin;
-  visible[1] = blocks[1]*sbin;
-  
-  for (int x = 1; x < visible[1]-1; x++) {
-    for (int y = 1; y < visible[0]-1; y++) {
+  int out[3];
+  int num_bands;
+  double *hist;
+  double *norm;
+  double *feat;
+};
+
+// accumulate gradient histograms of pixel columns [x0,x1) into hist
+void accumulate(const hog_data *d, double *hist, int x0, int x1) {
+  double *im = d->im;
+  const int *dims = d->dims;
+  const int *blocks = d->blocks;
+  int sbin = d->sbin;
+
+  for (int x = x0; x < x1; x++) {
+    for (int y = 1; y < d->visible[0]-1; y++) {
       // first color channel
       double *s = im + min(x, dims[1]-2)*dims[0] + min(y, dims[0]-2);
       double dy = *(s+1) - *(s-1);
@@ -140,6 +131,134 @@ mxArray *process(const mxArray *mximage, const mxArray *mxsbin) {
       }
     }
   }
+}
+
+// each band of pixel columns votes into its own copy of the histogram
+void hist_band(void *arg, int b) {
+  hog_data *d = (hog_data *)arg;
+  int len = d->visible[1]-2;
+  int x0 = 1 + (int)((long)len*b/d->num_bands);
+  int x1 = 1 + (int)((long)len*(b+1)/d->num_bands);
+  accumulate(d, d->hist + b*d->blocks[0]*d->blocks[1]*18, x0, x1);
+}
+
+// compute features of one output column
+void feature_column(void *arg, int x) {
+  hog_data *d = (hog_data *)arg;
+  const int *blocks = d->blocks;
+  const int *out = d->out;
+  double *hist = d->hist;
+  double *norm = d->norm;
+
+  for (int y = 0; y < out[0]; y++) {
+    double *dst = d->feat + x*out[0] + y;      
+    double *src, *p, n1, n2, n3, n4;
+
+    p = norm + (x+1)*blocks[0] + y+1;
+    n1 = 1.0 / sqrt(*p + *(p+1) + *(p+blocks[0]) + *(p+blocks[0]+1) + eps);
+    p = norm + (x+1)*blocks[0] + y;
+    n2 = 1.0 / sqrt(*p + *(p+1) + *(p+blocks[0]) + *(p+blocks[0]+1) + eps);
+    p = norm + x*blocks[0] + y+1;
+    n3 = 1.0 / sqrt(*p + *(p+1) + *(p+blocks[0]) + *(p+blocks[0]+1) + eps);
+    p = norm + x*blocks[0] + y;      
+    n4 = 1.0 / sqrt(*p + *(p+1) + *(p+blocks[0]) + *(p+blocks[0]+1) + eps);
+
+    double t1 = 0;
+    double t2 = 0;
+    double t3 = 0;
+    double t4 = 0;
+
+    // contrast-sensitive features
+    src = hist + (x+1)*blocks[0] + (y+1);
+    for (int o = 0; o < 18; o++) {
+      double h1 = min(*src * n1, 0.2);
+      double h2 = min(*src * n2, 0.2);
+      double h3 = min(*src * n3, 0.2);
+      double h4 = min(*src * n4, 0.2);
+      *dst = 0.5 * (h1 + h2 + h3 + h4);
+      t1 += h1;
+      t2 += h2;
+      t3 += h3;
+      t4 += h4;
+      dst += out[0]*out[1];
+      src += blocks[0]*blocks[1];
+    }
+
+    // contrast-insensitive features
+    src = hist + (x+1)*blocks[0] + (y+1);
+    for (int o = 0; o < 9; o++) {
+      double sum = *src + *(src + 9*blocks[0]*blocks[1]);
+      double h1 = min(sum * n1, 0.2);
+      double h2 = min(sum * n2, 0.2);
+      double h3 = min(sum * n3, 0.2);
+      double h4 = min(sum * n4, 0.2);
+      *dst = 0.5 * (h1 + h2 + h3 + h4);
+      dst += out[0]*out[1];
+      src += blocks[0]*blocks[1];
+    }
+
+    // texture features
+    *dst = 0.2357 * t1;
+    dst += out[0]*out[1];
+    *dst = 0.2357 * t2;
+    dst += out[0]*out[1];
+    *dst = 0.2357 * t3;
+    dst += out[0]*out[1];
+    *dst = 0.2357 * t4;
+
+    // truncation feature
+    dst += out[0]*out[1];
+    *dst = 0;
+  }
+}
+
+// main function:
+// takes a double color image and a bin size 
+// returns HOG features
+mxArray *process(const mxArray *mximage, const mxArray *mxsbin) {
+  hog_data d;
+  double *im = (double *)mxGetPr(mximage);
+  const int *dims = mxGetDimensions(mximage);
+  if (mxGetNumberOfDimensions(mximage) != 3 ||
+      dims[2] != 3 ||
+      mxGetClassID(mximage) != mxDOUBLE_CLASS)
+    mexErrMsgTxt("Invalid input");
+  d.im = im;
+  d.dims = dims;
+
+  int sbin = (int)mxGetScalar(mxsbin);
+  d.sbin = sbin;
+
+  // memory for caching orientation histograms & their norms
+  int *blocks = d.blocks;
+  blocks[0] = (int)round((double)dims[0]/(double)sbin);
+  blocks[1] = (int)round((double)dims[1]/(double)sbin);
+
+  // memory for HOG features
+  int *out = d.out;
+  out[0] = max(blocks[0]-2, 0);
+  out[1] = max(blocks[1]-2, 0);
+  out[2] = 27+4+1;
+  mxArray *mxfeat = mxCreateNumericArray(3, out, mxDOUBLE_CLASS, mxREAL);
+  d.feat = (double *)mxGetPr(mxfeat);
+  
+  d.visible[0] = blocks[0]*sbin;
+  d.visible[1] = blocks[1]*sbin;
+
+  // vote in bands of columns, one private histogram per band
+  ThreadPool &pool = ThreadPool::instance();
+  int hist_size = blocks[0]*blocks[1]*18;
+  d.num_bands = max(min(pool.size(), d.visible[1]-2), 1);
+  d.hist = (double *)mxCalloc(hist_size*d.num_bands, sizeof(double));
+  d.norm = (double *)mxCalloc(blocks[0]*blocks[1], sizeof(double));
+  pool.parallel_for(d.num_bands, hist_band, &d);
+  double *hist = d.hist;
+  for (int b = 1; b < d.num_bands; b++) {
+    double *src = hist + b*hist_size;
+    for (int i = 0; i < hist_size; i++)
+      hist[i] += src[i];
+  }
+  double *norm = d.norm;
 
   // compute energy in each block by summing over orientations
   for (int o = 0; o < 9; o++) {
@@ -155,83 +274,111 @@ mxArray *process(const mxArray *mximage, const mxArray *mxsbin) {
   }
 
   // compute features
-  for (int x = 0; x < out[1]; x++) {
-    for (int y = 0; y < out[0]; y++) {
-      double *dst = feat + x*out[0] + y;      
-      double *src, *p, n1, n2, n3, n4;
-
-      p = norm + (x+1)*blocks[0] + y+1;
-      n1 = 1.0 / sqrt(*p + *(p+1) + *(p+blocks[0]) + *(p+blocks[0]+1) + eps);
-      p = norm + (x+1)*blocks[0] + y;
-      n2 = 1.0 / sqrt(*p + *(p+1) + *(p+blocks[0]) + *(p+blocks[0]+1) + eps);
-      p = norm + x*blocks[0] + y+1;
-      n3 = 1.0 / sqrt(*p + *(p+1) + *(p+blocks[0]) + *(p+blocks[0]+1) + eps);
-      p = norm + x*blocks[0] + y;      
-      n4 = 1.0 / sqrt(*p + *(p+1) + *(p+blocks[0]) + *(p+blocks[0]+1) + eps);
-
-      double t1 = 0;
-      double t2 = 0;
-      double t3 = 0;
-      double t4 = 0;
-
-      // contrast-sensitive features
-      src = hist + (x+1)*blocks[0] + (y+1);
-      for (int o = 0; o < 18; o++) {
-	double h1 = min(*src * n1, 0.2);
-	double h2 = min(*src * n2, 0.2);
-	double h3 = min(*src * n3, 0.2);
-	double h4 = min(*src * n4, 0.2);
-	*dst = 0.5 * (h1 + h2 + h3 + h4);
-	t1 += h1;
-	t2 += h2;
-	t3 += h3;
-	t4 += h4;
-	dst += out[0]*out[1];
-	src += blocks[0]*blocks[1];
-      }
+  pool.parallel_for(out[1], feature_column, &d);
 
-      // contrast-insensitive features
-      src = hist + (x+1)*blocks[0] + (y+1);
-      for (int o = 0; o < 9; o++) {
-        double sum = *src + *(src + 9*blocks[0]*blocks[1]);
-        double h1 = min(sum * n1, 0.2);
-        double h2 = min(sum * n2, 0.2);
-        double h3 = min(sum * n3, 0.2);
-        double h4 = min(sum * n4, 0.2);
-        *dst = 0.5 * (h1 + h2 + h3 + h4);
-        dst += out[0]*out[1];
-        src += blocks[0]*blocks[1];
-      }
+  mxFree(hist);
+  mxFree(norm);
+  return mxfeat;
+}
 
-      // texture features
-      *dst = 0.2357 * t1;
-      dst += out[0]*out[1];
-      *dst = 0.2357 * t2;
-      dst += out[0]*out[1];
-      *dst = 0.2357 * t3;
-      dst += out[0]*out[1];
-      *dst = 0.2357 * t4;
+// state of the float path
+struct hog_float_data {
+  float *im;
+  int height;
+  int width;
+  int sbin;
+  bool integral;
+  hog_size size;
+  int num_bands;
+  float *hist;
+  float *norm;
+  double *feat;
+  int dims[3];
+};
 
-      // truncation feature
-      dst += out[0]*out[1];
-      *dst = 0;
-    }
+void hist_band_float(void *arg, int b) {
+  hog_float_data *d = (hog_float_data *)arg;
+  int len = d->size.visible[1]-2;
+  int x0 = 1 + (int)((long)len*b/d->num_bands);
+  int x1 = 1 + (int)((long)len*(b+1)/d->num_bands);
+  float *hist = d->hist + b*d->size.blocks[0]*d->size.blocks[1]*18;
+  hog_accumulate(d->im, d->height, d->width, d->sbin, &d->size, d->integral,
+                 hist, x0, x1);
+}
+
+void feature_column_float(void *arg, int x) {
+  hog_float_data *d = (hog_float_data *)arg;
+  hog_column(d->hist, d->norm, &d->size, x, d->feat, d->dims, 0, 0);
+}
+
+template <typename T>
+void convert_image(const T *src, float *dst, int n) {
+  for (int i = 0; i < n; i++)
+    dst[i] = (float)src[i];
+}
+
+// main function for uint8 and single images:
+// same features computed in float, with the orientation lookup table,
+// SIMD gradients and SIMD votes of hog.h, see there for the tolerance
+mxArray *process_float(const mxArray *mximage, const mxArray *mxsbin) {
+  hog_float_data d;
+  const mwSize *dims = mxGetDimensions(mximage);
+  if (mxGetNumberOfDimensions(mximage) != 3 || dims[2] != 3)
+    mexErrMsgTxt("Invalid input");
+  d.height = dims[0];
+  d.width = dims[1];
+  d.sbin = (int)mxGetScalar(mxsbin);
+  d.im = (float *)mxMalloc(d.height*d.width*3*sizeof(float));
+  if (mxGetClassID(mximage) == mxUINT8_CLASS) {
+    convert_image((unsigned char *)mxGetData(mximage), d.im, d.height*d.width*3);
+    d.integral = true;
+  } else {
+    convert_image((float *)mxGetData(mximage), d.im, d.height*d.width*3);
+    d.integral = false;
   }
 
-  mxFree(hist);
-  mxFree(norm);
+  hog_get_size(d.height, d.width, d.sbin, &d.size);
+  d.dims[0] = d.size.out[0];
+  d.dims[1] = d.size.out[1];
+  d.dims[2] = 27+4+1;
+  mxArray *mxfeat = mxCreateNumericArray(3, d.dims, mxDOUBLE_CLASS, mxREAL);
+  d.feat = (double *)mxGetPr(mxfeat);
+
+  // vote in bands of columns, one private histogram per band
+  hog_init_lut();
+  ThreadPool &pool = ThreadPool::instance();
+  int hist_size = d.size.blocks[0]*d.size.blocks[1]*18;
+  d.num_bands = max(min(pool.size(), d.size.visible[1]-2), 1);
+  d.hist = (float *)mxCalloc(hist_size*d.num_bands, sizeof(float));
+  d.norm = (float *)mxCalloc(d.size.blocks[0]*d.size.blocks[1], sizeof(float));
+  pool.parallel_for(d.num_bands, hist_band_float, &d);
+  for (int b = 1; b < d.num_bands; b++) {
+    float *src = d.hist + b*hist_size;
+    for (int i = 0; i < hist_size; i++)
+      d.hist[i] += src[i];
+  }
+  hog_norm(d.hist, &d.size, d.norm);
+  pool.parallel_for(d.dims[1], feature_column_float, &d);
+
+  mxFree(d.im);
+  mxFree(d.hist);
+  mxFree(d.norm);
   return mxfeat;
 }
 
 // matlab entry point
 // F = features(image, bin)
-// image should be color with double values
+// image should be color with double, single or uint8 values
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) { 
   if (nrhs != 2)
     mexErrMsgTxt("Wrong number of inputs"); 
   if (nlhs != 1)
     mexErrMsgTxt("Wrong number of outputs");
-  plhs[0] = process(prhs[0], prhs[1]);
+  if (mxGetClassID(prhs[0]) == mxUINT8_CLASS ||
+      mxGetClassID(prhs[0]) == mxSINGLE_CLASS)
+    plhs[0] = process_float(prhs[0], prhs[1]);
+  else
+    plhs[0] = process(prhs[0], prhs[1]);
 }
 
 
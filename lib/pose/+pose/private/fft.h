@@ -0,0 +1,132 @@
+#ifndef POSE_FFT_H
+#define POSE_FFT_H
+
+#include <math.h>
+#include <stdlib.h>
+#include "simd.h"
+
+/*
+ * Radix-2 complex FFT in single precision, for the small square
+ * power-of-two tiles of the frequency-domain convolution.
+ *
+ * A tile is stored as two n x n column-major planes, real and imaginary
+ * parts.  One pass transforms every row along the column index, with the
+ * rows as vector lanes, and the 2D transform is two passes around a
+ * transpose: frequency (ky, kx) of the value at (y, x), stored at x*n+y,
+ * ends up at ky*n+kx.  Transforms are not scaled.
+ */
+
+struct fft_plan {
+  int n;
+  int log2n;
+  float *wr;               // exp(-2 pi i k/n), n/2 real parts
+  float *wi;               // and imaginary parts
+  int *rev;                // bit reversal permutation, n
+};
+
+// returns false when out of memory or when n is not a power of two
+// multiple of SIMD_WIDTH
+static bool fft_plan_init(fft_plan *p, int n) {
+  p->n = n;
+  p->log2n = 0;
+  while ((1 << p->log2n) < n)
+    p->log2n++;
+  p->wr = (float *)malloc(n/2*sizeof(float));
+  p->wi = (float *)malloc(n/2*sizeof(float));
+  p->rev = (int *)malloc(n*sizeof(int));
+  if ((1 << p->log2n) != n || n % SIMD_WIDTH || !p->wr || !p->wi || !p->rev)
+    return false;
+  for (int k = 0; k < n/2; k++) {
+    p->wr[k] = (float)cos(-2*M_PI*k/n);
+    p->wi[k] = (float)sin(-2*M_PI*k/n);
+  }
+  for (int i = 0; i < n; i++) {
+    int r = 0;
+    for (int b = 0; b < p->log2n; b++)
+      r |= ((i >> b) & 1) << (p->log2n-1-b);
+    p->rev[i] = r;
+  }
+  return true;
+}
+
+static void fft_plan_free(fft_plan *p) {
+  free(p->wr);
+  free(p->wi);
+  free(p->rev);
+  p->wr = p->wi = NULL;
+  p->rev = NULL;
+}
+
+// transform rows [0, rows) of the planes along the column index; rows is
+// rounded up to a multiple of SIMD_WIDTH
+static void fft_rows(const fft_plan *p, float *re, float *im, int rows, bool inverse) {
+  const int n = p->n;
+  rows = (rows + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+  if (rows > n)
+    rows = n;
+  for (int i = 0; i < n; i++) {
+    int r = p->rev[i];
+    if (r <= i)
+      continue;
+    for (int y = 0; y < rows; y++) {
+      float t = re[i*n+y];
+      re[i*n+y] = re[r*n+y];
+      re[r*n+y] = t;
+      t = im[i*n+y];
+      im[i*n+y] = im[r*n+y];
+      im[r*n+y] = t;
+    }
+  }
+  const float sign = inverse ? -1.0f : 1.0f;
+  for (int len = 2; len <= n; len <<= 1) {
+    int half = len >> 1;
+    int step = n/len;
+    for (int i = 0; i < n; i += len) {
+      for (int k = 0; k < half; k++) {
+        vfloat wr = vset1(p->wr[k*step]);
+        vfloat wi = vset1(sign*p->wi[k*step]);
+        float *ar = re + (i+k)*n, *ai = im + (i+k)*n;
+        float *br = re + (i+k+half)*n, *bi = im + (i+k+half)*n;
+        for (int y = 0; y < rows; y += SIMD_WIDTH) {
+          vfloat xr = vload(br+y), xi = vload(bi+y);
+          vfloat tr = vsub(vmul(xr, wr), vmul(xi, wi));
+          vfloat ti = vmadd(xr, wi, vmul(xi, wr));
+          vfloat yr = vload(ar+y), yi = vload(ai+y);
+          vstore(br+y, vsub(yr, tr));
+          vstore(bi+y, vsub(yi, ti));
+          vstore(ar+y, vadd(yr, tr));
+          vstore(ai+y, vadd(yi, ti));
+        }
+      }
+    }
+  }
+}
+
+static void fft_transpose(float *x, int n) {
+  for (int c = 0; c < n; c++) {
+    for (int r = c+1; r < n; r++) {
+      float t = x[c*n+r];
+      x[c*n+r] = x[r*n+c];
+      x[r*n+c] = t;
+    }
+  }
+}
+
+// Forward transform of a tile whose rows from rows on are zero, the
+// result is transposed.
+static void fft_2d(const fft_plan *p, float *re, float *im, int rows) {
+  fft_rows(p, re, im, rows, false);
+  fft_transpose(re, p->n);
+  fft_transpose(im, p->n);
+  fft_rows(p, re, im, p->n, false);
+}
+
+// Inverse of fft_2d, computing only rows [0, rows) of the result.
+static void ifft_2d(const fft_plan *p, float *re, float *im, int rows) {
+  fft_rows(p, re, im, p->n, true);
+  fft_transpose(re, p->n);
+  fft_transpose(im, p->n);
+  fft_rows(p, re, im, rows, true);
+}
+
+#endif
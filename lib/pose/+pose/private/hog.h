@@ -0,0 +1,429 @@
+#ifndef POSE_HOG_H
+#define POSE_HOG_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+
+/*
+ * Float32 HOG pipeline shared by the pyramid builder.  The math follows
+ * resize.cc, reduce.cc and features.cc; images are column-major planar
+ * arrays like the MATLAB ones.
+ *
+ * The 9-way dot product search for the gradient orientation is replaced
+ * by a lookup table indexed by the gradient itself.  Gradients of uint8
+ * images are integers in [-255,255] and index the table directly, which
+ * gives exactly the bin of the search.  Other gradients are rescaled so
+ * their larger component is 255 and the lookup is refined against the
+ * neighbouring orientations.
+ *
+ * Gradients and magnitudes of a pixel column are computed with SIMD
+ * before the orientation lookup.  The bilinear vote is split by axis:
+ * each pixel of a column adds its magnitude, weighted along y with SIMD,
+ * to the two cells above and below it in a histogram of the column, and
+ * that histogram is added to the two cell columns left and right of the
+ * pixel column with SIMD, weighted along x.
+ *
+ * Histograms are float32, so features of uint8 images match the double
+ * path of features.cc to about 1e-7, and a few 1e-6 at worst.  Gradients of single images are
+ * float32 too: where the magnitudes of two channels or the projections
+ * on two orientations tie in exact arithmetic, rounding may pick the
+ * other one, and the features of the cells around such pixels differ by
+ * more.  This is the accepted cost of the float path.
+ */
+
+// small value, used to avoid division by zero
+#define HOG_EPS 0.0001f
+
+// number of HOG features per cell
+#define HOG_FEATURES 32
+
+#define HOG_LUT_RANGE 255
+#define HOG_LUT_SIZE (2*HOG_LUT_RANGE+1)
+
+static unsigned char hog_lut[HOG_LUT_SIZE*HOG_LUT_SIZE];
+static bool hog_lut_ready = false;
+
+// unit vectors used to compute gradient orientation
+static const float hog_uu[9] = {1.0000f, 0.9397f, 0.7660f, 0.500f, 0.1736f,
+                                -0.1736f, -0.5000f, -0.7660f, -0.9397f};
+static const float hog_vv[9] = {0.0000f, 0.3420f, 0.6428f, 0.8660f, 0.9848f,
+                                0.9848f, 0.8660f, 0.6428f, 0.3420f};
+
+// snap (dx,dy) to one of 18 orientations by the dot product search
+static inline int hog_search(double dx, double dy) {
+  double best_dot = 0;
+  int best_o = 0;
+  for (int o = 0; o < 9; o++) {
+    double dot = (double)hog_uu[o]*dx + (double)hog_vv[o]*dy;
+    if (dot > best_dot) {
+      best_dot = dot;
+      best_o = o;
+    } else if (-dot > best_dot) {
+      best_dot = -dot;
+      best_o = o+9;
+    }
+  }
+  return best_o;
+}
+
+// fill the orientation table; must be called before any parallel work
+static inline void hog_init_lut() {
+  if (hog_lut_ready)
+    return;
+  for (int dy = -HOG_LUT_RANGE; dy <= HOG_LUT_RANGE; dy++)
+    for (int dx = -HOG_LUT_RANGE; dx <= HOG_LUT_RANGE; dx++)
+      hog_lut[(dy+HOG_LUT_RANGE)*HOG_LUT_SIZE + dx+HOG_LUT_RANGE] =
+        hog_search(dx, dy);
+  hog_lut_ready = true;
+}
+
+// orientation bin of gradient (dx,dy); integral tells the gradient
+// components are integers within the table range.  Rescaled gradients
+// land within one bin of the answer, so only the looked up orientation
+// and its two neighbours are compared.
+static inline int hog_orientation(float dx, float dy, bool integral) {
+  if (integral)
+    return hog_lut[((int)dy+HOG_LUT_RANGE)*HOG_LUT_SIZE + (int)dx+HOG_LUT_RANGE];
+
+  float m = fabsf(dx) > fabsf(dy) ? fabsf(dx) : fabsf(dy);
+  if (m == 0)
+    return 0;
+  float s = HOG_LUT_RANGE / m;
+  int qx = (int)floorf(dx*s + 0.5f);
+  int qy = (int)floorf(dy*s + 0.5f);
+  int o = hog_lut[(qy+HOG_LUT_RANGE)*HOG_LUT_SIZE + qx+HOG_LUT_RANGE] % 9;
+  float best_dot = 0;
+  int best_o = 0;
+  for (int k = -1; k <= 1; k++) {
+    int c = (o+k+9) % 9;
+    float dot = hog_uu[c]*dx + hog_vv[c]*dy;
+    if (fabsf(dot) > best_dot) {
+      best_dot = fabsf(dot);
+      best_o = dot > 0 ? c : c+9;
+    }
+  }
+  return best_o;
+}
+
+// cell grid of a height x width image
+struct hog_size {
+  int blocks[2];
+  int visible[2];
+  int out[2];
+};
+
+static inline void hog_get_size(int height, int width, int sbin,
+                                hog_size *size) {
+  size->blocks[0] = (int)round((double)height/(double)sbin);
+  size->blocks[1] = (int)round((double)width/(double)sbin);
+  size->visible[0] = size->blocks[0]*sbin;
+  size->visible[1] = size->blocks[1]*sbin;
+  size->out[0] = size->blocks[0]-2 > 0 ? size->blocks[0]-2 : 0;
+  size->out[1] = size->blocks[1]-2 > 0 ? size->blocks[1]-2 : 0;
+}
+
+// gradient of the strongest channel and its magnitude at rows [1,len)
+// of a pixel column; rows past the image reuse the last interior row
+static inline void hog_gradients(const float *col, int height, int plane,
+                                 int len, float *gx, float *gy, float *gm) {
+  int y = 1;
+  int interior = len < height-1 ? len : height-1;
+  for (; y+SIMD_WIDTH <= interior; y += SIMD_WIDTH) {
+    const float *s = col + y;
+    vfloat dy = vsub(vload(s+1), vload(s-1));
+    vfloat dx = vsub(vload(s+height), vload(s-height));
+    vfloat v = vmadd(dx, dx, vmul(dy, dy));
+    for (int c = 1; c < 3; c++) {
+      s += plane;
+      vfloat dy2 = vsub(vload(s+1), vload(s-1));
+      vfloat dx2 = vsub(vload(s+height), vload(s-height));
+      vfloat v2 = vmadd(dx2, dx2, vmul(dy2, dy2));
+      dx = vselect_gt(v2, v, dx2, dx);
+      dy = vselect_gt(v2, v, dy2, dy);
+      v = vselect_gt(v2, v, v2, v);
+    }
+    vstore(gx+y, dx);
+    vstore(gy+y, dy);
+    vstore(gm+y, vsqrt(v));
+  }
+  for (; y < len; y++) {
+    const float *s = col + (y < height-2 ? y : height-2);
+    float dy = s[1] - s[-1];
+    float dx = s[height] - s[-height];
+    float v = dx*dx + dy*dy;
+
+    // pick channel with strongest gradient
+    for (int c = 1; c < 3; c++) {
+      s += plane;
+      float dy2 = s[1] - s[-1];
+      float dx2 = s[height] - s[-height];
+      float v2 = dx2*dx2 + dy2*dy2;
+      if (v2 > v) {
+        v = v2;
+        dx = dx2;
+        dy = dy2;
+      }
+    }
+    gx[y] = dx;
+    gy[y] = dy;
+    gm[y] = sqrtf(v);
+  }
+}
+
+// accumulate orientation histograms of pixel columns [x0,x1) of a
+// 3-channel image into hist (blocks[0] x blocks[1] x 18)
+static inline void hog_accumulate(const float *im, int height, int width,
+                                  int sbin, const hog_size *size,
+                                  bool integral, float *hist,
+                                  int x0, int x1) {
+  const int *blocks = size->blocks;
+  const int plane = height*width;
+  const int cells = blocks[0]*blocks[1];
+  const int len = size->visible[0]-1;
+  // histogram of a pixel column, with a cell of padding above and below
+  // for the votes that fall off the grid
+  const int rows = blocks[0]+2;
+  float *buf = (float *)malloc((7*(len+1) + 18*rows)*sizeof(float));
+  float *gx = buf, *gy = buf + len+1, *gm = buf + 2*(len+1);
+  float *wy0 = buf + 3*(len+1), *wy1 = buf + 4*(len+1);
+  float *v0 = buf + 5*(len+1), *v1 = buf + 6*(len+1);
+  float *colh = buf + 7*(len+1);
+  int *cell = (int *)malloc((len+1)*sizeof(int));
+
+  // cells and weights along y are the same for every column
+  for (int y = 1; y < len; y++) {
+    float yp = ((float)y+0.5f)/(float)sbin - 0.5f;
+    int iyp = (int)floorf(yp);
+    float vy0 = yp-iyp;
+    cell[y] = iyp+1;
+    wy0[y] = 1.0f-vy0;
+    wy1[y] = vy0;
+  }
+  memset(colh, 0, 18*rows*sizeof(float));
+
+  for (int x = x0; x < x1; x++) {
+    const float *col = im + (x < width-2 ? x : width-2)*height;
+    hog_gradients(col, height, plane, len, gx, gy, gm);
+
+    // magnitudes weighted along y
+    int y = 1;
+    for (; y+SIMD_WIDTH <= len; y += SIMD_WIDTH) {
+      vfloat m = vload(gm+y);
+      vstore(v0+y, vmul(m, vload(wy0+y)));
+      vstore(v1+y, vmul(m, vload(wy1+y)));
+    }
+    for (; y < len; y++) {
+      v0[y] = gm[y]*wy0[y];
+      v1[y] = gm[y]*wy1[y];
+    }
+
+    // vote into the cells above and below each pixel of the column
+    for (y = 1; y < len; y++) {
+      float *h = colh + hog_orientation(gx[y], gy[y], integral)*rows + cell[y];
+      h[0] += v0[y];
+      h[1] += v1[y];
+    }
+
+    // and into the cell columns left and right of it
+    float xp = ((float)x+0.5f)/(float)sbin - 0.5f;
+    int ixp = (int)floorf(xp);
+    vfloat vx0 = vset1(xp-ixp);
+    vfloat vx1 = vset1(1.0f-(xp-ixp));
+    for (int o = 0; o < 18; o++) {
+      const float *src = colh + o*rows + 1;
+      float *left = ixp >= 0 ? hist + o*cells + ixp*blocks[0] : NULL;
+      float *right = ixp+1 < blocks[1] ? hist + o*cells + (ixp+1)*blocks[0] : NULL;
+      int r = 0;
+      for (; r+SIMD_WIDTH <= blocks[0]; r += SIMD_WIDTH) {
+        vfloat v = vload(src+r);
+        if (left)
+          vstore(left+r, vmadd(vx1, v, vload(left+r)));
+        if (right)
+          vstore(right+r, vmadd(vx0, v, vload(right+r)));
+      }
+      for (; r < blocks[0]; r++) {
+        if (left)
+          left[r] += (1.0f-(xp-ixp))*src[r];
+        if (right)
+          right[r] += (xp-ixp)*src[r];
+      }
+    }
+    memset(colh, 0, 18*rows*sizeof(float));
+  }
+  free(cell);
+  free(buf);
+}
+
+// compute energy in each block by summing over orientations
+static inline void hog_norm(const float *hist, const hog_size *size,
+                            float *norm) {
+  const int cells = size->blocks[0]*size->blocks[1];
+  memset(norm, 0, cells*sizeof(float));
+  for (int o = 0; o < 9; o++) {
+    const float *src1 = hist + o*cells;
+    const float *src2 = hist + (o+9)*cells;
+    for (int i = 0; i < cells; i++)
+      norm[i] += (src1[i] + src2[i]) * (src1[i] + src2[i]);
+  }
+}
+
+// compute features of output column x into a map of dims[0] x dims[1]
+// x HOG_FEATURES, offset by (pady,padx)
+template <typename T>
+static inline void hog_column(const float *hist, const float *norm,
+                              const hog_size *size, int x, T *feat,
+                              const int *dims, int pady, int padx) {
+  const int *blocks = size->blocks;
+  const int cells = blocks[0]*blocks[1];
+  const int plane = dims[0]*dims[1];
+
+  for (int y = 0; y < size->out[0]; y++) {
+    T *dst = feat + (x+padx)*dims[0] + (y+pady);
+    const float *src, *p;
+    float n1, n2, n3, n4;
+
+    p = norm + (x+1)*blocks[0] + y+1;
+    n1 = 1.0f / sqrtf(p[0] + p[1] + p[blocks[0]] + p[blocks[0]+1] + HOG_EPS);
+    p = norm + (x+1)*blocks[0] + y;
+    n2 = 1.0f / sqrtf(p[0] + p[1] + p[blocks[0]] + p[blocks[0]+1] + HOG_EPS);
+    p = norm + x*blocks[0] + y+1;
+    n3 = 1.0f / sqrtf(p[0] + p[1] + p[blocks[0]] + p[blocks[0]+1] + HOG_EPS);
+    p = norm + x*blocks[0] + y;
+    n4 = 1.0f / sqrtf(p[0] + p[1] + p[blocks[0]] + p[blocks[0]+1] + HOG_EPS);
+
+    float t1 = 0, t2 = 0, t3 = 0, t4 = 0;
+
+    // contrast-sensitive features
+    src = hist + (x+1)*blocks[0] + (y+1);
+    for (int o = 0; o < 18; o++) {
+      float h1 = fminf(*src * n1, 0.2f);
+      float h2 = fminf(*src * n2, 0.2f);
+      float h3 = fminf(*src * n3, 0.2f);
+      float h4 = fminf(*src * n4, 0.2f);
+      *dst = 0.5f * (h1 + h2 + h3 + h4);
+      t1 += h1;
+      t2 += h2;
+      t3 += h3;
+      t4 += h4;
+      dst += plane;
+      src += cells;
+    }
+
+    // contrast-insensitive features
+    src = hist + (x+1)*blocks[0] + (y+1);
+    for (int o = 0; o < 9; o++) {
+      float sum = *src + *(src + 9*cells);
+      float h1 = fminf(sum * n1, 0.2f);
+      float h2 = fminf(sum * n2, 0.2f);
+      float h3 = fminf(sum * n3, 0.2f);
+      float h4 = fminf(sum * n4, 0.2f);
+      *dst = 0.5f * (h1 + h2 + h3 + h4);
+      dst += plane;
+      src += cells;
+    }
+
+    // texture features
+    *dst = 0.2357f * t1;
+    dst += plane;
+    *dst = 0.2357f * t2;
+    dst += plane;
+    *dst = 0.2357f * t3;
+    dst += plane;
+    *dst = 0.2357f * t4;
+
+    // truncation feature
+    dst += plane;
+    *dst = 0;
+  }
+}
+
+// struct used for caching interpolation values
+struct hog_alphainfo {
+  int si, di;
+  float alpha;
+};
+
+// resize along each column, see resize.cc
+// result is transposed, so we can apply it twice for a complete resize
+static inline void hog_resize1dtran(const float *src, int sheight, float *dst,
+                                    int dheight, int width, int chan) {
+  double scale = (double)dheight/(double)sheight;
+  double invscale = (double)sheight/(double)dheight;
+
+  // we cache the interpolation values since they can be
+  // shared among different columns
+  int len = (int)ceil(dheight*invscale) + 2*dheight;
+  hog_alphainfo *ofs = (hog_alphainfo *)malloc(len*sizeof(hog_alphainfo));
+  int k = 0;
+  for (int dy = 0; dy < dheight; dy++) {
+    double fsy1 = dy * invscale;
+    double fsy2 = fsy1 + invscale;
+    int sy1 = (int)ceil(fsy1);
+    int sy2 = (int)floor(fsy2);
+
+    if (sy1 - fsy1 > 1e-3) {
+      ofs[k].di = dy*width;
+      ofs[k].si = sy1-1;
+      ofs[k++].alpha = (sy1 - fsy1) * scale;
+    }
+    for (int sy = sy1; sy < sy2; sy++) {
+      ofs[k].di = dy*width;
+      ofs[k].si = sy;
+      ofs[k++].alpha = scale;
+    }
+    if (fsy2 - sy2 > 1e-3) {
+      ofs[k].di = dy*width;
+      ofs[k].si = sy2;
+      ofs[k++].alpha = (fsy2 - sy2) * scale;
+    }
+  }
+
+  // resize each column of each color channel
+  memset(dst, 0, chan*width*dheight*sizeof(float));
+  for (int c = 0; c < chan; c++) {
+    for (int x = 0; x < width; x++) {
+      const float *s = src + c*width*sheight + x*sheight;
+      float *d = dst + c*width*dheight + x;
+      for (int i = 0; i < k; i++)
+        d[ofs[i].di] += ofs[i].alpha * s[ofs[i].si];
+    }
+  }
+  free(ofs);
+}
+
+// reduce each column with a 5-tap binomial filter, see reduce.cc
+// result is transposed, so we can apply it twice for a complete reduction
+static inline void hog_reduce1dtran(const float *src, int sheight, float *dst,
+                                    int dheight, int width, int chan) {
+  for (int c = 0; c < chan; c++) {
+    for (int x = 0; x < width; x++) {
+      const float *s = src + c*width*sheight + x*sheight;
+      float *d = dst + c*dheight*width + x;
+
+      // First row
+      *d = s[0]*.6875f + s[1]*.2500f + s[2]*.0625f;
+
+      for (int y = 1; y < dheight-2; y++) {
+        s += 2;
+        d += width;
+        *d = s[-2]*0.0625f + s[-1]*.25f + s[0]*.375f + s[1]*.25f + s[2]*.0625f;
+      }
+
+      // Last two rows
+      s += 2;
+      d += width;
+      if (dheight*2 <= sheight) {
+        *d = s[-2]*0.0625f + s[-1]*.25f + s[0]*.375f + s[1]*.25f + s[2]*.0625f;
+      } else {
+        *d = s[1]*.3125f + s[0]*.3750f + s[-1]*.2500f + s[-2]*.0625f;
+      }
+      s += 2;
+      d += width;
+      *d = s[0]*.6875f + s[-1]*.2500f + s[-2]*.0625f;
+    }
+  }
+}
+
+#endif
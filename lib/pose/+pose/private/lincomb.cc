@@ -2,9 +2,36 @@
 #include <stdint.h>
 #include "mex.h"
 #include "matrix.h"
+#include "qp.h"
+#include "thread_pool.h"
+
+// lincomb(qp.x,qp.a,inds,len)
+// sums the sparse examples in qp.x at the columns specified by 'inds', weighted by qp.a
+
+struct lincomb_args {
+  const float *X;
+  const double *A;
+  const double *I;
+  int n;
+  int k;
+  int m;
+  int chunk;               // weights per task
+  double *W;
+};
+
+// Sum of the examples over one range of weights, one range per thread.
+// Every task runs over all examples in order, so each weight is summed in
+// the same order as a serial loop whatever the number of threads.
+static void lincomb_chunk(void *arg, int c) {
+  lincomb_args *a = (lincomb_args *)arg;
+  int lo = c*a->chunk;
+  int hi = QP_MIN(lo + a->chunk, a->m);
+  for (int i = 0; i < a->n; i++) {
+    int j = (int)(a->I[i]-1);
+    qp_add_range(a->W, a->X + (size_t)a->k*j, a->A[j], lo, hi);
+  }
+}
 
-// score(w,qp.x,inds)
-// scores a weight vector 'w' on a set of sparse examples in qp.x at the columns specified by 'inds'
 void mexFunction( int nlhs, mxArray *plhs[],
                   int nrhs, const mxArray *prhs[] )
 {
@@ -24,22 +51,10 @@ void mexFunction( int nlhs, mxArray *plhs[],
 
   mxArray *mxW = mxCreateDoubleMatrix(m[0],1,mxREAL);
   double  *W   = (double *)mxGetPr(mxW);
-  //printf("(%f,%d,%d)\n",m[0],n,k);
-  for (int i = 0; i < n; i++) {
-    const float *x = X + k*(int)(I[i]-1);
-    const double a = A[(int)(I[i]-1)];
-    int   xp = 1;
-    // printf("(%f,%f)\n",x[0],a);
-    // Iterate through blocks, and grab boundary indices using matlab's indexing
-    for (int b = 0; b < x[0]; b++) { 
-      int wp  = (int)x[xp++] - 1;
-      int len = (int)x[xp++] - wp;
-      // printf("(%f,%f,%d,%d,%d)\n",W[wp],x[xp],xp,wp,b);
-      for (int j = 0; j < len; j++) {      
-	W[wp++] += a * (double)x[xp++];
-      }
-    }
-  }
+  ThreadPool &pool = ThreadPool::instance();
+  int tasks = pool.size();
+  lincomb_args args = {X, A, I, n, k, (int)m[0], ((int)m[0] + tasks - 1) / tasks, W};
+  pool.parallel_for(tasks, lincomb_chunk, &args);
 
   plhs[0] = mxW;
   return;
@@ -0,0 +1,214 @@
+#ifndef POSE_PYRAMID_H
+#define POSE_PYRAMID_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hog.h"
+#include "thread_pool.h"
+
+/*
+ * HOG feature pyramid of one image, see featpyramid.m.
+ *
+ * The image is converted once to float planes.  The scaled images of the
+ * interval octave chains are built in parallel, then the features of all
+ * levels are computed in parallel, directly into padded single-precision
+ * maps with the boundary occlusion feature set.
+ *
+ * Only malloc is used, so a pyramid can be built inside a pool task, where
+ * the nested loops run serially; hog_init_lut() must have been called
+ * from the mex entry point.
+ */
+
+struct pyramid_level {
+  float *im;
+  int height;
+  int width;
+  bool owner;
+  bool integral;
+  bool failed;             // out of memory while building
+  hog_size size;
+  float *feat;             // dims[0] x dims[1] x dims[2], set by the caller
+  int dims[3];
+};
+
+struct pyramid_data {
+  float *im;
+  int height;
+  int width;
+  int sbin;
+  int interval;
+  int max_scale;
+  int num_levels;
+  int pady;
+  int padx;
+  pyramid_level *levels;
+  double *scale;           // num_levels, in image pixels per cell
+};
+
+static inline int pyramid_max(int x, int y) { return (x <= y ? y : x); }
+
+// resize or reduce src into the preallocated level dst
+static void scale_image(const pyramid_level *src, pyramid_level *dst, bool reduce) {
+  float *tmp = (float *)malloc(dst->height*src->width*3*sizeof(float));
+  dst->im = (float *)malloc(dst->height*dst->width*3*sizeof(float));
+  dst->owner = true;
+  if (!tmp || !dst->im) {
+    free(tmp);
+    free(dst->im);
+    dst->im = NULL;
+    return;
+  }
+  if (reduce) {
+    hog_reduce1dtran(src->im, src->height, tmp, dst->height, src->width, 3);
+    hog_reduce1dtran(tmp, src->width, dst->im, dst->width, dst->height, 3);
+  } else {
+    hog_resize1dtran(src->im, src->height, tmp, dst->height, src->width, 3);
+    hog_resize1dtran(tmp, src->width, dst->im, dst->width, dst->height, 3);
+  }
+  free(tmp);
+}
+
+// build the images of octave chain i: level i is resized from the input
+// and every level j+interval is reduced from level j
+static void build_chain(void *arg, int i) {
+  pyramid_data *d = (pyramid_data *)arg;
+  pyramid_level *level = &d->levels[i];
+  if (i > 0) {
+    pyramid_level input;
+    input.im = d->im;
+    input.height = d->height;
+    input.width = d->width;
+    scale_image(&input, level, false);
+  }
+  for (int j = i+d->interval; j < d->max_scale; j += d->interval) {
+    if (d->levels[j-d->interval].im == NULL)
+      return;
+    scale_image(&d->levels[j-d->interval], &d->levels[j], true);
+  }
+}
+
+// compute the padded feature map of level l
+static void build_level(void *arg, int l) {
+  pyramid_data *d = (pyramid_data *)arg;
+  pyramid_level *level = &d->levels[l];
+  const hog_size *size = &level->size;
+  int cells = size->blocks[0]*size->blocks[1];
+  float *hist = (float *)calloc(cells*18, sizeof(float));
+  float *norm = (float *)calloc(cells, sizeof(float));
+  if (!level->im || !hist || !norm) {
+    free(hist);
+    free(norm);
+    level->failed = true;
+    return;
+  }
+
+  hog_accumulate(level->im, level->height, level->width, d->sbin, size,
+                 level->integral, hist, 1, size->visible[1]-1);
+  hog_norm(hist, size, norm);
+  for (int x = 0; x < size->out[1]; x++)
+    hog_column(hist, norm, size, x, level->feat, level->dims,
+               d->pady+1, d->padx+1);
+
+  // write boundary occlusion feature
+  const int *dims = level->dims;
+  float *occ = level->feat + (HOG_FEATURES-1)*dims[0]*dims[1];
+  for (int x = 0; x < dims[1]; x++) {
+    for (int y = 0; y < dims[0]; y++) {
+      if (x <= d->padx || x >= dims[1]-d->padx-1 ||
+          y <= d->pady || y >= dims[0]-d->pady-1)
+        occ[x*dims[0] + y] = 1;
+    }
+  }
+
+  free(hist);
+  free(norm);
+}
+
+// convert a uint8, single or double image to float planes; tells whether
+// all values are integers in [0,255]
+template <typename T>
+bool convert_image(const T *src, float *dst, int pixels, int chan) {
+  bool integral = true;
+  for (int c = 0; c < 3; c++) {
+    const T *s = src + (chan == 3 ? c*pixels : 0);
+    float *d = dst + c*pixels;
+    for (int i = 0; i < pixels; i++) {
+      d[i] = (float)s[i];
+      if (d[i] != floorf(d[i]) || d[i] < 0 || d[i] > 255)
+        integral = false;
+    }
+  }
+  return integral;
+}
+
+// Level sizes, scales and feature map dims of an image of height x width
+// whose float planes are in d->im, following the order of featpyramid.m;
+// sbin, interval and the padding must be set.  Returns NULL or the error,
+// the caller then allocates the zeroed feature maps.
+static const char *pyramid_init(pyramid_data *d, bool integral) {
+  d->levels = NULL;
+  d->scale = NULL;
+  double sc = pow(2.0, 1.0/d->interval);
+  int min_size = d->height < d->width ? d->height : d->width;
+  d->max_scale = 1 + (int)floor(log(min_size/(5.0*d->sbin))/log(sc));
+  d->num_levels = pyramid_max(d->max_scale, d->interval);
+  d->levels = (pyramid_level *)calloc(d->num_levels, sizeof(pyramid_level));
+  d->scale = (double *)malloc(d->num_levels*sizeof(double));
+  if (!d->levels || !d->scale)
+    return "Out of memory";
+
+  double *scale = d->scale;
+  for (int i = 0; i < d->interval; i++) {
+    scale[i] = 1.0/pow(sc, i);
+    d->levels[i].height = (int)round(d->height*scale[i]);
+    d->levels[i].width = (int)round(d->width*scale[i]);
+    for (int j = i+d->interval; j < d->max_scale; j += d->interval) {
+      scale[j] = 0.5*scale[j-d->interval];
+      d->levels[j].height = (int)round(d->levels[j-d->interval].height*.5);
+      d->levels[j].width = (int)round(d->levels[j-d->interval].width*.5);
+    }
+  }
+  d->levels[0].im = d->im;
+  d->levels[0].integral = integral;
+
+  for (int l = 0; l < d->num_levels; l++) {
+    pyramid_level *level = &d->levels[l];
+    if (level->height < 3 || level->width < 3)
+      return "Image is too small for the model";
+    hog_get_size(level->height, level->width, d->sbin, &level->size);
+    level->dims[0] = level->size.out[0] + 2*(d->pady+1);
+    level->dims[1] = level->size.out[1] + 2*(d->padx+1);
+    level->dims[2] = HOG_FEATURES;
+    scale[l] = d->sbin/scale[l];
+  }
+  return NULL;
+}
+
+// fill the feature maps of all levels; returns false when out of memory
+static bool pyramid_build(pyramid_data *d) {
+  ThreadPool &pool = ThreadPool::instance();
+  pool.parallel_for(d->interval < d->num_levels ? d->interval : d->num_levels,
+                    build_chain, d);
+  pool.parallel_for(d->num_levels, build_level, d);
+  bool ok = true;
+  for (int l = 0; l < d->num_levels; l++)
+    ok = ok && !d->levels[l].failed;
+  return ok;
+}
+
+// release the scaled images and the levels, not the input image nor the
+// feature maps
+static void pyramid_free(pyramid_data *d) {
+  if (d->levels) {
+    for (int l = 1; l < d->num_levels; l++)
+      if (d->levels[l].owner)
+        free(d->levels[l].im);
+  }
+  free(d->levels);
+  free(d->scale);
+  d->levels = NULL;
+  d->scale = NULL;
+}
+
+#endif
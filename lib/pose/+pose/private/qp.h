@@ -0,0 +1,130 @@
+#ifndef POSE_QP_H
+#define POSE_QP_H
+
+#include "simd.h"
+
+/*
+ * Kernels on the block-sparse examples of the QP (see qp_write.m).  A
+ * column x of qp.x holds x[0] blocks, each stored as its first and last
+ * index in the weight vector (matlab indexing) followed by its values, so
+ * every block is a contiguous dense run of floats.
+ *
+ * Sums run in double over SIMD_DWIDTH lanes of widened floats.
+ */
+
+#define QP_MAX(A,B) ((A) < (B) ? (B) : (A))
+#define QP_MIN(A,B) ((A) > (B) ? (B) : (A))
+
+// sum of W[i]*x[i] over n entries
+static inline double qp_dot_dense(const double *W, const float *x, int n) {
+  vdouble s = vdzero();
+  int i = 0;
+  for (; i + SIMD_DWIDTH <= n; i += SIMD_DWIDTH)
+    s = vdmadd(vdload(W+i), vdcvt(x+i), s);
+  double y = vdsum(s);
+  for (; i < n; i++)
+    y += W[i] * (double)x[i];
+  return y;
+}
+
+// sum of x[i]*y[i] over n entries
+static inline double qp_dot_float(const float *x, const float *y, int n) {
+  vdouble s = vdzero();
+  int i = 0;
+  for (; i + SIMD_DWIDTH <= n; i += SIMD_DWIDTH)
+    s = vdmadd(vdcvt(x+i), vdcvt(y+i), s);
+  double r = vdsum(s);
+  for (; i < n; i++)
+    r += (double)x[i] * (double)y[i];
+  return r;
+}
+
+// W[i] += a*x[i] over n entries
+static inline void qp_axpy(double *W, const float *x, double a, int n) {
+  vdouble va = vdset1(a);
+  int i = 0;
+  for (; i + SIMD_DWIDTH <= n; i += SIMD_DWIDTH)
+    vdstore(W+i, vdmadd(va, vdcvt(x+i), vdload(W+i)));
+  for (; i < n; i++)
+    W[i] += a * (double)x[i];
+}
+
+// W*x
+static inline double qp_score(const double *W, const float *x) {
+  double y  = 0;
+  int    xp = 1;
+  for (int b = 0; b < x[0]; b++) {
+    int wp  = (int)x[xp] - 1;
+    int len = (int)x[xp+1] - wp;
+    y  += qp_dot_dense(W + wp, x + xp + 2, len);
+    xp += 2 + len;
+  }
+  return y;
+}
+
+// x*y, summed over the intersections of their blocks
+static inline double qp_dot(const float *x, const float *y) {
+  double res = 0;
+  int xnum = (int)x[0];
+  int ynum = (int)y[0];
+
+  //  b: block number
+  //  i: position in sparse vector
+  // j1: start position in dense vector (matlab index)
+  // j2: end   position in dense vector (matlab index)
+  int yb=0, xb=0;
+  int yi=1, xi=1;
+  int yj1 = (int)y[yi++];
+  int yj2 = (int)y[yi++];
+  int xj1 = (int)x[xi++];
+  int xj2 = (int)x[xi++];
+
+  while (1) {
+    // Find intersecting indices
+    if (xj2 >= yj1 && yj2 >= xj1) {
+      int j1 = QP_MAX(xj1,yj1);
+      int j2 = QP_MIN(xj2,yj2);
+      res += qp_dot_float(x + xi + j1 - xj1, y + yi + j1 - yj1, j2-j1+1);
+    }
+    // Increment x or y pointer
+    if (yj2 <= xj2) {
+      if (++yb >= ynum) break;
+      yi += yj2-yj1+1;
+      yj1 = y[yi++];
+      yj2 = y[yi++];
+    } else {
+      if (++xb >= xnum) break;
+      xi += xj2-xj1+1;
+      xj1 = x[xi++];
+      xj2 = x[xi++];
+    }
+  }
+  return res;
+}
+
+// W += a*x
+static inline void qp_add(double *W, const float *x, double a) {
+  int xp = 1;
+  for (int b = 0; b < x[0]; b++) {
+    int wp  = (int)x[xp] - 1;
+    int len = (int)x[xp+1] - wp;
+    qp_axpy(W + wp, x + xp + 2, a, len);
+    xp += 2 + len;
+  }
+}
+
+// W[lo,hi) += a*x, the part of qp_add that falls in a range of weights
+static inline void qp_add_range(double *W, const float *x, double a, int lo, int hi) {
+  int xp = 1;
+  for (int b = 0; b < x[0]; b++) {
+    int wp  = (int)x[xp] - 1;
+    int len = (int)x[xp+1] - wp;
+    int j1 = QP_MAX(wp, lo);
+    int j2 = QP_MIN(wp + len, hi);
+    if (j1 < j2)
+      qp_axpy(W + j1, x + xp + 2 + j1 - wp, a, j2 - j1);
+    xp += 2 + len;
+  }
+}
+
+#endif
@@ -2,24 +2,24 @@
 #include <stdint.h>
 #include "mex.h"
 #include "matrix.h"
+#include "qp.h"
+#include "thread_pool.h"
 
 // score(w,qp.x,inds)
 // scores a weight vector 'w' on a set of sparse examples in qp.x at the columns specified by 'inds'
 
-#define MAX(A,B) ((A) < (B) ? (B) : (A))
-
-static inline double score(const double *W, const float* x) {
-  double y  = 0;
-  int    xp = 1;
-  // Iterate through blocks, and grab boundary indices using matlab's indexing
-  for (int b = 0; b < x[0]; b++) { 
-    int wp  = (int)x[xp++] - 1;
-    int len = (int)x[xp++] - wp;
-    for (int i = 0; i < len; i++) {      
-      y += W[wp++] * (double)x[xp++];
-    }
-  }
-  return y;
+struct score_args {
+  const double *W;
+  const float *X;
+  const double *I;
+  int k;
+  double *Y;
+};
+
+// score of one example, run on the shared thread pool
+static void score_example(void *arg, int i) {
+  score_args *a = (score_args *)arg;
+  a->Y[i] = qp_score(a->W, a->X + (size_t)a->k*(int)(a->I[i]-1));
 }
 
 void mexFunction( int nlhs, mxArray *plhs[],
@@ -40,9 +40,8 @@ void mexFunction( int nlhs, mxArray *plhs[],
   mxArray *mxY = mxCreateDoubleMatrix(l,1,mxREAL);
   double  *Y   = (double *)mxGetPr(mxY);
   
-  for (int i = 0; i < l; i++) {    
-    Y[i] = score(W,X + k*(int)(I[i]-1));
-  }
+  score_args args = {W, X, I, k, Y};
+  ThreadPool::instance().parallel_for(l, score_example, &args);
   plhs[0] = mxY;
   return;
 }
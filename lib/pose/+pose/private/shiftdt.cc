@@ -1,56 +1,37 @@
-#define INF 1E20
 #include <math.h>
 #include <sys/types.h>
 #include "mex.h"
+#include "dt.h"
 
 /*
  * shiftdt.cc
  * Generalized distance transforms based on Felzenswalb and Huttenlocher.
  * This applies computes a min convolution of an arbitrary quadratic function ax^2 + bx
  * This outputs results on an shifted, subsampled grid (useful for passing messages between variables in different domains)
+ * The line transform dt1d is in dt.h.
  */
 
-static inline int square(int x) { return x*x; }
-
-// dt1d(source,destination_val,destination_ptr,source_step,source_length,
-//      a,b,dest_shift,dest_length,dest_step)
-void dt1d(double *src, double *dst, int *ptr, int step, int len, double a, double b, int dshift, int dlen, double dstep) {
-  int   *v = new int[len];
-  float *z = new float[len+1];
-  int k = 0;
-  int q = 0;
-  v[0] = 0;
-  z[0] = -INF;
-  z[1] = +INF;
-
-  for (q = 1; q <= len-1; q++) {
-    float s = ((src[q*step] - src[v[k]*step]) - b*(q - v[k]) + a*(square(q) - square(v[k]))) / (2*a*(q-v[k]));
-    while (s <= z[k]) {
-      k--;
-      s  = ((src[q*step] - src[v[k]*step]) - b*(q - v[k]) + a*(square(q) - square(v[k]))) / (2*a*(q-v[k]));
-    }
-    k++;
-    v[k]   = q;
-    z[k]   = s;
-    z[k+1] = +INF;
-  }
-
-   k = 0;
-   q = dshift;
-
-   for (int i=0; i <= dlen-1; i++) {
-     while (z[k+1] < q)
-       k++;
-     dst[i*step] = a*square(q-v[k]) + b*(q-v[k]) + src[v[k]*step];
-     ptr[i*step] = v[k];
-     q += dstep;
-  }
-
-  delete [] v;
-  delete [] z;
+// arguments shared by the column and row passes
+struct dt_data {
+  double *vals, *tmpM, *M;
+  int32_t *Ix, *tmpIy;
+  int sizx, sizy;
+  double ax, bx, ay, by;
+  int offx, offy, lenx, leny;
+  int step;
+};
+
+void dt_column(void *arg, int x) {
+  dt_data *d = (dt_data *)arg;
+  dt_scratch &s = DtArena::instance().local();
+  dt1d(d->vals+x*d->sizy, d->tmpM+x*d->leny, d->tmpIy+x*d->leny, 1, d->sizy, d->ay, d->by, d->offy, d->leny, d->step, s.v, s.z);
 }
 
-
+void dt_row(void *arg, int y) {
+  dt_data *d = (dt_data *)arg;
+  dt_scratch &s = DtArena::instance().local();
+  dt1d(d->tmpM+y, d->M+y, d->Ix+y, d->leny, d->sizx, d->ax, d->bx, d->offx, d->lenx, d->step, s.v, s.z);
+}
 
 // matlab entry point
 // [M, Ix, Iy] = dt(vals, ax, bx, ay, by)
@@ -75,7 +56,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
   int offy  = (int)mxGetScalar(prhs[6])-1;
   int lenx  = (int)mxGetScalar(prhs[7]);
   int leny  = (int)mxGetScalar(prhs[8]);
-  double step = mxGetScalar(prhs[9]);
+  int step  = (int)mxGetScalar(prhs[9]);
 
 
   mxArray  *mxM = mxCreateNumericMatrix(leny,lenx,mxDOUBLE_CLASS, mxREAL);
@@ -92,11 +73,12 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 
   // dt1d(source,destination_val,destination_ptr,source_step,source_length,
   //      a,b,dest_shift,dest_length,dest_step)
-  for (int x = 0; x < sizx; x++)
-    dt1d(vals+x*sizy, tmpM+x*leny, tmpIy+x*leny, 1, sizy, ay, by, offy, leny, step);
-   
-  for (int y = 0; y < leny; y++)
-    dt1d(tmpM+y, M+y, Ix+y, leny, sizx, ax, bx, offx, lenx, step);
+  // columns and rows are independent, run each pass on the thread pool
+  if (!DtArena::instance().reserve(sizx > sizy ? sizx : sizy, 0))
+    mexErrMsgTxt("Out of memory");
+  dt_data d = {vals, tmpM, M, Ix, tmpIy, sizx, sizy, ax, bx, ay, by, offx, offy, lenx, leny, step};
+  ThreadPool::instance().parallel_for(sizx, dt_column, &d);
+  ThreadPool::instance().parallel_for(leny, dt_row, &d);
 
   // get argmins and adjust for matlab indexing from 1
   for (int x = 0; x < lenx; x++) {
@@ -0,0 +1,159 @@
+#ifndef POSE_SIMD_H
+#define POSE_SIMD_H
+
+/*
+ * Thin wrapper over the float32 vector instructions available at compile
+ * time.  The same kernel source builds for AVX (8 lanes), SSE (4 lanes)
+ * or plain scalar code, so compile with -march=native to get the widest
+ * path the machine supports.
+ */
+
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+typedef __m256 vfloat;
+static inline vfloat vzero() { return _mm256_setzero_ps(); }
+static inline vfloat vset1(float x) { return _mm256_set1_ps(x); }
+static inline vfloat vload(const float *p) { return _mm256_loadu_ps(p); }
+static inline void vstore(float *p, vfloat v) { _mm256_storeu_ps(p, v); }
+static inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+static inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+// (a > b) ? x : y per lane
+static inline vfloat vselect_gt(vfloat a, vfloat b, vfloat x, vfloat y) {
+  return _mm256_blendv_ps(y, x, _mm256_cmp_ps(a, b, _CMP_GT_OQ));
+}
+static inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+#if defined(__FMA__)
+static inline vfloat vmadd(vfloat a, vfloat b, vfloat c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+static inline vfloat vmadd(vfloat a, vfloat b, vfloat c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+static inline float vsum(vfloat v) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+
+// float64 lanes, for sums over float data that need double accumulation
+#define SIMD_DWIDTH 4
+typedef __m256d vdouble;
+static inline vdouble vdzero() { return _mm256_setzero_pd(); }
+static inline vdouble vdset1(double x) { return _mm256_set1_pd(x); }
+static inline vdouble vdload(const double *p) { return _mm256_loadu_pd(p); }
+// SIMD_DWIDTH floats widened to double
+static inline vdouble vdcvt(const float *p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+static inline void vdstore(double *p, vdouble v) { _mm256_storeu_pd(p, v); }
+static inline vdouble vdmul(vdouble a, vdouble b) { return _mm256_mul_pd(a, b); }
+#if defined(__FMA__)
+static inline vdouble vdmadd(vdouble a, vdouble b, vdouble c) { return _mm256_fmadd_pd(a, b, c); }
+#else
+static inline vdouble vdmadd(vdouble a, vdouble b, vdouble c) { return _mm256_add_pd(_mm256_mul_pd(a, b), c); }
+#endif
+static inline double vdsum(vdouble v) {
+  __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  s = _mm_add_sd(s, _mm_unpackhi_pd(s, s));
+  return _mm_cvtsd_f64(s);
+}
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+typedef __m128 vfloat;
+static inline vfloat vzero() { return _mm_setzero_ps(); }
+static inline vfloat vset1(float x) { return _mm_set1_ps(x); }
+static inline vfloat vload(const float *p) { return _mm_loadu_ps(p); }
+static inline void vstore(float *p, vfloat v) { _mm_storeu_ps(p, v); }
+static inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+static inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a); }
+// (a > b) ? x : y per lane
+static inline vfloat vselect_gt(vfloat a, vfloat b, vfloat x, vfloat y) {
+  __m128 m = _mm_cmpgt_ps(a, b);
+  return _mm_or_ps(_mm_and_ps(m, x), _mm_andnot_ps(m, y));
+}
+static inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+static inline vfloat vmadd(vfloat a, vfloat b, vfloat c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+static inline float vsum(vfloat v) {
+  __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+
+// float64 lanes, for sums over float data that need double accumulation
+#define SIMD_DWIDTH 2
+typedef __m128d vdouble;
+static inline vdouble vdzero() { return _mm_setzero_pd(); }
+static inline vdouble vdset1(double x) { return _mm_set1_pd(x); }
+static inline vdouble vdload(const double *p) { return _mm_loadu_pd(p); }
+// SIMD_DWIDTH floats widened to double
+static inline vdouble vdcvt(const float *p) {
+  return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)p)));
+}
+static inline void vdstore(double *p, vdouble v) { _mm_storeu_pd(p, v); }
+static inline vdouble vdmul(vdouble a, vdouble b) { return _mm_mul_pd(a, b); }
+static inline vdouble vdmadd(vdouble a, vdouble b, vdouble c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+static inline double vdsum(vdouble v) {
+  return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+#else
+#include <math.h>
+#define SIMD_WIDTH 1
+typedef float vfloat;
+static inline vfloat vzero() { return 0.0f; }
+static inline vfloat vset1(float x) { return x; }
+static inline vfloat vload(const float *p) { return *p; }
+static inline void vstore(float *p, vfloat v) { *p = v; }
+static inline vfloat vadd(vfloat a, vfloat b) { return a + b; }
+static inline vfloat vsub(vfloat a, vfloat b) { return a - b; }
+static inline vfloat vmul(vfloat a, vfloat b) { return a * b; }
+static inline vfloat vsqrt(vfloat a) { return sqrtf(a); }
+// (a > b) ? x : y
+static inline vfloat vselect_gt(vfloat a, vfloat b, vfloat x, vfloat y) {
+  return (a > b) ? x : y;
+}
+static inline vfloat vmin(vfloat a, vfloat b) { return (a <= b) ? a : b; }
+static inline vfloat vmax(vfloat a, vfloat b) { return (a <= b) ? b : a; }
+static inline vfloat vmadd(vfloat a, vfloat b, vfloat c) { return a * b + c; }
+static inline float vsum(vfloat v) { return v; }
+
+#define SIMD_DWIDTH 1
+typedef double vdouble;
+static inline vdouble vdzero() { return 0.0; }
+static inline vdouble vdset1(double x) { return x; }
+static inline vdouble vdload(const double *p) { return *p; }
+static inline vdouble vdcvt(const float *p) { return (double)*p; }
+static inline void vdstore(double *p, vdouble v) { *p = v; }
+static inline vdouble vdmul(vdouble a, vdouble b) { return a * b; }
+static inline vdouble vdmadd(vdouble a, vdouble b, vdouble c) { return a * b + c; }
+static inline double vdsum(vdouble v) { return v; }
+#endif
+
+// number of floats a packed feature vector is padded to, so that every
+// cell of a packed map starts on a whole number of vector lanes
+#define SIMD_PAD 8
+static inline int simd_padded(int n) { return (n + SIMD_PAD - 1) / SIMD_PAD * SIMD_PAD; }
+
+// repack a column-major height x width x features array into
+// features-innermost order, padding features to num_features
+template <typename T>
+void pack(const T *src, float *dst, int height, int width, int features,
+          int num_features) {
+  memset(dst, 0, height*width*num_features*sizeof(float));
+  for (int f = 0; f < features; f++) {
+    const T *s = src + f*height*width;
+    float *d = dst + f;
+    for (int i = 0; i < height*width; i++)
+      d[i*num_features] = (float)s[i];
+  }
+}
+
+#endif
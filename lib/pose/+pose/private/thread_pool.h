@@ -0,0 +1,253 @@
+#ifndef POSE_THREAD_POOL_H
+#define POSE_THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "mex.h"
+
+/*
+ * Persistent work-stealing thread pool shared by the pose mex kernels.
+ *
+ * The pool is created on the first parallel call and lives until the mex
+ * file is cleared, so repeated calls from detect_fast do not pay for
+ * thread creation.  A parallel loop over [0,n) is split into one
+ * contiguous range per thread; a thread that runs out of work steals the
+ * upper half of the largest range it finds.  The calling thread takes
+ * part in the loop as slot 0.
+ *
+ * The number of threads defaults to the number of online cores and can be
+ * set with the POSE_NUM_THREADS environment variable, e.g. 1 to run
+ * several MATLAB processes side by side without oversubscription.
+ *
+ * Tasks must not call back into MATLAB.  Nested loops issued from inside
+ * a task run serially on the calling thread.
+ */
+
+typedef void (*pool_task)(void *arg, int index);
+
+struct pool_range {
+  pthread_mutex_t lock;
+  int begin;
+  int end;
+};
+
+class ThreadPool {
+ public:
+  // process-wide instance, created on first use
+  static ThreadPool &instance() {
+    if (!instance_) {
+      instance_ = new ThreadPool(default_size());
+      mexAtExit(destroy);
+    }
+    return *instance_;
+  }
+
+  static void destroy() {
+    delete instance_;
+    instance_ = NULL;
+  }
+
+  int size() const { return num_threads_; }
+
+  // slot of the calling thread in [0,size()), 0 outside of the pool;
+  // tasks can use it to index per-thread scratch memory
+  static int slot() { return slot_; }
+
+  // true inside a task, where nested loops run serially on the caller
+  static bool in_worker() { return in_worker_; }
+
+  // run task(arg, i) for every i in [0,n) and wait for completion
+  void parallel_for(int n, pool_task task, void *arg) {
+    if (n <= 0)
+      return;
+    if (num_threads_ == 1 || n == 1 || in_worker_) {
+      for (int i = 0; i < n; i++)
+        task(arg, i);
+      return;
+    }
+    pthread_mutex_lock(&job_lock_);
+    for (int s = 0; s < num_threads_; s++) {
+      ranges_[s].begin = (int)((long)n*s/num_threads_);
+      ranges_[s].end = (int)((long)n*(s+1)/num_threads_);
+    }
+    pthread_mutex_lock(&lock_);
+    task_ = task;
+    arg_ = arg;
+    active_ = num_threads_-1;
+    generation_++;
+    pthread_cond_broadcast(&wake_);
+    pthread_mutex_unlock(&lock_);
+
+    in_worker_ = true;
+    slot_ = 0;
+    run(0);
+    in_worker_ = false;
+
+    pthread_mutex_lock(&lock_);
+    while (active_ > 0)
+      pthread_cond_wait(&done_, &lock_);
+    pthread_mutex_unlock(&lock_);
+    pthread_mutex_unlock(&job_lock_);
+  }
+
+ private:
+  struct worker_arg {
+    ThreadPool *pool;
+    int slot;
+  };
+
+  explicit ThreadPool(int num_threads)
+      : num_threads_(num_threads), task_(NULL), arg_(NULL),
+        generation_(0), active_(0), stop_(false) {
+    pthread_mutex_init(&lock_, NULL);
+    pthread_mutex_init(&job_lock_, NULL);
+    pthread_cond_init(&wake_, NULL);
+    pthread_cond_init(&done_, NULL);
+    ranges_ = new pool_range[num_threads_];
+    for (int s = 0; s < num_threads_; s++) {
+      pthread_mutex_init(&ranges_[s].lock, NULL);
+      ranges_[s].begin = ranges_[s].end = 0;
+    }
+    threads_ = new pthread_t[num_threads_];
+    args_ = new worker_arg[num_threads_];
+    for (int s = 1; s < num_threads_; s++) {
+      args_[s].pool = this;
+      args_[s].slot = s;
+      if (pthread_create(&threads_[s], NULL, worker, (void *)&args_[s])) {
+        // run with the threads we managed to start
+        num_threads_ = s;
+        break;
+      }
+    }
+  }
+
+  ~ThreadPool() {
+    pthread_mutex_lock(&lock_);
+    stop_ = true;
+    pthread_cond_broadcast(&wake_);
+    pthread_mutex_unlock(&lock_);
+    for (int s = 1; s < num_threads_; s++)
+      pthread_join(threads_[s], NULL);
+    for (int s = 0; s < num_threads_; s++)
+      pthread_mutex_destroy(&ranges_[s].lock);
+    pthread_mutex_destroy(&lock_);
+    pthread_mutex_destroy(&job_lock_);
+    pthread_cond_destroy(&wake_);
+    pthread_cond_destroy(&done_);
+    delete [] ranges_;
+    delete [] threads_;
+    delete [] args_;
+  }
+
+  static int default_size() {
+    const char *env = getenv("POSE_NUM_THREADS");
+    int n = env ? atoi(env) : 0;
+    if (n <= 0)
+      n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? n : 1;
+  }
+
+  static void *worker(void *thread_arg) {
+    worker_arg *args = (worker_arg *)thread_arg;
+    ThreadPool *pool = args->pool;
+    unsigned seen = 0;
+    in_worker_ = true;
+    slot_ = args->slot;
+    while (true) {
+      pthread_mutex_lock(&pool->lock_);
+      while (!pool->stop_ && pool->generation_ == seen)
+        pthread_cond_wait(&pool->wake_, &pool->lock_);
+      if (pool->stop_) {
+        pthread_mutex_unlock(&pool->lock_);
+        break;
+      }
+      seen = pool->generation_;
+      pthread_mutex_unlock(&pool->lock_);
+
+      pool->run(args->slot);
+
+      pthread_mutex_lock(&pool->lock_);
+      if (--pool->active_ == 0)
+        pthread_cond_signal(&pool->done_);
+      pthread_mutex_unlock(&pool->lock_);
+    }
+    return NULL;
+  }
+
+  // take the next index from our own range, -1 if it is empty
+  int pop(int slot) {
+    pool_range *r = &ranges_[slot];
+    pthread_mutex_lock(&r->lock);
+    int i = (r->begin < r->end) ? r->begin++ : -1;
+    pthread_mutex_unlock(&r->lock);
+    return i;
+  }
+
+  // move the upper half of the largest other range into ours
+  bool steal(int slot) {
+    int victim = -1;
+    int most = 0;
+    for (int s = 0; s < num_threads_; s++) {
+      int left = ranges_[s].end - ranges_[s].begin;
+      if (s != slot && left > most) {
+        most = left;
+        victim = s;
+      }
+    }
+    if (victim < 0)
+      return false;
+    pool_range *r = &ranges_[victim];
+    pthread_mutex_lock(&r->lock);
+    int left = r->end - r->begin;
+    int end = r->end;
+    int mid = end - (left+1)/2;
+    if (left > 0)
+      r->end = mid;
+    pthread_mutex_unlock(&r->lock);
+    if (left <= 0)
+      return true;  // lost a race, look again
+    pool_range *own = &ranges_[slot];
+    pthread_mutex_lock(&own->lock);
+    own->begin = mid;
+    own->end = end;
+    pthread_mutex_unlock(&own->lock);
+    return true;
+  }
+
+  void run(int slot) {
+    while (true) {
+      int i = pop(slot);
+      if (i < 0) {
+        if (!steal(slot))
+          break;
+        continue;
+      }
+      task_(arg_, i);
+    }
+  }
+
+  static ThreadPool *instance_;
+  static __thread bool in_worker_;
+  static __thread int slot_;
+
+  int num_threads_;
+  pthread_t *threads_;
+  worker_arg *args_;
+  pool_range *ranges_;
+  pthread_mutex_t lock_;
+  pthread_mutex_t job_lock_;
+  pthread_cond_t wake_;
+  pthread_cond_t done_;
+  pool_task task_;
+  void *arg_;
+  unsigned generation_;
+  int active_;
+  bool stop_;
+};
+
+ThreadPool *ThreadPool::instance_ = NULL;
+__thread bool ThreadPool::in_worker_ = false;
+__thread int ThreadPool::slot_ = 0;
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef POSE_TREE_H
+#define POSE_TREE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dt.h"
+
+/*
+ * Tree inference of one component of the pose model at one root level,
+ * the inner loop of detect_fast.
+ *
+ * Messages are passed from the leaves to the root one depth of the tree
+ * at a time: the distance transforms of all children at a depth are
+ * dt_map tasks, then each (parent, parent mixture) plane picks the best
+ * child mixture of all its children and adds the message.  The root
+ * locations scoring at least thresh are walked back down the tree in
+ * parallel and returned as boxes.
+ *
+ * Buffers are allocated with malloc, so a whole detection can run inside
+ * a pool task; the pool and the arena must have been created from the
+ * mex entry point.
+ */
+
+struct tree_part {
+  // model, set by the caller
+  int parent;              // -1 for the root
+  int level;               // pyramid level, from 0
+  int K;                   // number of mixtures
+  const double *b;         // bias, L x K, or K for the root
+  const double *w;         // deformation, 4 x K
+  const double *startx;    // anchor per mixture, from 1
+  const double *starty;
+  int step;
+  const double *sizx;      // filter size per mixture
+  const double *sizy;
+  // local scores, malloc'ed by the caller and freed by tree_free
+  int height, width;
+  double *score;           // height x width x K
+  // per parent mixture, on the grid of the parent
+  int depth;
+  int32_t *Ix, *Iy, *Ik;   // Ny x Nx x L, from 1
+  // distance transform per mixture, on the grid of the parent
+  double *M;               // Ny x Nx x K
+  int32_t *DIx, *DIy;      // Ny x Nx x K, from 1
+};
+
+struct tree_data {
+  tree_part *parts;
+  int num_parts;
+  const double *scale;     // pyramid scales
+  double padx, pady;
+  int component;
+  int *planes;             // (parent, mixture) planes of the current depth
+  double *rscore;          // root score
+  int32_t *rmix;           // root mixture, from 1
+  int32_t *det;            // linear index of every detection in rscore
+  int num_dets;
+  int *ptrs;               // x, y and mixture of every part per detection
+  double *boxes;           // num_dets x (4*num_parts+2)
+};
+
+// best child mixture at each location of one parent mixture plane,
+// children are visited in the order of detect.m
+static void pass_messages(void *arg, int i) {
+  tree_data *d = (tree_data *)arg;
+  int par = d->planes[2*i];
+  int l = d->planes[2*i+1];
+  tree_part *parent = &d->parts[par];
+  int L = parent->K;
+  int N = parent->height*parent->width;
+  double *dst = parent->score + (size_t)l*N;
+  for (int k = d->num_parts-1; k > 0; k--) {
+    tree_part *child = &d->parts[k];
+    if (child->parent != par)
+      continue;
+    const double *b = child->b;
+    int32_t *Ix = child->Ix + (size_t)l*N;
+    int32_t *Iy = child->Iy + (size_t)l*N;
+    int32_t *Ik = child->Ik + (size_t)l*N;
+    for (int p = 0; p < N; p++) {
+      double best = child->M[p] + b[l];
+      int best_k = 0;
+      for (int m = 1; m < child->K; m++) {
+        double s = child->M[(size_t)m*N+p] + b[l+L*m];
+        if (s > best) {
+          best = s;
+          best_k = m;
+        }
+      }
+      Ix[p] = child->DIx[(size_t)best_k*N+p];
+      Iy[p] = child->DIy[(size_t)best_k*N+p];
+      Ik[p] = best_k+1;
+      dst[p] += best;
+    }
+  }
+}
+
+// walk back down the tree from one root location
+static void backtrack(void *arg, int i) {
+  tree_data *d = (tree_data *)arg;
+  int n = d->num_dets;
+  int *xptr = d->ptrs + (size_t)i*3*d->num_parts;
+  int *yptr = xptr + d->num_parts;
+  int *mptr = yptr + d->num_parts;
+  int h = d->parts[0].height;
+  xptr[0] = d->det[i]/h+1;
+  yptr[0] = d->det[i]%h+1;
+  mptr[0] = d->rmix[d->det[i]];
+  for (int k = 0; k < d->num_parts; k++) {
+    const tree_part *p = &d->parts[k];
+    if (k > 0) {
+      const tree_part *parent = &d->parts[p->parent];
+      int ph = parent->height;
+      size_t I = ((size_t)(mptr[p->parent]-1)*parent->width +
+                  xptr[p->parent]-1)*ph + yptr[p->parent]-1;
+      xptr[k] = p->Ix[I];
+      yptr[k] = p->Iy[I];
+      mptr[k] = p->Ik[I];
+    }
+    double scale = d->scale[p->level];
+    double x1 = (xptr[k] - 1 - d->padx)*scale+1;
+    double y1 = (yptr[k] - 1 - d->pady)*scale+1;
+    double x2 = x1 + p->sizx[mptr[k]-1]*scale - 1;
+    double y2 = y1 + p->sizy[mptr[k]-1]*scale - 1;
+    d->boxes[i+n*(4*k)] = x1;
+    d->boxes[i+n*(4*k+1)] = y1;
+    d->boxes[i+n*(4*k+2)] = x2;
+    d->boxes[i+n*(4*k+3)] = y2;
+  }
+  d->boxes[i+n*(4*d->num_parts)] = d->component;
+  d->boxes[i+n*(4*d->num_parts+1)] = d->rscore[d->det[i]];
+}
+
+// release everything tree_detect and the caller allocated
+static void tree_free(tree_data *d) {
+  for (int k = 0; k < d->num_parts; k++) {
+    tree_part *p = &d->parts[k];
+    free(p->score);
+    free(p->M);
+    free(p->DIx);
+    free(p->DIy);
+    free(p->Ix);
+    free(p->Iy);
+    free(p->Ik);
+    p->score = p->M = NULL;
+    p->DIx = p->DIy = p->Ix = p->Iy = p->Ik = NULL;
+  }
+  free(d->planes);
+  free(d->rscore);
+  free(d->rmix);
+  free(d->det);
+  free(d->ptrs);
+  free(d->boxes);
+  d->planes = d->ptrs = NULL;
+  d->rscore = d->boxes = NULL;
+  d->rmix = d->det = NULL;
+}
+
+// Run the inference on the local scores of the parts, which must be in
+// topological order.  Fills d->boxes with one row per root location
+// scoring at least thresh, in the order of find(), and returns their
+// number, or -1 when out of memory.
+static int tree_detect(tree_data *d, double thresh) {
+  tree_part *parts = d->parts;
+  int num_parts = d->num_parts;
+  d->planes = d->ptrs = NULL;
+  d->rscore = d->boxes = NULL;
+  d->rmix = d->det = NULL;
+  d->num_dets = 0;
+
+  // deformation costs and message buffers
+  int max_depth = 0;
+  int num_jobs = 0;
+  int num_planes = 0;
+  for (int k = 0; k < num_parts; k++) {
+    parts[k].depth = k > 0 ? parts[parts[k].parent].depth+1 : 0;
+    if (parts[k].depth > max_depth)
+      max_depth = parts[k].depth;
+    num_jobs += k > 0 ? parts[k].K : 0;
+    num_planes += parts[k].K;
+  }
+  dt_job *jobs = (dt_job *)calloc(num_jobs+1, sizeof(dt_job));
+  dt_job *depth_jobs = (dt_job *)calloc(num_jobs+1, sizeof(dt_job));
+  int *first_job = (int *)calloc(num_parts+1, sizeof(int));
+  bool *has_child = (bool *)calloc(num_parts, sizeof(bool));
+  d->planes = (int *)calloc(2*num_planes, sizeof(int));
+  bool ok = jobs && depth_jobs && first_job && has_child && d->planes;
+  int max_line = 0;
+  size_t max_map = 0;
+  for (int k = 1; k < num_parts && ok; k++) {
+    tree_part *p = &parts[k];
+    const tree_part *parent = &parts[p->parent];
+    size_t N = (size_t)parent->height*parent->width;
+    int L = parent->K;
+    p->M = (double *)malloc(N*p->K*sizeof(double));
+    p->DIx = (int32_t *)malloc(N*p->K*sizeof(int32_t));
+    p->DIy = (int32_t *)malloc(N*p->K*sizeof(int32_t));
+    p->Ix = (int32_t *)malloc(N*L*sizeof(int32_t));
+    p->Iy = (int32_t *)malloc(N*L*sizeof(int32_t));
+    p->Ik = (int32_t *)malloc(N*L*sizeof(int32_t));
+    ok = p->M && p->DIx && p->DIy && p->Ix && p->Iy && p->Ik;
+
+    // Read in deformation coefficients, negating to define a cost
+    // Read in offsets for output grid, fixing MATLAB 0-1 indexing
+    first_job[k] = first_job[k-1] + (k > 1 ? parts[k-1].K : 0);
+    for (int m = 0; m < p->K && ok; m++) {
+      dt_job *job = &jobs[first_job[k]+m];
+      job->vals = p->score + (size_t)m*p->height*p->width;
+      job->sizx = p->width;
+      job->sizy = p->height;
+      job->ax = -p->w[4*m];
+      job->bx = -p->w[4*m+1];
+      job->ay = -p->w[4*m+2];
+      job->by = -p->w[4*m+3];
+      job->offx = (int)p->startx[m]-1;
+      job->offy = (int)p->starty[m]-1;
+      job->lenx = parent->width;
+      job->leny = parent->height;
+      job->step = p->step;
+      job->M = p->M + m*N;
+      job->Ix = p->DIx + m*N;
+      job->Iy = p->DIy + m*N;
+    }
+    int line = p->width > p->height ? p->width : p->height;
+    if (line > max_line)
+      max_line = line;
+    if ((size_t)parent->height*p->width > max_map)
+      max_map = (size_t)parent->height*p->width;
+  }
+
+  // Walk from leaves to root of tree, passing message to parent
+  ThreadPool &pool = ThreadPool::instance();
+  DtArena &arena = DtArena::instance();
+  ok = ok && arena.reserve(max_line, max_map);
+  for (int depth = max_depth; depth > 0 && ok; depth--) {
+    // children at this depth have all their messages, transform them
+    int n = 0;
+    memset(has_child, 0, num_parts*sizeof(bool));
+    for (int k = 1; k < num_parts; k++) {
+      if (parts[k].depth != depth)
+        continue;
+      memcpy(depth_jobs+n, jobs+first_job[k], parts[k].K*sizeof(dt_job));
+      n += parts[k].K;
+      has_child[parts[k].parent] = true;
+    }
+    dt_batch b = {depth_jobs, &arena};
+    pool.parallel_for(n, dt_map, &b);
+
+    // then every parent mixture of the depth above takes their messages
+    n = 0;
+    for (int k = 0; k < num_parts; k++) {
+      if (!has_child[k])
+        continue;
+      for (int l = 0; l < parts[k].K; l++, n++) {
+        d->planes[2*n] = k;
+        d->planes[2*n+1] = l;
+      }
+    }
+    pool.parallel_for(n, pass_messages, d);
+  }
+  free(jobs);
+  free(depth_jobs);
+  free(first_job);
+  free(has_child);
+
+  // Add bias to root score
+  tree_part *root = &parts[0];
+  int N = root->height*root->width;
+  if (ok) {
+    d->rscore = (double *)malloc(N*sizeof(double));
+    d->rmix = (int32_t *)malloc(N*sizeof(int32_t));
+    d->det = (int32_t *)malloc(N*sizeof(int32_t));
+    ok = d->rscore && d->rmix && d->det;
+  }
+  for (int p = 0; p < N && ok; p++) {
+    double best = root->score[p] + root->b[0];
+    int best_m = 0;
+    for (int m = 1; m < root->K; m++) {
+      double s = root->score[(size_t)m*N+p] + root->b[m];
+      if (s > best) {
+        best = s;
+        best_m = m;
+      }
+    }
+    d->rscore[p] = best;
+    d->rmix[p] = best_m+1;
+    if (best >= thresh)
+      d->det[d->num_dets++] = p;
+  }
+
+  // Walk back down tree following pointers
+  if (ok) {
+    d->boxes = (double *)malloc(((size_t)d->num_dets*(4*num_parts+2)+1)*sizeof(double));
+    d->ptrs = (int *)malloc(((size_t)d->num_dets*3*num_parts+1)*sizeof(int));
+    ok = d->boxes && d->ptrs;
+  }
+  if (!ok)
+    return -1;
+  pool.parallel_for(d->num_dets, backtrack, d);
+  return d->num_dets;
+}
+
+#endif
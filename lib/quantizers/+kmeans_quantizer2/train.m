@@ -1,9 +1,15 @@
 function [model, projections] = train(samples, varargin)
 %TRAIN Train a K-means quantizer.
+%
+%    SAMPLES may also be the name of a file of SINGLE values, DIMENSION
+%    per sample, which is clustered in mini-batches without loading it.
 
-  % Use (log(#SAMPLES + 1) * 4 * sqrt(#DIMS)) as default.
-  NUM_CLUSTERS = round(log(size(samples, 1) + 1) * 4 * sqrt(size(samples, 2)));
+  NUM_CLUSTERS = [];
   NORMALIZE = false;
+  INDEX_FILE = [];
+  NUM_THREADS = 0;
+  MINI_BATCH = 0;
+  DIMENSION = [];
   mark_delete = false(size(varargin));
   for i = 1:2:numel(varargin)
     switch varargin{i}
@@ -13,33 +19,75 @@ function [model, projections] = train(samples, varargin)
       case 'Normalize'
         NORMALIZE = varargin{i+1};
         mark_delete(i:i+1) = true;
+      case 'IndexFile'
+        INDEX_FILE = varargin{i+1};
+        mark_delete(i:i+1) = true;
+      case 'NumThreads'
+        NUM_THREADS = varargin{i+1};
+        mark_delete(i:i+1) = true;
+      case 'MiniBatch'
+        MINI_BATCH = varargin{i+1};
+        mark_delete(i:i+1) = true;
+      case 'Dimension'
+        DIMENSION = varargin{i+1};
+        mark_delete(i:i+1) = true;
     end
   end
   varargin(mark_delete) = [];
 
+  if ischar(samples)
+    assert(~isempty(DIMENSION), 'kmeans_quantizer2: Dimension is required for a sample file.');
+    assert(~NORMALIZE && nargout < 2, ...
+           'kmeans_quantizer2: Normalize and projections need the samples in memory.');
+    file_info = dir(samples);
+    num_samples = file_info.bytes / (4 * DIMENSION);
+    num_dims = DIMENSION;
+  else
+    num_samples = size(samples, 1);
+    num_dims = size(samples, 2);
+  end
+  if isempty(NUM_CLUSTERS)
+    % Use (log(#SAMPLES + 1) * 4 * sqrt(#DIMS)) as default.
+    NUM_CLUSTERS = round(log(num_samples + 1) * 4 * sqrt(num_dims));
+  end
+
   % Check if the input is row vectors.
-  assert(isnumeric(samples));
-  if ndims(samples) > 2
-    siz = size(samples);
-    samples = reshape(samples, [siz(1)*siz(2), prod(siz(3:end))]);
+  if ~ischar(samples)
+    assert(isnumeric(samples));
+    if ndims(samples) > 2
+      siz = size(samples);
+      samples = reshape(samples, [siz(1)*siz(2), prod(siz(3:end))]);
+    end
+    num_samples = size(samples, 1);
   end
 
-  assert(isnumeric(samples));
-  NUM_CLUSTERS = min(size(samples, 1), NUM_CLUSTERS);
+  NUM_CLUSTERS = min(num_samples, NUM_CLUSTERS);
   logger('kmeans_quantizer2: computing %d clusters for %d samples.', ...
-         NUM_CLUSTERS, size(samples, 1));
+         NUM_CLUSTERS, num_samples);
   model.name = 'kmeans_quantizer2';
   
   if NORMALIZE
     [samples, model.mu, model.sigma] = zscore(samples);
   end
   
-  if size(samples, 1) == NUM_CLUSTERS
+  kmeans_options = {'Verbose', 'NumThreads', NUM_THREADS};
+  if MINI_BATCH > 0
+    kmeans_options = [kmeans_options, {'MiniBatch', MINI_BATCH}];
+  end
+  if ischar(samples)
+    model.centroids = vl_kmeans(samples, NUM_CLUSTERS, ...
+                                'Dimension', DIMENSION, kmeans_options{:});
+  elseif num_samples == NUM_CLUSTERS
     model.centroids = single(samples');
   else
-    model.centroids = vl_kmeans(single(samples'), NUM_CLUSTERS, 'Verbose');
+    model.centroids = vl_kmeans(single(samples'), NUM_CLUSTERS, kmeans_options{:});
   end
   model.kdtree = vl_kdtreebuild(model.centroids);
+  if ~isempty(INDEX_FILE)
+    % Queries map the saved tree instead of rebuilding it from the struct.
+    vl_kdtreesave(model.kdtree, model.centroids, INDEX_FILE);
+    model.kdtree = INDEX_FILE;
+  end
   if nargout > 1
     projections = kmeans_quantizer2.project(model, samples, varargin{:});
   end
@@ -235,6 +235,7 @@ mexsrc = \
   toolbox\misc\vl_inthist.c \
   toolbox\misc\vl_kdtreebuild.c \
   toolbox\misc\vl_kdtreequery.c \
+  toolbox\misc\vl_kdtreesave.c \
   toolbox\misc\vl_lbp.c \
   toolbox\misc\vl_localmax.c \
   toolbox\misc\vl_maketrainingset.c \
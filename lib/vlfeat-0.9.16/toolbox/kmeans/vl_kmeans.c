@@ -13,6 +13,7 @@ the terms of the BSD license (see the COPYING file).
 
 #include <vl/kmeans.h>
 #include <mexutils.h>
+#include <stdio.h>
 #include <string.h>
 
 enum {
@@ -21,6 +22,9 @@ enum {
   opt_distance,
   opt_initialization,
   opt_num_repetitions,
+  opt_num_threads,
+  opt_mini_batch,
+  opt_dimension,
   opt_verbose
 } ;
 
@@ -37,9 +41,143 @@ vlmxOption  options [] = {
   {"NumRepetitions",    1,   opt_num_repetitions,    },
   {"Initialization",    1,   opt_initialization      },
   {"Initialisation",    1,   opt_initialization      }, /* UK spelling */
+  {"NumThreads",        1,   opt_num_threads         },
+  {"MiniBatch",         1,   opt_mini_batch          },
+  {"Dimension",         1,   opt_dimension           },
   {0,                   0,   0                       }
 } ;
 
+/** @internal @brief Data read from the DATA matrix or from a file */
+typedef struct _DataSource
+{
+  void const * data ;          /**< DATA matrix, or NULL */
+  FILE * file ;                /**< file of SINGLE values, or NULL */
+  vl_size dimension ;
+  vl_size numData ;
+  vl_size typeSize ;
+  void * buffer ;              /**< batch read from the file */
+} DataSource ;
+
+/** @internal @brief Close the data file and raise an error */
+static void
+data_source_error (DataSource * source, char const * message)
+{
+  if (source->file) {
+    fclose (source->file) ;
+    source->file = NULL ;
+  }
+  vlmxError (vlmxErrInvalidArgument, message) ;
+}
+
+/** @internal @brief Get the points [begin, begin + numData) of the source
+ ** @return pointer to the points, valid until the next read.
+ **/
+
+static void const *
+data_source_read (DataSource * source, vl_uindex begin, vl_size numData)
+{
+  vl_size pointSize = source->typeSize * source->dimension ;
+  int seekFailed ;
+  if (source->data) {
+    return (char const *)source->data + begin * pointSize ;
+  }
+#if defined(VL_OS_WIN)
+  seekFailed = _fseeki64 (source->file, (__int64) (begin * pointSize), SEEK_SET) ;
+#else
+  seekFailed = fseeko (source->file, (off_t) (begin * pointSize), SEEK_SET) ;
+#endif
+  if (seekFailed ||
+      fread (source->buffer, pointSize, numData, source->file) != numData) {
+    data_source_error (source, "Could not read the DATA file.") ;
+  }
+  return source->buffer ;
+}
+
+/** @internal @brief Seed the centers from a random sample of the source
+ **
+ ** The sample has @a numSamples points, read one at a time from
+ ** a file, which must not exceed the size of the batch buffer.
+ **/
+
+static void
+seed_from_sample (VlKMeans * kmeans, DataSource * source,
+                  vl_size numSamples, vl_size numCenters,
+                  int initialization)
+{
+  vl_size pointSize = source->typeSize * source->dimension ;
+  char * sample = mxMalloc (pointSize * numSamples) ;
+  VlRand * rand = vl_get_rand () ;
+  vl_uindex i, x ;
+
+  /* selection sampling keeps the points in file order */
+  for (i = 0, x = 0 ; i < numSamples ; ++ x) {
+    if (vl_rand_uindex (rand, source->numData - x) < numSamples - i) {
+      memcpy (sample + i * pointSize,
+              data_source_read (source, x, 1), pointSize) ;
+      ++ i ;
+    }
+  }
+
+  switch (initialization) {
+    case VlKMeansPlusPlus :
+      vl_kmeans_seed_centers_plus_plus (kmeans, sample, source->dimension,
+                                        numSamples, numCenters) ;
+      break ;
+    case VlKMeansRandomSelection :
+      vl_kmeans_seed_centers_with_rand_data (kmeans, sample, source->dimension,
+                                             numSamples, numCenters) ;
+      break ;
+    default:
+      abort() ;
+  }
+  mxFree (sample) ;
+}
+
+/** @internal @brief Mini-batch k-means
+ ** @return energy of the last pass.
+ **
+ ** Each pass visits the batches of the source in a random order.
+ **/
+
+static double
+cluster_with_batches (VlKMeans * kmeans, DataSource * source,
+                      vl_size numCenters, vl_size batchSize,
+                      vl_size numPasses, int initialization)
+{
+  vl_size numBatches = (source->numData + batchSize - 1) / batchSize ;
+  vl_uindex * order = mxMalloc (sizeof(vl_uindex) * numBatches) ;
+  VlRand * rand = vl_get_rand () ;
+  double energy = 0 ;
+  vl_uindex pass, b ;
+
+  seed_from_sample (kmeans, source,
+                    VL_MIN(VL_MAX(batchSize, numCenters), source->numData),
+                    numCenters, initialization) ;
+
+  for (b = 0 ; b < numBatches ; ++ b) order[b] = b ;
+  for (pass = 0 ; pass < numPasses ; ++ pass) {
+    /* Fisher-Yates shuffle of the batches */
+    for (b = numBatches ; b > 1 ; -- b) {
+      vl_uindex j = vl_rand_uindex (rand, b) ;
+      vl_uindex tmp = order[b - 1] ;
+      order[b - 1] = order[j] ;
+      order[j] = tmp ;
+    }
+    energy = 0 ;
+    for (b = 0 ; b < numBatches ; ++ b) {
+      vl_uindex begin = order[b] * batchSize ;
+      vl_size n = VL_MIN(batchSize, source->numData - begin) ;
+      energy += vl_kmeans_update_centers_with_batch
+        (kmeans, data_source_read (source, begin, n), n) ;
+    }
+    if (vl_kmeans_get_verbosity (kmeans)) {
+      mexPrintf("kmeans: mini-batch pass %d: energy = %g\n", pass, energy) ;
+    }
+  }
+  mxFree (order) ;
+  return energy ;
+}
+
 /* driver */
 void
 mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
@@ -60,7 +198,10 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
   VlKMeansAlgorithm algorithm = VlKMeansLloyd ;
   VlVectorComparisonType distance = VlDistanceL2 ;
   vl_size maxNumIterations = 100 ;
+  vl_bool maxNumIterationsSet = VL_FALSE ;
   vl_size numRepetitions = 1 ;
+  vl_size numThreads = 0 ;
+  vl_size batchSize = 0 ;
   double energy ;
   int verbosity = 0 ;
   int initialization = INIT_PLUSPLUS ;
@@ -69,6 +210,8 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
   mxClassID classID ;
 
   VlKMeans * kmeans ;
+  DataSource source ;
+  char * path = NULL ;
 
   VL_USE_MATLAB_ENV ;
 
@@ -85,33 +228,31 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
               "Too many output arguments.");
   }
 
-  classID = mxGetClassID (IN(DATA)) ;
-  switch (classID) {
-    case mxSINGLE_CLASS: dataType = VL_TYPE_FLOAT ; break ;
-    case mxDOUBLE_CLASS: dataType = VL_TYPE_DOUBLE ; break ;
-    default:
-      vlmxError (vlmxErrInvalidArgument,
-                "DATA must be of class SINGLE or DOUBLE") ;
-      abort() ;
-  }
-
-  dimension = mxGetM (IN(DATA)) ;
-  numData = mxGetN (IN(DATA)) ;
-
-  if (dimension == 0) {
-    vlmxError (vlmxErrInvalidArgument, "SIZE(DATA,1) is zero") ;
-  }
+  if (vlmxIsString (IN(DATA), -1)) {
+    /* the data are SINGLE columns in a file; the size is known once
+       the DIMENSION option is parsed */
+    path = mxArrayToString (IN(DATA)) ;
+    classID = mxSINGLE_CLASS ;
+    dataType = VL_TYPE_FLOAT ;
+    dimension = 0 ;
+    numData = 0 ;
+  } else {
+    classID = mxGetClassID (IN(DATA)) ;
+    switch (classID) {
+      case mxSINGLE_CLASS: dataType = VL_TYPE_FLOAT ; break ;
+      case mxDOUBLE_CLASS: dataType = VL_TYPE_DOUBLE ; break ;
+      default:
+        vlmxError (vlmxErrInvalidArgument,
+                  "DATA must be of class SINGLE or DOUBLE") ;
+        abort() ;
+    }
 
-  if (!vlmxIsPlainScalar(IN(NUMCENTERS)) ||
-      (numCenters = (vl_size) mxGetScalar(IN(NUMCENTERS))) < 1  ||
-      numCenters > numData) {
-    vlmxError (vlmxErrInvalidArgument,
-              "NUMCENTERS must be a positive integer not greater "
-              "than the number of data.") ;
-  }
+    dimension = mxGetM (IN(DATA)) ;
+    numData = mxGetN (IN(DATA)) ;
 
-  if (dimension == 0) {
-    vlmxError (vlmxErrInvalidArgument, "SIZE(DATA,1) is zero") ;
+    if (dimension == 0) {
+      vlmxError (vlmxErrInvalidArgument, "SIZE(DATA,1) is zero") ;
+    }
   }
 
   while ((opt = vlmxNextOption (in, nin, options, &next, &optarg)) >= 0) {
@@ -129,6 +270,7 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
                     "MAXNUMITERATIONS must be a non-negative integer scalar") ;
         }
         maxNumIterations = (vl_size) mxGetScalar(optarg) ;
+        maxNumIterationsSet = VL_TRUE ;
         break ;
 
       case opt_algorithm :
@@ -205,18 +347,100 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
         numRepetitions = (vl_size) mxGetScalar (optarg) ;
         break ;
 
+      case opt_num_threads :
+        if (!vlmxIsPlainScalar(optarg) || mxGetScalar(optarg) < 0) {
+          vlmxError (vlmxErrInvalidArgument,
+                     "NUMTHREADS must be a non-negative scalar.") ;
+        }
+        numThreads = (vl_size) mxGetScalar (optarg) ;
+        break ;
+
+      case opt_mini_batch :
+        if (!vlmxIsPlainScalar(optarg) || mxGetScalar(optarg) < 0) {
+          vlmxError (vlmxErrInvalidArgument,
+                     "MINIBATCH must be a non-negative scalar.") ;
+        }
+        batchSize = (vl_size) mxGetScalar (optarg) ;
+        break ;
+
+      case opt_dimension :
+        if (!vlmxIsPlainScalar(optarg) || mxGetScalar(optarg) < 1) {
+          vlmxError (vlmxErrInvalidArgument,
+                     "DIMENSION must be a positive scalar.") ;
+        }
+        if (! path) {
+          vlmxError (vlmxErrInvalidArgument,
+                     "DIMENSION can only be used when DATA is a FILENAME.") ;
+        }
+        dimension = (vl_size) mxGetScalar (optarg) ;
+        break ;
+
       default :
         abort() ;
         break ;
     }
   }
 
+  memset (&source, 0, sizeof(source)) ;
+  source.typeSize = vl_get_type_size (dataType) ;
+
+  if (path) {
+    vl_int64 fileSize ;
+    if (dimension == 0) {
+      vlmxError (vlmxErrInvalidArgument,
+                 "DIMENSION is required when DATA is a FILENAME.") ;
+    }
+    source.file = fopen (path, "rb") ;
+    mxFree (path) ;
+    if (! source.file) {
+      vlmxError (vlmxErrInvalidArgument, "Could not open the DATA file.") ;
+    }
+#if defined(VL_OS_WIN)
+    _fseeki64 (source.file, 0, SEEK_END) ;
+    fileSize = _ftelli64 (source.file) ;
+#else
+    fseeko (source.file, 0, SEEK_END) ;
+    fileSize = ftello (source.file) ;
+#endif
+    if (fileSize < 0 || fileSize % (source.typeSize * dimension) != 0) {
+      data_source_error (&source,
+                         "The size of the DATA file is not a multiple of "
+                         "DIMENSION SINGLE values.") ;
+    }
+    numData = (vl_size) fileSize / (source.typeSize * dimension) ;
+    if (batchSize == 0) batchSize = 10000 ;
+  } else {
+    data = mxGetData (IN(DATA)) ;
+    source.data = data ;
+  }
+  source.dimension = dimension ;
+  source.numData = numData ;
+
+  if (!vlmxIsPlainScalar(IN(NUMCENTERS)) ||
+      (numCenters = (vl_size) mxGetScalar(IN(NUMCENTERS))) < 1  ||
+      numCenters > numData) {
+    data_source_error (&source,
+                       "NUMCENTERS must be a positive integer not greater "
+                       "than the number of data.") ;
+  }
+
+  if (batchSize > 0) {
+    if (distance != VlDistanceL2) {
+      data_source_error (&source, "MINIBATCH requires the L2 distance.") ;
+    }
+    /* a pass over the data costs about as much as a Lloyd iteration,
+       but far fewer passes are needed */
+    if (! maxNumIterationsSet) maxNumIterations = 10 ;
+    if (source.file) {
+      source.buffer = mxMalloc (source.typeSize * dimension *
+                                VL_MIN(VL_MAX(batchSize, numCenters), numData)) ;
+    }
+  }
+
   /* -----------------------------------------------------------------
    *                                                        Do the job
    * -------------------------------------------------------------- */
 
-  data = mxGetPr(IN(DATA)) ;
-
   kmeans = vl_kmeans_new (dataType, distance) ;
 
   vl_kmeans_set_verbosity (kmeans, verbosity) ;
@@ -224,6 +448,7 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
   vl_kmeans_set_algorithm (kmeans, algorithm) ;
   vl_kmeans_set_initialization (kmeans, initialization) ;
   vl_kmeans_set_max_num_iterations (kmeans, maxNumIterations) ;
+  vl_kmeans_set_num_threads (kmeans, numThreads) ;
 
   if (verbosity) {
     char const * algorithmName = 0 ;
@@ -244,6 +469,10 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
     mexPrintf("kmeans: Algorithm = %s\n", algorithmName) ;
     mexPrintf("kmeans: MaxNumIterations = %d\n", vl_kmeans_get_max_num_iterations(kmeans)) ;
     mexPrintf("kmeans: NumRepetitions = %d\n", vl_kmeans_get_num_repetitions(kmeans)) ;
+    mexPrintf("kmeans: NumThreads = %d\n", vl_kmeans_get_num_threads(kmeans)) ;
+    if (batchSize > 0) {
+      mexPrintf("kmeans: MiniBatch = %d\n", batchSize) ;
+    }
     mexPrintf("kmeans: data type = %s\n", vl_get_type_name(vl_kmeans_get_data_type(kmeans))) ;
     mexPrintf("kmeans: distance = %s\n", vl_get_vector_comparison_type_name(vl_kmeans_get_distance(kmeans))) ;
     mexPrintf("kmeans: data dimension = %d\n", dimension) ;
@@ -256,7 +485,12 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
   /*                                    Clustering and quantization */
   /* -------------------------------------------------------------- */
 
-  energy = vl_kmeans_cluster(kmeans, data, dimension, numData, numCenters) ;
+  if (batchSize > 0) {
+    energy = cluster_with_batches (kmeans, &source, numCenters, batchSize,
+                                   maxNumIterations, initialization) ;
+  } else {
+    energy = vl_kmeans_cluster(kmeans, data, dimension, numData, numCenters) ;
+  }
 
   /* copy centers */
   OUT(CENTERS) = mxCreateNumericMatrix (dimension, numCenters, classID, mxREAL) ;
@@ -271,12 +505,33 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
     OUT(ASSIGNMENTS) = mxCreateNumericMatrix (1, numData, mxUINT32_CLASS, mxREAL) ;
     assignments = mxGetData (OUT(ASSIGNMENTS)) ;
 
-    vl_kmeans_quantize (kmeans, assignments, NULL, data, numData) ;
+    if (batchSize > 0) {
+      /* quantize batch by batch, and replace the mini-batch estimate
+         by the energy of the final centers */
+      void * distances = mxMalloc (source.typeSize * batchSize) ;
+      energy = 0 ;
+      for (j = 0 ; j < numData ; j += batchSize) {
+        vl_size n = VL_MIN(batchSize, numData - j) ;
+        vl_uindex i ;
+        vl_kmeans_quantize (kmeans, assignments + j, distances,
+                            data_source_read (&source, j, n), n) ;
+        for (i = 0 ; i < n ; ++i) {
+          energy += (dataType == VL_TYPE_FLOAT) ?
+            ((float*)distances)[i] : ((double*)distances)[i] ;
+        }
+      }
+      mxFree (distances) ;
+    } else {
+      vl_kmeans_quantize (kmeans, assignments, NULL, data, numData) ;
+    }
 
     /* use MATLAB indexing convention */
     for (j = 0 ; j < numData ; ++j) { assignments[j] += 1 ; }
   }
 
+  if (source.file) fclose (source.file) ;
+  if (source.buffer) mxFree (source.buffer) ;
+
   /* optionally return energy */
   if (nout > 2) {
     OUT(ENERGY) = vlmxCreatePlainScalar (energy) ;
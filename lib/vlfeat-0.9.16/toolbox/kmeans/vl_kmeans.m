@@ -9,6 +9,12 @@
 %   [C, A, ENERGY] = VL_KMEANS(...) returns the energy of the solution
 %   (or an upper bound for the ELKAN algorithm) as well.
 %
+%   [C, A] = VL_KMEANS(FILENAME, NUMCENTERS, 'DIMENSION', D) clusters
+%   data stored in FILENAME as SINGLE values, one column of D values
+%   after the other (as written by FWRITE(FID, X, 'single')). The data
+%   is read in mini-batches (see the MiniBatch option) and never held
+%   in memory at once.
+%
 %   KMEANS() supports different initialization and optimization
 %   methods and different clustering distances. Specifically, the
 %   following options are supported:
@@ -31,11 +37,38 @@
 %     Number of time to restart k-means. The solution with minimal
 %     energy is returned.
 %
+%   MaxNumIterations:: [100]
+%     Maximum number of iterations, or of passes over the data with
+%     MiniBatch (10 by default in that case).
+%
+%   NumThreads:: [0]
+%     Number of threads among which the assignments to the centers and
+%     the center updates are split. The special value 0 means the
+%     number of CPUs. The result does not depend on the number of
+%     threads.
+%
+%   MiniBatch:: [0]
+%     Use mini-batch k-means with batches of this many points (10000
+%     by default when DATA is a FILENAME). The centers are seeded from
+%     a random sample of MAX(MINIBATCH, NUMCENTERS) points; then each
+%     pass visits the batches in random order and moves every center
+%     towards the points assigned to it, with a step inversely
+%     proportional to the number of points it has received. Only the
+%     L2 distance is supported, and the Algorithm and NumRepetitions
+%     options are ignored. ENERGY is the energy of the final centers.
+%
+%   Dimension::
+%     Dimension of the data points stored in FILENAME.
+%
 %   Example::
 %     VL_KMEANS(X, 10, 'verbose', 'distance', 'l1', 'algorithm',
 %     'elkan') clusters the data point X using 10 centers, l1
 %     distance, and the Elkan's algorithm.
 %
+%     VL_KMEANS('feats.bin', 1000, 'dimension', 128, 'minibatch', 10000)
+%     clusters the 128-dimensional points of the file FEATS.BIN in
+%     1000 centers, 10000 points at a time.
+%
 %   See also: VL_HELP().
 
 % Authors: Andrea Vedaldi
@@ -55,7 +55,7 @@
 %      with the index of the splitting dimension and the threshold for
 %      each node.
 %
-%   See also: VL_KDTREEQUERY(), VL_HELP().
+%   See also: VL_KDTREEQUERY(), VL_KDTREESAVE(), VL_HELP().
 
 % Authors: Andrea Vedaldi
 
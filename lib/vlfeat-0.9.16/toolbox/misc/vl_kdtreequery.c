@@ -16,13 +16,15 @@ the terms of the BSD license (see the COPYING file).
 #include <vl/kdtree.h>
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "kdtree.h"
 
 /* option codes */
 enum {
-  opt_verbose, opt_num_neighs, opt_max_num_comparisons
+  opt_verbose, opt_num_neighs, opt_max_num_comparisons, opt_num_threads
 } ;
 
 /* options */
@@ -31,9 +33,107 @@ vlmxOption  options [] = {
 {"NumNeighbors",      1,   opt_num_neighs          },
 {"MaxComparisons",    1,   opt_max_num_comparisons },
 {"MaxNumComparisons", 1,   opt_max_num_comparisons },
+{"NumThreads",        1,   opt_num_threads         },
 {0,                   0,   0                       }
 } ;
 
+/** @internal @brief Forest read from a file, kept open across calls */
+typedef struct _OpenForest
+{
+  char * path ;
+  time_t modificationTime ;
+  vl_size fileSize ;
+  VlKDForest * forest ;
+  struct _OpenForest * next ;
+} OpenForest ;
+
+static OpenForest * openForests = 0 ;
+
+/** ------------------------------------------------------------------
+ ** @internal @brief Close the forests read from files
+ **
+ ** Called when the MEX file is cleared. The forests are allocated by
+ ** the C library rather than MATLAB, so that they survive the call
+ ** that opened them.
+ **/
+
+static void
+close_forests (void)
+{
+  vl_set_alloc_func (malloc, realloc, calloc, free) ;
+  while (openForests) {
+    OpenForest * entry = openForests ;
+    openForests = entry->next ;
+    vl_kdforest_delete (entry->forest) ;
+    free (entry->path) ;
+    free (entry) ;
+  }
+  vl_set_alloc_func (mxMalloc, mxRealloc, mxCalloc, mxFree) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @internal @brief Get the forest of a file written by VL_KDTREESAVE()
+ ** @param path_array MEX string with the file name.
+ ** @return KDForest object instance, owned by the cache.
+ **
+ ** The file is mapped on first use and stays mapped until the MEX
+ ** file is cleared, or until the file changes.
+ **/
+
+static VlKDForest *
+open_forest (mxArray const * path_array)
+{
+  char * path = mxArrayToString (path_array) ;
+  OpenForest * entry ;
+  OpenForest ** link ;
+  struct stat info ;
+
+  if (stat (path, &info) != 0) {
+    vlmxError(vlmxErrInvalidArgument, "Cannot read '%s'.", path) ;
+  }
+
+  for (link = &openForests ; *link ; link = &(*link)->next) {
+    if (strcmp ((*link)->path, path) == 0) break ;
+  }
+  entry = *link ;
+  if (entry &&
+      entry->modificationTime == info.st_mtime &&
+      entry->fileSize == (vl_size) info.st_size) {
+    mxFree (path) ;
+    return entry->forest ;
+  }
+
+  vl_set_alloc_func (malloc, realloc, calloc, free) ;
+  if (entry) {
+    /* the file was written again */
+    *link = entry->next ;
+    vl_kdforest_delete (entry->forest) ;
+    free (entry->path) ;
+    free (entry) ;
+  }
+  entry = malloc (sizeof(OpenForest)) ;
+  entry->forest = vl_kdforest_new_from_file (path) ;
+  if (entry->forest) {
+    entry->path = malloc (strlen (path) + 1) ;
+    strcpy (entry->path, path) ;
+    entry->modificationTime = info.st_mtime ;
+    entry->fileSize = (vl_size) info.st_size ;
+    entry->next = openForests ;
+    openForests = entry ;
+  } else {
+    free (entry) ;
+    entry = 0 ;
+  }
+  vl_set_alloc_func (mxMalloc, mxRealloc, mxCalloc, mxFree) ;
+
+  if (! entry) {
+    vlmxError(vlmxErrInvalidArgument, "%s", vl_get_last_error_message()) ;
+  }
+  mexAtExit (close_forests) ;
+  mxFree (path) ;
+  return entry->forest ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief MEX entry point
  **/
@@ -61,11 +161,12 @@ mexFunction(int nout, mxArray *out[],
   void * distance ;
   vl_size numNeighbors = 1 ;
   vl_size numQueries ;
-  vl_uindex qi, ni;
-  unsigned int numComparisons = 0 ;
+  vl_uindex i ;
+  vl_size numComparisons = 0 ;
   unsigned int maxNumComparisons = 0 ;
-  VlKDForestNeighbor * neighbors ;
+  vl_size numThreads = 0 ;
   mxClassID dataClass ;
+  vl_bool fromFile = VL_FALSE ;
 
   VL_USE_MATLAB_ENV ;
 
@@ -80,9 +181,17 @@ mexFunction(int nout, mxArray *out[],
     vlmxError(vlmxErrTooManyOutputArguments, NULL) ;
   }
 
-  forest = new_kdforest_from_array (forest_array, data_array) ;
+  if (vlmxIsString (forest_array, -1)) {
+    /* a file written by VL_KDTREESAVE(), which also holds the data */
+    fromFile = VL_TRUE ;
+    forest = open_forest (forest_array) ;
+    dataClass = (vl_kdforest_get_data_type (forest) == VL_TYPE_FLOAT) ?
+      mxSINGLE_CLASS : mxDOUBLE_CLASS ;
+  } else {
+    forest = new_kdforest_from_array (forest_array, data_array) ;
+    dataClass = mxGetClassID (data_array) ;
+  }
 
-  dataClass = mxGetClassID (data_array) ;
   if (mxGetClassID (query_array) != dataClass) {
     vlmxError(vlmxErrInvalidArgument,
              "QUERY must have the same storage class as DATA.") ;
@@ -114,6 +223,14 @@ mexFunction(int nout, mxArray *out[],
         maxNumComparisons = mxGetScalar(optarg) ;
         break;
 
+      case opt_num_threads :
+        if (! vlmxIsPlainScalar(optarg) || mxGetScalar(optarg) < 0) {
+          vlmxError(vlmxErrInvalidArgument,
+                   "NUMTHREADS must be a non-negative scalar.") ;
+        }
+        numThreads = (vl_size) mxGetScalar(optarg) ;
+        break;
+
       case opt_verbose :
         ++ verbose ;
         break ;
@@ -122,8 +239,6 @@ mexFunction(int nout, mxArray *out[],
 
   vl_kdforest_set_max_num_comparisons (forest, maxNumComparisons) ;
 
-  neighbors = vl_malloc (sizeof(VlKDForestNeighbor) * numNeighbors) ;
-
   query = mxGetData (query_array) ;
   numQueries = mxGetN (query_array) ;
 
@@ -141,37 +256,16 @@ mexFunction(int nout, mxArray *out[],
     VL_PRINTF ("vl_kdforestquery: number of neighbors per query: %d\n", numNeighbors) ;
     VL_PRINTF ("vl_kdforestquery: max num of comparisons per query: %d\n",
                vl_kdforest_get_max_num_comparisons (forest)) ;
+    VL_PRINTF ("vl_kdforestquery: number of threads: %d\n",
+               (int) (numThreads ? numThreads : vl_get_num_cpus())) ;
   }
 
-  for (qi = 0 ; qi < numQueries ; ++ qi) {
-    numComparisons += vl_kdforest_query (forest, neighbors, numNeighbors,
-                                         query) ;
-    switch (dataClass) {
-      case mxSINGLE_CLASS:
-      {
-        float * distance_ = (float*) distance ;
-        for (ni = 0 ; ni < numNeighbors ; ++ni) {
-          *index++     = neighbors[ni].index + 1 ;
-          *distance_++ = neighbors[ni].distance ;
-        }
-        query = (float*)query + vl_kdforest_get_data_dimension (forest) ;
-        distance = distance_ ;
-        break ;
-      }
-      case mxDOUBLE_CLASS:
-      {
-        double * distance_ = (double*) distance ;
-        for (ni = 0 ; ni < numNeighbors ; ++ni) {
-          *index++     = neighbors[ni].index + 1 ;
-          *distance_++ = neighbors[ni].distance ;
-        }
-        query = (double*)query + vl_kdforest_get_data_dimension (forest)  ;
-        distance = distance_ ;
-        break ;
-      }
-      default:
-        abort() ;
-    }
+  /* one searcher per thread over the shared forest */
+  numComparisons = vl_kdforest_query_with_array (forest, index, distance,
+                                                 numNeighbors, numQueries,
+                                                 query, numThreads) ;
+  for (i = 0 ; i < numNeighbors * numQueries ; ++ i) {
+    index[i] += 1 ;
   }
 
   if (verbose) {
@@ -181,6 +275,7 @@ mexFunction(int nout, mxArray *out[],
                ((double) numComparisons) / (numQueries * numNeighbors)) ;
   }
 
-  vl_kdforest_delete (forest) ;
-  vl_free (neighbors) ;
+  if (! fromFile) {
+    vl_kdforest_delete (forest) ;
+  }
 }
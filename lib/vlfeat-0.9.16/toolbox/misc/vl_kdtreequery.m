@@ -17,6 +17,12 @@
 %   nearest one. In this case INDEX and DIST are NN x NUMQUERIES
 %   matrices. Neighbors are returned by increasing distance.
 %
+%   [INDEX, DIST] = VL_KDTREEQUERY(FILENAME, [], Y) queries the forest
+%   and data saved by VL_KDTREESAVE() to FILENAME. The file is mapped
+%   on first use and stays mapped across calls until the MEX file is
+%   cleared (CLEAR VL_KDTREEQUERY) or the file is saved again. Y must
+%   have the class of the saved data.
+%
 %   VL_KDTREEQUERY(..., 'MAXNUMCOMPARISONS', NCOMP) performs at most
 %   NCOMP comparisons for each query point. In this case the result is
 %   only approximate (i.e. approximated nearest-neighbors, or ANNs)
@@ -32,7 +38,13 @@
 %     Sets the maximum number of comparisons per query point. The
 %     special value 0 means unbounded. The default is 0.
 %
-%   See also: VL_KDTREEBUILD(), VL_HELP().
+%   NumThreads::
+%     Sets the number of threads among which the query points are
+%     split; each thread searches the trees with its own search state.
+%     The special value 0 means the number of CPUs. The default is 0.
+%     The results do not depend on the number of threads.
+%
+%   See also: VL_KDTREEBUILD(), VL_KDTREESAVE(), VL_HELP().
 
 % Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
 % All rights reserved.
@@ -0,0 +1,61 @@
+/** @internal
+ ** @file     vl_kdtreesave.c
+ ** @brief    vl_kdtreesave - MEX implementation
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <mexutils.h>
+#include <vl/kdtree.h>
+
+#include "kdtree.h"
+
+/** ------------------------------------------------------------------
+ ** @brief MEX entry point
+ **/
+
+void
+mexFunction(int nout, mxArray *out[],
+            int nin, const mxArray *in[])
+{
+  enum {IN_FOREST = 0, IN_DATA, IN_FILENAME, IN_END} ;
+
+  VlKDForest * forest ;
+  char * path ;
+  int err ;
+
+  VL_USE_MATLAB_ENV ;
+
+  /* -----------------------------------------------------------------
+   *                                               Check the arguments
+   * -------------------------------------------------------------- */
+
+  if (nin < IN_END) {
+    vlmxError(vlmxErrNotEnoughInputArguments, NULL) ;
+  } else if (nin > IN_END) {
+    vlmxError(vlmxErrTooManyInputArguments, NULL) ;
+  }
+  if (nout > 0) {
+    vlmxError(vlmxErrTooManyOutputArguments, NULL) ;
+  }
+  if (! vlmxIsString (in[IN_FILENAME], -1)) {
+    vlmxError(vlmxErrInvalidArgument, "FILENAME must be a string.") ;
+  }
+
+  forest = new_kdforest_from_array (in[IN_FOREST], in[IN_DATA]) ;
+  path = mxArrayToString (in[IN_FILENAME]) ;
+
+  err = vl_kdforest_write (forest, path) ;
+
+  vl_kdforest_delete (forest) ;
+  mxFree (path) ;
+  if (err) {
+    vlmxError(vlmxErrInvalidArgument, "%s", vl_get_last_error_message()) ;
+  }
+}
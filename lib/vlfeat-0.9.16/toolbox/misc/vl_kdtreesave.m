@@ -0,0 +1,29 @@
+% VL_KDTREESAVE Save a KD-tree forest and its data to a file
+%   VL_KDTREESAVE(KDTREE, X, FILENAME) writes the forest KDTREE built
+%   by VL_KDTREEBUILD() on the data X to the file FILENAME. The file
+%   holds the trees, ready for searching, and a copy of X, in the
+%   layout used in memory by VL_KDTREEQUERY().
+%
+%   Pass FILENAME in place of the forest to VL_KDTREEQUERY() to query
+%   it; the data argument is then ignored and can be empty:
+%
+%     vl_kdtreesave(kdtree, X, 'index.kdf') ;
+%     [index, dist] = vl_kdtreequery('index.kdf', [], Y) ;
+%
+%   VL_KDTREEQUERY() maps the file read-only on first use and keeps
+%   it mapped until the MEX file is cleared, so later queries neither
+%   rebuild the forest nor load X, and processes querying the same
+%   file share its memory. The file is written under a temporary name
+%   and renamed, so saving again is picked up by the next query
+%   without disturbing processes that mapped the previous version.
+%
+%   The file is specific to the byte order and word size of the
+%   machine that wrote it.
+%
+%   See also: VL_KDTREEBUILD(), VL_KDTREEQUERY(), VL_HELP().
+
+% Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+% All rights reserved.
+%
+% This file is part of the VLFeat library and is made available under
+% the terms of the BSD license (see the COPYING file).
@@ -84,3 +84,24 @@ for i=1:size(s.Q,2)
             numel(union(nn(:,i), nn_(:,i))) ;
   assert(overlap > 0.6, 'ANN did not return enough correct nearest neighbors') ;
 end
+
+function test_save(s)
+numNeighbors = 7 ;
+for type = {@single, @double}
+  conv = type{1} ;
+  X = conv(s.X) ;
+  Q = conv(s.Q) ;
+  tree = vl_kdtreebuild(X, 'numTrees', 3) ;
+  [nn, d2] = vl_kdtreequery(tree, X, Q, ...
+                            'numNeighbors', numNeighbors, ...
+                            'maxComparisons', 50) ;
+  filename = [tempname '.kdf'] ;
+  vl_kdtreesave(tree, X, filename) ;
+  [nn_, d2_] = vl_kdtreequery(filename, [], Q, ...
+                              'numNeighbors', numNeighbors, ...
+                              'maxComparisons', 50) ;
+  clear vl_kdtreequery ;
+  delete(filename) ;
+  vl_assert_equal(nn, nn_, 'incorrect nns: type=%s', func2str(conv)) ;
+  vl_assert_equal(d2, d2_, 'incorrect distances: type=%s', func2str(conv)) ;
+end
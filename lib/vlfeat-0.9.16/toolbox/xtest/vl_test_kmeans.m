@@ -45,6 +45,45 @@ for dataType = dataTypes
   end
 end
 
+function test_threads(s)
+for algorithm = {'Lloyd', 'Elkan'}
+  vl_twister('state',0) ;
+  [centers, assignments, en] = vl_kmeans(single(s.X), 10, ...
+                                         'Algorithm', char(algorithm), ...
+                                         'NumThreads', 1) ;
+  vl_twister('state',0) ;
+  [centers_, assignments_, en_] = vl_kmeans(single(s.X), 10, ...
+                                            'Algorithm', char(algorithm), ...
+                                            'NumThreads', 4) ;
+  assert(isequal(centers, centers_)) ;
+  assert(isequal(assignments, assignments_)) ;
+  assert(isequal(en, en_)) ;
+end
+
+function test_minibatch(s)
+X = single(s.X) ;
+vl_twister('state',0) ;
+[centers, assignments, en] = vl_kmeans(X, 10, 'NumRepetitions', 10) ;
+vl_twister('state',0) ;
+[centers_, assignments_, en_] = vl_kmeans(X, 10, 'MiniBatch', 20, ...
+                                          'MaxNumIterations', 20) ;
+assert(en_ <= 1.1 * en, 'mini-batch vl_kmeans did not optimize enough') ;
+
+% the same batches read from a file
+path = [tempname '.bin'] ;
+fid = fopen(path, 'w') ;
+fwrite(fid, X, 'single') ;
+fclose(fid) ;
+vl_twister('state',0) ;
+[centers__, assignments__, en__] = vl_kmeans(path, 10, ...
+                                             'Dimension', size(X,1), ...
+                                             'MiniBatch', 20, ...
+                                             'MaxNumIterations', 20) ;
+delete(path) ;
+assert(isequal(centers_, centers__)) ;
+assert(isequal(assignments_, assignments__)) ;
+vl_assert_almost_equal(en_, en__, 1e-5) ;
+
 function test_patterns(s)
 distances = {'l1', 'l2'} ;
 dataTypes = {'single','double'} ;
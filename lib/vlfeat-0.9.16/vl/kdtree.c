@@ -48,6 +48,17 @@ To find the N nearest neighbors to a query point use
 and calculate approximate nearest neighbors use
 ::vl_kdforest_set_max_num_comparisons.
 
+::vl_kdforest_query keeps the state of the search in the forest, so a
+forest can be queried by one thread at a time. To query from several
+threads, create a ::VlKDForestSearcher per thread with
+::vl_kdforest_new_searcher and use ::vl_kdforestsearcher_query; the
+forest is then only read. ::vl_kdforest_query_with_array does this
+for a whole matrix of query points, splitting them among threads.
+
+::vl_kdforest_write saves a built forest together with its data, and
+::vl_kdforest_new_from_file maps such a file read-only and queries it
+in place, without rebuilding the trees or loading the data.
+
 <!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
 @section kdtree-tech Technical details
 <!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
@@ -84,6 +95,22 @@ trivial to compute because partitions are hyper-rectangles.
 #include "mathop.h"
 #include <stdlib.h>
 
+#if ! defined(VL_DISABLE_THREADS) && defined(VL_THREADS_POSIX)
+#include <pthread.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#if ! defined(VL_OS_WIN)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static void vl_kdforest_unmap_file (void * mapping, vl_size size) ;
+
 #define VL_HEAP_prefix     vl_kdforest_search_heap
 #define VL_HEAP_type       VlKDForestSearchState
 #define VL_HEAP_cmp(v,x,y) (v[x].distanceLowerBound - v[y].distanceLowerBound)
@@ -311,12 +338,12 @@ vl_kdforest_new (vl_type dataType,
   self -> splitHeapSize = VL_MIN(numTrees, VL_KDTREE_SPLIT_HEAP_SIZE) ;
   self -> splitHeapNumNodes = 0 ;
 
-  self -> searchHeapArray = 0 ;
-  self -> searchHeapNumNodes = 0 ;
-
   self -> searchMaxNumComparisons = 0 ;
-  self -> searchIdBook = 0 ;
-  self -> searchId = 0 ;
+  self -> searchBoundsReady = VL_FALSE ;
+  self -> searcher = 0 ;
+
+  self -> mapping = 0 ;
+  self -> mappingSize = 0 ;
 
   switch (self->dataType) {
     case VL_TYPE_FLOAT:
@@ -344,18 +371,21 @@ VL_EXPORT void
 vl_kdforest_delete (VlKDForest * self)
 {
   vl_uindex ti ;
-  if (self->searchIdBook) vl_free (self->searchIdBook) ;
+  if (self->searcher) vl_kdforestsearcher_delete (self->searcher) ;
   if (self->trees) {
     for (ti = 0 ; ti < self->numTrees ; ++ ti) {
       if (self->trees[ti]) {
-        if (self->trees[ti]->nodes) vl_free (self->trees[ti]->nodes) ;
-        if (self->trees[ti]->dataIndex) vl_free (self->trees[ti]->dataIndex) ;
+        /* the nodes of a forest read from a file are in the mapping */
+        if (! self->mapping) {
+          if (self->trees[ti]->nodes) vl_free (self->trees[ti]->nodes) ;
+          if (self->trees[ti]->dataIndex) vl_free (self->trees[ti]->dataIndex) ;
+        }
         vl_free (self->trees[ti]) ;
       }
     }
     vl_free (self->trees) ;
   }
-  if (self->searchHeapArray) vl_free (self->searchHeapArray) ;
+  if (self->mapping) vl_kdforest_unmap_file (self->mapping, self->mappingSize) ;
   vl_free (self) ;
 }
 
@@ -380,6 +410,7 @@ vl_kdforest_build (VlKDForest * self, vl_size numData, void const * data)
   self->data = data ;
   self->numData = numData ;
   self->trees = vl_malloc (sizeof(VlKDTree*) * self->numTrees) ;
+  self->searchBoundsReady = VL_FALSE ;
 
   for (ti = 0 ; ti < self->numTrees ; ++ ti) {
     self->trees[ti] = vl_malloc (sizeof(VlKDTree)) ;
@@ -403,7 +434,7 @@ vl_kdforest_build (VlKDForest * self, vl_size numData, void const * data)
  **/
 
 VL_EXPORT vl_uindex
-vl_kdforest_query_recursively (VlKDForest  * self,
+vl_kdforest_query_recursively (VlKDForestSearcher * searcher,
                                VlKDTree * tree,
                                vl_uindex nodeIndex,
                                VlKDForestNeighbor * neighbors,
@@ -421,8 +452,9 @@ vl_kdforest_query_recursively (VlKDForest  * self,
   double x2 = node->splitThreshold ;
   double x3 = node->upperBound ;
   VlKDForestSearchState * searchState ;
+  VlKDForest const * self = searcher->forest ;
 
-  self->searchNumRecursions ++ ;
+  searcher->searchNumRecursions ++ ;
 
   switch (self->dataType) {
     case VL_TYPE_FLOAT :
@@ -444,15 +476,15 @@ vl_kdforest_query_recursively (VlKDForest  * self,
     for (iter = begin ;
          iter < end &&
          (self->searchMaxNumComparisons == 0 ||
-          self->searchNumComparisons < self->searchMaxNumComparisons) ;
+          searcher->searchNumComparisons < self->searchMaxNumComparisons) ;
          ++ iter) {
 
       vl_index di = tree->dataIndex [iter].index ;
 
       /* multiple KDTrees share the database points and we must avoid
        * adding the same point twice */
-      if (self->searchIdBook[di] == self->searchId) continue ;
-      self->searchIdBook[di] = self->searchId ;
+      if (searcher->searchIdBook[di] == searcher->searchId) continue ;
+      searcher->searchIdBook[di] = searcher->searchId ;
 
       /* compare the query to this point */
       switch (self->dataType) {
@@ -471,7 +503,7 @@ vl_kdforest_query_recursively (VlKDForest  * self,
         default:
           abort() ;
       }
-      self->searchNumComparisons += 1 ;
+      searcher->searchNumComparisons += 1 ;
 
       /* see if it should be added to the result set */
       if (*numAddedNeighbors < numNeighbors) {
@@ -526,15 +558,15 @@ vl_kdforest_query_recursively (VlKDForest  * self,
   }
 
   if (*numAddedNeighbors < numNeighbors || neighbors[0].distance > saveDist) {
-    searchState = self->searchHeapArray + self->searchHeapNumNodes ;
+    searchState = searcher->searchHeapArray + searcher->searchHeapNumNodes ;
     searchState->tree = tree ;
     searchState->nodeIndex = saveChild ;
     searchState->distanceLowerBound = saveDist ;
-    vl_kdforest_search_heap_push (self->searchHeapArray,
-                                  &self->searchHeapNumNodes) ;
+    vl_kdforest_search_heap_push (searcher->searchHeapArray,
+                                  &searcher->searchHeapNumNodes) ;
   }
 
-  return vl_kdforest_query_recursively (self,
+  return vl_kdforest_query_recursively (searcher,
                                         tree,
                                         nextChild,
                                         neighbors,
@@ -574,6 +606,85 @@ vl_kdtree_calc_bounds_recursively (VlKDTree * tree,
   }
 }
 
+/** ------------------------------------------------------------------
+ ** @internal @brief Compute the bounds of the nodes of all trees
+ ** @param self KDForest object instance.
+ **/
+
+static void
+vl_kdforest_calc_bounds (VlKDForest * self)
+{
+  vl_uindex ti ;
+  double * searchBounds ;
+
+  if (self->searchBoundsReady) return ;
+
+  searchBounds = vl_malloc(sizeof(double) * 2 * self->dimension) ;
+  for (ti = 0 ; ti < self->numTrees ; ++ti) {
+    double * iter = searchBounds  ;
+    double * end = iter + 2 * self->dimension ;
+    while (iter < end) {
+      *iter++ = - VL_INFINITY_F ;
+      *iter++ = + VL_INFINITY_F ;
+    }
+    vl_kdtree_calc_bounds_recursively (self->trees[ti], 0, searchBounds) ;
+  }
+  vl_free (searchBounds) ;
+  self->searchBoundsReady = VL_TRUE ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Create a searcher of a KDForest
+ ** @param self KDForest object, already built.
+ ** @return new searcher.
+ **
+ ** A searcher holds the search heap and the book of visited points of
+ ** a query, so that several threads can query the same forest, each
+ ** with its own searcher. Create the searchers before starting the
+ ** threads: the first call also computes the bounds of the tree nodes.
+ ** The forest must outlive its searchers.
+ **
+ ** @sa ::vl_kdforestsearcher_query, ::vl_kdforestsearcher_delete.
+ **/
+
+VL_EXPORT VlKDForestSearcher *
+vl_kdforest_new_searcher (VlKDForest * self)
+{
+  VlKDForestSearcher * searcher = vl_malloc (sizeof(VlKDForestSearcher)) ;
+  vl_size maxNumNodes = 0 ;
+  vl_uindex ti ;
+
+  vl_kdforest_calc_bounds (self) ;
+
+  /* the search heap holds at most all the nodes of the forest */
+  for (ti = 0 ; ti < self->numTrees ; ++ti) {
+    maxNumNodes += self->trees[ti]->numUsedNodes ;
+  }
+  searcher->forest = self ;
+  searcher->searchHeapArray = vl_malloc (sizeof(VlKDForestSearchState) * maxNumNodes) ;
+  searcher->searchHeapNumNodes = 0 ;
+  searcher->searchIdBook = vl_calloc (sizeof(vl_uindex), self->numData) ;
+  searcher->searchId = 0 ;
+  searcher->searchNumComparisons = 0 ;
+  searcher->searchNumRecursions = 0 ;
+  searcher->searchNumSimplifications = 0 ;
+  return searcher ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Delete a KDForest searcher
+ ** @param self searcher to delete.
+ ** @sa ::vl_kdforest_new_searcher
+ **/
+
+VL_EXPORT void
+vl_kdforestsearcher_delete (VlKDForestSearcher * self)
+{
+  vl_free (self->searchIdBook) ;
+  vl_free (self->searchHeapArray) ;
+  vl_free (self) ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief Query operation
  ** @param self KDTree object instance.
@@ -586,6 +697,9 @@ vl_kdtree_calc_bounds_recursively (VlKDTree * tree,
  ** ::VlKDForestNeighbor. Each entry contains the index of the
  ** neighbor (this is an index into the KDTree data) and its distance
  ** to the query point. Neighbors are sorted by increasing distance.
+ **
+ ** The search uses a searcher owned by the forest; see
+ ** ::vl_kdforestsearcher_query to query from several threads.
  **/
 
 VL_EXPORT vl_size
@@ -594,8 +708,34 @@ vl_kdforest_query (VlKDForest * self,
                    vl_size numNeighbors,
                    void const * query)
 {
+  if (! self->searcher) {
+    self->searcher = vl_kdforest_new_searcher (self) ;
+  }
+  return vl_kdforestsearcher_query (self->searcher, neighbors,
+                                    numNeighbors, query) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Query operation with a searcher
+ ** @param self searcher object instance.
+ ** @param neighbors list of nearest neighbors found (output).
+ ** @param numNeighbors number of nearest neighbors to find.
+ ** @param query query point.
+ ** @return number of tree leaves visited.
+ **
+ ** Same as ::vl_kdforest_query, but modifies only the searcher; the
+ ** forest is read only.
+ **/
+
+VL_EXPORT vl_size
+vl_kdforestsearcher_query (VlKDForestSearcher * self,
+                           VlKDForestNeighbor * neighbors,
+                           vl_size numNeighbors,
+                           void const * query)
+{
+  VlKDForest const * forest = self->forest ;
   vl_uindex i, ti ;
-  vl_bool exactSearch = (self->searchMaxNumComparisons == 0) ;
+  vl_bool exactSearch = (forest->searchMaxNumComparisons == 0) ;
   VlKDForestSearchState * searchState  ;
   vl_size numAddedNeighbors = 0 ;
 
@@ -607,44 +747,21 @@ vl_kdforest_query (VlKDForest * self,
   self -> searchId += 1 ;
   self -> searchNumRecursions = 0 ;
 
-  if (! self -> searchHeapArray) {
-    /* count number of tree nodes */
-    /* add support structures */
-    vl_size maxNumNodes = 0 ;
-    for (ti = 0 ; ti < self->numTrees ; ++ti) {
-      maxNumNodes += self->trees[ti]->numUsedNodes ;
-    }
-    self -> searchHeapArray = vl_malloc (sizeof(VlKDForestSearchState) * maxNumNodes) ;
-    self -> searchIdBook = vl_calloc (sizeof(vl_uindex), self->numData) ;
-
-    for (ti = 0 ; ti < self->numTrees ; ++ti) {
-      double * searchBounds = vl_malloc(sizeof(double) * 2 * self->dimension) ;
-      double * iter = searchBounds  ;
-      double * end = iter + 2 * self->dimension ;
-      while (iter < end) {
-        *iter++ = - VL_INFINITY_F ;
-        *iter++ = + VL_INFINITY_F ;
-      }
-      vl_kdtree_calc_bounds_recursively (self->trees[ti], 0, searchBounds) ;
-      vl_free (searchBounds) ;
-    }
-  }
-
   self->searchNumComparisons = 0 ;
   self->searchNumSimplifications = 0 ;
 
   /* put the root node into the search heap */
   self->searchHeapNumNodes = 0 ;
-  for (ti = 0 ; ti < self->numTrees ; ++ ti) {
+  for (ti = 0 ; ti < forest->numTrees ; ++ ti) {
     searchState = self->searchHeapArray + self->searchHeapNumNodes ;
-    searchState -> tree = self->trees[ti] ;
+    searchState -> tree = forest->trees[ti] ;
     searchState -> nodeIndex = 0 ;
     searchState -> distanceLowerBound = 0 ;
     vl_kdforest_search_heap_push (self->searchHeapArray, &self->searchHeapNumNodes) ;
   }
 
   /* branch and bound */
-  while (exactSearch || self->searchNumComparisons < self->searchMaxNumComparisons)
+  while (exactSearch || self->searchNumComparisons < forest->searchMaxNumComparisons)
   {
     /* pop the next optimal search node */
     VlKDForestSearchState * searchState ;
@@ -685,3 +802,467 @@ vl_kdforest_query (VlKDForest * self,
 
   return self->searchNumComparisons ;
 }
+
+/** ------------------------------------------------------------------
+ ** @internal @brief Queries of ::vl_kdforest_query_with_array given to a thread
+ **/
+
+typedef struct _VlKDForestQueryJob
+{
+  VlKDForestSearcher * searcher ;
+  VlKDForestNeighbor * neighbors ;
+  vl_uint32 * index ;
+  void * distance ;
+  vl_size numNeighbors ;
+  vl_uindex begin ;
+  vl_uindex end ;
+  void const * queries ;
+  vl_size numComparisons ;
+} VlKDForestQueryJob ;
+
+static void *
+vl_kdforest_query_job (void * arg)
+{
+  VlKDForestQueryJob * job = arg ;
+  VlKDForest const * forest = job->searcher->forest ;
+  vl_uindex qi, ni ;
+
+  for (qi = job->begin ; qi < job->end ; ++ qi) {
+    vl_uindex first = qi * job->numNeighbors ;
+    switch (forest->dataType) {
+      case VL_TYPE_FLOAT:
+      {
+        float * distance = (float*) job->distance + first ;
+        job->numComparisons += vl_kdforestsearcher_query
+          (job->searcher, job->neighbors, job->numNeighbors,
+           (float const*) job->queries + qi * forest->dimension) ;
+        for (ni = 0 ; ni < job->numNeighbors ; ++ni) {
+          job->index[first + ni] = (vl_uint32) job->neighbors[ni].index ;
+          if (distance) distance[ni] = job->neighbors[ni].distance ;
+        }
+        break ;
+      }
+      case VL_TYPE_DOUBLE:
+      {
+        double * distance = (double*) job->distance + first ;
+        job->numComparisons += vl_kdforestsearcher_query
+          (job->searcher, job->neighbors, job->numNeighbors,
+           (double const*) job->queries + qi * forest->dimension) ;
+        for (ni = 0 ; ni < job->numNeighbors ; ++ni) {
+          job->index[first + ni] = (vl_uint32) job->neighbors[ni].index ;
+          if (distance) distance[ni] = job->neighbors[ni].distance ;
+        }
+        break ;
+      }
+      default:
+        abort() ;
+    }
+  }
+  return NULL ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Query operation on a matrix of query points
+ ** @param self KDForest object instance.
+ ** @param index numNeighbors x numQueries matrix of neighbor indexes (output).
+ ** @param distance numNeighbors x numQueries matrix of distances (output).
+ ** @param numNeighbors number of nearest neighbors to find.
+ ** @param numQueries number of query points.
+ ** @param queries dimension x numQueries matrix of query points.
+ ** @param numThreads number of threads (0 for the number of CPUs).
+ ** @return total number of tree leaves visited.
+ **
+ ** Column @c q of @a index and @a distance receives the neighbors of
+ ** column @c q of @a queries, as ::vl_kdforest_query would give them;
+ ** missing neighbors have index @c (vl_uint32)-1. @a distance has the
+ ** data type of the forest and may be NULL.
+ **
+ ** The queries are split in contiguous blocks among @a numThreads
+ ** threads, each with its own ::VlKDForestSearcher. All memory is
+ ** allocated by the calling thread. Without POSIX threads the queries
+ ** run on the calling thread.
+ **/
+
+VL_EXPORT vl_size
+vl_kdforest_query_with_array (VlKDForest * self,
+                              vl_uint32 * index,
+                              void * distance,
+                              vl_size numNeighbors,
+                              vl_size numQueries,
+                              void const * queries,
+                              vl_size numThreads)
+{
+  VlKDForestQueryJob * jobs ;
+  vl_size numComparisons = 0 ;
+  vl_uindex t ;
+
+  assert (index) ;
+  assert (numNeighbors > 0) ;
+  assert (queries || numQueries == 0) ;
+
+#if ! defined(VL_DISABLE_THREADS) && defined(VL_THREADS_POSIX)
+  if (numThreads == 0) numThreads = vl_get_num_cpus () ;
+  numThreads = VL_MAX(VL_MIN(numThreads, numQueries), 1) ;
+#else
+  numThreads = 1 ;
+#endif
+
+  jobs = vl_malloc (sizeof(VlKDForestQueryJob) * numThreads) ;
+  for (t = 0 ; t < numThreads ; ++ t) {
+    jobs[t].searcher = vl_kdforest_new_searcher (self) ;
+    jobs[t].neighbors = vl_malloc (sizeof(VlKDForestNeighbor) * numNeighbors) ;
+    jobs[t].index = index ;
+    jobs[t].distance = distance ;
+    jobs[t].numNeighbors = numNeighbors ;
+    jobs[t].begin = (numQueries * t) / numThreads ;
+    jobs[t].end = (numQueries * (t + 1)) / numThreads ;
+    jobs[t].queries = queries ;
+    jobs[t].numComparisons = 0 ;
+  }
+
+#if ! defined(VL_DISABLE_THREADS) && defined(VL_THREADS_POSIX)
+  {
+    /* the calling thread runs block 0, and the blocks of threads that
+       cannot be created */
+    pthread_t * threads = vl_malloc (sizeof(pthread_t) * numThreads) ;
+    vl_bool * started = vl_malloc (sizeof(vl_bool) * numThreads) ;
+    for (t = 1 ; t < numThreads ; ++ t) {
+      started[t] = (pthread_create (threads + t, NULL,
+                                    vl_kdforest_query_job, jobs + t) == 0) ;
+    }
+    vl_kdforest_query_job (jobs) ;
+    for (t = 1 ; t < numThreads ; ++ t) {
+      if (started[t]) pthread_join (threads[t], NULL) ;
+      else vl_kdforest_query_job (jobs + t) ;
+    }
+    vl_free (started) ;
+    vl_free (threads) ;
+  }
+#else
+  vl_kdforest_query_job (jobs) ;
+#endif
+
+  for (t = 0 ; t < numThreads ; ++ t) {
+    numComparisons += jobs[t].numComparisons ;
+    vl_free (jobs[t].neighbors) ;
+    vl_kdforestsearcher_delete (jobs[t].searcher) ;
+  }
+  vl_free (jobs) ;
+  return numComparisons ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                              Saving and mapping */
+/* ---------------------------------------------------------------- */
+
+/*
+ A forest file holds, in the byte order and type sizes of the machine
+ that wrote it and with every section aligned to
+ VL_KDFOREST_FILE_ALIGN bytes:
+
+ - a ::VlKDForestFileHeader;
+ - numTrees ::VlKDForestFileTree entries;
+ - for each tree, its nodes (with the search bounds) and data index;
+ - the dimension x numData data matrix.
+
+ Offsets are from the beginning of the file, so that the trees and
+ the data can be used in place from a read-only mapping.
+ */
+
+#define VL_KDFOREST_FILE_MAGIC "VLKDFRST"
+#define VL_KDFOREST_FILE_VERSION 1
+#define VL_KDFOREST_FILE_BYTE_ORDER 0x01020304
+#define VL_KDFOREST_FILE_ALIGN 16
+
+typedef struct _VlKDForestFileHeader
+{
+  char magic [8] ;
+  vl_uint32 version ;
+  vl_uint32 byteOrder ;
+  vl_uint32 dataType ;
+  vl_uint32 thresholdingMethod ;
+  vl_uint32 nodeSize ;
+  vl_uint32 dataIndexEntrySize ;
+  vl_uint64 dimension ;
+  vl_uint64 numData ;
+  vl_uint64 numTrees ;
+  vl_uint64 dataOffset ;
+} VlKDForestFileHeader ;
+
+typedef struct _VlKDForestFileTree
+{
+  vl_uint64 numUsedNodes ;
+  vl_uint64 depth ;
+  vl_uint64 nodesOffset ;
+  vl_uint64 dataIndexOffset ;
+} VlKDForestFileTree ;
+
+/** @internal @brief Round @a offset up to the file alignment */
+static vl_uint64
+vl_kdforest_file_align (vl_uint64 offset)
+{
+  return (offset + VL_KDFOREST_FILE_ALIGN - 1) & ~ (vl_uint64) (VL_KDFOREST_FILE_ALIGN - 1) ;
+}
+
+/** @internal @brief Write @a size bytes padding to @a offset */
+static int
+vl_kdforest_file_put (FILE * file, vl_uint64 * position, vl_uint64 offset,
+                      void const * data, vl_size size)
+{
+  static char const zeros [VL_KDFOREST_FILE_ALIGN] = {0} ;
+  while (*position < offset) {
+    vl_size n = VL_MIN(offset - *position, VL_KDFOREST_FILE_ALIGN) ;
+    if (fwrite (zeros, 1, n, file) != n) return 0 ;
+    *position += n ;
+  }
+  if (size && fwrite (data, 1, size, file) != size) return 0 ;
+  *position += size ;
+  return 1 ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Write a KDForest and its data to a file
+ ** @param self KDForest object, already built.
+ ** @param path name of the file.
+ ** @return error code.
+ **
+ ** The file holds the trees, with the bounds used by the search, and
+ ** a copy of the indexed data, so that ::vl_kdforest_new_from_file
+ ** can query it without the original data. The file is written
+ ** under a temporary name and then renamed, so a process that has
+ ** mapped a previous version keeps reading it. The format is that of
+ ** the machine writing it (byte order and type sizes) and files
+ ** written on a different architecture are rejected when read.
+ **
+ ** In case of error, the function returns ::VL_ERR_IO and sets the
+ ** last error message (see ::vl_get_last_error_message).
+ **/
+
+VL_EXPORT int
+vl_kdforest_write (VlKDForest * self, char const * path)
+{
+  VlKDForestFileHeader header ;
+  VlKDForestFileTree * fileTrees ;
+  vl_size dataSize = self->dimension * self->numData * vl_get_type_size (self->dataType) ;
+  vl_uint64 offset, position = 0 ;
+  vl_uindex ti ;
+  FILE * file ;
+  char * partPath ;
+  int ok ;
+
+  vl_kdforest_calc_bounds (self) ;
+
+  /* layout */
+  memset (&header, 0, sizeof(header)) ;
+  memcpy (header.magic, VL_KDFOREST_FILE_MAGIC, sizeof(header.magic)) ;
+  header.version = VL_KDFOREST_FILE_VERSION ;
+  header.byteOrder = VL_KDFOREST_FILE_BYTE_ORDER ;
+  header.dataType = self->dataType ;
+  header.thresholdingMethod = self->thresholdingMethod ;
+  header.nodeSize = sizeof(VlKDTreeNode) ;
+  header.dataIndexEntrySize = sizeof(VlKDTreeDataIndexEntry) ;
+  header.dimension = self->dimension ;
+  header.numData = self->numData ;
+  header.numTrees = self->numTrees ;
+
+  fileTrees = vl_calloc (self->numTrees, sizeof(VlKDForestFileTree)) ;
+  offset = vl_kdforest_file_align (sizeof(header)) ;
+  offset = vl_kdforest_file_align (offset + sizeof(VlKDForestFileTree) * self->numTrees) ;
+  for (ti = 0 ; ti < self->numTrees ; ++ ti) {
+    VlKDTree const * tree = self->trees[ti] ;
+    fileTrees[ti].numUsedNodes = tree->numUsedNodes ;
+    fileTrees[ti].depth = tree->depth ;
+    fileTrees[ti].nodesOffset = offset ;
+    offset = vl_kdforest_file_align (offset + sizeof(VlKDTreeNode) * tree->numUsedNodes) ;
+    fileTrees[ti].dataIndexOffset = offset ;
+    offset = vl_kdforest_file_align (offset + sizeof(VlKDTreeDataIndexEntry) * self->numData) ;
+  }
+  header.dataOffset = offset ;
+
+  /* write to a temporary file and rename it, so that the processes
+     mapping an older version of the file are not disturbed */
+  partPath = vl_malloc (strlen (path) + 6) ;
+  strcpy (partPath, path) ;
+  strcat (partPath, ".part") ;
+  file = fopen (partPath, "wb") ;
+  if (! file) {
+    vl_free (partPath) ;
+    vl_free (fileTrees) ;
+    return vl_set_last_error (VL_ERR_IO, "Cannot open '%s' for writing.", path) ;
+  }
+  ok = vl_kdforest_file_put (file, &position, 0, &header, sizeof(header)) ;
+  ok = ok && vl_kdforest_file_put (file, &position, vl_kdforest_file_align (sizeof(header)),
+                                   fileTrees, sizeof(VlKDForestFileTree) * self->numTrees) ;
+  for (ti = 0 ; ok && ti < self->numTrees ; ++ ti) {
+    VlKDTree const * tree = self->trees[ti] ;
+    ok = vl_kdforest_file_put (file, &position, fileTrees[ti].nodesOffset,
+                               tree->nodes, sizeof(VlKDTreeNode) * tree->numUsedNodes) ;
+    ok = ok && vl_kdforest_file_put (file, &position, fileTrees[ti].dataIndexOffset,
+                                     tree->dataIndex, sizeof(VlKDTreeDataIndexEntry) * self->numData) ;
+  }
+  ok = ok && vl_kdforest_file_put (file, &position, header.dataOffset, self->data, dataSize) ;
+  ok = (fclose (file) == 0) && ok ;
+  vl_free (fileTrees) ;
+
+#if defined(VL_OS_WIN)
+  if (ok) remove (path) ;
+#endif
+  ok = ok && (rename (partPath, path) == 0) ;
+  if (! ok) remove (partPath) ;
+  vl_free (partPath) ;
+  if (! ok) {
+    return vl_set_last_error (VL_ERR_IO, "Cannot write '%s'.", path) ;
+  }
+  return VL_ERR_OK ;
+}
+
+/** ------------------------------------------------------------------
+ ** @internal @brief Map a file read-only
+ ** @param path name of the file.
+ ** @param size size of the file (output).
+ ** @return the mapping, or NULL on error.
+ **
+ ** Where @c mmap is not available the file is read into memory.
+ **/
+
+static void *
+vl_kdforest_map_file (char const * path, vl_size * size)
+{
+#if ! defined(VL_OS_WIN)
+  struct stat info ;
+  void * mapping ;
+  int fd = open (path, O_RDONLY) ;
+  if (fd < 0) return NULL ;
+  if (fstat (fd, &info) != 0 || info.st_size <= 0) {
+    close (fd) ;
+    return NULL ;
+  }
+  *size = (vl_size) info.st_size ;
+  mapping = mmap (NULL, *size, PROT_READ, MAP_SHARED, fd, 0) ;
+  close (fd) ;
+  return (mapping == MAP_FAILED) ? NULL : mapping ;
+#else
+  void * mapping ;
+  long length ;
+  FILE * file = fopen (path, "rb") ;
+  if (! file) return NULL ;
+  if (fseek (file, 0, SEEK_END) != 0 || (length = ftell (file)) <= 0 ||
+      fseek (file, 0, SEEK_SET) != 0) {
+    fclose (file) ;
+    return NULL ;
+  }
+  *size = (vl_size) length ;
+  mapping = vl_malloc (*size) ;
+  if (mapping && fread (mapping, 1, *size, file) != *size) {
+    vl_free (mapping) ;
+    mapping = NULL ;
+  }
+  fclose (file) ;
+  return mapping ;
+#endif
+}
+
+/** @internal @brief Release a mapping of ::vl_kdforest_map_file */
+static void
+vl_kdforest_unmap_file (void * mapping, vl_size size)
+{
+#if ! defined(VL_OS_WIN)
+  munmap (mapping, size) ;
+#else
+  (void) size ;
+  vl_free (mapping) ;
+#endif
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Create a KDForest from a file
+ ** @param path name of a file written by ::vl_kdforest_write.
+ ** @return new KDForest, or NULL on error.
+ **
+ ** The file is mapped read-only and the trees and the data are used
+ ** in place, so opening the forest costs neither a rebuild nor a
+ ** copy, and processes mapping the same file share its pages. The
+ ** forest is ready for querying; it must not be built again. The
+ ** mapping is released by ::vl_kdforest_delete.
+ **
+ ** In case of error, the function returns NULL and sets the last
+ ** error (see ::vl_get_last_error_message).
+ **/
+
+VL_EXPORT VlKDForest *
+vl_kdforest_new_from_file (char const * path)
+{
+  VlKDForest * self ;
+  VlKDForestFileHeader const * header ;
+  VlKDForestFileTree const * fileTrees ;
+  char * mapping ;
+  vl_size size = 0 ;
+  vl_size dataSize ;
+  vl_uindex ti ;
+
+  mapping = vl_kdforest_map_file (path, &size) ;
+  if (! mapping) {
+    vl_set_last_error (VL_ERR_IO, "Cannot read '%s'.", path) ;
+    return NULL ;
+  }
+
+  /* check the header and that every section is in the file */
+  header = (VlKDForestFileHeader const *) mapping ;
+  if (size < sizeof(VlKDForestFileHeader) ||
+      memcmp (header->magic, VL_KDFOREST_FILE_MAGIC, sizeof(header->magic)) ||
+      header->version != VL_KDFOREST_FILE_VERSION) {
+    vl_kdforest_unmap_file (mapping, size) ;
+    vl_set_last_error (VL_ERR_BAD_ARG, "'%s' is not a KDForest file.", path) ;
+    return NULL ;
+  }
+  if (header->byteOrder != VL_KDFOREST_FILE_BYTE_ORDER ||
+      header->nodeSize != sizeof(VlKDTreeNode) ||
+      header->dataIndexEntrySize != sizeof(VlKDTreeDataIndexEntry) ||
+      (header->dataType != VL_TYPE_FLOAT && header->dataType != VL_TYPE_DOUBLE) ||
+      header->dimension < 1 || header->numTrees < 1) {
+    vl_kdforest_unmap_file (mapping, size) ;
+    vl_set_last_error (VL_ERR_BAD_ARG, "'%s' was written by an incompatible machine.", path) ;
+    return NULL ;
+  }
+  fileTrees = (VlKDForestFileTree const *)
+    (mapping + vl_kdforest_file_align (sizeof(VlKDForestFileHeader))) ;
+  dataSize = header->dimension * header->numData * vl_get_type_size (header->dataType) ;
+  if ((char const *) (fileTrees + header->numTrees) > mapping + size ||
+      header->dataOffset > size || dataSize > size - header->dataOffset) {
+    vl_kdforest_unmap_file (mapping, size) ;
+    vl_set_last_error (VL_ERR_BAD_ARG, "'%s' is truncated.", path) ;
+    return NULL ;
+  }
+  for (ti = 0 ; ti < header->numTrees ; ++ ti) {
+    VlKDForestFileTree const * fileTree = fileTrees + ti ;
+    if (fileTree->numUsedNodes < 1 ||
+        fileTree->nodesOffset > size ||
+        fileTree->numUsedNodes > (size - fileTree->nodesOffset) / sizeof(VlKDTreeNode) ||
+        fileTree->dataIndexOffset > size ||
+        header->numData > (size - fileTree->dataIndexOffset) / sizeof(VlKDTreeDataIndexEntry)) {
+      vl_kdforest_unmap_file (mapping, size) ;
+      vl_set_last_error (VL_ERR_BAD_ARG, "'%s' is truncated.", path) ;
+      return NULL ;
+    }
+  }
+
+  self = vl_kdforest_new ((vl_type) header->dataType, header->dimension, header->numTrees) ;
+  self->thresholdingMethod = (VlKDTreeThresholdingMethod) header->thresholdingMethod ;
+  self->numData = header->numData ;
+  self->data = mapping + header->dataOffset ;
+  self->mapping = mapping ;
+  self->mappingSize = size ;
+  self->trees = vl_malloc (sizeof(VlKDTree*) * self->numTrees) ;
+  for (ti = 0 ; ti < self->numTrees ; ++ ti) {
+    VlKDTree * tree = vl_malloc (sizeof(VlKDTree)) ;
+    tree->nodes = (VlKDTreeNode *) (mapping + fileTrees[ti].nodesOffset) ;
+    tree->numUsedNodes = fileTrees[ti].numUsedNodes ;
+    tree->numAllocatedNodes = fileTrees[ti].numUsedNodes ;
+    tree->dataIndex = (VlKDTreeDataIndexEntry *) (mapping + fileTrees[ti].dataIndexOffset) ;
+    tree->depth = (unsigned int) fileTrees[ti].depth ;
+    self->trees[ti] = tree ;
+  }
+  /* the bounds are in the file; the mapping is never written */
+  self->searchBoundsReady = VL_TRUE ;
+  return self ;
+}
@@ -23,6 +23,7 @@ typedef struct _VlKDTreeNode VlKDTreeNode ;
 typedef struct _VlKDTreeSplitDimension VlKDTreeSplitDimension ;
 typedef struct _VlKDTreeDataIndexEntry VlKDTreeDataIndexEntry ;
 typedef struct _VlKDForestSearchState VlKDForestSearchState ;
+typedef struct _VlKDForestSearcher VlKDForestSearcher ;
 
 struct _VlKDTreeNode
 {
@@ -102,16 +103,33 @@ typedef struct _VlKDForest
   vl_size splitHeapSize ;
 
   /* querying */
+  vl_size searchMaxNumComparisons ;
+  vl_bool searchBoundsReady ;
+  VlKDForestSearcher * searcher ;   /* used by ::vl_kdforest_query */
+
+  /* file mapping holding trees and data, see ::vl_kdforest_new_from_file */
+  void * mapping ;
+  vl_size mappingSize ;
+} VlKDForest ;
+
+/** @brief KDForest searcher
+ **
+ ** The state of a query. The forest is only read during a query, so
+ ** threads can query the same forest at once with a searcher each.
+ **/
+struct _VlKDForestSearcher
+{
+  VlKDForest const * forest ;
+
   VlKDForestSearchState * searchHeapArray ;
   vl_size searchHeapNumNodes ;
   vl_uindex searchId ;
   vl_uindex * searchIdBook ;
 
-  vl_size searchMaxNumComparisons ;
   vl_size searchNumComparisons;
   vl_size searchNumRecursions ;
   vl_size searchNumSimplifications ;
-} VlKDForest ;
+} ;
 
 /** @name Creatind and disposing
  ** @{ */
@@ -129,6 +147,29 @@ VL_EXPORT vl_size vl_kdforest_query (VlKDForest * self,
                                      VlKDForestNeighbor * neighbors,
                                      vl_size numNeighbors,
                                      void const * query) ;
+VL_EXPORT vl_size vl_kdforest_query_with_array (VlKDForest * self,
+                                                vl_uint32 * index,
+                                                void * distance,
+                                                vl_size numNeighbors,
+                                                vl_size numQueries,
+                                                void const * queries,
+                                                vl_size numThreads) ;
+/** @} */
+
+/** @name Searching from several threads
+ ** @{ */
+VL_EXPORT VlKDForestSearcher * vl_kdforest_new_searcher (VlKDForest * self) ;
+VL_EXPORT void vl_kdforestsearcher_delete (VlKDForestSearcher * self) ;
+VL_EXPORT vl_size vl_kdforestsearcher_query (VlKDForestSearcher * self,
+                                             VlKDForestNeighbor * neighbors,
+                                             vl_size numNeighbors,
+                                             void const * query) ;
+/** @} */
+
+/** @name Saving and mapping
+ ** @{ */
+VL_EXPORT int vl_kdforest_write (VlKDForest * self, char const * path) ;
+VL_EXPORT VlKDForest * vl_kdforest_new_from_file (char const * path) ;
 /** @} */
 
 /** @name Retrieving and setting parameters
@@ -88,6 +88,24 @@ quantize new data points.
   square of the number of clusters, which makes it unpractical for a
   very large number of clusters.
 
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
+@subsection kmeans-usage-threads Multiple threads and mini-batches
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
+
+::vl_kmeans_set_num_threads splits the k-means++ distances, the
+point-to-center assignments and the center updates of both optimizers
+among several threads. Each thread handles a contiguous block of
+points (or of centers for the update), so the result is the same for
+any number of threads.
+
+When the data does not fit in memory, ::vl_kmeans_update_centers_with_batch
+refines the centers from one batch of points at a time
+(@e l2 distance only). Each point moves its closest center towards
+itself by a step inversely proportional to the number of points the
+center has absorbed so far, so that after a pass over the data each
+center is the running mean of its points. The centers must be seeded
+first, for instance from the first batch.
+
 @section kmeans-tech Technical details
 
 Given data points @f$ x_1, \dots, x_n \in \mathbb{R}^d @f$, k-means
@@ -176,6 +194,10 @@ then a point need not to be reassigned. See [3] for details.
 #include "mathop.h"
 #include <string.h>
 
+#if ! defined(VL_DISABLE_THREADS) && defined(VL_THREADS_POSIX)
+#include <pthread.h>
+#endif
+
 /* ================================================================ */
 #ifndef VL_KMEANS_INSTANTIATING
 
@@ -197,8 +219,10 @@ vl_kmeans_reset (VlKMeans * self)
 
   if (self->centers) vl_free(self->centers) ;
   if (self->centerDistances) vl_free(self->centerDistances) ;
+  if (self->centerMasses) vl_free(self->centerMasses) ;
   self->centers = NULL ;
   self->centerDistances = NULL ;
+  self->centerMasses = NULL ;
 }
 
 /** ------------------------------------------------------------------
@@ -221,9 +245,11 @@ vl_kmeans_new (vl_type dataType,
   self->verbosity = 0 ;
   self->maxNumIterations = 100 ;
   self->numRepetitions = 1 ;
+  self->numThreads = 1 ;
 
   self->centers = NULL ;
   self->centerDistances = NULL ;
+  self->centerMasses = NULL ;
 
   vl_kmeans_reset (self) ;
 
@@ -248,11 +274,13 @@ vl_kmeans_new_copy (VlKMeans const * kmeans)
   self->verbosity = kmeans->verbosity ;
   self->maxNumIterations = kmeans->maxNumIterations ;
   self->numRepetitions = kmeans->numRepetitions ;
+  self->numThreads = kmeans->numThreads ;
 
   self->dimension = kmeans->dimension ;
   self->numCenters = kmeans->numCenters ;
   self->centers = NULL ;
   self->centerDistances = NULL ;
+  self->centerMasses = NULL ;
 
   if (kmeans->centers) {
     vl_size dataSize = vl_get_type_size(self->dataType) * self->dimension * self->numCenters ;
@@ -266,6 +294,12 @@ vl_kmeans_new_copy (VlKMeans const * kmeans)
     memcpy (self->centerDistances, kmeans->centerDistances, dataSize) ;
   }
 
+  if (kmeans->centerMasses) {
+    vl_size dataSize = sizeof(vl_size) * self->numCenters ;
+    self->centerMasses = vl_malloc(dataSize) ;
+    memcpy (self->centerMasses, kmeans->centerMasses, dataSize) ;
+  }
+
   return self ;
 }
 
@@ -299,6 +333,109 @@ typedef struct _VlKMeansSortWrapper
 #define VL_SHUFFLE_prefix _vl_kmeans
 #include "shuffle-def.h"
 
+/* ---------------------------------------------------------------- */
+/*                                                          Threads */
+/* ---------------------------------------------------------------- */
+
+/* A job processes the items [begin, end) (points or centers) of a
+ * parallel step. The typed pointers are stored as void and only the
+ * fields used by the step are set. All memory is allocated by the
+ * calling thread, as vl_malloc may not be thread safe (for instance
+ * when it is mxMalloc). */
+
+typedef struct _VlKMeansJob
+{
+  VlKMeans * self ;
+  void const * data ;
+  vl_size numData ;
+  vl_uindex begin ;
+  vl_uindex end ;
+
+  vl_uint32 * assignments ;
+  void * distances ;
+  void * buffer ;                      /* per job scratch space */
+  void const * center ;                /* k-means++ new center */
+  void * centers ;                     /* updated centers */
+  vl_size const * clusterMasses ;
+
+  /* Elkan bounds */
+  void * pointToClosestCenterUB ;
+  vl_bool * pointToClosestCenterUBIsStrict ;
+  void * pointToCenterLB ;
+  void const * nextCenterDistances ;
+  void const * centerToNewCenterDistances ;
+  vl_size numDistanceComputations ;
+  vl_size numDistanceComputationsToRefreshUB ;
+  vl_bool allDone ;
+} VlKMeansJob ;
+
+/** @internal
+ ** @brief Split items among jobs
+ ** @param self KMeans object.
+ ** @param numItems number of items.
+ ** @param numJobs number of jobs (output).
+ ** @return jobs, to be released by ::vl_free.
+ **
+ ** There is one job per thread, but not more jobs than items.
+ **/
+
+static VlKMeansJob *
+_vl_kmeans_new_jobs (VlKMeans * self, vl_size numItems, vl_size * numJobs)
+{
+  VlKMeansJob * jobs ;
+  vl_uindex t ;
+#if ! defined(VL_DISABLE_THREADS) && defined(VL_THREADS_POSIX)
+  vl_size numThreads = self->numThreads ;
+  if (numThreads == 0) numThreads = vl_get_num_cpus () ;
+  *numJobs = VL_MAX(VL_MIN(numThreads, numItems), 1) ;
+#else
+  *numJobs = 1 ;
+#endif
+  jobs = vl_calloc (*numJobs, sizeof(VlKMeansJob)) ;
+  for (t = 0 ; t < *numJobs ; ++ t) {
+    jobs[t].self = self ;
+    jobs[t].begin = (numItems * t) / *numJobs ;
+    jobs[t].end = (numItems * (t + 1)) / *numJobs ;
+  }
+  return jobs ;
+}
+
+/** @internal
+ ** @brief Run jobs in parallel
+ ** @param function job function.
+ ** @param jobs jobs.
+ ** @param numJobs number of jobs.
+ **
+ ** The calling thread runs the first job, and any job whose thread
+ ** could not be started.
+ **/
+
+static void
+_vl_kmeans_run_jobs (void * (*function) (void *),
+                     VlKMeansJob * jobs, vl_size numJobs)
+{
+  vl_uindex t ;
+#if ! defined(VL_DISABLE_THREADS) && defined(VL_THREADS_POSIX)
+  if (numJobs > 1) {
+    pthread_t * threads = vl_malloc (sizeof(pthread_t) * numJobs) ;
+    vl_bool * started = vl_malloc (sizeof(vl_bool) * numJobs) ;
+    for (t = 1 ; t < numJobs ; ++ t) {
+      started[t] = (pthread_create (threads + t, NULL,
+                                    function, jobs + t) == 0) ;
+    }
+    function (jobs) ;
+    for (t = 1 ; t < numJobs ; ++ t) {
+      if (started[t]) pthread_join (threads[t], NULL) ;
+      else function (jobs + t) ;
+    }
+    vl_free (started) ;
+    vl_free (threads) ;
+    return ;
+  }
+#endif
+  for (t = 0 ; t < numJobs ; ++ t) function (jobs + t) ;
+}
+
 /* #ifdef VL_KMEANS_INSTANTITATING */
 #endif
 
@@ -386,6 +523,28 @@ VL_XCAT(_vl_kmeans_seed_centers_with_rand_data_, SFX)
 /*                                                 kmeans++ seeding */
 /* ---------------------------------------------------------------- */
 
+/* distances from the new center to the points of a job */
+static void *
+VL_XCAT(_vl_kmeans_plus_plus_job_, SFX) (void * arg)
+{
+  VlKMeansJob * job = arg ;
+  VlKMeans * self = job->self ;
+  TYPE const * data = job->data ;
+#if (FLT == VL_TYPE_FLOAT)
+  VlFloatVectorComparisonFunction distFn = vl_get_vector_comparison_function_f(self->distance) ;
+#else
+  VlDoubleVectorComparisonFunction distFn = vl_get_vector_comparison_function_d(self->distance) ;
+#endif
+
+  VL_XCAT(vl_eval_vector_comparison_on_all_pairs_, SFX)
+  ((TYPE*)job->distances + job->begin,
+   self->dimension,
+   job->center, 1,
+   data + job->begin * self->dimension, job->end - job->begin,
+   distFn) ;
+  return NULL ;
+}
+
 static void
 VL_XCAT(_vl_kmeans_seed_centers_plus_plus_, SFX)
 (VlKMeans * self,
@@ -394,20 +553,22 @@ VL_XCAT(_vl_kmeans_seed_centers_plus_plus_, SFX)
  vl_size numData,
  vl_size numCenters)
 {
-  vl_uindex x, c ;
+  vl_uindex x, c, t ;
   VlRand * rand = vl_get_rand () ;
   TYPE * distances = vl_malloc (sizeof(TYPE) * numData) ;
   TYPE * minDistances = vl_malloc (sizeof(TYPE) * numData) ;
-#if (FLT == VL_TYPE_FLOAT)
-  VlFloatVectorComparisonFunction distFn = vl_get_vector_comparison_function_f(self->distance) ;
-#else
-  VlDoubleVectorComparisonFunction distFn = vl_get_vector_comparison_function_d(self->distance) ;
-#endif
+  vl_size numJobs ;
+  VlKMeansJob * jobs = _vl_kmeans_new_jobs (self, numData, &numJobs) ;
 
   self->dimension = dimension ;
   self->numCenters = numCenters ;
   self->centers = vl_malloc (sizeof(TYPE) * dimension * numCenters) ;
 
+  for (t = 0 ; t < numJobs ; ++ t) {
+    jobs[t].data = data ;
+    jobs[t].distances = distances ;
+  }
+
   for (x = 0 ; x < numData ; ++x) {
     minDistances[x] = (TYPE) VL_INFINITY_D ;
   }
@@ -427,12 +588,10 @@ VL_XCAT(_vl_kmeans_seed_centers_plus_plus_, SFX)
     c ++ ;
     if (c == numCenters) break ;
 
-    VL_XCAT(vl_eval_vector_comparison_on_all_pairs_, SFX)
-    (distances,
-     dimension,
-     (TYPE*)self->centers + (c - 1) * dimension, 1,
-     data, numData,
-     distFn) ;
+    for (t = 0 ; t < numJobs ; ++ t) {
+      jobs[t].center = (TYPE*)self->centers + (c - 1) * dimension ;
+    }
+    _vl_kmeans_run_jobs (VL_XCAT(_vl_kmeans_plus_plus_job_, SFX), jobs, numJobs) ;
 
     for (x = 0 ; x < numData ; ++x) {
       minDistances[x] = VL_MIN(minDistances[x], distances[x]) ;
@@ -445,6 +604,7 @@ VL_XCAT(_vl_kmeans_seed_centers_plus_plus_, SFX)
     }
   }
 
+  vl_free(jobs) ;
   vl_free(distances) ;
   vl_free(minDistances) ;
 }
@@ -453,23 +613,24 @@ VL_XCAT(_vl_kmeans_seed_centers_plus_plus_, SFX)
 /*                                                     Quantization */
 /* ---------------------------------------------------------------- */
 
-static void
-VL_XCAT(_vl_kmeans_quantize_, SFX)
-(VlKMeans * self,
- vl_uint32 * assignments,
- TYPE * distances,
- TYPE const * data,
- vl_size numData)
+/* assign the points of a job to their closest center */
+static void *
+VL_XCAT(_vl_kmeans_quantize_job_, SFX) (void * arg)
 {
+  VlKMeansJob * job = arg ;
+  VlKMeans * self = job->self ;
+  TYPE const * data = job->data ;
+  vl_uint32 * assignments = job->assignments ;
+  TYPE * distances = job->distances ;
+  TYPE * distanceToCenters = job->buffer ;
   vl_uindex i ;
 #if (FLT == VL_TYPE_FLOAT)
   VlFloatVectorComparisonFunction distFn = vl_get_vector_comparison_function_f(self->distance) ;
 #else
   VlDoubleVectorComparisonFunction distFn = vl_get_vector_comparison_function_d(self->distance) ;
 #endif
-  TYPE * distanceToCenters = vl_malloc (sizeof(TYPE) * self->numCenters) ;
 
-  for (i = 0 ; i < numData ; ++i) {
+  for (i = job->begin ; i < job->end ; ++i) {
     vl_size k ;
     TYPE bestDistance = (TYPE) VL_INFINITY_D ;
     VL_XCAT(vl_eval_vector_comparison_on_all_pairs_, SFX)(distanceToCenters,
@@ -486,7 +647,91 @@ VL_XCAT(_vl_kmeans_quantize_, SFX)
 
     if (distances) distances[i] = bestDistance ;
   }
-  vl_free(distanceToCenters) ;
+  return NULL ;
+}
+
+static void
+VL_XCAT(_vl_kmeans_quantize_, SFX)
+(VlKMeans * self,
+ vl_uint32 * assignments,
+ TYPE * distances,
+ TYPE const * data,
+ vl_size numData)
+{
+  vl_uindex t ;
+  vl_size numJobs ;
+  VlKMeansJob * jobs = _vl_kmeans_new_jobs (self, numData, &numJobs) ;
+
+  for (t = 0 ; t < numJobs ; ++ t) {
+    jobs[t].data = data ;
+    jobs[t].assignments = assignments ;
+    jobs[t].distances = distances ;
+    jobs[t].buffer = vl_malloc (sizeof(TYPE) * self->numCenters) ;
+  }
+  _vl_kmeans_run_jobs (VL_XCAT(_vl_kmeans_quantize_job_, SFX), jobs, numJobs) ;
+  for (t = 0 ; t < numJobs ; ++ t) vl_free (jobs[t].buffer) ;
+  vl_free (jobs) ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                    Center update */
+/* ---------------------------------------------------------------- */
+
+/* The l2 update: average the points of each center of a job. The
+ * points of a center are summed in the order of the data, whatever
+ * the number of jobs. Empty centers are left to the caller. */
+
+static void *
+VL_XCAT(_vl_kmeans_update_centers_job_, SFX) (void * arg)
+{
+  VlKMeansJob * job = arg ;
+  VlKMeans * self = job->self ;
+  TYPE const * data = job->data ;
+  TYPE * centers = job->centers ;
+  vl_uindex c, d, x ;
+
+  memset(centers + job->begin * self->dimension, 0,
+         sizeof(TYPE) * self->dimension * (job->end - job->begin)) ;
+  for (x = 0 ; x < job->numData ; ++x) {
+    vl_uint32 cx = job->assignments[x] ;
+    if (cx >= job->begin && cx < job->end) {
+      TYPE * cpt = centers + cx * self->dimension ;
+      TYPE const * xpt = data + x * self->dimension ;
+      for (d = 0 ; d < self->dimension ; ++d) { cpt[d] += xpt[d] ; }
+    }
+  }
+  for (c = job->begin ; c < job->end ; ++c) {
+    TYPE * cpt = centers + c * self->dimension ;
+    if (job->clusterMasses[c] > 0) {
+      TYPE mass = job->clusterMasses[c] ;
+      for (d = 0 ; d < self->dimension ; ++d) { cpt[d] /= mass ; }
+    }
+  }
+  return NULL ;
+}
+
+static void
+VL_XCAT(_vl_kmeans_update_centers_, SFX)
+(VlKMeans * self,
+ TYPE * centers,
+ vl_uint32 const * assignments,
+ vl_size const * clusterMasses,
+ TYPE const * data,
+ vl_size numData)
+{
+  vl_uindex t ;
+  vl_size numJobs ;
+  VlKMeansJob * jobs = _vl_kmeans_new_jobs (self, self->numCenters, &numJobs) ;
+
+  for (t = 0 ; t < numJobs ; ++ t) {
+    jobs[t].data = data ;
+    jobs[t].numData = numData ;
+    jobs[t].assignments = (vl_uint32*)assignments ;
+    jobs[t].clusterMasses = clusterMasses ;
+    jobs[t].centers = centers ;
+  }
+  _vl_kmeans_run_jobs (VL_XCAT(_vl_kmeans_update_centers_job_, SFX), jobs, numJobs) ;
+  vl_free (jobs) ;
 }
 
 /* ---------------------------------------------------------------- */
@@ -610,18 +855,11 @@ VL_XCAT(_vl_kmeans_refine_centers_lloyd_, SFX)
     numRestartedCenters = 0 ;
     switch (self->distance) {
       case VlDistanceL2:
-        memset(self->centers, 0, sizeof(TYPE) * self->dimension * self->numCenters) ;
-        for (x = 0 ; x < numData ; ++x) {
-          TYPE * cpt = (TYPE*)self->centers + assignments[x] * self->dimension ;
-          TYPE const * xpt = data + x * self->dimension ;
-          for (d = 0 ; d < self->dimension ; ++d) { cpt[d] += xpt[d] ; }
-        }
+        VL_XCAT(_vl_kmeans_update_centers_, SFX)
+        (self, self->centers, assignments, clusterMasses, data, numData) ;
         for (c = 0 ; c < self->numCenters ; ++c) {
           TYPE * cpt = (TYPE*)self->centers + c * self->dimension ;
-          if (clusterMasses[c] > 0) {
-            TYPE mass = clusterMasses[c] ;
-            for (d = 0 ; d < self->dimension ; ++d) { cpt[d] /= mass ; }
-          } else {
+          if (clusterMasses[c] == 0) {
             vl_uindex x = vl_rand_uindex(rand, numData) ;
             numRestartedCenters ++ ;
             for (d = 0 ; d < self->dimension ; ++d) {
@@ -703,6 +941,237 @@ VL_XCAT(_vl_kmeans_update_center_distances_, SFX)
 
 
 
+/* assign the points of a job to the initial centers and initialize
+ * their bounds */
+static void *
+VL_XCAT(_vl_kmeans_elkan_init_job_, SFX) (void * arg)
+{
+  VlKMeansJob * job = arg ;
+  VlKMeans * self = job->self ;
+  TYPE const * data = job->data ;
+  vl_uint32 * assignments = job->assignments ;
+  TYPE * pointToClosestCenterUB = job->pointToClosestCenterUB ;
+  vl_bool * pointToClosestCenterUBIsStrict = job->pointToClosestCenterUBIsStrict ;
+  TYPE * pointToCenterLB = job->pointToCenterLB ;
+  vl_uindex x ;
+  vl_uint32 c ;
+#if (FLT == VL_TYPE_FLOAT)
+  VlFloatVectorComparisonFunction distFn = vl_get_vector_comparison_function_f(self->distance) ;
+#else
+  VlDoubleVectorComparisonFunction distFn = vl_get_vector_comparison_function_d(self->distance) ;
+#endif
+
+  for (x = job->begin ; x < job->end ; ++x) {
+    TYPE distance ;
+
+    /* do the first center */
+    assignments[x] = 0 ;
+    distance = distFn(self->dimension,
+                      data + x * self->dimension,
+                      (TYPE*)self->centers + 0) ;
+    pointToClosestCenterUB[x] = distance ;
+    pointToClosestCenterUBIsStrict[x] = VL_TRUE ;
+    pointToCenterLB[0 + x * self->numCenters] = distance ;
+    job->numDistanceComputations += 1 ;
+
+    /* do other centers */
+    for (c = 1 ; c < self->numCenters ; ++c) {
+
+      /* Can skip if the center assigned so far is twice as close
+         as its distance to the center under consideration */
+
+      if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
+          pointToClosestCenterUB[x] <=
+          ((TYPE*)self->centerDistances)
+          [c + assignments[x] * self->numCenters]) {
+        continue ;
+      }
+
+      distance = distFn(self->dimension,
+                        data + x * self->dimension,
+                        (TYPE*)self->centers + c * self->dimension) ;
+      pointToCenterLB[c + x * self->numCenters] = distance ;
+      job->numDistanceComputations += 1 ;
+      if (distance < pointToClosestCenterUB[x]) {
+        pointToClosestCenterUB[x] = distance ;
+        assignments[x] = c ;
+      }
+    }
+  }
+  return NULL ;
+}
+
+/* update the bounds of the points of a job after the centers moved */
+static void *
+VL_XCAT(_vl_kmeans_elkan_update_bounds_job_, SFX) (void * arg)
+{
+  VlKMeansJob * job = arg ;
+  VlKMeans * self = job->self ;
+  vl_uint32 const * assignments = job->assignments ;
+  TYPE * pointToClosestCenterUB = job->pointToClosestCenterUB ;
+  vl_bool * pointToClosestCenterUBIsStrict = job->pointToClosestCenterUBIsStrict ;
+  TYPE * pointToCenterLB = job->pointToCenterLB ;
+  TYPE const * centerToNewCenterDistances = job->centerToNewCenterDistances ;
+  vl_uindex x ;
+  vl_uint32 c ;
+
+  /*
+   Update upper bounds on point-to-closest-center distances
+   based on the center variation.
+   */
+  for (x = job->begin ; x < job->end ; ++x) {
+    TYPE a = pointToClosestCenterUB[x] ;
+    TYPE b = centerToNewCenterDistances[assignments[x]] ;
+    if (self->distance == VlDistanceL1) {
+      pointToClosestCenterUB[x] = a + b ;
+    } else {
+#if (FLT == VL_TYPE_FLOAT)
+      TYPE sqrtab =  sqrtf (a * b) ;
+#else
+      TYPE sqrtab =  sqrt (a * b) ;
+#endif
+      pointToClosestCenterUB[x] = a + b + 2.0 * sqrtab ;
+    }
+    pointToClosestCenterUBIsStrict[x] = VL_FALSE ;
+  }
+
+  /*
+   Update lower bounds on point-to-center distances
+   based on the center variation.
+   */
+  for (x = job->begin ; x < job->end ; ++x) {
+    for (c = 0 ; c < self->numCenters ; ++c) {
+      TYPE a = pointToCenterLB[c + x * self->numCenters] ;
+      TYPE b = centerToNewCenterDistances[c] ;
+      if (a < b) {
+        pointToCenterLB[c + x * self->numCenters] = 0 ;
+      } else {
+        if (self->distance == VlDistanceL1) {
+           pointToCenterLB[c + x * self->numCenters]  = a - b ;
+        } else {
+#if (FLT == VL_TYPE_FLOAT)
+          TYPE sqrtab =  sqrtf (a * b) ;
+#else
+          TYPE sqrtab =  sqrt (a * b) ;
+#endif
+           pointToCenterLB[c + x * self->numCenters]  = a + b - 2.0 * sqrtab ;
+        }
+      }
+    }
+  }
+  return NULL ;
+}
+
+/* reassign the points of a job, using the bounds to skip as many
+ * distance calculations as possible */
+static void *
+VL_XCAT(_vl_kmeans_elkan_reassign_job_, SFX) (void * arg)
+{
+  VlKMeansJob * job = arg ;
+  VlKMeans * self = job->self ;
+  TYPE const * data = job->data ;
+  vl_uint32 * assignments = job->assignments ;
+  TYPE * pointToClosestCenterUB = job->pointToClosestCenterUB ;
+  vl_bool * pointToClosestCenterUBIsStrict = job->pointToClosestCenterUBIsStrict ;
+  TYPE * pointToCenterLB = job->pointToCenterLB ;
+  TYPE const * nextCenterDistances = job->nextCenterDistances ;
+  vl_uindex x ;
+  vl_uint32 c ;
+#if (FLT == VL_TYPE_FLOAT)
+  VlFloatVectorComparisonFunction distFn = vl_get_vector_comparison_function_f(self->distance) ;
+#else
+  VlDoubleVectorComparisonFunction distFn = vl_get_vector_comparison_function_d(self->distance) ;
+#endif
+
+  job->numDistanceComputations = 0 ;
+  job->numDistanceComputationsToRefreshUB = 0 ;
+  job->allDone = VL_TRUE ;
+  /*
+   Scan the data and to the reassignments. Use the bounds to
+   skip as many point-to-center distance calculations as possible.
+   */
+  for (x = job->begin ; x < job->end ; ++x) {
+    /*
+     A point x sticks with its current center assignmets[x]
+     the UB to d(x, c[assigmnets[x]]) is not larger than half
+     the distance of c[assigments[x]] to any other center c.
+     */
+    if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
+        pointToClosestCenterUB[x] <= nextCenterDistances[assignments[x]]) {
+      continue ;
+    }
+
+    for (c = 0 ; c < self->numCenters ; ++c) {
+      vl_uint32 cx = assignments[x] ;
+      TYPE distance ;
+
+      /* The point is not reassigned to a given center c
+       if either:
+
+       0 - c is already the assigned center
+       1 - The UB of d(x, c[assignments[x]]) is smaller than half
+           the distance of c[assigments[x]] to c, OR
+       2 - The UB of d(x, c[assignmets[x]]) is smaller than the
+           LB of the distance of x to c.
+       */
+      if (cx == c) {
+        continue ;
+      }
+      if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
+          pointToClosestCenterUB[x] <= ((TYPE*)self->centerDistances)
+          [c + cx * self->numCenters]) {
+        continue ;
+      }
+      if (pointToClosestCenterUB[x] <= pointToCenterLB
+          [c + x * self->numCenters]) {
+        continue ;
+      }
+
+      /* If the UB is loose, try recomputing it and test again */
+      if (! pointToClosestCenterUBIsStrict[x]) {
+        distance = distFn(self->dimension,
+                          data + self->dimension * x,
+                          (TYPE*)self->centers + self->dimension * cx) ;
+        pointToClosestCenterUB[x] = distance ;
+        pointToClosestCenterUBIsStrict[x] = VL_TRUE ;
+        pointToCenterLB[cx + x * self->numCenters] = distance ;
+        job->numDistanceComputationsToRefreshUB += 1 ;
+
+        if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
+            pointToClosestCenterUB[x] <= ((TYPE*)self->centerDistances)
+            [c + cx * self->numCenters]) {
+          continue ;
+        }
+        if (pointToClosestCenterUB[x] <= pointToCenterLB
+            [c + x * self->numCenters]) {
+          continue ;
+        }
+      }
+
+      /*
+       Now the UB is strict (equal to d(x, assignments[x])), but
+       we still could not exclude that x should be reassigned to
+       c. We therefore compute the distance, update the LB,
+       and check if a reassigmnet must be made
+       */
+      distance = distFn(self->dimension,
+                        data + x * self->dimension,
+                        (TYPE*)self->centers + c *  self->dimension) ;
+      job->numDistanceComputations += 1 ;
+      pointToCenterLB[c + x * self->numCenters] = distance ;
+
+      if (distance < pointToClosestCenterUB[x]) {
+        assignments[x] = c ;
+        pointToClosestCenterUB[x] = distance ;
+        job->allDone = VL_FALSE ;
+        /* the UB strict flag is already set here */
+      }
+
+    } /* assign center */
+  } /* next data point */
+  return NULL ;
+}
+
 static double
 VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
 (VlKMeans * self,
@@ -732,6 +1201,9 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
 
   vl_uint32 * permutations = NULL ;
   vl_size * numSeenSoFar = NULL ;
+  vl_uindex t ;
+  vl_size numJobs ;
+  VlKMeansJob * jobs = _vl_kmeans_new_jobs (self, numData, &numJobs) ;
 
   double energy ;
 
@@ -749,6 +1221,16 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
     VL_XCAT(_vl_kmeans_sort_data_helper_, SFX)(self, permutations, data, numData) ;
   }
 
+  for (t = 0 ; t < numJobs ; ++ t) {
+    jobs[t].data = data ;
+    jobs[t].assignments = assignments ;
+    jobs[t].pointToClosestCenterUB = pointToClosestCenterUB ;
+    jobs[t].pointToClosestCenterUBIsStrict = pointToClosestCenterUBIsStrict ;
+    jobs[t].pointToCenterLB = pointToCenterLB ;
+    jobs[t].nextCenterDistances = nextCenterDistances ;
+    jobs[t].centerToNewCenterDistances = centerToNewCenterDistances ;
+  }
+
   /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
   /*                          Initialization                        */
   /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
@@ -764,42 +1246,10 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
 
   /* assigmen points to the initial centers and initialize bounds */
   memset(pointToCenterLB, 0, sizeof(TYPE) * self->numCenters *  numData) ;
-  for (x = 0 ; x < numData ; ++x) {
-    TYPE distance ;
-
-    /* do the first center */
-    assignments[x] = 0 ;
-    distance = distFn(self->dimension,
-                      data + x * self->dimension,
-                      (TYPE*)self->centers + 0) ;
-    pointToClosestCenterUB[x] = distance ;
-    pointToClosestCenterUBIsStrict[x] = VL_TRUE ;
-    pointToCenterLB[0 + x * self->numCenters] = distance ;
-    totDistanceComputationsToInit += 1 ;
-
-    /* do other centers */
-    for (c = 1 ; c < self->numCenters ; ++c) {
-
-      /* Can skip if the center assigned so far is twice as close
-         as its distance to the center under consideration */
-
-      if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
-          pointToClosestCenterUB[x] <=
-          ((TYPE*)self->centerDistances)
-          [c + assignments[x] * self->numCenters]) {
-        continue ;
-      }
-
-      distance = distFn(self->dimension,
-                        data + x * self->dimension,
-                        (TYPE*)self->centers + c * self->dimension) ;
-      pointToCenterLB[c + x * self->numCenters] = distance ;
-      totDistanceComputationsToInit += 1 ;
-      if (distance < pointToClosestCenterUB[x]) {
-        pointToClosestCenterUB[x] = distance ;
-        assignments[x] = c ;
-      }
-    }
+  for (t = 0 ; t < numJobs ; ++ t) jobs[t].numDistanceComputations = 0 ;
+  _vl_kmeans_run_jobs (VL_XCAT(_vl_kmeans_elkan_init_job_, SFX), jobs, numJobs) ;
+  for (t = 0 ; t < numJobs ; ++ t) {
+    totDistanceComputationsToInit += jobs[t].numDistanceComputations ;
   }
 
   /* compute UB on energy */
@@ -860,18 +1310,11 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
 
     switch (self->distance) {
       case VlDistanceL2:
-        memset(newCenters, 0, sizeof(TYPE) * self->dimension * self->numCenters) ;
-        for (x = 0 ; x < numData ; ++x) {
-          TYPE * cpt = newCenters + assignments[x] * self->dimension ;
-          TYPE const * xpt = data + x * self->dimension ;
-          for (d = 0 ; d < self->dimension ; ++d) { cpt[d] += xpt[d] ; }
-        }
+        VL_XCAT(_vl_kmeans_update_centers_, SFX)
+        (self, newCenters, assignments, clusterMasses, data, numData) ;
         for (c = 0 ; c < self->numCenters ; ++c) {
           TYPE * cpt = newCenters + c * self->dimension ;
-          if (clusterMasses[c] > 0) {
-            TYPE mass = clusterMasses[c] ;
-            for (d = 0 ; d < self->dimension ; ++d) { cpt[d] /= mass ; }
-          } else {
+          if (clusterMasses[c] == 0) {
             /* restart the center */
             vl_uindex x = vl_rand_uindex(rand, numData) ;
 			numRestartedCenters ++ ;
@@ -946,50 +1389,7 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
       }
     }
 
-    /*
-     Update upper bounds on point-to-closest-center distances
-     based on the center variation.
-     */
-    for (x = 0 ; x < numData ; ++x) {
-      TYPE a = pointToClosestCenterUB[x] ;
-      TYPE b = centerToNewCenterDistances[assignments[x]] ;
-      if (self->distance == VlDistanceL1) {
-        pointToClosestCenterUB[x] = a + b ;
-      } else {
-#if (FLT == VL_TYPE_FLOAT)
-        TYPE sqrtab =  sqrtf (a * b) ;
-#else
-        TYPE sqrtab =  sqrt (a * b) ;
-#endif
-        pointToClosestCenterUB[x] = a + b + 2.0 * sqrtab ;
-      }
-      pointToClosestCenterUBIsStrict[x] = VL_FALSE ;
-    }
-
-    /*
-     Update lower bounds on point-to-center distances
-     based on the center variation.
-     */
-    for (x = 0 ; x < numData ; ++x) {
-      for (c = 0 ; c < self->numCenters ; ++c) {
-        TYPE a = pointToCenterLB[c + x * self->numCenters] ;
-        TYPE b = centerToNewCenterDistances[c] ;
-        if (a < b) {
-          pointToCenterLB[c + x * self->numCenters] = 0 ;
-        } else {
-          if (self->distance == VlDistanceL1) {
-             pointToCenterLB[c + x * self->numCenters]  = a - b ;
-          } else {
-#if (FLT == VL_TYPE_FLOAT)
-            TYPE sqrtab =  sqrtf (a * b) ;
-#else
-            TYPE sqrtab =  sqrt (a * b) ;
-#endif
-             pointToCenterLB[c + x * self->numCenters]  = a + b - 2.0 * sqrtab ;
-          }
-        }
-      }
-    }
+    _vl_kmeans_run_jobs (VL_XCAT(_vl_kmeans_elkan_update_bounds_job_, SFX), jobs, numJobs) ;
 
    #ifdef SANITY
     {
@@ -1014,89 +1414,12 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
     }
 #endif
 
-    /*
-     Scan the data and to the reassignments. Use the bounds to
-     skip as many point-to-center distance calculations as possible.
-     */
-    for (allDone = VL_TRUE, x = 0 ; x < numData ; ++x) {
-      /*
-       A point x sticks with its current center assignmets[x]
-       the UB to d(x, c[assigmnets[x]]) is not larger than half
-       the distance of c[assigments[x]] to any other center c.
-       */
-      if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
-          pointToClosestCenterUB[x] <= nextCenterDistances[assignments[x]]) {
-        continue ;
-      }
-
-      for (c = 0 ; c < self->numCenters ; ++c) {
-        vl_uint32 cx = assignments[x] ;
-        TYPE distance ;
-
-        /* The point is not reassigned to a given center c
-         if either:
-
-         0 - c is already the assigned center
-         1 - The UB of d(x, c[assignments[x]]) is smaller than half
-             the distance of c[assigments[x]] to c, OR
-         2 - The UB of d(x, c[assignmets[x]]) is smaller than the
-             LB of the distance of x to c.
-         */
-        if (cx == c) {
-          continue ;
-        }
-        if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
-            pointToClosestCenterUB[x] <= ((TYPE*)self->centerDistances)
-            [c + cx * self->numCenters]) {
-          continue ;
-        }
-        if (pointToClosestCenterUB[x] <= pointToCenterLB
-            [c + x * self->numCenters]) {
-          continue ;
-        }
-
-        /* If the UB is loose, try recomputing it and test again */
-        if (! pointToClosestCenterUBIsStrict[x]) {
-          distance = distFn(self->dimension,
-                            data + self->dimension * x,
-                            (TYPE*)self->centers + self->dimension * cx) ;
-          pointToClosestCenterUB[x] = distance ;
-          pointToClosestCenterUBIsStrict[x] = VL_TRUE ;
-          pointToCenterLB[cx + x * self->numCenters] = distance ;
-          numDistanceComputationsToRefreshUB += 1 ;
-
-          if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
-              pointToClosestCenterUB[x] <= ((TYPE*)self->centerDistances)
-              [c + cx * self->numCenters]) {
-            continue ;
-          }
-          if (pointToClosestCenterUB[x] <= pointToCenterLB
-              [c + x * self->numCenters]) {
-            continue ;
-          }
-        }
-
-        /*
-         Now the UB is strict (equal to d(x, assignments[x])), but
-         we still could not exclude that x should be reassigned to
-         c. We therefore compute the distance, update the LB,
-         and check if a reassigmnet must be made
-         */
-        distance = distFn(self->dimension,
-                          data + x * self->dimension,
-                          (TYPE*)self->centers + c *  self->dimension) ;
-        numDistanceComputationsToRefreshLB += 1 ;
-        pointToCenterLB[c + x * self->numCenters] = distance ;
-
-        if (distance < pointToClosestCenterUB[x]) {
-          assignments[x] = c ;
-          pointToClosestCenterUB[x] = distance ;
-          allDone = VL_FALSE ;
-          /* the UB strict flag is already set here */
-        }
-
-      } /* assign center */
-    } /* next data point */
+    _vl_kmeans_run_jobs (VL_XCAT(_vl_kmeans_elkan_reassign_job_, SFX), jobs, numJobs) ;
+    for (allDone = VL_TRUE, t = 0 ; t < numJobs ; ++ t) {
+      numDistanceComputationsToRefreshUB += jobs[t].numDistanceComputationsToRefreshUB ;
+      numDistanceComputationsToRefreshLB += jobs[t].numDistanceComputations ;
+      allDone &= jobs[t].allDone ;
+    }
 
     totDistanceComputationsToRefreshUB
     += numDistanceComputationsToRefreshUB ;
@@ -1251,6 +1574,7 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
   vl_free(assignments) ;
   vl_free(clusterMasses) ;
 
+  vl_free(jobs) ;
   vl_free(nextCenterDistances) ;
   vl_free(pointToClosestCenterUB) ;
   vl_free(pointToClosestCenterUBIsStrict) ;
@@ -1282,6 +1606,42 @@ VL_XCAT(_vl_kmeans_refine_centers_, SFX)
   }
 }
 
+/* ---------------------------------------------------------------- */
+/*                                              Mini-batch update */
+/* ---------------------------------------------------------------- */
+
+static double
+VL_XCAT(_vl_kmeans_update_centers_with_batch_, SFX)
+(VlKMeans * self,
+ TYPE const * data,
+ vl_size numData)
+{
+  vl_uindex d, x ;
+  double energy = 0 ;
+  TYPE * distances = vl_malloc (sizeof(TYPE) * numData) ;
+  vl_uint32 * assignments = vl_malloc (sizeof(vl_uint32) * numData) ;
+
+  if (! self->centerMasses) {
+    self->centerMasses = vl_calloc (self->numCenters, sizeof(vl_size)) ;
+  }
+
+  /* assign the batch to the current centers */
+  VL_XCAT(_vl_kmeans_quantize_, SFX)(self, assignments, distances, data, numData) ;
+
+  /* move each center towards its points by the inverse of its mass */
+  for (x = 0 ; x < numData ; ++x) {
+    TYPE * cpt = (TYPE*)self->centers + assignments[x] * self->dimension ;
+    TYPE const * xpt = data + x * self->dimension ;
+    TYPE rate = (TYPE) 1.0 / (++ self->centerMasses[assignments[x]]) ;
+    for (d = 0 ; d < self->dimension ; ++d) { cpt[d] += rate * (xpt[d] - cpt[d]) ; }
+    energy += distances[x] ;
+  }
+
+  vl_free(distances) ;
+  vl_free(assignments) ;
+  return energy ;
+}
+
 /* VL_KMEANS_INSTANTIATING */
 #else
 
@@ -1473,6 +1833,46 @@ vl_kmeans_refine_centers
 }
 
 
+/** ------------------------------------------------------------------
+ ** @brief Refine centers from a batch of data
+ ** @param self KMeans object.
+ ** @param data batch of data points.
+ ** @param numData number of data points in the batch.
+ ** @return energy of the batch before the update.
+ **
+ ** The function assigns the batch to the current centers and moves
+ ** each center towards its points, with a step inversely proportional
+ ** to the number of points assigned to the center since it was seeded.
+ ** Passing all the data one batch at a time is one pass of the
+ ** mini-batch k-means algorithm; several passes usually approach the
+ ** Lloyd solution while only one batch needs to be in memory. The
+ ** centers must have been seeded or set, and the distance must be
+ ** ::VlDistanceL2.
+ **/
+
+VL_EXPORT double
+vl_kmeans_update_centers_with_batch
+(VlKMeans * self,
+ void const * data,
+ vl_size numData)
+{
+  assert (self->centers) ;
+  assert (self->distance == VlDistanceL2) ;
+
+  switch (self->dataType) {
+    case VL_TYPE_FLOAT :
+      return
+      _vl_kmeans_update_centers_with_batch_f
+      (self, (float const *)data, numData) ;
+    case VL_TYPE_DOUBLE :
+      return
+      _vl_kmeans_update_centers_with_batch_d
+      (self, (double const *)data, numData) ;
+    default:
+      abort() ;
+  }
+}
+
 /** ------------------------------------------------------------------
  ** @brief Cluster data.
  ** @param self KMeans object.
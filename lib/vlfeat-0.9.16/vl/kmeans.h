@@ -51,10 +51,12 @@ typedef struct _VlKMeans
   VlVectorComparisonType distance ;    /**< Distance */
   vl_size maxNumIterations ;           /**< Maximum number of refinement iterations */
   vl_size numRepetitions   ;           /**< Number of clustering repetitions */
+  vl_size numThreads ;                 /**< Number of threads (0 for the number of CPUs) */
   int verbosity ;                      /**< verbosity level */
 
   void * centers ;                     /**< centers */
   void * centerDistances ;             /**< centers inter-distances */
+  vl_size * centerMasses ;             /**< points seen by each center in mini-batch updates */
 
   double energy ;                      /**< current solution energy */
   VlFloatVectorComparisonFunction floatVectorComparisonFn ;
@@ -113,6 +115,10 @@ VL_EXPORT double vl_kmeans_refine_centers (VlKMeans * self,
                                            void const * data,
                                            vl_size numData) ;
 
+VL_EXPORT double vl_kmeans_update_centers_with_batch (VlKMeans * self,
+                                                      void const * data,
+                                                      vl_size numData) ;
+
 /** @} */
 
 /** @name Retrieve data and parameters
@@ -124,6 +130,7 @@ VL_INLINE VlVectorComparisonType vl_kmeans_get_distance (VlKMeans const * self)
 VL_INLINE VlKMeansAlgorithm vl_kmeans_get_algorithm (VlKMeans const * self) ;
 VL_INLINE VlKMeansInitialization vl_kmeans_get_initialization (VlKMeans const * self) ;
 VL_INLINE vl_size vl_kmeans_get_num_repetitions (VlKMeans const * self) ;
+VL_INLINE vl_size vl_kmeans_get_num_threads (VlKMeans const * self) ;
 
 VL_INLINE vl_size vl_kmeans_get_dimension (VlKMeans const * self) ;
 VL_INLINE vl_size vl_kmeans_get_num_centers (VlKMeans const * self) ;
@@ -140,6 +147,7 @@ VL_INLINE void const * vl_kmeans_get_centers (VlKMeans const * self) ;
 VL_INLINE void vl_kmeans_set_algorithm (VlKMeans * self, VlKMeansAlgorithm algorithm) ;
 VL_INLINE void vl_kmeans_set_initialization (VlKMeans * self, VlKMeansInitialization initialization) ;
 VL_INLINE void vl_kmeans_set_num_repetitions (VlKMeans * self, vl_size numRepetitions) ;
+VL_INLINE void vl_kmeans_set_num_threads (VlKMeans * self, vl_size numThreads) ;
 VL_INLINE void vl_kmeans_set_max_num_iterations (VlKMeans * self, vl_size maxNumIterations) ;
 VL_INLINE void vl_kmeans_set_verbosity (VlKMeans * self, int verbosity) ;
 /** @} */
@@ -284,6 +292,32 @@ vl_kmeans_set_num_repetitions (VlKMeans * self,
   self->numRepetitions = numRepetitions ;
 }
 
+/** ------------------------------------------------------------------
+ ** @brief Get number of threads
+ ** @param self KMeans object instance.
+ ** @return number of threads (0 for the number of CPUs).
+ **/
+
+VL_INLINE vl_size
+vl_kmeans_get_num_threads (VlKMeans const * self)
+{
+  return self->numThreads ;
+}
+
+/** @brief Set number of threads
+ ** @param self KMeans object instance.
+ ** @param numThreads number of threads (0 for the number of CPUs).
+ **
+ ** The assignment and update steps split the data among this many
+ ** threads. The result does not depend on the number of threads.
+ **/
+
+VL_INLINE void
+vl_kmeans_set_num_threads (VlKMeans * self, vl_size numThreads)
+{
+  self->numThreads = numThreads ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief Get K-means algorithm
  ** @param self KMeans object.
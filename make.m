@@ -9,4 +9,6 @@ function make(varargin)
   bdb.make(varargin{:});
   GCO_BuildLib;
   pf.make();
+  knn_retriever.make();
+  dense_hog_calculator.make();
 end